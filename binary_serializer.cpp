@@ -0,0 +1,297 @@
+#include "binary_serializer.h"
+#include "logger.h"
+#include <arpa/inet.h>
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace {
+
+struct FrameHeader {
+    uint32_t length;
+    uint16_t code;
+    uint16_t flags;
+};
+static_assert(sizeof(FrameHeader) == BinarySerializer::HEADER_SIZE, "frame header layout");
+
+struct AttrHeader {
+    uint16_t length;
+    uint16_t type;
+};
+
+// Длина атрибута вместе с заголовком должна поместиться в u16
+constexpr size_t MAX_ATTR_DATA = UINT16_MAX - sizeof(AttrHeader);
+
+constexpr size_t align4(size_t len) {
+    return (len + 3) & ~size_t(3);
+}
+
+struct CodeName {
+    uint16_t code;
+    std::string_view name;
+};
+
+constexpr std::array<CodeName, 19> CODES = {{
+    {1, "enumerate"},
+    {2, "on"},
+    {3, "off"},
+    {4, "dhcpOn"},
+    {5, "dhcpOff"},
+    {6, "setStatic"},
+    {7, "route_lookup"},
+    {8, "apply"},
+    {9, "help"},
+    {10, "batch"},
+    {11, "logLevel"},
+    {12, "trace"},
+    {13, "handoff"},
+    {BinarySerializer::CODE_EVENT_BASE + 0, "add_iface"},
+    {BinarySerializer::CODE_EVENT_BASE + 1, "del_iface"},
+    {BinarySerializer::CODE_EVENT_BASE + 2, "add_addr"},
+    {BinarySerializer::CODE_EVENT_BASE + 3, "del_addr"},
+    {BinarySerializer::CODE_EVENT_BASE + 4, "add_route"},
+    {BinarySerializer::CODE_EVENT_BASE + 5, "del_route"},
+}};
+
+void appendAttr(OutputBuffer& out, uint16_t type, const void* data, size_t len) {
+    static const char padding[3] = {};
+    if (len > MAX_ATTR_DATA) {
+        // Длина с переносом сдвинула бы разбор всех следующих атрибутов и кадров
+        logError("BinarySerializer: атрибут ", type, " длиной ", len, " обрезан до ", MAX_ATTR_DATA);
+        len = MAX_ATTR_DATA;
+    }
+    AttrHeader header{static_cast<uint16_t>(sizeof(AttrHeader) + len), type};
+    out.appendBytes(&header, sizeof(header)).appendBytes(data, len);
+    out.appendBytes(padding, align4(len) - len);
+}
+
+uint16_t fieldAttr(Field field) {
+    return static_cast<uint16_t>(BinarySerializer::ATTR_FIELD_BASE + static_cast<uint16_t>(field));
+}
+
+} // namespace
+
+uint16_t BinarySerializer::commandCode(std::string_view name) {
+    for (const auto& entry : CODES) {
+        if (entry.name == name) {
+            return entry.code;
+        }
+    }
+    return CODE_ERROR;
+}
+
+std::string_view BinarySerializer::commandName(uint16_t code) {
+    for (const auto& entry : CODES) {
+        if (entry.code == code) {
+            return entry.name;
+        }
+    }
+    return {};
+}
+
+std::string_view BinarySerializer::hello() const {
+    static const std::string text = [] {
+        uint16_t words[2] = {VERSION, 0};
+        std::string hello("\0NDB", 4);
+        hello.append(reinterpret_cast<const char*>(words), sizeof(words));
+        return hello;
+    }();
+    return text;
+}
+
+std::unique_ptr<CommandStream> BinarySerializer::createStream() {
+    return std::make_unique<BinaryStream>();
+}
+
+size_t BinarySerializer::beginResponse(OutputBuffer& out, std::string_view command, uint32_t request_id) {
+    size_t mark = out.size();
+    FrameHeader header{0, commandCode(command), 0};
+    out.appendBytes(&header, sizeof(header));
+    if (request_id) {
+        appendAttr(out, ATTR_REQUEST_ID, &request_id, sizeof(request_id));
+    }
+    return mark;
+}
+
+void BinarySerializer::endResponse(OutputBuffer& out, size_t mark) {
+    uint32_t length = static_cast<uint32_t>(out.size() - mark);
+    out.overwrite(mark, &length, sizeof(length));
+}
+
+void BinarySerializer::parseError(OutputBuffer& out) {
+    size_t mark = beginResponse(out, {}, 0);
+    status(out, "error(invalid frame format)");
+    endResponse(out, mark);
+}
+
+// success(текст) / error(текст) -> STATUS + MESSAGE; прочие ответы считаются успешными.
+// Текст длиннее атрибута (дамп trace) идёт несколькими MESSAGE подряд.
+void BinarySerializer::status(OutputBuffer& out, std::string_view text) {
+    uint8_t code = 0;
+    std::string_view message = text;
+    for (std::string_view prefix : {std::string_view("success("), std::string_view("error(")}) {
+        if (text.size() > prefix.size() && text.compare(0, prefix.size(), prefix) == 0 && text.back() == ')') {
+            code = prefix[0] == 'e' ? 1 : 0;
+            message = text.substr(prefix.size(), text.size() - prefix.size() - 1);
+            break;
+        }
+    }
+    appendAttr(out, ATTR_STATUS, &code, sizeof(code));
+    do {
+        size_t len = std::min(message.size(), MAX_ATTR_DATA);
+        appendAttr(out, ATTR_MESSAGE, message.data(), len);
+        message.remove_prefix(len);
+    } while (!message.empty());
+}
+
+// Список - просто последовательность атрибутов RECORD
+void BinarySerializer::beginList(OutputBuffer&, std::string_view) {}
+
+void BinarySerializer::endList(OutputBuffer&) {}
+
+void BinarySerializer::recordSeparator(OutputBuffer&) {}
+
+size_t BinarySerializer::beginRecord(OutputBuffer& out) {
+    size_t mark = out.size();
+    AttrHeader header{0, ATTR_RECORD};
+    out.appendBytes(&header, sizeof(header));
+    return mark;
+}
+
+void BinarySerializer::endRecord(OutputBuffer& out, size_t mark) {
+    // Вложенные атрибуты выровнены, поэтому длина записи кратна 4
+    uint16_t length = static_cast<uint16_t>(out.size() - mark);
+    out.overwrite(mark, &length, sizeof(length));
+}
+
+void BinarySerializer::textField(OutputBuffer& out, bool, Field field, std::string_view value) {
+    appendAttr(out, fieldAttr(field), value.data(), value.size());
+}
+
+void BinarySerializer::ipv4Field(OutputBuffer& out, bool, Field field, bool present, uint32_t address,
+                                 std::string_view) {
+    if (present) {
+        uint32_t address_be = htonl(address);
+        appendAttr(out, fieldAttr(field), &address_be, sizeof(address_be));
+    }
+}
+
+// Адрес сети (4 байта) и длина префикса (1 байт)
+void BinarySerializer::prefixField(OutputBuffer& out, bool, Field field, uint32_t address, uint8_t prefix_len) {
+    uint8_t data[5];
+    uint32_t address_be = htonl(address);
+    memcpy(data, &address_be, sizeof(address_be));
+    data[4] = prefix_len;
+    appendAttr(out, fieldAttr(field), data, sizeof(data));
+}
+
+void BinarySerializer::prefixLenField(OutputBuffer& out, bool, Field field, bool present, uint8_t prefix_len,
+                                      bool) {
+    if (present) {
+        appendAttr(out, fieldAttr(field), &prefix_len, sizeof(prefix_len));
+    }
+}
+
+void BinarySerializer::macField(OutputBuffer& out, bool, Field field, const uint8_t* mac, char) {
+    if (mac) {
+        appendAttr(out, fieldAttr(field), mac, 6);
+    }
+}
+
+void BinarySerializer::hexField(OutputBuffer& out, bool, Field field, uint32_t value) {
+    appendAttr(out, fieldAttr(field), &value, sizeof(value));
+}
+
+void BinarySerializer::decimalField(OutputBuffer& out, bool, Field field, uint32_t value) {
+    appendAttr(out, fieldAttr(field), &value, sizeof(value));
+}
+
+// Кадр с неверными атрибутами разбирается как пустая команда (ответ - ошибка разбора):
+// граница следующего кадра известна, поэтому поток не теряется
+CommandStream::Status BinaryStream::parse(std::string& buffer, CommandTokens& tokens, size_t& end) {
+    if (buffer.size() - pos_ < BinarySerializer::HEADER_SIZE) {
+        return Status::NeedMore;
+    }
+    FrameHeader header;
+    memcpy(&header, buffer.data() + pos_, sizeof(header));
+    if (header.length < BinarySerializer::HEADER_SIZE || header.length > BinarySerializer::MAX_FRAME) {
+        return Status::Error;
+    }
+    if (buffer.size() - pos_ < header.length) {
+        return Status::NeedMore;
+    }
+
+    const char* frame = buffer.data() + pos_;
+    end = pos_ + header.length;
+    pos_ = end;
+
+    tokens.clear();
+    // Неизвестный код - пустое имя: на него ответят как на неизвестную команду
+    tokens.push(BinarySerializer::commandName(header.code));
+
+    size_t offset = BinarySerializer::HEADER_SIZE;
+    while (offset < header.length) {
+        AttrHeader attr;
+        if (header.length - offset < sizeof(attr)) {
+            tokens.clear();
+            break;
+        }
+        memcpy(&attr, frame + offset, sizeof(attr));
+        if (attr.length < sizeof(attr) || attr.length > header.length - offset) {
+            tokens.clear();
+            break;
+        }
+        const char* payload = frame + offset + sizeof(attr);
+        size_t len = attr.length - sizeof(attr);
+
+        bool ok = false;
+        switch (attr.type) {
+            case BinarySerializer::ATTR_STRING: {
+                // Завершающий ноль (как в строковых атрибутах netlink) допускается
+                std::string_view text(payload, len);
+                while (!text.empty() && text.back() == '\0') {
+                    text.remove_suffix(1);
+                }
+                tokens.push(text);
+                ok = true;
+                break;
+            }
+            case BinarySerializer::ATTR_IPV4:
+                if (len == 4) {
+                    uint32_t address_be;
+                    memcpy(&address_be, payload, sizeof(address_be));
+                    tokens.pushValue(CommandTokens::Kind::IPv4, ntohl(address_be));
+                    ok = true;
+                }
+                break;
+            case BinarySerializer::ATTR_REQUEST_ID:
+                if (len == 4 && !tokens.requestId()) {
+                    uint32_t id;
+                    memcpy(&id, payload, sizeof(id));
+                    tokens.setRequestId(id);
+                    ok = id != 0;
+                }
+                break;
+            case BinarySerializer::ATTR_U8:
+                if (len == 1) {
+                    tokens.pushValue(CommandTokens::Kind::Number, static_cast<uint8_t>(payload[0]));
+                    ok = true;
+                }
+                break;
+        }
+        if (!ok) {
+            tokens.clear();
+            break;
+        }
+        offset += align4(attr.length);
+    }
+    return Status::Complete;
+}
+
+void BinaryStream::discard(size_t bytes) {
+    pos_ -= bytes;
+}
+
+void BinaryStream::reset() {
+    pos_ = 0;
+}
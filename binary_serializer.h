@@ -0,0 +1,81 @@
+#ifndef BINARY_SERIALIZER_H
+#define BINARY_SERIALIZER_H
+
+#include "command_serializer.h"
+#include <string>
+
+// Двоичный протокол (TLV). Клиент выбирает его, отправив первыми байтами
+// приветствие "\0NDB" + версия (u16) + резерв (u16); сервер отвечает тем же.
+//
+// Кадр: заголовок {u32 длина кадра с заголовком; u16 код; u16 флаги},
+// затем атрибуты в стиле netlink: {u16 длина с заголовком; u16 тип} + данные,
+// выровненные до 4 байт. Целые в порядке байт хоста, адреса IPv4 - сети.
+class BinarySerializer : public CommandSerializer {
+public:
+    static constexpr uint16_t VERSION = 1;
+    static constexpr size_t HEADER_SIZE = 8;
+    static constexpr size_t MAX_FRAME = 1024 * 1024;
+
+    // Коды кадров: часть протокола, не зависят от порядка команд в реестре
+    static constexpr uint16_t CODE_EVENT_BASE = 0x100;
+    static constexpr uint16_t CODE_ERROR = 0xffff; // Неизвестная команда или неразобранный кадр
+
+    // Атрибуты запроса
+    enum RequestAttr : uint16_t {
+        ATTR_STRING = 1, // Имя интерфейса, спецификация apply
+        ATTR_IPV4 = 2,   // 4 байта; для шлюза 0.0.0.0 - нет шлюза
+        ATTR_U8 = 3,     // Длина префикса
+        ATTR_REQUEST_ID = 4, // u32, номер запроса (не 0); повторяется первым атрибутом ответа
+    };
+    // Атрибуты ответа; поля записей - ATTR_FIELD_BASE + Field
+    enum ResponseAttr : uint16_t {
+        ATTR_STATUS = 16,  // u8: 0 - успех, 1 - ошибка
+        ATTR_MESSAGE = 17, // Текст из success(...)/error(...); длинный - несколько атрибутов подряд,
+                           // их данные склеиваются
+        ATTR_RECORD = 18,  // Вложенные атрибуты-поля
+        ATTR_FIELD_BASE = 32,
+    };
+
+    static uint16_t commandCode(std::string_view name);
+    static std::string_view commandName(uint16_t code);
+
+    std::string_view hello() const override;
+    bool binary() const override { return true; }
+    std::unique_ptr<CommandStream> createStream() override;
+    size_t beginResponse(OutputBuffer& out, std::string_view command, uint32_t request_id) override;
+    void endResponse(OutputBuffer& out, size_t mark) override;
+    void parseError(OutputBuffer& out) override;
+
+    void status(OutputBuffer& out, std::string_view text) override;
+    void beginList(OutputBuffer& out, std::string_view name) override;
+    void endList(OutputBuffer& out) override;
+    void recordSeparator(OutputBuffer& out) override;
+    size_t beginRecord(OutputBuffer& out) override;
+    void endRecord(OutputBuffer& out, size_t mark) override;
+
+    void textField(OutputBuffer& out, bool first, Field field, std::string_view value) override;
+    void ipv4Field(OutputBuffer& out, bool first, Field field, bool present, uint32_t address,
+                   std::string_view absent) override;
+    void prefixField(OutputBuffer& out, bool first, Field field, uint32_t address, uint8_t prefix_len) override;
+    void prefixLenField(OutputBuffer& out, bool first, Field field, bool present, uint8_t prefix_len,
+                        bool netmask) override;
+    void macField(OutputBuffer& out, bool first, Field field, const uint8_t* mac, char separator) override;
+    void hexField(OutputBuffer& out, bool first, Field field, uint32_t value) override;
+    void decimalField(OutputBuffer& out, bool first, Field field, uint32_t value) override;
+};
+
+// Разбор кадров: строковые атрибуты остаются ссылками во входной буфер,
+// адреса и числа передаются в токенах уже декодированными
+class BinaryStream : public CommandStream {
+public:
+    Status parse(std::string& buffer, CommandTokens& tokens, size_t& end) override;
+    void discard(size_t bytes) override;
+    void reset() override;
+    // Остаток неверного кадра разбирался бы как заголовки следующих
+    bool recoverable() const override { return false; }
+
+private:
+    size_t pos_ = 0; // Начало следующего кадра
+};
+
+#endif // BINARY_SERIALIZER_H
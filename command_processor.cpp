@@ -1,142 +1,1014 @@
 #include "command_processor.h"
+#include "logger.h"
+#include "flight_recorder.h"
+#include <algorithm>
 #include <sstream>
 #include <chrono>
 #include <iomanip>
 #include <netlink/cache.h>
 #include <netlink/route/link.h>
+#include <netlink/route/addr.h>
+#include <fnmatch.h>
+#include <cstring>
+#include <unordered_set>
 #include <net/if.h>
-#include <iostream>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 
-CommandProcessor::CommandProcessor(UnixSocketServer& server, NetlinkManager& netlink_mgr, 
-                                   NetworkManager& network_mgr, std::unique_ptr<CommandSerializer> serializer)
-    : server_(server), netlink_mgr_(netlink_mgr), network_mgr_(network_mgr), serializer_(std::move(serializer)) {
-    server_.setClientHandler(std::bind(&CommandProcessor::handleCommand, this,
+// Незавершённая команда не может занимать больше
+constexpr size_t MAX_PENDING_INPUT = 1024 * 1024;
+
+CommandProcessor::CommandProcessor(UnixSocketServer& server, EventLoop& loop, NetlinkManager& netlink_mgr,
+                                   NetworkManager& network_mgr, OutputBufferPool& pool,
+                                   std::vector<std::unique_ptr<CommandSerializer>> serializers)
+    : server_(server), loop_(loop), netlink_mgr_(netlink_mgr), network_mgr_(network_mgr), pool_(pool),
+      serializers_(std::move(serializers)), event_buffers_(serializers_.size()),
+      invalid_commands_metric_(MetricsRegistry::instance().counter(
+          "network_daemon_invalid_commands_total", "Unknown commands, invalid arguments and parse errors")),
+      operations_metric_(MetricsRegistry::instance().gauge(
+          "network_daemon_pending_operations", "Interface operations queued or running")),
+      fanout_metric_(MetricsRegistry::instance().histogram(
+          "network_daemon_event_fanout", "Clients receiving one netlink event", {}, fanoutBuckets(), 1)),
+      broadcast_metric_(MetricsRegistry::instance().histogram(
+          "network_daemon_event_broadcast_seconds", "Time to format and send one event to all clients", {})) {
+    if (serializers_.empty() || serializers_.size() > 32) {
+        throw std::invalid_argument("CommandProcessor: 1..32 serializers expected");
+    }
+    MetricsRegistry& metrics = MetricsRegistry::instance();
+    for (size_t i = 0; i < COMMAND_COUNT; ++i) {
+        std::string label = metricLabel("command", COMMANDS.entries()[i].schema.name);
+        command_metrics_[i].latency = &metrics.histogram(
+            "network_daemon_command_duration_seconds", "Time from receiving a command to its response", label);
+        command_metrics_[i].errors = &metrics.counter(
+            "network_daemon_command_errors_total", "Commands answered with error(...)", label);
+    }
+    server_.setClientHandler(std::bind(&CommandProcessor::handleInput, this,
                                       std::placeholders::_1, std::placeholders::_2));
+    server_.setDisconnectHandler(std::bind(&CommandProcessor::handleDisconnect, this, std::placeholders::_1));
 }
 
-std::string CommandProcessor::getTimestamp() const {
-    auto now = std::chrono::system_clock::now();
-    auto time = std::chrono::system_clock::to_time_t(now);
-    std::stringstream ss;
-    ss << std::put_time(std::localtime(&time), "%Y-%m-%d %H:%M:%S");
-    return ss.str();
-}
+// Реестр команд: имя, типы аргументов, справка и обработчик.
+// Идеальный хеш по именам строится при компиляции.
+constexpr CommandRegistry<CommandProcessor::CommandEntry, CommandProcessor::COMMAND_COUNT> CommandProcessor::COMMANDS({{
+    {{"enumerate", {ArgType::Option}, 1, true, "list interfaces (from=ifindex limit=N stream=1 name=glob flags=up,!loopback has_addr=0|1 mac=prefix fields=iface,addr,...)"},
+     &CommandProcessor::handleEnumerate, KernelState::Routes},
+    {{"on", {ArgType::Ifname}, 1, false, "bring interface up"}, &CommandProcessor::handleOn, KernelState::Interfaces},
+    {{"off", {ArgType::Ifname}, 1, false, "bring interface down"}, &CommandProcessor::handleOff, KernelState::Interfaces},
+    {{"dhcpOn", {ArgType::Ifname}, 1, false, "start DHCP on interface"}, &CommandProcessor::handleDhcpOn,
+     KernelState::Interfaces},
+    {{"dhcpOff", {ArgType::Ifname}, 1, false, "stop DHCP on interface"}, &CommandProcessor::handleDhcpOff,
+     KernelState::Interfaces},
+    {{"setStatic", {ArgType::Ifname, ArgType::IPv4, ArgType::Prefix, ArgType::Gateway}, 4, false,
+      "set static address and default gateway"}, &CommandProcessor::handleSetStatic, KernelState::Routes},
+    {{"route_lookup", {ArgType::IPv4}, 1, false, "longest prefix match route"}, &CommandProcessor::handleRouteLookup,
+     KernelState::Routes},
+    {{"apply", {ArgType::Spec}, 1, true, "reconcile interfaces to desired state"}, &CommandProcessor::handleApply,
+     KernelState::Routes},
+    {{"batch", {ArgType::Spec}, 1, true, "run on/off/setStatic commands as one transaction"},
+     &CommandProcessor::handleBatch, KernelState::Routes},
+    {{"logLevel", {ArgType::Option}, 1, true, "show or change log level (level=debug|info|warning|error)"},
+     &CommandProcessor::handleLogLevel},
+    {{"trace", {ArgType::Spec, ArgType::Option}, 2, true,
+      "recent command and event spans as Chrome trace JSON (dump seconds=N)"}, &CommandProcessor::handleTrace},
+    {{"handoff", {}, 0, false, "pass sockets and state to a new daemon (started with NETWORK_DAEMON_TAKEOVER=1)"},
+     &CommandProcessor::handleHandoff},
+    {{"help", {}, 0, false, "list commands"}, &CommandProcessor::handleHelp},
+}});
 
-void CommandProcessor::handleCommand(int client_fd, const std::string& command) {
-    std::cout << "[" << getTimestamp() << "] CommandProcessor: Received command: " << command << std::endl;
+std::shared_ptr<CommandProcessor::ClientInput>& CommandProcessor::clientInput(int client_fd) {
+    uint64_t client_id = server_.getClientId(client_fd);
+    auto& slot = inputs_[client_fd];
+    if (!slot || slot->client_id != client_id) {
+        if (slot && slot->negotiation_timer) {
+            loop_.cancelTimer(slot->negotiation_timer);
+        }
+        slot = std::make_shared<ClientInput>();
+        slot->client_id = client_id;
+    }
+    return slot;
+}
 
-    // Парсим команду с помощью сериализатора
-    std::vector<std::string> tokens = serializer_->parseCommand(command);
-    if (tokens.empty()) {
-        std::string response = serializer_->serializeResponse("error", "invalid S-expression format");
-        server_.sendResponse(client_fd, response);
-        std::cout << "[" << getTimestamp() << "] CommandProcessor: Sent response: " << response << std::endl;
+void CommandProcessor::handleInput(int client_fd, std::string_view data) {
+    uint64_t client_id = server_.getClientId(client_fd);
+    // Обработчик команды может закрыть клиента и удалить запись из inputs_
+    std::shared_ptr<ClientInput> input = clientInput(client_fd);
+    if (input->closing) {
         return;
     }
+    input->buffer.append(data.data(), data.size());
+    if (!input->stream && !negotiate(client_fd, *input)) {
+        return;
+    }
+    CommandSerializer& serializer = *serializers_[input->serializer];
 
-    std::string cmd = tokens[0];
-    std::string response;
+    CommandTokens tokens;
+    size_t consumed = 0;
+    while (!input->parked) {
+        size_t end = 0;
+        CommandStream::Status status;
+        {
+            TraceSpan span("parse", TraceCategory::Command, client_fd);
+            status = input->stream->parse(input->buffer, tokens, end);
+        }
+        if (status == CommandStream::Status::NeedMore) {
+            break;
+        }
+        if (status == CommandStream::Status::Error) {
+            dropInput(client_fd, *input, serializer);
+            return;
+        }
 
-    if (cmd == "enumerate" && tokens.size() == 1) {
-        response = handleEnumerate();
-    } else if (cmd == "on" && tokens.size() == 2) {
-        response = handleOn(tokens[1]);
-        return;
-    } else if (cmd == "off" && tokens.size() == 2) {
-        response = handleOff(tokens[1]);
+        consumed = end;
+        if (tokens.empty()) {
+            sendParseError(client_fd, serializer);
+        } else if (!parkCommand(client_fd, *input, tokens)) {
+            handleCommand(client_fd, serializer, tokens);
+        }
+        if (!server_.isClientConnected(client_fd, client_id)) {
+            return;
+        }
+    }
+
+    // Разобранные команды удаляем одним сдвигом, а не после каждой
+    if (consumed > 0) {
+        input->buffer.erase(0, consumed);
+        input->stream->discard(consumed);
+    }
+    if (input->buffer.size() > MAX_PENDING_INPUT) {
+        logWarning("CommandProcessor: Command from fd=", client_fd, " exceeds ", MAX_PENDING_INPUT, " bytes, dropped");
+        dropInput(client_fd, *input, serializer);
+    }
+}
+
+void CommandProcessor::dropInput(int client_fd, ClientInput& input, CommandSerializer& serializer) {
+    // Границу следующей команды не найти: отбрасываем всё полученное
+    input.buffer.clear();
+    input.stream->reset();
+    sendParseError(client_fd, serializer);
+    if (!input.stream->recoverable()) {
+        logWarning("CommandProcessor: Unrecoverable input from fd=", client_fd, ", closing connection");
+        input.closing = true;
+        server_.closeWhenFlushed(client_fd);
+    }
+}
+
+bool CommandProcessor::parkCommand(int client_fd, ClientInput& input, const CommandTokens& tokens) {
+    const CommandEntry* entry = COMMANDS.find(tokens[0]);
+    KernelState needs = entry ? entry->needs : KernelState::None;
+    if (needs == KernelState::None || (needs == KernelState::Interfaces && netlink_mgr_.isReady()) ||
+        netlink_mgr_.areRoutesReady()) {
+        return false;
+    }
+
+    // Токены указывают в буфер, который сдвинется: копируем тексты (без перераспределения)
+    auto parked = std::make_unique<ParkedCommand>();
+    size_t length = 0;
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        length += tokens[i].size();
+    }
+    parked->text.reserve(length);
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        if (tokens.kind(i) == CommandTokens::Kind::Text) {
+            size_t offset = parked->text.size();
+            parked->text.append(tokens[i]);
+            parked->tokens.push(std::string_view(parked->text).substr(offset, tokens[i].size()));
+        } else {
+            parked->tokens.pushValue(tokens.kind(i), tokens.value(i));
+        }
+    }
+    parked->tokens.setRequestId(tokens.requestId());
+    input.parked = std::move(parked);
+
+    logDebug("CommandProcessor: Command from fd=", client_fd, " waits for kernel state");
+    auto resume = [this, client_fd, client_id = input.client_id](bool ok) { resumeClient(client_fd, client_id, ok); };
+    if (needs == KernelState::Interfaces) {
+        netlink_mgr_.whenReady(resume);
+    } else {
+        netlink_mgr_.whenRoutesReady(resume);
+    }
+    return true;
+}
+
+void CommandProcessor::resumeClient(int client_fd, uint64_t client_id, bool ok) {
+    auto it = inputs_.find(client_fd);
+    if (it == inputs_.end() || it->second->client_id != client_id || !it->second->parked) {
         return;
-    } else if (cmd == "dhcpOn" && tokens.size() == 2) {
-        response = handleDhcpOn(tokens[1]);
+    }
+    std::shared_ptr<ClientInput> input = it->second;
+    std::unique_ptr<ParkedCommand> parked = std::move(input->parked);
+    CommandSerializer& serializer = *serializers_[input->serializer];
+    if (ok) {
+        handleCommand(client_fd, serializer, parked->tokens);
+    } else {
+        std::string cmd(parked->tokens[0]);
+        sendDeferredResponse(Waiter{client_fd, client_id, parked->tokens.requestId()}, cmd,
+                             "error(kernel state not loaded)");
+    }
+    if (server_.isClientConnected(client_fd, client_id)) {
+        handleInput(client_fd, {});
+    }
+}
+
+// Клиент, чьи первые байты совпадают с приветствием одного из форматов, переходит
+// на этот формат; приветствие отправляется ему обратно. Остальные - формат по умолчанию.
+bool CommandProcessor::negotiate(int client_fd, ClientInput& input) {
+    std::string_view received = input.buffer;
+    for (size_t i = 1; i < serializers_.size(); ++i) {
+        std::string_view hello = serializers_[i]->hello();
+        size_t len = std::min(hello.size(), received.size());
+        if (received.substr(0, len) != hello.substr(0, len)) {
+            continue;
+        }
+        if (len < hello.size()) {
+            return false;
+        }
+        input.buffer.erase(0, hello.size());
+        input.serializer = i;
+        input.stream = serializers_[i]->createStream();
+        logInfo("CommandProcessor: Client fd=", client_fd, " switched to ",
+                (serializers_[i]->binary() ? "binary" : "text"), " protocol #", i);
+        finishNegotiation(client_fd, input);
+        server_.sendResponse(client_fd, hello);
+        return server_.isClientConnected(client_fd, input.client_id);
+    }
+    input.stream = serializers_[0]->createStream();
+    finishNegotiation(client_fd, input);
+    return server_.isClientConnected(client_fd, input.client_id);
+}
+
+void CommandProcessor::finishNegotiation(int client_fd, ClientInput& input) {
+    if (input.negotiation_timer) {
+        loop_.cancelTimer(input.negotiation_timer);
+        input.negotiation_timer = 0;
+    }
+    std::string held = std::move(input.held_events);
+    input.held_events.clear();
+    // События до приветствия - в формате по умолчанию: клиенту другого формата они не нужны,
+    // его поток начинается с эха приветствия
+    if (!held.empty() && input.serializer == 0) {
+        server_.sendResponse(client_fd, held);
+    }
+}
+
+void CommandProcessor::holdEvent(int client_fd, ClientInput& input, std::string_view event) {
+    if (input.held_events.size() + event.size() > MAX_HELD_EVENTS) {
         return;
-    } else if (cmd == "dhcpOff" && tokens.size() == 2) {
-        response = handleDhcpOff(tokens[1]);
+    }
+    input.held_events.append(event);
+    if (input.negotiation_timer) {
         return;
-    } else if (cmd == "setStatic" && tokens.size() == 5) {
-        response = handleSetStatic(tokens[1], tokens[2], tokens[3], tokens[4]);
+    }
+    input.negotiation_timer = loop_.addTimer(NEGOTIATION_TIMEOUT, [this, client_fd, client_id = input.client_id]() {
+        auto it = inputs_.find(client_fd);
+        if (it == inputs_.end() || it->second->client_id != client_id) {
+            return;
+        }
+        std::shared_ptr<ClientInput> input = it->second;
+        input->negotiation_timer = 0;
+        if (input->stream) {
+            return;
+        }
+        // Клиент молчит: только слушает события, формат по умолчанию. Если он уже прислал
+        // начало приветствия, решит negotiate по следующим байтам.
+        if (input->buffer.empty()) {
+            input->stream = serializers_[0]->createStream();
+            finishNegotiation(client_fd, *input);
+        }
+    });
+}
+
+size_t CommandProcessor::serializerIndex(int client_fd, uint64_t client_id) const {
+    auto it = inputs_.find(client_fd);
+    if (it == inputs_.end() || it->second->client_id != client_id) {
+        return 0;
+    }
+    return it->second->serializer;
+}
+
+void CommandProcessor::broadcastEvent(OutputBuffer& out, const EventFormatter& format) {
+    auto started = std::chrono::steady_clock::now();
+    {
+        TraceSpan span("format", TraceCategory::Event);
+        format(*serializers_[0], out);
+    }
+    uint32_t formatted = 1;
+    uint64_t recipients = 0;
+    TraceSpan span("broadcast", TraceCategory::Event);
+    server_.broadcastToAllClients([&](int client_fd) -> std::string_view {
+        ++recipients;
+        std::shared_ptr<ClientInput>& input = clientInput(client_fd);
+        if (!input->stream) {
+            holdEvent(client_fd, *input, out.view());
+            return {};
+        }
+        size_t index = input->serializer;
+        if (index == 0) {
+            return out.view();
+        }
+        if (!(formatted & (1u << index))) {
+            event_buffers_[index].clear();
+            format(*serializers_[index], event_buffers_[index]);
+            formatted |= 1u << index;
+        }
+        return event_buffers_[index].view();
+    });
+    fanout_metric_.observe(recipients);
+    broadcast_metric_.observe(std::chrono::steady_clock::now() - started);
+}
+
+void CommandProcessor::handleDisconnect(int client_fd) {
+    auto it = inputs_.find(client_fd);
+    if (it != inputs_.end()) {
+        if (it->second->negotiation_timer) {
+            loop_.cancelTimer(it->second->negotiation_timer);
+        }
+        inputs_.erase(it);
+    }
+    enumerate_streams_.erase(client_fd);
+}
+
+void CommandProcessor::sendParseError(int client_fd, CommandSerializer& serializer) {
+    auto out = pool_.acquire();
+    serializer.parseError(*out);
+    invalid_commands_metric_.inc();
+    sendResponse(client_fd, serializer, out->view());
+}
+
+void CommandProcessor::sendResponse(int client_fd, CommandSerializer& serializer, std::string_view response) {
+    {
+        TraceSpan span("send", TraceCategory::Command, client_fd);
+        server_.sendResponse(client_fd, response);
+    }
+    if (serializer.binary()) {
+        logInfo("CommandProcessor: Sent binary response: ", response.size(), " bytes");
     } else {
+        logInfo("CommandProcessor: Sent response: ", response);
+    }
+}
+
+void CommandProcessor::handleCommand(int client_fd, CommandSerializer& serializer, const CommandTokens& tokens) {
+    auto received = std::chrono::steady_clock::now();
+    {
+        // Аргументы, пришедшие уже декодированными, печатаются в текстовом виде
+        auto text = pool_.acquire();
+        text->append('(');
+        for (size_t i = 0; i < tokens.size(); ++i) {
+            if (i) {
+                text->append(' ');
+            }
+            switch (tokens.kind(i)) {
+                case CommandTokens::Kind::Text: text->append(tokens[i]); break;
+                case CommandTokens::Kind::IPv4: text->appendIPv4(tokens.value(i)); break;
+                case CommandTokens::Kind::Number: text->appendDecimal(tokens.value(i)); break;
+            }
+        }
+        logInfo("CommandProcessor: Received command: ", text->view(), ")");
+    }
+
+    std::string cmd(tokens[0]);
+    std::string response;
+    const CommandEntry* entry = COMMANDS.find(cmd);
+    CommandArgs args;
+    std::string error;
+
+    auto out = pool_.acquire();
+    size_t mark = serializer.beginResponse(*out, cmd, tokens.requestId());
+    if (!entry) {
         response = "error(unknown command or invalid arguments)";
+        invalid_commands_metric_.inc();
+    } else if (!decodeCommandArgs(entry->schema, tokens, args, error)) {
+        response = "error(" + error + ")";
+        invalid_commands_metric_.inc();
+    } else {
+        Reply reply{serializer, *out, tokens.requestId()};
+        TraceSpan span(entry->schema.name.data(), TraceCategory::Command, client_fd);
+        response = (this->*entry->handler)(client_fd, args, reply);
+        if (response.empty() && !reply.written) {
+            return; // Задержку запишет операция или поток enumerate
+        }
+    }
+
+    if (!response.empty()) {
+        serializer.status(*out, response);
+    }
+    serializer.endResponse(*out, mark);
+    sendResponse(client_fd, serializer, out->view());
+    if (entry) {
+        recordCommand(cmd, received, response);
+    }
+}
+
+void CommandProcessor::recordCommand(std::string_view cmd, std::chrono::steady_clock::time_point received,
+                                     std::string_view response) {
+    const CommandEntry* entry = COMMANDS.find(cmd);
+    if (!entry) {
+        return;
+    }
+    CommandMetrics& metrics = command_metrics_[entry - COMMANDS.entries().data()];
+    metrics.latency->observe(std::chrono::steady_clock::now() - received);
+    if (response.substr(0, 6) == "error(") {
+        metrics.errors->inc();
+    }
+}
+
+void CommandProcessor::submitOperation(int client_fd, uint32_t request_id, std::string_view cmd, const CommandArgs& args,
+                                       std::vector<std::string> interfaces, std::function<void(Completion)> start) {
+    std::sort(interfaces.begin(), interfaces.end());
+    interfaces.erase(std::unique(interfaces.begin(), interfaces.end()), interfaces.end());
+
+    // Аргументы в каноническом виде: одинаковые команды текстового и двоичного клиентов совпадают
+    const CommandSchema& schema = COMMANDS.find(cmd)->schema;
+    auto text = pool_.acquire();
+    text->append(cmd);
+    for (size_t i = 0; i < args.size(); ++i) {
+        appendArgText(text->append(' '), schema.args[std::min<size_t>(i, schema.arg_count - 1)], args[i]);
+    }
+    std::string key = text->str();
+    Waiter waiter{client_fd, server_.getClientId(client_fd), request_id};
+
+    // Присоединяемся, только если такая же операция последняя во всех нужных очередях:
+    // иначе между ними стоит другая операция и повтор изменит результат
+    auto first = interface_queues_.find(interfaces.front());
+    if (first != interface_queues_.end()) {
+        std::shared_ptr<Operation> last = first->second.back();
+        bool same = last->key == key && std::all_of(interfaces.begin(), interfaces.end(),
+            [this, &last](const std::string& ifname) {
+                auto it = interface_queues_.find(ifname);
+                return it != interface_queues_.end() && it->second.back() == last;
+            });
+        if (same) {
+            last->waiters.push_back(waiter);
+            logInfo("CommandProcessor: Joined ", (last->running ? "running" : "queued"), " operation: ", key,
+                    " (clients: ", last->waiters.size(), ")");
+            return;
+        }
+    }
+
+    auto op = std::make_shared<Operation>();
+    op->cmd = std::string(cmd);
+    op->key = key;
+    op->interfaces = std::move(interfaces);
+    op->start = std::move(start);
+    op->waiters.push_back(waiter);
+    op->received = std::chrono::steady_clock::now();
+    operations_metric_.add(1);
+    for (const auto& ifname : op->interfaces) {
+        auto& queue = interface_queues_[ifname];
+        queue.push_back(op);
+        if (queue.size() > 1) {
+            logInfo("CommandProcessor: ", key, " waits for ", queue.front()->key);
+        }
+    }
+    tryStart(op);
+}
+
+void CommandProcessor::tryStart(const std::shared_ptr<Operation>& op) {
+    if (op->running) {
+        return;
+    }
+    for (const auto& ifname : op->interfaces) {
+        if (interface_queues_[ifname].front() != op) {
+            return;
+        }
+    }
+    op->running = true;
+    // Синхронная операция завершится прямо внутри start
+    op->start([this, op](const std::string& response) { completeOperation(op, response); });
+}
+
+void CommandProcessor::completeOperation(const std::shared_ptr<Operation>& op, const std::string& response) {
+    std::vector<std::shared_ptr<Operation>> next;
+    for (const auto& ifname : op->interfaces) {
+        auto it = interface_queues_.find(ifname);
+        it->second.pop_front();
+        if (it->second.empty()) {
+            interface_queues_.erase(it);
+        } else {
+            next.push_back(it->second.front());
+        }
+    }
+
+    operations_metric_.add(-1);
+    recordCommand(op->cmd, op->received, response);
+    // Отрезок от получения команды до завершения операции (включая ожидание в очереди)
+    FlightRecorder::instance().record(COMMANDS.find(op->cmd)->schema.name.data(), TraceCategory::Command,
+                                      FlightRecorder::traceTime(op->received), FlightRecorder::now(),
+                                      op->waiters.front().client_fd);
+    if (!response.empty()) {
+        for (const auto& waiter : op->waiters) {
+            sendDeferredResponse(waiter, op->cmd, response);
+        }
+    }
+    for (const auto& candidate : next) {
+        tryStart(candidate);
+    }
+}
+
+namespace {
+
+// Порция потокового enumerate: записей на одну итерацию цикла событий
+constexpr size_t STREAM_BATCH = 256;
+// trace dump: за сколько последних секунд отдаются отрезки
+constexpr uint32_t TRACE_DUMP_SECONDS = 10;
+constexpr uint32_t MAX_TRACE_DUMP_SECONDS = 3600;
+
+bool parseUnsigned(std::string_view text, uint32_t& value) {
+    if (text.empty() || text.size() > 9) {
+        return false;
     }
+    value = 0;
+    for (char c : text) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        value = value * 10 + (c - '0');
+    }
+    return true;
+}
 
-    std::string full_response = serializer_->serializeResponse(cmd, response);
-    server_.sendResponse(client_fd, full_response);
-    std::cout << "[" << getTimestamp() << "] CommandProcessor: Sent response: " << full_response << std::endl;
+uint32_t fieldBit(Field field) {
+    return 1u << static_cast<int>(field);
 }
 
-std::string CommandProcessor::handleEnumerate() {
+// Элементы списка через запятую: up,!loopback / iface,addr
+template <typename Callback>
+bool forEachItem(std::string_view list, Callback callback) {
+    while (true) {
+        size_t comma = list.find(',');
+        if (!callback(list.substr(0, comma))) {
+            return false;
+        }
+        if (comma == std::string_view::npos) {
+            return true;
+        }
+        list.remove_prefix(comma + 1);
+    }
+}
+
+// Имена флагов - как у libnl (up, running, loopback, lowerup...); '!' - флаг сброшен
+bool parseFlags(std::string_view value, unsigned int& set, unsigned int& clear) {
+    return forEachItem(value, [&](std::string_view item) {
+        bool negate = !item.empty() && item[0] == '!';
+        if (negate) {
+            item.remove_prefix(1);
+        }
+        int flag = item.empty() ? 0 : rtnl_link_str2flags(std::string(item).c_str());
+        if (flag <= 0) {
+            return false;
+        }
+        (negate ? clear : set) |= static_cast<unsigned int>(flag);
+        return true;
+    });
+}
+
+// Начало MAC-адреса: байты в hex через ':' или '-' (52:54:00)
+bool parseMacPrefix(std::string_view value, std::vector<uint8_t>& mac) {
+    mac.clear();
+    while (!value.empty()) {
+        if (!mac.empty()) {
+            if (value[0] != ':' && value[0] != '-') {
+                return false;
+            }
+            value.remove_prefix(1);
+        }
+        size_t len = 0;
+        unsigned int byte = 0;
+        for (; len < value.size() && len < 2 && isxdigit(static_cast<unsigned char>(value[len])); ++len) {
+            char c = static_cast<char>(tolower(static_cast<unsigned char>(value[len])));
+            byte = byte * 16 + (c <= '9' ? c - '0' : c - 'a' + 10);
+        }
+        if (len == 0 || mac.size() == 6) {
+            return false;
+        }
+        mac.push_back(static_cast<uint8_t>(byte));
+        value.remove_prefix(len);
+    }
+    return !mac.empty();
+}
+
+bool parseFields(std::string_view value, uint32_t& fields) {
+    static constexpr Field RECORD_FIELDS[] = {Field::Iface, Field::Addr, Field::Mac,
+                                              Field::Gateway, Field::Mask, Field::Flag};
+    fields = 0;
+    return forEachItem(value, [&](std::string_view item) {
+        for (Field field : RECORD_FIELDS) {
+            if (fieldName(field) == item) {
+                fields |= fieldBit(field);
+                return true;
+            }
+        }
+        return false;
+    });
+}
+
+// Фильтры enumerate по состоянию из кэшей: имя, флаги и MAC - из кэша интерфейсов,
+// наличие адреса IPv4 - из кэша адресов (один проход на запрос, а не запрос к ядру
+// на каждый интерфейс). Записи для интерфейсов, не прошедших фильтр, не собираются.
+class LinkFilter {
+public:
+    template <typename Query>
+    LinkFilter(const Query& query, struct nl_cache* addr_cache)
+        : name_(query.name), flags_set_(query.flags_set), flags_clear_(query.flags_clear),
+          has_address_(query.has_address), mac_(query.mac) {
+        if (has_address_ >= 0 && addr_cache) {
+            for (struct nl_object* obj = nl_cache_get_first(addr_cache); obj; obj = nl_cache_get_next(obj)) {
+                struct rtnl_addr* addr = (struct rtnl_addr*)obj;
+                if (rtnl_addr_get_family(addr) == AF_INET) {
+                    addressed_.insert(rtnl_addr_get_ifindex(addr));
+                }
+            }
+        }
+    }
+
+    bool operator()(struct rtnl_link* link) const {
+        const char* ifname = rtnl_link_get_name(link);
+        if (!ifname) {
+            return false;
+        }
+        unsigned int flags = rtnl_link_get_flags(link);
+        if ((flags & flags_set_) != flags_set_ || (flags & flags_clear_)) {
+            return false;
+        }
+        if (!name_.empty() && fnmatch(name_.c_str(), ifname, 0) != 0) {
+            return false;
+        }
+        if (!mac_.empty()) {
+            struct nl_addr* addr = rtnl_link_get_addr(link);
+            if (!addr || nl_addr_get_len(addr) < mac_.size() ||
+                memcmp(nl_addr_get_binary_addr(addr), mac_.data(), mac_.size()) != 0) {
+                return false;
+            }
+        }
+        if (has_address_ >= 0 && addressed_.count(rtnl_link_get_ifindex(link)) != static_cast<size_t>(has_address_)) {
+            return false;
+        }
+        return true;
+    }
+
+private:
+    const std::string& name_;
+    unsigned int flags_set_;
+    unsigned int flags_clear_;
+    int has_address_;
+    const std::vector<uint8_t>& mac_;
+    std::unordered_set<int> addressed_;
+};
+
+// Интерфейсы с ifindex >= from, прошедшие фильтр, по возрастанию ifindex, не больше limit
+std::vector<struct rtnl_link*> collectLinks(struct nl_cache* link_cache, uint32_t from, size_t limit,
+                                            const LinkFilter& filter) {
+    std::vector<struct rtnl_link*> links;
+    for (struct nl_object* obj = nl_cache_get_first(link_cache); obj; obj = nl_cache_get_next(obj)) {
+        struct rtnl_link* link = (struct rtnl_link*)obj;
+        if (static_cast<uint32_t>(rtnl_link_get_ifindex(link)) >= from && filter(link)) {
+            links.push_back(link);
+        }
+    }
+    auto by_ifindex = [](struct rtnl_link* a, struct rtnl_link* b) {
+        return rtnl_link_get_ifindex(a) < rtnl_link_get_ifindex(b);
+    };
+    if (links.size() > limit) {
+        std::nth_element(links.begin(), links.begin() + limit, links.end(), by_ifindex);
+        links.resize(limit);
+    }
+    std::sort(links.begin(), links.end(), by_ifindex);
+    return links;
+}
+
+} // namespace
+
+// (enumerate) - все интерфейсы в порядке кэша; (enumerate (from=N) (limit=M)) - страница
+// по возрастанию ifindex с курсором next; (enumerate (stream=1)) - потоковый режим.
+// Фильтры: name=glob, flags=up,!loopback, has_addr=0|1, mac=52:54:00;
+// fields=iface,addr,... - только перечисленные поля записи.
+std::string CommandProcessor::handleEnumerate(int client_fd, const CommandArgs& args, Reply& reply) {
+    // Записи собираются из кэшей: сначала накладываем ждущие в сокете уведомления
+    if (netlink_mgr_.hasPendingEvents()) {
+        netlink_mgr_.processEvents();
+    }
     struct nl_cache* link_cache = netlink_mgr_.getLinkCache();
     if (!link_cache) {
         return "error(no link cache)";
     }
 
-    std::stringstream ss;
-    struct nl_object* obj = nl_cache_get_first(link_cache);
+    EnumerateQuery query;
+    for (size_t i = 0; i < args.size(); ++i) {
+        std::string_view text = args[i].text;
+        std::string_view key = text.substr(0, text.find('='));
+        std::string_view value = text.substr(key.size() + 1);
+        if (key == "from") {
+            if (!parseUnsigned(value, query.from)) {
+                return "error(invalid from)";
+            }
+            query.paged = true;
+        } else if (key == "limit") {
+            uint32_t limit = 0;
+            if (!parseUnsigned(value, limit) || limit == 0) {
+                return "error(invalid limit)";
+            }
+            query.limit = limit;
+            query.paged = true;
+        } else if (key == "stream") {
+            if (value != "0" && value != "1") {
+                return "error(invalid stream)";
+            }
+            query.stream = value == "1";
+        } else if (key == "name") {
+            if (value.empty()) {
+                return "error(invalid name)";
+            }
+            query.name = std::string(value);
+        } else if (key == "flags") {
+            if (!parseFlags(value, query.flags_set, query.flags_clear)) {
+                return "error(invalid flags)";
+            }
+        } else if (key == "has_addr") {
+            if (value != "0" && value != "1") {
+                return "error(invalid has_addr)";
+            }
+            query.has_address = value == "1";
+        } else if (key == "mac") {
+            if (!parseMacPrefix(value, query.mac)) {
+                return "error(invalid mac)";
+            }
+        } else if (key == "fields") {
+            if (!parseFields(value, query.fields)) {
+                return "error(invalid fields)";
+            }
+        } else {
+            return "error(unknown option " + std::string(key) + ")";
+        }
+    }
+
+    if (query.stream) {
+        return startEnumerateStream(client_fd, reply, query);
+    }
+    reply.written = true;
+    EnumerateCache* cache = enumerateCache(reply.serializer, query.fields);
+    if (query.paged) {
+        writeEnumeratePage(reply.serializer, reply.out, link_cache, query, cache);
+        return "";
+    }
+    if (!cache || query.filtered()) {
+        writeEnumerate(reply.serializer, reply.out, link_cache, query, cache);
+        return "";
+    }
+
+    uint64_t generation = netlink_mgr_.getGeneration();
+    if (!cache->valid || cache->generation != generation) {
+        cache->body.clear();
+        writeEnumerate(reply.serializer, cache->body, link_cache, query, cache);
+        cache->valid = true;
+        cache->generation = generation;
+    }
+    reply.out.append(cache->body.view());
+    return "";
+}
+
+CommandProcessor::EnumerateCache* CommandProcessor::enumerateCache(const CommandSerializer& serializer,
+                                                                   uint32_t fields) {
+    // Запомненному можно верить, только если все изменения доходят до кэшей и уже применены
+    // (уведомление о только что сделанном изменении может ещё ждать в сокете)
+    if (!netlink_mgr_.isTrackingComplete() || netlink_mgr_.hasPendingEvents()) {
+        return nullptr;
+    }
+    return &enumerate_cache_[{&serializer, fields}];
+}
+
+void CommandProcessor::writeEnumerate(CommandSerializer& serializer, OutputBuffer& out, struct nl_cache* link_cache,
+                                      const EnumerateQuery& query, EnumerateCache* cache) {
+    if (cache) {
+        ++cache->pass;
+    }
+    LinkFilter filter(query, netlink_mgr_.getAddrCache());
+    serializer.beginList(out, "enumerate");
     bool first_interface = true;
-    
-    ss << "enumerate(";
-    
-    while (obj) {
+    for (struct nl_object* obj = nl_cache_get_first(link_cache); obj; obj = nl_cache_get_next(obj)) {
         struct rtnl_link* link = (struct rtnl_link*)obj;
-        const char* ifname = rtnl_link_get_name(link);
-        
-        if (ifname) {
-            if (!first_interface) {
-                ss << " ";
-            }
-            
-            // Получаем информацию об интерфейсе через существующий метод
-            std::string interface_info = network_mgr_.getInterfaceInfo(ifname);
-            
-            // Парсим информацию (формат: ifname:ip:mask:flag:gateway)
-            std::vector<std::string> parts;
-            std::istringstream iss(interface_info);
-            std::string part;
-            
-            while (std::getline(iss, part, ':')) {
-                parts.push_back(part);
-            }
-            
-            // Получаем MAC-адрес
-            struct nl_addr* addr = rtnl_link_get_addr(link);
-            std::string mac_str = "none";
-            if (addr) {
-                unsigned char* mac = (unsigned char*)nl_addr_get_binary_addr(addr);
-                char mac_buf[18];
-                snprintf(mac_buf, sizeof(mac_buf), "%02x-%02x-%02x-%02x-%02x-%02x",
-                         mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-                mac_str = mac_buf;
-            }
-            
-            // Получаем флаги интерфейса
-            unsigned int flags = rtnl_link_get_flags(link);
-            char flags_buf[9];
-            snprintf(flags_buf, sizeof(flags_buf), "%08x", flags);
-            
-            // Формируем информацию об интерфейсе
-            ss << "iface=" << ifname 
-               << " addr=" << (parts.size() >= 2 && parts[1] != "none" ? parts[1] : "none")
-               << " mac=" << mac_str
-               << " gateway=" << (parts.size() >= 5 && parts[4] != "none" ? parts[4] : "none")
-               << " mask=" << (parts.size() >= 3 && parts[2] != "none" ? parts[2] : "none")
-               << " flag=" << flags_buf;
-            
-            first_interface = false;
-        }
-        obj = nl_cache_get_next(obj);
-    }
-    
-    ss << ")";
-    
-    return ss.str();
-}
-
-std::string CommandProcessor::handleOn(const std::string& ifname) {
-    if (ifname.empty()) {
-        return "error(no interface specified)";
+        if (cache) {
+            // Интерфейс существует: его запись сохраняется, даже если он не прошёл фильтр
+            auto fragment = cache->fragments.find(rtnl_link_get_ifindex(link));
+            if (fragment != cache->fragments.end()) {
+                fragment->second.pass = cache->pass;
+            }
+        }
+        if (!filter(link)) {
+            continue;
+        }
+        if (!first_interface) {
+            serializer.recordSeparator(out);
+        }
+        first_interface = false;
+        appendInterfaceRecord(serializer, out, link, query.fields, cache);
+    }
+    serializer.endList(out);
+
+    // Записи исчезнувших интерфейсов не сохраняем
+    if (cache) {
+        for (auto it = cache->fragments.begin(); it != cache->fragments.end();) {
+            it = it->second.pass == cache->pass ? std::next(it) : cache->fragments.erase(it);
+        }
+    }
+}
+
+void CommandProcessor::writeEnumeratePage(CommandSerializer& serializer, OutputBuffer& out,
+                                          struct nl_cache* link_cache, const EnumerateQuery& query,
+                                          EnumerateCache* cache) {
+    // Лишний интерфейс сверх limit - курсор следующей страницы
+    LinkFilter filter(query, netlink_mgr_.getAddrCache());
+    size_t limit = query.limit;
+    std::vector<struct rtnl_link*> links = collectLinks(link_cache, query.from, limit ? limit + 1 : SIZE_MAX, filter);
+    struct rtnl_link* next = nullptr;
+    if (limit && links.size() > limit) {
+        next = links.back();
+        links.pop_back();
+    }
+
+    serializer.beginList(out, "enumerate");
+    for (size_t i = 0; i < links.size(); ++i) {
+        if (i) {
+            serializer.recordSeparator(out);
+        }
+        appendInterfaceRecord(serializer, out, links[i], query.fields, cache);
+    }
+    serializer.endList(out);
+    if (next) {
+        serializer.recordSeparator(out);
+        RecordWriter(serializer, out).decimal(Field::Next, rtnl_link_get_ifindex(next)).finish();
+    }
+}
+
+// Запись интерфейса пересобирается, только если он изменился после её сборки
+void CommandProcessor::appendInterfaceRecord(CommandSerializer& serializer, OutputBuffer& out,
+                                             struct rtnl_link* link, uint32_t fields, EnumerateCache* cache) {
+    if (!cache) {
+        writeInterfaceRecord(serializer, out, link, fields);
+        return;
+    }
+    int ifindex = rtnl_link_get_ifindex(link);
+    EnumerateCache::Fragment& fragment = cache->fragments[ifindex];
+    if (fragment.record.empty() || fragment.generation < netlink_mgr_.getInterfaceGeneration(ifindex)) {
+        fragment.record.clear();
+        writeInterfaceRecord(serializer, fragment.record, link, fields);
+        fragment.generation = netlink_mgr_.getGeneration();
+    }
+    fragment.pass = cache->pass;
+    out.append(fragment.record.view());
+}
+
+std::string CommandProcessor::startEnumerateStream(int client_fd, const Reply& reply, const EnumerateQuery& query) {
+    if (enumerate_streams_.count(client_fd)) {
+        return "error(enumerate stream already in progress)";
+    }
+    auto stream = std::make_shared<EnumerateStream>(EnumerateStream{
+        client_fd, server_.getClientId(client_fd), &reply.serializer, reply.request_id, query, query.from,
+        query.limit ? query.limit : SIZE_MAX, 0, std::chrono::steady_clock::now()});
+    enumerate_streams_[client_fd] = stream;
+    logInfo("CommandProcessor: Streaming enumerate to fd=", client_fd, " from ifindex ", query.from);
+    continueEnumerateStream(stream);
+    return "";
+}
+
+void CommandProcessor::continueEnumerateStream(const std::shared_ptr<EnumerateStream>& stream) {
+    auto it = enumerate_streams_.find(stream->client_fd);
+    if (it == enumerate_streams_.end() || it->second != stream ||
+        !server_.isClientConnected(stream->client_fd, stream->client_id)) {
+        return;
+    }
+
+    CommandSerializer& serializer = *stream->serializer;
+    const EnumerateQuery& query = stream->query;
+    if (netlink_mgr_.hasPendingEvents()) {
+        netlink_mgr_.processEvents();
+    }
+    struct nl_cache* link_cache = netlink_mgr_.getLinkCache();
+    std::vector<struct rtnl_link*> links;
+    if (link_cache) {
+        LinkFilter filter(query, netlink_mgr_.getAddrCache());
+        links = collectLinks(link_cache, stream->next_ifindex, std::min(stream->remaining, STREAM_BATCH), filter);
+    }
+
+    // Каждая запись - отдельный ответ enumerate; порция уходит одной отправкой
+    EnumerateCache* cache = enumerateCache(serializer, query.fields);
+    auto out = pool_.acquire();
+    for (struct rtnl_link* link : links) {
+        size_t mark = serializer.beginResponse(*out, "enumerate", stream->request_id);
+        appendInterfaceRecord(serializer, *out, link, query.fields, cache);
+        serializer.endResponse(*out, mark);
+    }
+    if (!links.empty()) {
+        stream->next_ifindex = static_cast<uint32_t>(rtnl_link_get_ifindex(links.back())) + 1;
+        stream->remaining -= links.size();
+        stream->sent += links.size();
+    }
+
+    bool done = links.size() < STREAM_BATCH || stream->remaining == 0;
+    if (done) {
+        enumerate_streams_.erase(it);
+        std::string status = "success(" + std::to_string(stream->sent) + " interfaces)";
+        serializer.serializeResponse(*out, "enumerate", status, stream->request_id);
+        logInfo("CommandProcessor: Enumerate stream to fd=", stream->client_fd, " finished: ", stream->sent,
+                " interfaces");
+    }
+    server_.sendResponse(stream->client_fd, out->view());
+    if (done) {
+        recordCommand("enumerate", stream->received, {});
+        FlightRecorder::instance().record("enumerate stream", TraceCategory::Command,
+                                          FlightRecorder::traceTime(stream->received), FlightRecorder::now(),
+                                          stream->client_fd);
+    } else {
+        // Следующая порция - когда клиент разберёт очередь вывода
+        server_.onWritable(stream->client_fd, [this, stream]() { continueEnumerateStream(stream); });
+    }
+}
+
+void CommandProcessor::writeInterfaceRecord(CommandSerializer& serializer, OutputBuffer& out, struct rtnl_link* link,
+                                            uint32_t fields) {
+    const char* ifname = rtnl_link_get_name(link);
+    // Всё из кэшей, без запросов к ядру: MAC и флаги - из кэша интерфейсов, адрес -
+    // из кэша адресов, шлюз - маршрут по умолчанию через интерфейс в индексе маршрутов.
+    // Маска адреса /32 не указывается (как в текстовой записи адреса).
+    int ifindex = rtnl_link_get_ifindex(link);
+    const InterfaceAddress* address = nullptr;
+    if (fields & (fieldBit(Field::Addr) | fieldBit(Field::Mask))) {
+        address = findInterfaceAddress(ifindex);
+    }
+    uint32_t gateway = 0;
+    if (fields & fieldBit(Field::Gateway)) {
+        const RouteEntry* default_route = netlink_mgr_.getRouteIndex().find(0, 0, ifindex);
+        gateway = default_route ? default_route->gateway : 0;
+    }
+    struct nl_addr* addr = rtnl_link_get_addr(link);
+    const uint8_t* mac = addr && nl_addr_get_len(addr) >= 6
+                             ? static_cast<const uint8_t*>(nl_addr_get_binary_addr(addr))
+                             : nullptr;
+
+    RecordWriter record(serializer, out);
+    if (fields & fieldBit(Field::Iface)) {
+        record.text(Field::Iface, ifname);
+    }
+    if (fields & fieldBit(Field::Addr)) {
+        record.ipv4(Field::Addr, address != nullptr, address ? address->address : 0);
+    }
+    if (fields & fieldBit(Field::Mac)) {
+        record.mac(Field::Mac, mac, '-');
+    }
+    if (fields & fieldBit(Field::Gateway)) {
+        record.ipv4(Field::Gateway, gateway != 0, gateway);
+    }
+    if (fields & fieldBit(Field::Mask)) {
+        record.prefixLen(Field::Mask, address && address->prefix_len != 32, address ? address->prefix_len : 0);
+    }
+    if (fields & fieldBit(Field::Flag)) {
+        record.hex(Field::Flag, rtnl_link_get_flags(link));
+    }
+    record.finish();
+}
+
+// Индекс пересобирается одним проходом по кэшу адресов, когда изменилось состояние netlink
+const CommandProcessor::InterfaceAddress* CommandProcessor::findInterfaceAddress(int ifindex) {
+    uint64_t generation = netlink_mgr_.getGeneration();
+    if (interface_addrs_generation_ != generation) {
+        interface_addrs_.clear();
+        struct nl_cache* addr_cache = netlink_mgr_.getAddrCache();
+        for (struct nl_object* obj = addr_cache ? nl_cache_get_first(addr_cache) : nullptr; obj;
+             obj = nl_cache_get_next(obj)) {
+            struct rtnl_addr* addr = (struct rtnl_addr*)obj;
+            struct nl_addr* local = rtnl_addr_get_local(addr);
+            if (rtnl_addr_get_family(addr) != AF_INET || !local || nl_addr_get_len(local) != sizeof(uint32_t)) {
+                continue;
+            }
+            uint32_t address_be;
+            memcpy(&address_be, nl_addr_get_binary_addr(local), sizeof(address_be));
+            // Первый адрес интерфейса, как в getInterfaceState
+            interface_addrs_.emplace(rtnl_addr_get_ifindex(addr),
+                                     InterfaceAddress{ntohl(address_be),
+                                                      static_cast<uint8_t>(nl_addr_get_prefixlen(local))});
+        }
+        interface_addrs_generation_ = generation;
     }
+    auto it = interface_addrs_.find(ifindex);
+    return it != interface_addrs_.end() ? &it->second : nullptr;
+}
+
+std::string CommandProcessor::handleOn(int client_fd, const CommandArgs& args, Reply& reply) {
+    std::string ifname(args[0].text);
+    submitOperation(client_fd, reply.request_id, "on", args, {ifname}, [this, ifname](Completion done) {
+        done(setLinkState(ifname, true));
+    });
+    return "";
+}
 
+std::string CommandProcessor::handleOff(int client_fd, const CommandArgs& args, Reply& reply) {
+    std::string ifname(args[0].text);
+    submitOperation(client_fd, reply.request_id, "off", args, {ifname}, [this, ifname](Completion done) {
+        done(setLinkState(ifname, false));
+    });
+    return "";
+}
+
+std::string CommandProcessor::setLinkState(const std::string& ifname, bool up) {
     struct nl_cache* link_cache = netlink_mgr_.getLinkCache();
     if (!link_cache) {
         return "error(no link cache)";
@@ -148,90 +1020,368 @@ std::string CommandProcessor::handleOn(const std::string& ifname) {
     }
 
     struct rtnl_link* change = rtnl_link_alloc();
-    rtnl_link_set_flags(change, IFF_UP);
-    int err = rtnl_link_change(netlink_mgr_.getSocket(), link, change, 0);
+    if (up) {
+        rtnl_link_set_flags(change, IFF_UP);
+    } else {
+        rtnl_link_unset_flags(change, IFF_UP);
+    }
+    int err;
+    {
+        TraceSpan span("netlink ack", TraceCategory::Netlink, 1);
+        err = rtnl_link_change(netlink_mgr_.getSocket(), link, change, 0);
+    }
     rtnl_link_put(link);
     rtnl_link_put(change);
 
     if (err < 0) {
-        return "error(failed to enable interface: " + std::string(nl_geterror(err)) + ")";
+        return std::string("error(failed to ") + (up ? "enable" : "disable") + " interface: " + nl_geterror(err) + ")";
     }
-    return "success(interface enabled)";
+    return up ? "success(interface enabled)" : "success(interface disabled)";
 }
 
-std::string CommandProcessor::handleOff(const std::string& ifname) {
-    if (ifname.empty()) {
-        return "error(no interface specified)";
+void CommandProcessor::sendDeferredResponse(const Waiter& waiter, const std::string& cmd,
+                                            const std::string& response) {
+    if (!server_.isClientConnected(waiter.client_fd, waiter.client_id)) {
+        logInfo("CommandProcessor: Client disconnected, dropping ", cmd, " response");
+        return;
+    }
+    CommandSerializer& serializer = *serializers_[serializerIndex(waiter.client_fd, waiter.client_id)];
+    auto out = pool_.acquire();
+    serializer.serializeResponse(*out, cmd, response, waiter.request_id);
+    sendResponse(waiter.client_fd, serializer, out->view());
+}
+
+std::string CommandProcessor::handleDhcpOn(int client_fd, const CommandArgs& args, Reply& reply) {
+    std::string ifname(args[0].text);
+    submitOperation(client_fd, reply.request_id, "dhcpOn", args, {ifname}, [this, ifname](Completion done) {
+        network_mgr_.setDynamicIP(ifname, done);
+    });
+    return "";
+}
+
+std::string CommandProcessor::handleDhcpOff(int client_fd, const CommandArgs& args, Reply& reply) {
+    std::string ifname(args[0].text);
+    submitOperation(client_fd, reply.request_id, "dhcpOff", args, {ifname}, [this, ifname](Completion done) {
+        network_mgr_.stopDhcpcd(ifname, done);
+    });
+    return "";
+}
+
+std::string CommandProcessor::handleSetStatic(int client_fd, const CommandArgs& args, Reply& reply) {
+    // Адрес, префикс и шлюз уже проверены при декодировании аргументов;
+    // текст собирается из значений, потому что двоичный клиент передаёт их без текста
+    std::string ifname(args[0].text);
+    OutputBuffer text;
+    text.appendIPv4(args[1].ipv4).append('/').appendDecimal(args[2].prefix);
+    std::string ip_mask = text.str();
+    text.clear();
+    appendArgText(text, ArgType::Gateway, args[3]);
+    std::string gateway = text.str();
+    submitOperation(client_fd, reply.request_id, "setStatic", args, {ifname}, [this, ifname, ip_mask, gateway](Completion done) {
+        std::string error;
+        if (!network_mgr_.setStaticIP(ifname, ip_mask, gateway, error)) {
+            done("error(" + error + ")");
+            return;
+        }
+        done("success(static address set)");
+    });
+    return "";
+}
+
+std::string CommandProcessor::handleRouteLookup(int, const CommandArgs& args, Reply& reply) {
+    const RouteEntry* route = netlink_mgr_.getRouteIndex().lookup(args[0].ipv4);
+    if (!route) {
+        return "error(no route to host)";
+    }
+
+    RecordWriter(reply.serializer, reply.out)
+        .prefix(Field::Dst, route->prefix, route->prefix_len)
+        .text(Field::Iface, route->ifindex ? netlink_mgr_.getInterfaceName(route->ifindex) : "none")
+        .ipv4(Field::Gateway, route->gateway != 0, route->gateway)
+        .decimal(Field::Metric, route->priority)
+        .finish();
+    reply.written = true;
+    return "";
+}
+
+std::string CommandProcessor::handleApply(int client_fd, const CommandArgs& args, Reply& reply) {
+    std::vector<InterfaceSpec> desired;
+    std::vector<std::string> interfaces;
+    try {
+        for (size_t i = 0; i < args.size(); ++i) {
+            desired.push_back(InterfaceSpec::parse(std::string(args[i].text)));
+            interfaces.push_back(desired.back().ifname);
+        }
+    } catch (const std::invalid_argument& e) {
+        return "error(" + std::string(e.what()) + ")";
+    }
+
+    submitOperation(client_fd, reply.request_id, "apply", args, std::move(interfaces), [this, desired](Completion done) {
+        done(applyDesiredState(desired));
+    });
+    return "";
+}
+
+std::string CommandProcessor::applyDesiredState(const std::vector<InterfaceSpec>& desired) {
+    StateReconciler reconciler(netlink_mgr_);
+    size_t operations = 0;
+    std::string error;
+    if (!reconciler.apply(desired, operations, error)) {
+        return "error(" + error + ")";
+    }
+    if (operations == 0) {
+        return "success(no changes)";
+    }
+    return "success(applied " + std::to_string(operations) + " changes)";
+}
+
+// Команды пакета проверяются все до выполнения: при ошибке в любой не выполняется ни одна.
+// Изменения всех команд собираются в одну транзакцию и уходят в ядро одним пакетом.
+std::string CommandProcessor::handleBatch(int client_fd, const CommandArgs& args, Reply& reply) {
+    std::vector<BatchCommand> commands;
+    std::vector<std::string> interfaces;
+    for (size_t i = 0; i < args.size(); ++i) {
+        BatchCommand command;
+        std::string error;
+        if (!parseBatchCommand(args[i].text, command, error)) {
+            return "error(command " + std::to_string(i + 1) + ": " + error + ")";
+        }
+        interfaces.push_back(command.ifname);
+        commands.push_back(std::move(command));
+    }
+
+    submitOperation(client_fd, reply.request_id, "batch", args, std::move(interfaces), [this, commands](Completion done) {
+        done(applyBatch(commands));
+    });
+    return "";
+}
+
+// Команда пакета: имя и аргументы через запятую (setStatic,eth0,10.0.0.5,24,10.0.0.1)
+bool CommandProcessor::parseBatchCommand(std::string_view text, BatchCommand& command, std::string& error) const {
+    CommandTokens tokens;
+    while (true) {
+        size_t comma = text.find(',');
+        tokens.push(text.substr(0, comma));
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        text.remove_prefix(comma + 1);
+    }
+
+    command.name = std::string(tokens[0]);
+    if (command.name != "on" && command.name != "off" && command.name != "setStatic") {
+        error = "command not allowed in batch";
+        return false;
     }
+    CommandArgs args;
+    if (!decodeCommandArgs(COMMANDS.find(command.name)->schema, tokens, args, error)) {
+        return false;
+    }
+    command.ifname = std::string(args[0].text);
+    if (command.name == "setStatic") {
+        OutputBuffer value;
+        value.appendIPv4(args[1].ipv4).append('/').appendDecimal(args[2].prefix);
+        command.ip_mask = value.str();
+        value.clear();
+        appendArgText(value, ArgType::Gateway, args[3]);
+        command.gateway = value.str();
+    }
+    return true;
+}
 
+std::string CommandProcessor::applyBatch(const std::vector<BatchCommand>& commands) {
     struct nl_cache* link_cache = netlink_mgr_.getLinkCache();
     if (!link_cache) {
         return "error(no link cache)";
     }
 
-    struct rtnl_link* link = rtnl_link_get_by_name(link_cache, ifname.c_str());
-    if (!link) {
-        return "error(interface not found)";
+    // Состояние интерфейса с учётом предыдущих команд пакета: (off,eth0) (on,eth0)
+    // должно дать включённый интерфейс, хотя в ядре он включён и сейчас
+    std::map<std::string, bool> link_up;
+    auto isUp = [&](struct rtnl_link* link, const std::string& ifname) {
+        auto it = link_up.find(ifname);
+        return it != link_up.end() ? it->second : (rtnl_link_get_flags(link) & IFF_UP) != 0;
+    };
+
+    NetlinkTransaction txn(netlink_mgr_);
+    std::vector<size_t> ends; // Граница шагов каждой команды в транзакции
+    for (const auto& command : commands) {
+        std::string label = command.name + " " + command.ifname;
+        struct rtnl_link* link = rtnl_link_get_by_name(link_cache, command.ifname.c_str());
+        if (!link) {
+            return "error(" + label + ": interface not found)";
+        }
+        int err = 0;
+        std::string error;
+        bool up = command.name != "off";
+        if (up != isUp(link, command.ifname) && (command.name != "setStatic" || rtnl_link_get_flags(link) & IFF_UP)) {
+            // setStatic сам включает интерфейс, выключенный в ядре
+            err = txn.setLinkUp(link, up);
+        }
+        rtnl_link_put(link);
+        if (err < 0) {
+            return "error(" + label + ": failed to prepare configuration: " + nl_geterror(err) + ")";
+        }
+        if (command.name == "setStatic" && !network_mgr_.stageStaticIP(txn, command.ifname, command.ip_mask,
+                                                                       command.gateway, error)) {
+            return "error(" + label + ": " + error + ")";
+        }
+        link_up[command.ifname] = up;
+        ends.push_back(txn.size());
     }
 
-    struct rtnl_link* change = rtnl_link_alloc();
-    rtnl_link_unset_flags(change, IFF_UP);
-    int err = rtnl_link_change(netlink_mgr_.getSocket(), link, change, 0);
-    rtnl_link_put(link);
-    rtnl_link_put(change);
+    size_t steps = txn.size();
+    int err = txn.commit();
+    // Уведомления об изменениях забираем сразу, чтобы индекс маршрутов и кэши их видели
+    netlink_mgr_.processEvents();
+    if (err < 0 && txn.failedIndex() == std::string::npos) {
+        return "error(batch submission failed: " + std::string(strerror(-err)) + ", state unknown)";
+    }
 
-    if (err < 0) {
-        return "error(failed to disable interface: " + std::string(nl_geterror(err)) + ")";
+    // Итог по каждой команде
+    std::string result;
+    size_t begin = 0;
+    for (size_t i = 0; i < commands.size(); ++i) {
+        if (i) {
+            result += "; ";
+        }
+        result += commands[i].name + " " + commands[i].ifname + ": ";
+        if (ends[i] == begin) {
+            result += "unchanged";
+        } else if (err == 0) {
+            result += "applied";
+        } else if (txn.failedIndex() >= begin && txn.failedIndex() < ends[i]) {
+            result += "failed to set " + txn.failedStep() + ": " + strerror(-err);
+        } else {
+            // Шаги пакета выполняются все; успешные откатываются после ошибки любого
+            result += txn.rollbackComplete() ? "rolled back" : "rollback incomplete";
+        }
+        begin = ends[i];
     }
-    return "success(interface disabled)";
+    logInfo("CommandProcessor: Batch of ", commands.size(), " commands, ", steps, " changes: ",
+            (err == 0 ? "applied" : "rolled back"));
+    return (err == 0 ? "success(" : "error(") + result + ")";
 }
 
-std::string CommandProcessor::handleDhcpOn(const std::string& ifname) {
-    if (ifname.empty()) {
-        return "error(no interface specified)";
+std::string CommandProcessor::handleLogLevel(int, const CommandArgs& args, Reply&) {
+    for (size_t i = 0; i < args.size(); ++i) {
+        std::string_view text = args[i].text;
+        std::string_view key = text.substr(0, text.find('='));
+        std::string_view value = text.substr(key.size() + 1);
+        if (key != "level") {
+            return "error(unknown option " + std::string(key) + ")";
+        }
+        LogLevel level;
+        if (!parseLogLevel(value, level)) {
+            return "error(invalid level)";
+        }
+        Logger::instance().setLevel(level);
     }
-    return network_mgr_.setDynamicIP(ifname);
+    Logger& logger = Logger::instance();
+    return "success(level " + std::string(logLevelName(logger.level())) + ", dropped " +
+           std::to_string(logger.dropped()) + ")";
 }
 
-std::string CommandProcessor::handleDhcpOff(const std::string& ifname) {
-    if (ifname.empty()) {
-        return "error(no interface specified)";
+std::string CommandProcessor::handleTrace(int, const CommandArgs& args, Reply&) {
+    if (args[0].text != "dump") {
+        return "error(unknown trace action " + std::string(args[0].text) + ")";
     }
-    network_mgr_.stopDhcpcd(ifname);
-    return "success(DHCP disabled)";
+    uint32_t seconds = TRACE_DUMP_SECONDS;
+    for (size_t i = 1; i < args.size(); ++i) {
+        std::string_view text = args[i].text;
+        std::string_view key = text.substr(0, text.find('='));
+        std::string_view value = text.substr(key.size() + 1);
+        if (key != "seconds") {
+            return "error(unknown option " + std::string(key) + ")";
+        }
+        if (!parseUnsigned(value, seconds) || seconds == 0 || seconds > MAX_TRACE_DUMP_SECONDS) {
+            return "error(invalid seconds)";
+        }
+    }
+    return "success(" + FlightRecorder::instance().dumpChromeTrace(seconds) + ")";
 }
 
-std::string CommandProcessor::handleSetStatic(const std::string& ifname, const std::string& ip, 
-                                             const std::string& prefix, const std::string& gateway) {
-    if (ifname.empty() || ip.empty() || prefix.empty()) {
-        return "error(invalid arguments)";
+std::string CommandProcessor::handleHandoff(int client_fd, const CommandArgs&, Reply&) {
+    if (!handoff_handler_) {
+        return "error(handoff not supported)";
     }
+    return handoff_handler_(client_fd);
+}
 
-    // Валидация IP-адреса
-    struct in_addr addr;
-    if (inet_pton(AF_INET, ip.c_str(), &addr) != 1) {
-        return "error(invalid IP address)";
-    }
+void CommandProcessor::setHandoffHandler(HandoffHandler handler) {
+    handoff_handler_ = std::move(handler);
+}
 
-    // Валидация префикса
-    int prefix_len;
-    try {
-        prefix_len = std::stoi(prefix);
-        if (prefix_len < 0 || prefix_len > 32) {
-            return "error(invalid prefix length)";
+bool CommandProcessor::prepareHandoff(int requester_fd, HandoffState& state, std::string& reason) {
+    // Передаётся только состояние между командами: у незавершённых операций, потоков
+    // enumerate и недополученных команд ответ остался бы за старым процессом
+    if (!interface_queues_.empty()) {
+        reason = "operations in progress";
+        return false;
+    }
+    if (!enumerate_streams_.empty()) {
+        reason = "enumerate streams in progress";
+        return false;
+    }
+    for (int fd : server_.getClients()) {
+        if (fd == requester_fd) {
+            continue;
+        }
+        HandoffState::Client client;
+        client.fd = fd;
+        auto it = inputs_.find(fd);
+        if (it != inputs_.end() && it->second->client_id == server_.getClientId(fd)) {
+            const ClientInput& input = *it->second;
+            if (!input.buffer.empty() || input.parked) {
+                reason = "partial command from client";
+                return false;
+            }
+            if (!input.held_events.empty()) {
+                reason = "client protocol not negotiated yet";
+                return false;
+            }
+            if (input.stream) {
+                client.serializer = static_cast<int>(input.serializer);
+            }
         }
-    } catch (...) {
-        return "error(invalid prefix format)";
+        client.output = server_.getPendingOutput(fd);
+        state.clients.push_back(std::move(client));
     }
+    return true;
+}
 
-    // Валидация шлюза (если указан)
-    if (!gateway.empty() && gateway != "none") {
-        if (inet_pton(AF_INET, gateway.c_str(), &addr) != 1) {
-            return "error(invalid gateway address)";
+void CommandProcessor::restoreClients(const HandoffState& state) {
+    for (const HandoffState::Client& client : state.clients) {
+        server_.adoptClient(client.fd);
+        uint64_t client_id = server_.getClientId(client.fd);
+        if (client.serializer >= 0 && static_cast<size_t>(client.serializer) < serializers_.size()) {
+            auto input = std::make_shared<ClientInput>();
+            input->client_id = client_id;
+            input->serializer = client.serializer;
+            input->stream = serializers_[client.serializer]->createStream();
+            inputs_[client.fd] = std::move(input);
+        }
+        if (!client.output.empty() && server_.isClientConnected(client.fd, client_id)) {
+            server_.sendResponse(client.fd, client.output);
         }
     }
+}
 
-    std::string ip_mask = ip + "/" + prefix;
-    network_mgr_.setStaticIP(ifname, ip_mask, gateway.empty() ? "none" : gateway);
-    return "success(static address set)";
-}
\ No newline at end of file
+std::string CommandProcessor::handleHelp(int, const CommandArgs&, Reply&) {
+    std::string result;
+    for (const auto& entry : COMMANDS.entries()) {
+        const CommandSchema& schema = entry.schema;
+        if (!result.empty()) {
+            result += "; ";
+        }
+        result.append(schema.name);
+        for (size_t i = 0; i < schema.arg_count; ++i) {
+            result.append(" ").append(argTypeName(schema.args[i]));
+        }
+        if (schema.variadic) {
+            result += "...";
+        }
+        result.append(" - ").append(schema.help);
+    }
+    return "success(" + result + ")";
+}
@@ -5,37 +5,285 @@
 #include "netlink_manager.h"
 #include "network_manager.h"
 #include "command_serializer.h"
+#include "command_registry.h"
+#include "state_reconciler.h"
+#include "handoff.h"
+#include "metrics.h"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
 #include <functional>
+#include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 class CommandProcessor {
 public:
-    using ClientHandler = std::function<void(int, const std::string&)>;
+    // Первый формат - по умолчанию, остальные клиент выбирает приветствием (CommandSerializer::hello).
+    // События, пришедшие до выбора формата, ждут его не дольше NEGOTIATION_TIMEOUT: клиент,
+    // не приславший за это время ни байта, считается клиентом формата по умолчанию.
+    CommandProcessor(UnixSocketServer& server, EventLoop& loop, NetlinkManager& netlink_mgr,
+                     NetworkManager& network_mgr, OutputBufferPool& pool,
+                     std::vector<std::unique_ptr<CommandSerializer>> serializers);
 
-    CommandProcessor(UnixSocketServer& server, NetlinkManager& netlink_mgr, NetworkManager& network_mgr,
-                     std::unique_ptr<CommandSerializer> serializer);
+    static constexpr std::chrono::milliseconds NEGOTIATION_TIMEOUT{500};
+    static constexpr size_t MAX_HELD_EVENTS = 64 * 1024; // Дальше события до выбора формата теряются
 
-    void handleCommand(int client_fd, const std::string& command);
+    // Очередной кусок входных данных клиента: выполняет все полностью пришедшие команды
+    void handleInput(int client_fd, std::string_view data);
+    void handleDisconnect(int client_fd);
 
-    CommandSerializer* getSerializer() const {
-        return serializer_ .get();
-    }
+    // Рассылает событие всем клиентам, каждому в его формате. format вызывается
+    // не больше раза на используемый формат; out получает вариант по умолчанию (для журнала).
+    using EventFormatter = std::function<void(CommandSerializer& serializer, OutputBuffer& out)>;
+    void broadcastEvent(OutputBuffer& out, const EventFormatter& format);
+
+    // Команда handoff: передача работы новому процессу (см. handoff.h). Обработчик
+    // получает fd запросившего; пустая строка - передача состоялась, ответа нет.
+    using HandoffHandler = std::function<std::string(int client_fd)>;
+    void setHandoffHandler(HandoffHandler handler);
+    // Клиенты (кроме запросившего) для передачи; false - идут команды, причина в reason
+    bool prepareHandoff(int requester_fd, HandoffState& state, std::string& reason);
+    // Принимает клиентов от предыдущего процесса: формат и неотправленные ответы
+    void restoreClients(const HandoffState& state);
 
 private:
+    using Completion = std::function<void(const std::string&)>;
+
+    // Клиент, ждущий ответа операции
+    struct Waiter {
+        int client_fd;
+        uint64_t client_id;
+        uint32_t request_id; // Номер запроса клиента (0 - нет)
+    };
+
+    // Команда, изменяющая интерфейсы. Операции над одним интерфейсом выполняются
+    // строго по очереди; одинаковая команда, пришедшая пока предыдущая ждёт или
+    // выполняется, не запускается повторно, а получает тот же ответ.
+    struct Operation {
+        std::string cmd;                     // Имя команды для ответа
+        std::string key;                     // Команда с аргументами
+        std::vector<std::string> interfaces; // Без повторов
+        std::function<void(Completion)> start;
+        std::vector<Waiter> waiters;
+        bool running = false;
+        std::chrono::steady_clock::time_point received; // Для метрики задержки
+    };
+
     UnixSocketServer& server_;
+    EventLoop& loop_;
     NetlinkManager& netlink_mgr_;
     NetworkManager& network_mgr_;
-    std::unique_ptr<CommandSerializer> serializer_;
-
-    std::string getTimestamp() const;
-    std::string handleEnumerate();
-    std::string handleOn(const std::string& ifname);
-    std::string handleOff(const std::string& ifname);
-    std::string handleDhcpOn(const std::string& ifname);
-    std::string handleDhcpOff(const std::string& ifname);
-    std::string handleSetStatic(const std::string& ifname, const std::string& ip, 
-                               const std::string& prefix, const std::string& gateway);
+    OutputBufferPool& pool_; // Буферы ответов
+    std::vector<std::unique_ptr<CommandSerializer>> serializers_;
+    std::vector<OutputBuffer> event_buffers_; // Событие в остальных форматах, по индексу формата
+    // Очередь операций каждого интерфейса; первая - выполняемая или следующая
+    std::map<std::string, std::deque<std::shared_ptr<Operation>>> interface_queues_;
+
+    // Ответ команды в формате клиента. Обработчик, записавший тело ответа в out, ставит written.
+    struct Reply {
+        CommandSerializer& serializer;
+        OutputBuffer& out;
+        uint32_t request_id; // Для ответов, отправляемых позже
+        bool written = false;
+    };
+
+    // Обработчик команды: аргументы уже проверены и декодированы по схеме.
+    // Возвращает success(...)/error(...) либо пустую строку: тогда тело ответа уже
+    // записано в reply.out, а если не записано - ответ будет отправлен позже (или не нужен).
+    using Handler = std::string (CommandProcessor::*)(int client_fd, const CommandArgs& args, Reply& reply);
+    // Какая часть состояния ядра нужна команде; до её загрузки команда
+    // (и следующие за ней команды клиента) ждёт
+    enum class KernelState : uint8_t { None, Interfaces, Routes };
+    struct CommandEntry {
+        CommandSchema schema;
+        Handler handler;
+        KernelState needs = KernelState::None;
+    };
+    static constexpr size_t COMMAND_COUNT = 13;
+    static const CommandRegistry<CommandEntry, COMMAND_COUNT> COMMANDS;
+
+    // Копия токенов команды, чтобы она пережила сдвиг буфера клиента
+    struct ParkedCommand {
+        std::string text; // Тексты токенов подряд
+        CommandTokens tokens;
+    };
+
+    // Недоразобранный ввод клиента; токены команд указывают прямо в buffer.
+    // stream создаётся, когда по первым байтам определён формат клиента.
+    struct ClientInput {
+        uint64_t client_id;
+        std::string buffer;
+        size_t serializer = 0; // Индекс в serializers_
+        std::unique_ptr<CommandStream> stream;
+        // Команда, ждущая загрузки состояния; остальной ввод до её выполнения не разбирается
+        std::unique_ptr<ParkedCommand> parked;
+        bool closing = false; // Поток потерял границы команд: ввод больше не разбирается
+        // События до выбора формата, в формате по умолчанию; двоичный клиент их не получает
+        std::string held_events;
+        EventLoop::TimerId negotiation_timer = 0;
+    };
+    std::map<int, std::shared_ptr<ClientInput>> inputs_;
+
+    // Метрики команды: время от получения до ответа и ответы error(...)
+    struct CommandMetrics {
+        Histogram* latency;
+        Counter* errors;
+    };
+    std::array<CommandMetrics, COMMAND_COUNT> command_metrics_; // По порядку COMMANDS.entries()
+    Counter& invalid_commands_metric_; // Неизвестные команды, неверные аргументы, ошибки разбора
+    Gauge& operations_metric_;         // Операции в очередях интерфейсов
+    Histogram& fanout_metric_;         // Получателей одного события
+    Histogram& broadcast_metric_;      // Время рассылки события
+
+    // Параметры enumerate. Фильтры проверяются по кэшам netlink до сборки записей,
+    // fields - набор полей записи (бит 1 << Field); поля, которые не нужны, не вычисляются
+    struct EnumerateQuery {
+        static constexpr uint32_t ALL_FIELDS = 1u << static_cast<int>(Field::Iface) |
+                                               1u << static_cast<int>(Field::Addr) |
+                                               1u << static_cast<int>(Field::Mac) |
+                                               1u << static_cast<int>(Field::Gateway) |
+                                               1u << static_cast<int>(Field::Mask) |
+                                               1u << static_cast<int>(Field::Flag);
+        uint32_t from = 0;
+        size_t limit = 0; // 0 - без ограничения
+        bool paged = false;
+        bool stream = false;
+        std::string name;             // Шаблон имени (fnmatch)
+        unsigned int flags_set = 0;   // Флаги, которые должны быть установлены
+        unsigned int flags_clear = 0; // и сброшены
+        int has_address = -1;         // -1 - не проверяется
+        std::vector<uint8_t> mac;     // Начало MAC-адреса
+        uint32_t fields = ALL_FIELDS;
+
+        bool filtered() const {
+            return !name.empty() || flags_set || flags_clear || has_address >= 0 || !mac.empty();
+        }
+    };
+
+    // Запомненный ответ enumerate в одном формате: тело целиком (по номеру состояния
+    // netlink) и запись каждого интерфейса (по номеру изменения этого интерфейса)
+    struct EnumerateCache {
+        struct Fragment {
+            uint64_t generation = 0;
+            uint64_t pass = 0;
+            OutputBuffer record;
+        };
+        bool valid = false;
+        uint64_t generation = 0;
+        OutputBuffer body;
+        std::unordered_map<int, Fragment> fragments; // По ifindex
+        uint64_t pass = 0; // Номер полной сборки: записи, не попавшие в неё, удаляются
+    };
+    // По формату и набору полей
+    std::map<std::pair<const CommandSerializer*, uint32_t>, EnumerateCache> enumerate_cache_;
+
+    // Первый адрес IPv4 каждого интерфейса (по ifindex), собранный из кэша адресов
+    // по номеру состояния netlink: записи enumerate не обращаются к ядру
+    struct InterfaceAddress {
+        uint32_t address = 0;
+        uint8_t prefix_len = 0;
+    };
+    std::unordered_map<int, InterfaceAddress> interface_addrs_;
+    uint64_t interface_addrs_generation_ = UINT64_MAX;
+
+    // Потоковый enumerate: записи по одной в отдельных ответах, порциями по мере
+    // освобождения очереди вывода клиента. Не больше одного потока на клиента.
+    struct EnumerateStream {
+        int client_fd;
+        uint64_t client_id;
+        CommandSerializer* serializer;
+        uint32_t request_id;
+        EnumerateQuery query;  // Фильтры и поля
+        uint32_t next_ifindex; // Курсор: следующий интерфейс с ifindex не меньше
+        size_t remaining;      // Сколько ещё записей можно отправить
+        size_t sent = 0;
+        std::chrono::steady_clock::time_point received;
+    };
+    std::map<int, std::shared_ptr<EnumerateStream>> enumerate_streams_;
+    HandoffHandler handoff_handler_;
+
+    // Команда из пакета batch, уже проверенная по схеме реестра
+    struct BatchCommand {
+        std::string name;    // on, off, setStatic
+        std::string ifname;
+        std::string ip_mask; // setStatic: адрес/префикс
+        std::string gateway; // setStatic: шлюз или none
+    };
+
+    // Запись клиента (создаётся при первых данных или первом событии)
+    std::shared_ptr<ClientInput>& clientInput(int client_fd);
+    // Выбор формата по приветствию; false - нужно больше данных
+    bool negotiate(int client_fd, ClientInput& input);
+    // Формат выбран: отложенные события уходят клиенту формата по умолчанию
+    void finishNegotiation(int client_fd, ClientInput& input);
+    // Событие клиенту, ещё не выбравшему формат
+    void holdEvent(int client_fd, ClientInput& input, std::string_view event);
+    // Индекс формата клиента в serializers_ (0, пока клиент не выбрал формат)
+    size_t serializerIndex(int client_fd, uint64_t client_id) const;
+    void handleCommand(int client_fd, CommandSerializer& serializer, const CommandTokens& tokens);
+    // Откладывает команду, если нужная ей часть состояния ядра ещё не загружена; true - отложена
+    bool parkCommand(int client_fd, ClientInput& input, const CommandTokens& tokens);
+    // Выполняет отложенную команду и продолжает разбор ввода клиента
+    void resumeClient(int client_fd, uint64_t client_id, bool ok);
+    void sendParseError(int client_fd, CommandSerializer& serializer);
+    // Ввод клиента не разобрать: сбрасывает его или, если формат не восстанавливается, закрывает соединение
+    void dropInput(int client_fd, ClientInput& input, CommandSerializer& serializer);
+    void sendResponse(int client_fd, CommandSerializer& serializer, std::string_view response);
+    void submitOperation(int client_fd, uint32_t request_id, std::string_view cmd, const CommandArgs& args,
+                         std::vector<std::string> interfaces, std::function<void(Completion)> start);
+    void tryStart(const std::shared_ptr<Operation>& op);
+    void completeOperation(const std::shared_ptr<Operation>& op, const std::string& response);
+    void recordCommand(std::string_view cmd, std::chrono::steady_clock::time_point received,
+                       std::string_view response);
+
+    // Отправляет ответ асинхронной команды, если клиент ещё подключён
+    void sendDeferredResponse(const Waiter& waiter, const std::string& cmd, const std::string& response);
+
+    std::string handleEnumerate(int client_fd, const CommandArgs& args, Reply& reply);
+    std::string handleOn(int client_fd, const CommandArgs& args, Reply& reply);
+    std::string handleOff(int client_fd, const CommandArgs& args, Reply& reply);
+    std::string handleDhcpOn(int client_fd, const CommandArgs& args, Reply& reply);
+    std::string handleDhcpOff(int client_fd, const CommandArgs& args, Reply& reply);
+    std::string handleSetStatic(int client_fd, const CommandArgs& args, Reply& reply);
+    std::string handleRouteLookup(int client_fd, const CommandArgs& args, Reply& reply);
+    // Желаемое состояние интерфейсов: (apply (iface=eth0,state=up,addr=10.0.0.5/24,gateway=10.0.0.1) ...)
+    std::string handleApply(int client_fd, const CommandArgs& args, Reply& reply);
+    // Пакет команд: (batch (on,eth0) (setStatic,eth1,10.0.0.5,24,10.0.0.1) (off,eth2))
+    std::string handleBatch(int client_fd, const CommandArgs& args, Reply& reply);
+    // Уровень журнала и число потерянных записей; (logLevel (level=debug)) меняет уровень
+    std::string handleLogLevel(int client_fd, const CommandArgs& args, Reply& reply);
+    // Отрезки самописца за последние секунды: (trace (dump) (seconds=5))
+    std::string handleTrace(int client_fd, const CommandArgs& args, Reply& reply);
+    std::string handleHandoff(int client_fd, const CommandArgs& args, Reply& reply);
+    // Список команд из схемы реестра
+    std::string handleHelp(int client_fd, const CommandArgs& args, Reply& reply);
+
+    // Запомненные записи enumerate в формате serializer с полями fields, если им можно верить
+    EnumerateCache* enumerateCache(const CommandSerializer& serializer, uint32_t fields);
+    // Тело ответа enumerate (интерфейсы, прошедшие фильтры query, в порядке кэша);
+    // с cache - из запомненных записей неизменившихся интерфейсов
+    void writeEnumerate(CommandSerializer& serializer, OutputBuffer& out, struct nl_cache* link_cache,
+                        const EnumerateQuery& query, EnumerateCache* cache);
+    // Страница: интерфейсы с ifindex >= from по возрастанию, не больше limit (0 - все), и курсор next
+    void writeEnumeratePage(CommandSerializer& serializer, OutputBuffer& out, struct nl_cache* link_cache,
+                            const EnumerateQuery& query, EnumerateCache* cache);
+    void appendInterfaceRecord(CommandSerializer& serializer, OutputBuffer& out, struct rtnl_link* link,
+                               uint32_t fields, EnumerateCache* cache);
+    void writeInterfaceRecord(CommandSerializer& serializer, OutputBuffer& out, struct rtnl_link* link,
+                              uint32_t fields);
+    const InterfaceAddress* findInterfaceAddress(int ifindex);
+    std::string startEnumerateStream(int client_fd, const Reply& reply, const EnumerateQuery& query);
+    void continueEnumerateStream(const std::shared_ptr<EnumerateStream>& stream);
+
+    std::string setLinkState(const std::string& ifname, bool up);
+    std::string applyDesiredState(const std::vector<InterfaceSpec>& desired);
+    bool parseBatchCommand(std::string_view text, BatchCommand& command, std::string& error) const;
+    std::string applyBatch(const std::vector<BatchCommand>& commands);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,172 @@
+#include "command_registry.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+namespace {
+
+bool parseIPv4(std::string_view text, uint32_t& address) {
+    char buffer[INET_ADDRSTRLEN];
+    if (text.size() >= sizeof(buffer)) {
+        return false;
+    }
+    text.copy(buffer, text.size());
+    buffer[text.size()] = '\0';
+    struct in_addr addr;
+    if (inet_pton(AF_INET, buffer, &addr) != 1) {
+        return false;
+    }
+    address = ntohl(addr.s_addr);
+    return true;
+}
+
+bool decodeArg(ArgType type, std::string_view text, ArgValue& value, std::string& error) {
+    value.text = text;
+    switch (type) {
+        case ArgType::Ifname:
+            if (text.size() >= IFNAMSIZ) {
+                error = "invalid interface name";
+                return false;
+            }
+            return true;
+        case ArgType::IPv4:
+            if (!parseIPv4(text, value.ipv4)) {
+                error = "invalid IP address";
+                return false;
+            }
+            return true;
+        case ArgType::Prefix: {
+            if (text.empty() || text.size() > 3) {
+                error = "invalid prefix format";
+                return false;
+            }
+            unsigned prefix = 0;
+            for (char c : text) {
+                if (c < '0' || c > '9') {
+                    error = "invalid prefix format";
+                    return false;
+                }
+                prefix = prefix * 10 + (c - '0');
+            }
+            if (prefix > 32) {
+                error = "invalid prefix length";
+                return false;
+            }
+            value.prefix = static_cast<uint8_t>(prefix);
+            return true;
+        }
+        case ArgType::Gateway:
+            if (text == "none") {
+                value.ipv4 = 0;
+                return true;
+            }
+            if (!parseIPv4(text, value.ipv4)) {
+                error = "invalid gateway address";
+                return false;
+            }
+            return true;
+        case ArgType::Spec:
+            return true;
+        case ArgType::Option: {
+            size_t eq = text.find('=');
+            if (eq == 0 || eq == std::string_view::npos) {
+                error = "invalid option";
+                return false;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// Значение, переданное двоичным протоколом уже декодированным
+bool decodeTypedArg(ArgType type, CommandTokens::Kind kind, uint32_t raw, ArgValue& value, std::string& error) {
+    value.text = {};
+    switch (type) {
+        case ArgType::IPv4:
+        case ArgType::Gateway:
+            if (kind != CommandTokens::Kind::IPv4) {
+                error = type == ArgType::IPv4 ? "invalid IP address" : "invalid gateway address";
+                return false;
+            }
+            value.ipv4 = raw;
+            return true;
+        case ArgType::Prefix:
+            if (kind != CommandTokens::Kind::Number || raw > 32) {
+                error = "invalid prefix length";
+                return false;
+            }
+            value.prefix = static_cast<uint8_t>(raw);
+            return true;
+        case ArgType::Ifname:
+            error = "invalid interface name";
+            return false;
+        case ArgType::Spec:
+        case ArgType::Option:
+            error = "unknown command or invalid arguments";
+            return false;
+    }
+    return false;
+}
+
+} // namespace
+
+bool decodeCommandArgs(const CommandSchema& schema, const CommandTokens& tokens, CommandArgs& args,
+                       std::string& error) {
+    size_t count = tokens.size() - 1;
+    size_t required = schema.arg_count;
+    if (schema.variadic && schema.args[schema.arg_count - 1] == ArgType::Option) {
+        --required;
+    }
+    bool count_ok = schema.variadic ? count >= required : count == required;
+    if (!count_ok) {
+        error = "unknown command or invalid arguments";
+        return false;
+    }
+
+    args.values.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        ArgType type = schema.args[std::min<size_t>(i, schema.arg_count - 1)];
+        bool ok = tokens.kind(i + 1) == CommandTokens::Kind::Text
+                      ? decodeArg(type, tokens[i + 1], args.values[i], error)
+                      : decodeTypedArg(type, tokens.kind(i + 1), tokens.value(i + 1), args.values[i], error);
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CommandArgs::option(size_t first, std::string_view key, std::string_view& value) const {
+    for (size_t i = first; i < values.size(); ++i) {
+        std::string_view text = values[i].text;
+        if (text.size() > key.size() && text.compare(0, key.size(), key) == 0 && text[key.size()] == '=') {
+            value = text.substr(key.size() + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void appendArgText(OutputBuffer& out, ArgType type, const ArgValue& value) {
+    switch (type) {
+        case ArgType::IPv4:
+            out.appendIPv4(value.ipv4);
+            return;
+        case ArgType::Gateway:
+            if (value.ipv4 == 0) {
+                out.append("none");
+            } else {
+                out.appendIPv4(value.ipv4);
+            }
+            return;
+        case ArgType::Prefix:
+            out.appendDecimal(value.prefix);
+            return;
+        case ArgType::Ifname:
+        case ArgType::Spec:
+        case ArgType::Option:
+            out.append(value.text);
+            return;
+    }
+}
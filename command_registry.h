@@ -0,0 +1,128 @@
+#ifndef COMMAND_REGISTRY_H
+#define COMMAND_REGISTRY_H
+
+#include "command_serializer.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Типы аргументов команд; разбираются один раз при декодировании запроса
+enum class ArgType : uint8_t {
+    Ifname,  // Имя интерфейса
+    IPv4,    // Адрес IPv4
+    Prefix,  // Длина префикса 0..32
+    Gateway, // Адрес IPv4 или none
+    Spec,    // Строка key=value,... (разбирает сама команда)
+    Option,  // Необязательный параметр key=value
+};
+
+constexpr std::string_view argTypeName(ArgType type) {
+    switch (type) {
+        case ArgType::Ifname: return "ifname";
+        case ArgType::IPv4: return "ipv4";
+        case ArgType::Prefix: return "prefix";
+        case ArgType::Gateway: return "gateway";
+        case ArgType::Spec: return "spec";
+        case ArgType::Option: return "option";
+    }
+    return "?";
+}
+
+constexpr size_t MAX_SCHEMA_ARGS = 4;
+
+// Описание команды: имя, типы аргументов и краткая справка для help
+struct CommandSchema {
+    std::string_view name;
+    std::array<ArgType, MAX_SCHEMA_ARGS> args;
+    uint8_t arg_count;
+    bool variadic; // Последний аргумент повторяется (не меньше одного раза; Option - сколько угодно)
+    std::string_view help;
+};
+
+// Декодированный аргумент: исходный текст и значение по типу (порядок байт хоста).
+// Для адресов и префиксов из двоичного протокола текст пуст.
+struct ArgValue {
+    std::string_view text;
+    uint32_t ipv4 = 0;
+    uint8_t prefix = 0;
+};
+
+struct CommandArgs {
+    std::vector<ArgValue> values;
+
+    const ArgValue& operator[](size_t i) const { return values[i]; }
+    size_t size() const { return values.size(); }
+
+    // Значение параметра key=value среди аргументов начиная с first; false - параметра нет
+    bool option(size_t first, std::string_view key, std::string_view& value) const;
+};
+
+// Проверяет число аргументов и декодирует их по схеме; при ошибке - текст в error
+bool decodeCommandArgs(const CommandSchema& schema, const CommandTokens& tokens, CommandArgs& args,
+                       std::string& error);
+
+// Каноническая запись аргумента (не зависит от протокола, которым он пришёл)
+void appendArgText(OutputBuffer& out, ArgType type, const ArgValue& value);
+
+// FNV-1a с затравкой: подбирается при компиляции так, чтобы имена команд не пересекались.
+// Младшие биты FNV зависят только от младших битов символов и затравки, поэтому
+// в номер слота подмешиваются старшие: иначе разных затравок всего Slots.
+constexpr uint32_t hashCommandName(std::string_view name, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;
+    for (char c : name) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 16777619u;
+    }
+    return hash ^ (hash >> 16);
+}
+
+// Таблица команд с идеальным хешем, построенная при компиляции.
+// Entry - любой тип с полем schema; поиск - один хеш и одно сравнение строк.
+template <typename Entry, size_t N, size_t Slots = 32>
+class CommandRegistry {
+public:
+    static_assert(Slots >= N && (Slots & (Slots - 1)) == 0, "Slots must be a power of two not less than N");
+
+    constexpr explicit CommandRegistry(const std::array<Entry, N>& entries) : entries_(entries), slots_{} {
+        for (uint32_t seed = 0;; ++seed) {
+            if (tryBuild(seed)) {
+                seed_ = seed;
+                return;
+            }
+        }
+    }
+
+    constexpr const Entry* find(std::string_view name) const {
+        int16_t index = slots_[hashCommandName(name, seed_) & (Slots - 1)];
+        if (index < 0 || entries_[index].schema.name != name) {
+            return nullptr;
+        }
+        return &entries_[index];
+    }
+
+    constexpr const std::array<Entry, N>& entries() const { return entries_; }
+
+private:
+    std::array<Entry, N> entries_;
+    std::array<int16_t, Slots> slots_;
+    uint32_t seed_ = 0;
+
+    constexpr bool tryBuild(uint32_t seed) {
+        for (auto& slot : slots_) {
+            slot = -1;
+        }
+        for (size_t i = 0; i < N; ++i) {
+            auto& slot = slots_[hashCommandName(entries_[i].schema.name, seed) & (Slots - 1)];
+            if (slot != -1) {
+                return false;
+            }
+            slot = static_cast<int16_t>(i);
+        }
+        return true;
+    }
+};
+
+#endif // COMMAND_REGISTRY_H
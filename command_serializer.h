@@ -1,18 +1,213 @@
 #ifndef COMMAND_SERIALIZER_H
 #define COMMAND_SERIALIZER_H
 
+#include "output_buffer.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
+// Токены команды (имя + аргументы): ссылки во входной буфер клиента,
+// действительны до следующего изменения этого буфера. Двоичный протокол
+// передаёт адреса и числа уже декодированными - такие токены без текста.
+// Число аргументов не ограничено; память переиспользуется между командами.
+class CommandTokens {
+public:
+    enum class Kind : uint8_t {
+        Text,
+        IPv4,   // value - адрес в порядке байт хоста
+        Number, // value - целое без знака
+    };
+
+    void clear() {
+        tokens_.clear();
+        request_id_ = 0;
+    }
+    void push(std::string_view token) { tokens_.push_back({token, 0, Kind::Text}); }
+    void pushValue(Kind kind, uint32_t value) { tokens_.push_back({{}, value, kind}); }
+
+    size_t size() const { return tokens_.size(); }
+    bool empty() const { return tokens_.empty(); }
+    std::string_view operator[](size_t i) const { return tokens_[i].text; }
+    Kind kind(size_t i) const { return tokens_[i].kind; }
+    uint32_t value(size_t i) const { return tokens_[i].value; }
+
+    // Номер запроса, выбранный клиентом (0 - не указан); повторяется в ответе,
+    // чтобы клиент сопоставил его с запросом при нескольких командах в работе
+    void setRequestId(uint32_t id) { request_id_ = id; }
+    uint32_t requestId() const { return request_id_; }
+
+private:
+    struct Token {
+        std::string_view text;
+        uint32_t value;
+        Kind kind;
+    };
+    std::vector<Token> tokens_;
+    uint32_t request_id_ = 0;
+};
+
+// Разбор входного потока одного клиента. Команда может прийти несколькими
+// кусками, а в одном куске может быть несколько команд; разбор продолжается
+// с места, где остановился.
+class CommandStream {
+public:
+    enum class Status { NeedMore, Complete, Error };
+
+    virtual ~CommandStream() = default;
+
+    // Продолжает разбор buffer (к которому с прошлого вызова только дописывали).
+    // Complete: tokens заполнены, end - смещение сразу за командой; следующий
+    // вызов начнёт со следующей команды. Буфер может изменяться внутри уже
+    // разобранной части (токены собираются на месте).
+    virtual Status parse(std::string& buffer, CommandTokens& tokens, size_t& end) = 0;
+    // Вызывающий удалил первые bytes байт буфера (только уже разобранные команды)
+    virtual void discard(size_t bytes) = 0;
+    virtual void reset() = 0;
+    // После Error (или переполнения ввода) разбор можно продолжить с новых данных.
+    // false - границы команд потеряны насовсем, соединение закрывается.
+    virtual bool recoverable() const { return true; }
+};
+
+// Поля записей в ответах и событиях
+enum class Field : uint16_t {
+    Iface = 1,
+    Addr,
+    Mac,
+    Gateway,
+    Mask,
+    Flag,
+    Dst,
+    Metric,
+    Next, // Курсор следующей страницы
+};
+
+constexpr std::string_view fieldName(Field field) {
+    switch (field) {
+        case Field::Iface: return "iface";
+        case Field::Addr: return "addr";
+        case Field::Mac: return "mac";
+        case Field::Gateway: return "gateway";
+        case Field::Mask: return "mask";
+        case Field::Flag: return "flag";
+        case Field::Dst: return "dst";
+        case Field::Metric: return "metric";
+        case Field::Next: return "next";
+    }
+    return "?";
+}
+
 class CommandSerializer {
 public:
     virtual ~CommandSerializer() = default;
-    
-    // Парсит входную команду и возвращает вектор токенов (команда + аргументы)
-    virtual std::vector<std::string> parseCommand(const std::string& command) = 0;
-    
-    // Сериализует ответ в требуемый формат (например, S-выражение)
-    virtual std::string serializeResponse(const std::string& command, const std::string& response) = 0;
+
+    // Приветствие, которым клиент выбирает этот формат в начале соединения
+    // (отправляется ему обратно). Пустое - формат по умолчанию.
+    virtual std::string_view hello() const { return {}; }
+    // Ответы не текстовые: в журнал пишется только их размер
+    virtual bool binary() const { return false; }
+
+    // Создаёт разборщик входного потока для нового клиента
+    virtual std::unique_ptr<CommandStream> createStream() = 0;
+
+    // Ответ в требуемом формате (например, S-выражение) пишется прямо в буфер вывода:
+    // beginResponse, затем тело ответа, затем endResponse с меткой от beginResponse.
+    // request_id - номер запроса клиента (0 - нет; у событий его не бывает).
+    virtual size_t beginResponse(OutputBuffer& out, std::string_view command, uint32_t request_id) = 0;
+    virtual void endResponse(OutputBuffer& out, size_t mark) = 0;
+    // Полный ответ на поток, который не удалось разобрать
+    virtual void parseError(OutputBuffer& out) = 0;
+
+    // Тело-статус: "success(...)" или "error(...)"
+    virtual void status(OutputBuffer& out, std::string_view text) = 0;
+
+    // Тело из записей с полями. Список - несколько записей под общим именем,
+    // перед каждой записью, кроме первой, пишется recordSeparator.
+    // beginRecord возвращает метку, которую нужно передать в endRecord.
+    virtual void beginList(OutputBuffer& out, std::string_view name) = 0;
+    virtual void endList(OutputBuffer& out) = 0;
+    virtual void recordSeparator(OutputBuffer& out) = 0;
+    virtual size_t beginRecord(OutputBuffer& out) = 0;
+    virtual void endRecord(OutputBuffer& out, size_t mark) = 0;
+
+    // Поля записи; first - первое поле записи. Для отсутствующих значений
+    // текстовый формат пишет absent, двоичный пропускает поле.
+    virtual void textField(OutputBuffer& out, bool first, Field field, std::string_view value) = 0;
+    virtual void ipv4Field(OutputBuffer& out, bool first, Field field, bool present, uint32_t address,
+                           std::string_view absent) = 0;
+    // Сеть с длиной префикса: 10.0.0.0/24
+    virtual void prefixField(OutputBuffer& out, bool first, Field field, uint32_t address, uint8_t prefix_len) = 0;
+    // Длина префикса: числом или (netmask) маской 255.255.255.0
+    virtual void prefixLenField(OutputBuffer& out, bool first, Field field, bool present, uint8_t prefix_len,
+                                bool netmask) = 0;
+    virtual void macField(OutputBuffer& out, bool first, Field field, const uint8_t* mac, char separator) = 0;
+    virtual void hexField(OutputBuffer& out, bool first, Field field, uint32_t value) = 0;
+    virtual void decimalField(OutputBuffer& out, bool first, Field field, uint32_t value) = 0;
+
+    void serializeResponse(OutputBuffer& out, std::string_view command, std::string_view response,
+                           uint32_t request_id = 0) {
+        size_t mark = beginResponse(out, command, request_id);
+        status(out, response);
+        endResponse(out, mark);
+    }
+};
+
+// Запись ответа: следит за первым полем и закрывает запись в finish()
+class RecordWriter {
+public:
+    RecordWriter(CommandSerializer& serializer, OutputBuffer& out, bool first_in_list = true)
+        : serializer_(serializer), out_(out), mark_(begin(serializer, out, first_in_list)) {}
+
+    RecordWriter& text(Field field, std::string_view value) {
+        serializer_.textField(out_, next(), field, value);
+        return *this;
+    }
+    RecordWriter& ipv4(Field field, bool present, uint32_t address, std::string_view absent = "none") {
+        serializer_.ipv4Field(out_, next(), field, present, address, absent);
+        return *this;
+    }
+    RecordWriter& prefix(Field field, uint32_t address, uint8_t prefix_len) {
+        serializer_.prefixField(out_, next(), field, address, prefix_len);
+        return *this;
+    }
+    RecordWriter& prefixLen(Field field, bool present, uint8_t prefix_len, bool netmask = false) {
+        serializer_.prefixLenField(out_, next(), field, present, prefix_len, netmask);
+        return *this;
+    }
+    RecordWriter& mac(Field field, const uint8_t* mac, char separator) {
+        serializer_.macField(out_, next(), field, mac, separator);
+        return *this;
+    }
+    RecordWriter& hex(Field field, uint32_t value) {
+        serializer_.hexField(out_, next(), field, value);
+        return *this;
+    }
+    RecordWriter& decimal(Field field, uint32_t value) {
+        serializer_.decimalField(out_, next(), field, value);
+        return *this;
+    }
+    void finish() { serializer_.endRecord(out_, mark_); }
+
+private:
+    CommandSerializer& serializer_;
+    OutputBuffer& out_;
+    size_t mark_;
+    bool first_ = true;
+
+    static size_t begin(CommandSerializer& serializer, OutputBuffer& out, bool first_in_list) {
+        if (!first_in_list) {
+            serializer.recordSeparator(out);
+        }
+        return serializer.beginRecord(out);
+    }
+
+    bool next() {
+        bool first = first_;
+        first_ = false;
+        return first;
+    }
 };
 
-#endif // COMMAND_SERIALIZER_H
\ No newline at end of file
+#endif // COMMAND_SERIALIZER_H
@@ -0,0 +1,576 @@
+#include "dhcp_client.h"
+#include "logger.h"
+#include "network_manager.h"
+#include "netns.h"
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <random>
+#include <system_error>
+
+namespace {
+
+constexpr uint16_t DHCP_SERVER_PORT = 67;
+constexpr uint16_t DHCP_CLIENT_PORT = 68;
+constexpr uint32_t DHCP_MAGIC_COOKIE = 0x63825363;
+constexpr uint32_t INFINITE_LEASE = 0xffffffff;
+constexpr uint32_t DEFAULT_LEASE_TIME = 3600;
+constexpr auto ACQUIRE_TIMEOUT = std::chrono::seconds(30); // Как у dhcpcd по умолчанию
+constexpr unsigned MAX_REQUEST_ATTEMPTS = 4;
+constexpr uint32_t MIN_RENEW_RETRY = 60;
+// Пауза перед новым DISCOVER, если аренду не удалось назначить (как после DECLINE, RFC 2131 3.1)
+constexpr auto RESTART_DELAY = std::chrono::seconds(10);
+
+enum DhcpMessageType : uint8_t {
+    DHCPDISCOVER = 1,
+    DHCPOFFER = 2,
+    DHCPREQUEST = 3,
+    DHCPDECLINE = 4,
+    DHCPACK = 5,
+    DHCPNAK = 6,
+    DHCPRELEASE = 7,
+};
+
+enum DhcpOption : uint8_t {
+    OPT_PAD = 0,
+    OPT_SUBNET_MASK = 1,
+    OPT_ROUTER = 3,
+    OPT_DNS = 6,
+    OPT_REQUESTED_IP = 50,
+    OPT_LEASE_TIME = 51,
+    OPT_MESSAGE_TYPE = 53,
+    OPT_SERVER_ID = 54,
+    OPT_PARAM_REQUEST = 55,
+    OPT_RENEW_TIME = 58,
+    OPT_REBIND_TIME = 59,
+    OPT_CLIENT_ID = 61,
+    OPT_END = 255,
+};
+
+#pragma pack(push, 1)
+struct DhcpPacket {
+    uint8_t op;
+    uint8_t htype;
+    uint8_t hlen;
+    uint8_t hops;
+    uint32_t xid;
+    uint16_t secs;
+    uint16_t flags;
+    uint32_t ciaddr;
+    uint32_t yiaddr;
+    uint32_t siaddr;
+    uint32_t giaddr;
+    uint8_t chaddr[16];
+    uint8_t sname[64];
+    uint8_t file[128];
+    uint32_t cookie;
+    uint8_t options[308];
+};
+
+struct DhcpFrame {
+    struct iphdr ip;
+    struct udphdr udp;
+    DhcpPacket dhcp;
+};
+#pragma pack(pop)
+
+constexpr size_t DHCP_FIXED_LEN = offsetof(DhcpPacket, options);
+
+// Пропускаем только нефрагментированные UDP датаграммы на порт клиента
+// (SOCK_DGRAM: смещение 0 - начало IP заголовка)
+struct sock_filter dhcp_filter[] = {
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, offsetof(struct iphdr, protocol)),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 5),
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, offsetof(struct iphdr, frag_off)),
+    BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 3, 0),
+    BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),
+    BPF_STMT(BPF_LD | BPF_H | BPF_IND, offsetof(struct udphdr, dest)),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, DHCP_CLIENT_PORT, 1, 0),
+    BPF_STMT(BPF_RET | BPF_K, 0),
+    BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+};
+
+uint16_t ipChecksum(const void* data, size_t len) {
+    const uint16_t* words = static_cast<const uint16_t*>(data);
+    uint32_t sum = 0;
+    for (size_t i = 0; i < len / 2; ++i) {
+        sum += words[i];
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return static_cast<uint16_t>(~sum);
+}
+
+uint32_t randomXid() {
+    static std::mt19937 rng(std::random_device{}());
+    return rng();
+}
+
+uint8_t maskToPrefix(uint32_t mask) {
+    return static_cast<uint8_t>(__builtin_popcount(mask));
+}
+
+std::string ipToString(uint32_t addr) {
+    struct in_addr in = { htonl(addr) };
+    char buf[INET_ADDRSTRLEN] = {0};
+    inet_ntop(AF_INET, &in, buf, sizeof(buf));
+    return buf;
+}
+
+class OptionWriter {
+public:
+    explicit OptionWriter(uint8_t* options) : options_(options) {}
+
+    void put(uint8_t code, const void* data, uint8_t len) {
+        options_[pos_++] = code;
+        options_[pos_++] = len;
+        memcpy(options_ + pos_, data, len);
+        pos_ += len;
+    }
+
+    void putU8(uint8_t code, uint8_t value) { put(code, &value, 1); }
+
+    void putAddr(uint8_t code, uint32_t addr) {
+        uint32_t be = htonl(addr);
+        put(code, &be, 4);
+    }
+
+    void end() { options_[pos_++] = OPT_END; }
+
+private:
+    uint8_t* options_;
+    size_t pos_ = 0;
+};
+
+} // namespace
+
+DhcpClient::DhcpClient(EventLoop& loop, NetworkManager& network_mgr, const std::string& ifname,
+                       int ifindex, const uint8_t mac[6])
+    : loop_(loop), network_mgr_(network_mgr), ifname_(ifname), ifindex_(ifindex) {
+    memcpy(mac_, mac, sizeof(mac_));
+}
+
+DhcpClient::~DhcpClient() {
+    cancelTimer(retransmit_timer_);
+    cancelTimer(lease_timer_);
+    cancelTimer(acquire_timer_);
+    closeSocket();
+}
+
+void DhcpClient::openSocket() {
+    {
+        // Пакетный сокет привязывается к ifindex пространства имён, где он создан
+        NetnsScope netns(network_mgr_.getNetns());
+        sock_ = socket(AF_PACKET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, htons(ETH_P_IP));
+    }
+    if (sock_ == -1) {
+        throw std::system_error(errno, std::generic_category(), "Не удалось создать DHCP сокет");
+    }
+
+    struct sock_fprog prog = { sizeof(dhcp_filter) / sizeof(dhcp_filter[0]), dhcp_filter };
+    if (setsockopt(sock_, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == -1) {
+        int err = errno;
+        closeSocket();
+        throw std::system_error(err, std::generic_category(), "Не удалось установить фильтр DHCP сокета");
+    }
+
+    struct sockaddr_ll addr = {};
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_IP);
+    addr.sll_ifindex = ifindex_;
+    if (bind(sock_, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        int err = errno;
+        closeSocket();
+        throw std::system_error(err, std::generic_category(), "Не удалось привязать DHCP сокет");
+    }
+
+    loop_.add(sock_, EPOLLIN, [this](int fd, uint32_t events) { handlePacket(fd, events); });
+}
+
+void DhcpClient::closeSocket() {
+    if (sock_ != -1) {
+        loop_.remove(sock_);
+        close(sock_);
+        sock_ = -1;
+    }
+}
+
+void DhcpClient::cancelTimer(EventLoop::TimerId& id) {
+    if (id) {
+        loop_.cancelTimer(id);
+        id = 0;
+    }
+}
+
+void DhcpClient::start(ResultCallback on_result) {
+    on_result_ = std::move(on_result);
+    openSocket();
+
+    acquire_start_ = std::chrono::steady_clock::now();
+    acquire_timer_ = loop_.addTimer(ACQUIRE_TIMEOUT, [this]() {
+        acquire_timer_ = 0;
+        logWarning("DhcpClient(", ifname_, "): аренда не получена за ", ACQUIRE_TIMEOUT.count(), " с");
+        reportResult("error(dhcp timeout)");
+        stop();
+    });
+    enterInit();
+}
+
+void DhcpClient::stop() {
+    cancelTimer(retransmit_timer_);
+    cancelTimer(lease_timer_);
+    cancelTimer(acquire_timer_);
+
+    if (lease_applied_ && sock_ != -1) {
+        xid_ = randomXid();
+        transmit(DHCPRELEASE, lease_.address, lease_.server_id, false);
+    }
+    dropLease();
+    closeSocket();
+    state_ = State::Stopped;
+    reportResult("error(dhcp stopped)");
+}
+
+DhcpClient::Snapshot DhcpClient::snapshot() const {
+    Snapshot snapshot;
+    snapshot.ifname = ifname_;
+    snapshot.ifindex = ifindex_;
+    memcpy(snapshot.mac, mac_, sizeof(mac_));
+    snapshot.state = state_;
+    snapshot.xid = xid_;
+    snapshot.lease = lease_;
+    snapshot.lease_applied = lease_applied_;
+    snapshot.lease_start = lease_start_;
+    return snapshot;
+}
+
+void DhcpClient::resume(const Snapshot& snapshot) {
+    openSocket();
+    xid_ = snapshot.xid;
+    lease_ = snapshot.lease;
+    lease_applied_ = snapshot.lease_applied;
+    lease_start_ = snapshot.lease_start;
+    switch (snapshot.state) {
+        case State::Bound:
+        case State::Renewing:
+        case State::Rebinding:
+            state_ = snapshot.state;
+            logInfo("DhcpClient(", ifname_, "): аренда ", ipToString(lease_.address), "/",
+                    static_cast<int>(lease_.prefix_len), " принята от предыдущего процесса");
+            scheduleLeaseTimer();
+            break;
+        default:
+            enterInit();
+            break;
+    }
+}
+
+void DhcpClient::reportResult(const std::string& result) {
+    if (on_result_) {
+        auto callback = std::move(on_result_);
+        on_result_ = nullptr;
+        callback(result);
+    }
+}
+
+void DhcpClient::transmit(uint8_t msg_type, uint32_t ciaddr, uint32_t dst_ip, bool select_offer) {
+    DhcpFrame frame = {};
+    DhcpPacket& dhcp = frame.dhcp;
+    dhcp.op = 1; // BOOTREQUEST
+    dhcp.htype = 1; // Ethernet
+    dhcp.hlen = 6;
+    dhcp.xid = htonl(xid_);
+    auto elapsed = std::chrono::steady_clock::now() - acquire_start_;
+    dhcp.secs = htons(static_cast<uint16_t>(
+        std::min<long long>(std::chrono::duration_cast<std::chrono::seconds>(elapsed).count(), 0xffff)));
+    dhcp.ciaddr = htonl(ciaddr);
+    memcpy(dhcp.chaddr, mac_, sizeof(mac_));
+    dhcp.cookie = htonl(DHCP_MAGIC_COOKIE);
+
+    OptionWriter opts(dhcp.options);
+    opts.putU8(OPT_MESSAGE_TYPE, msg_type);
+    uint8_t client_id[7] = {1};
+    memcpy(client_id + 1, mac_, sizeof(mac_));
+    opts.put(OPT_CLIENT_ID, client_id, sizeof(client_id));
+    if (select_offer) {
+        opts.putAddr(OPT_REQUESTED_IP, offer_.address);
+        opts.putAddr(OPT_SERVER_ID, offer_.server_id);
+    }
+    if (msg_type == DHCPRELEASE) {
+        opts.putAddr(OPT_SERVER_ID, lease_.server_id);
+    } else {
+        const uint8_t params[] = {OPT_SUBNET_MASK, OPT_ROUTER, OPT_DNS, OPT_LEASE_TIME,
+                                  OPT_SERVER_ID, OPT_RENEW_TIME, OPT_REBIND_TIME};
+        opts.put(OPT_PARAM_REQUEST, params, sizeof(params));
+    }
+    opts.end();
+
+    // Полный размер BOOTP пакета (300 байт) - некоторые серверы отбрасывают более короткие
+    size_t dhcp_len = sizeof(DhcpPacket);
+    frame.udp.source = htons(DHCP_CLIENT_PORT);
+    frame.udp.dest = htons(DHCP_SERVER_PORT);
+    frame.udp.len = htons(static_cast<uint16_t>(sizeof(struct udphdr) + dhcp_len));
+    frame.ip.version = 4;
+    frame.ip.ihl = 5;
+    frame.ip.ttl = 64;
+    frame.ip.protocol = IPPROTO_UDP;
+    frame.ip.saddr = htonl(ciaddr);
+    frame.ip.daddr = htonl(dst_ip ? dst_ip : INADDR_BROADCAST);
+    frame.ip.tot_len = htons(static_cast<uint16_t>(sizeof(frame)));
+    frame.ip.check = ipChecksum(&frame.ip, sizeof(frame.ip));
+
+    struct sockaddr_ll addr = {};
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_IP);
+    addr.sll_ifindex = ifindex_;
+    addr.sll_halen = ETH_ALEN;
+    memset(addr.sll_addr, 0xff, ETH_ALEN);
+
+    if (sendto(sock_, &frame, sizeof(frame), 0, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        logError("DhcpClient(", ifname_, "): ошибка отправки: ", strerror(errno));
+    }
+}
+
+void DhcpClient::enterInit() {
+    cancelTimer(retransmit_timer_);
+    cancelTimer(lease_timer_);
+    state_ = State::Selecting;
+    attempt_ = 0;
+    xid_ = randomXid();
+    sendDiscover();
+}
+
+void DhcpClient::sendDiscover() {
+    transmit(DHCPDISCOVER, 0, 0, false);
+    // Экспоненциальная задержка 4, 8, 16, 32, 64 с (RFC 2131, 4.1)
+    auto delay = std::chrono::seconds(4u << std::min(attempt_++, 4u));
+    retransmit_timer_ = loop_.addTimer(delay, [this]() {
+        retransmit_timer_ = 0;
+        sendDiscover();
+    });
+}
+
+void DhcpClient::sendRequest() {
+    if (attempt_ >= MAX_REQUEST_ATTEMPTS) {
+        logWarning("DhcpClient(", ifname_, "): нет ответа на REQUEST, начинаем заново");
+        enterInit();
+        return;
+    }
+    transmit(DHCPREQUEST, 0, 0, true);
+    auto delay = std::chrono::seconds(4u << attempt_++);
+    retransmit_timer_ = loop_.addTimer(delay, [this]() {
+        retransmit_timer_ = 0;
+        sendRequest();
+    });
+}
+
+void DhcpClient::handlePacket(int fd, [[maybe_unused]] uint32_t events) {
+    uint8_t buffer[1500];
+    while (true) {
+        ssize_t len = recv(fd, buffer, sizeof(buffer), 0);
+        if (len <= 0) {
+            return;
+        }
+        if (static_cast<size_t>(len) < sizeof(struct iphdr)) {
+            continue;
+        }
+
+        // Пакетный сокет получает кадры до проверок IP стека: заголовки проверяем сами
+        const struct iphdr* ip = (const struct iphdr*)buffer;
+        size_t ip_len = ip->ihl * 4u;
+        if (ip->ihl < 5 || static_cast<size_t>(len) < ip_len + sizeof(struct udphdr) + DHCP_FIXED_LEN) {
+            continue;
+        }
+        const struct udphdr* udp = (const struct udphdr*)(buffer + ip_len);
+        size_t udp_len = ntohs(udp->len);
+        if (udp_len < sizeof(struct udphdr) || udp_len > len - ip_len) {
+            continue;
+        }
+        size_t dhcp_len = udp_len - sizeof(struct udphdr);
+        if (dhcp_len < DHCP_FIXED_LEN) {
+            continue;
+        }
+
+        DhcpPacket dhcp = {};
+        memcpy(&dhcp, udp + 1, std::min(dhcp_len, sizeof(dhcp)));
+        if (dhcp.op != 2 || ntohl(dhcp.xid) != xid_ || memcmp(dhcp.chaddr, mac_, sizeof(mac_)) != 0 ||
+            ntohl(dhcp.cookie) != DHCP_MAGIC_COOKIE) {
+            continue;
+        }
+
+        uint8_t msg_type = 0;
+        uint32_t mask = 0;
+        Lease lease;
+        lease.address = ntohl(dhcp.yiaddr);
+        lease.lease_time = DEFAULT_LEASE_TIME;
+        bool have_t1 = false;
+        bool have_t2 = false;
+
+        size_t opt_len = std::min(dhcp_len - DHCP_FIXED_LEN, sizeof(dhcp.options));
+        for (size_t i = 0; i < opt_len;) {
+            uint8_t code = dhcp.options[i++];
+            if (code == OPT_PAD) continue;
+            if (code == OPT_END || i >= opt_len) break;
+            uint8_t olen = dhcp.options[i++];
+            if (i + olen > opt_len) break;
+            const uint8_t* data = dhcp.options + i;
+            uint32_t value = 0;
+            if (olen >= 4) {
+                memcpy(&value, data, 4);
+                value = ntohl(value);
+            }
+            switch (code) {
+                case OPT_MESSAGE_TYPE: if (olen >= 1) msg_type = data[0]; break;
+                case OPT_SUBNET_MASK: if (olen >= 4) mask = value; break;
+                case OPT_ROUTER: if (olen >= 4) lease.router = value; break;
+                case OPT_SERVER_ID: if (olen >= 4) lease.server_id = value; break;
+                case OPT_LEASE_TIME: if (olen >= 4) lease.lease_time = value; break;
+                case OPT_RENEW_TIME: if (olen >= 4) { lease.renew_time = value; have_t1 = true; } break;
+                case OPT_REBIND_TIME: if (olen >= 4) { lease.rebind_time = value; have_t2 = true; } break;
+                default: break;
+            }
+            i += olen;
+        }
+
+        lease.prefix_len = mask ? maskToPrefix(mask) : 24;
+        if (lease.lease_time != INFINITE_LEASE) {
+            if (!have_t1) lease.renew_time = lease.lease_time / 2;
+            if (!have_t2) lease.rebind_time = static_cast<uint32_t>(lease.lease_time * 7ull / 8);
+        }
+
+        if (msg_type == DHCPOFFER && state_ == State::Selecting && lease.address) {
+            logInfo("DhcpClient(", ifname_, "): OFFER ", ipToString(lease.address), " от ",
+                    ipToString(lease.server_id));
+            cancelTimer(retransmit_timer_);
+            offer_ = lease;
+            state_ = State::Requesting;
+            attempt_ = 0;
+            sendRequest();
+        } else if (msg_type == DHCPACK && (state_ == State::Requesting || state_ == State::Renewing ||
+                                           state_ == State::Rebinding)) {
+            enterBound(lease);
+        } else if (msg_type == DHCPNAK && (state_ == State::Requesting || state_ == State::Renewing ||
+                                           state_ == State::Rebinding)) {
+            logWarning("DhcpClient(", ifname_, "): получен NAK");
+            dropLease();
+            enterInit();
+        }
+    }
+}
+
+void DhcpClient::enterBound(const Lease& lease) {
+    cancelTimer(retransmit_timer_);
+    cancelTimer(lease_timer_);
+
+    if (lease_applied_ && (lease_.address != lease.address || lease_.prefix_len != lease.prefix_len ||
+                           lease_.router != lease.router)) {
+        dropLease();
+    }
+    lease_ = lease;
+    if (!lease_.server_id) {
+        lease_.server_id = offer_.server_id;
+    }
+    lease_start_ = std::chrono::steady_clock::now();
+    state_ = State::Bound;
+
+    logInfo("DhcpClient(", ifname_, "): ACK ", ipToString(lease_.address), "/", static_cast<int>(lease_.prefix_len),
+            " шлюз ", ipToString(lease_.router), " аренда ", lease_.lease_time, " с");
+
+    if (!network_mgr_.applyDhcpLease(ifindex_, lease_.address, lease_.prefix_len, lease_.router,
+                                     lease_.lease_time)) {
+        // Ошибка назначения здесь, а не конфликт адреса в сети: DHCPDECLINE не нужен.
+        // Снимаем то, что осталось от прежней аренды, и начинаем заново после паузы.
+        dropLease();
+        state_ = State::Init;
+        retransmit_timer_ = loop_.addTimer(RESTART_DELAY, [this]() {
+            retransmit_timer_ = 0;
+            enterInit();
+        });
+        return;
+    }
+    lease_applied_ = true;
+
+    cancelTimer(acquire_timer_);
+    reportResult(network_mgr_.getInterfaceInfo(ifname_));
+    scheduleLeaseTimer();
+}
+
+uint32_t DhcpClient::secondsSinceLeaseStart() const {
+    auto elapsed = std::chrono::steady_clock::now() - lease_start_;
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(elapsed).count());
+}
+
+void DhcpClient::scheduleLeaseTimer() {
+    if (lease_.lease_time == INFINITE_LEASE) {
+        return;
+    }
+
+    uint32_t elapsed = secondsSinceLeaseStart();
+    uint32_t deadline;
+    switch (state_) {
+        case State::Bound:
+            deadline = lease_.renew_time;
+            break;
+        case State::Renewing:
+            // Повторы в RENEWING: половина оставшегося до T2, но не чаще раза в минуту
+            deadline = std::min(lease_.rebind_time,
+                                elapsed + std::max(MIN_RENEW_RETRY, (lease_.rebind_time - elapsed) / 2));
+            break;
+        case State::Rebinding:
+            deadline = std::min(lease_.lease_time,
+                                elapsed + std::max(MIN_RENEW_RETRY, (lease_.lease_time - elapsed) / 2));
+            break;
+        default:
+            return;
+    }
+
+    uint32_t delay = deadline > elapsed ? deadline - elapsed : 0;
+    lease_timer_ = loop_.addTimer(std::chrono::seconds(delay), [this]() {
+        lease_timer_ = 0;
+        onLeaseTimer();
+    });
+}
+
+void DhcpClient::onLeaseTimer() {
+    uint32_t elapsed = secondsSinceLeaseStart();
+    if (elapsed >= lease_.lease_time) {
+        logWarning("DhcpClient(", ifname_, "): аренда истекла");
+        dropLease();
+        enterInit();
+        return;
+    }
+
+    if (elapsed >= lease_.rebind_time) {
+        if (state_ != State::Rebinding) {
+            xid_ = randomXid();
+        }
+        state_ = State::Rebinding;
+        transmit(DHCPREQUEST, lease_.address, 0, false);
+    } else {
+        if (state_ != State::Renewing) {
+            xid_ = randomXid();
+        }
+        state_ = State::Renewing;
+        transmit(DHCPREQUEST, lease_.address, lease_.server_id, false);
+    }
+    scheduleLeaseTimer();
+}
+
+void DhcpClient::dropLease() {
+    if (lease_applied_) {
+        network_mgr_.removeDhcpLease(ifindex_, lease_.address, lease_.prefix_len, lease_.router);
+        lease_applied_ = false;
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef DHCP_CLIENT_H
+#define DHCP_CLIENT_H
+
+#include "event_loop.h"
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+class NetworkManager;
+
+// Встроенный DHCPv4 клиент (RFC 2131) для одного интерфейса.
+// Пакеты отправляются и принимаются через AF_PACKET сокет (адреса на интерфейсе
+// ещё нет), таймеры повторов и продления аренды живут в EventLoop, а полученная
+// аренда применяется через netlink методами NetworkManager.
+class DhcpClient {
+public:
+    enum class State { Init, Selecting, Requesting, Bound, Renewing, Rebinding, Stopped };
+
+    struct Lease {
+        uint32_t address = 0;     // Адреса в порядке байт хоста
+        uint8_t prefix_len = 0;
+        uint32_t router = 0;
+        uint32_t server_id = 0;
+        uint32_t lease_time = 0;  // Секунды; 0xffffffff - бессрочно
+        uint32_t renew_time = 0;  // T1
+        uint32_t rebind_time = 0; // T2
+    };
+
+    // Состояние клиента для передачи новому процессу демона (см. handoff.h)
+    struct Snapshot {
+        std::string ifname;
+        int ifindex = 0;
+        uint8_t mac[6] = {};
+        State state = State::Init;
+        uint32_t xid = 0;
+        Lease lease;
+        bool lease_applied = false;
+        std::chrono::steady_clock::time_point lease_start;
+    };
+
+    using ResultCallback = std::function<void(const std::string&)>;
+
+    DhcpClient(EventLoop& loop, NetworkManager& network_mgr, const std::string& ifname,
+               int ifindex, const uint8_t mac[6]);
+    ~DhcpClient();
+
+    DhcpClient(const DhcpClient&) = delete;
+    DhcpClient& operator=(const DhcpClient&) = delete;
+
+    // Начинает получение аренды. on_result вызывается один раз: после первого ACK
+    // (информация об интерфейсе) или с ошибкой по таймауту начального получения
+    void start(ResultCallback on_result);
+    // Отправляет DHCPRELEASE, снимает адрес и маршрут аренды
+    void stop();
+
+    Snapshot snapshot() const;
+    // Вместо start(): продолжает работу клиента другого процесса. Аренда уже
+    // на интерфейсе, таймеры продления отсчитываются от её прежнего начала.
+    // Не закончившееся получение аренды начинается заново.
+    void resume(const Snapshot& snapshot);
+
+    State state() const { return state_; }
+    const Lease& lease() const { return lease_; }
+    const std::string& ifname() const { return ifname_; }
+
+private:
+    EventLoop& loop_;
+    NetworkManager& network_mgr_;
+    std::string ifname_;
+    int ifindex_;
+    uint8_t mac_[6];
+
+    int sock_ = -1;
+    State state_ = State::Init;
+    uint32_t xid_ = 0;
+    unsigned attempt_ = 0;
+    Lease offer_;
+    Lease lease_;
+    bool lease_applied_ = false;
+    std::chrono::steady_clock::time_point acquire_start_;
+    std::chrono::steady_clock::time_point lease_start_;
+    EventLoop::TimerId retransmit_timer_ = 0;
+    EventLoop::TimerId lease_timer_ = 0;
+    EventLoop::TimerId acquire_timer_ = 0;
+    ResultCallback on_result_;
+
+    void openSocket();
+    void closeSocket();
+    void handlePacket(int fd, uint32_t events);
+    void transmit(uint8_t msg_type, uint32_t ciaddr, uint32_t dst_ip, bool select_offer);
+
+    void enterInit();
+    void sendDiscover();
+    void sendRequest();
+    void enterBound(const Lease& lease);
+    void scheduleLeaseTimer();
+    void onLeaseTimer();
+    void dropLease();
+
+    uint32_t secondsSinceLeaseStart() const;
+    void reportResult(const std::string& result);
+    void cancelTimer(EventLoop::TimerId& id);
+};
+
+#endif // DHCP_CLIENT_H
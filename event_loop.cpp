@@ -1,19 +1,44 @@
 #include "event_loop.h"
-#include <iostream>
+#include "logger.h"
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
 
 EventLoop::EventLoop() {
     base_ = event_base_new();
     if (!base_) {
         throw std::runtime_error("Не удалось создать event_base");
     }
+
+    wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeup_fd_ == -1) {
+        event_base_free(base_);
+        throw std::runtime_error("Не удалось создать eventfd");
+    }
+    add(wakeup_fd_, EPOLLIN, [this](int, uint32_t) { runPosted(); });
 }
 
 EventLoop::~EventLoop() {
+    for (auto& [id, timer] : timers_) {
+        event_free(timer->ev);
+    }
+    if (sigchld_event_) {
+        event_free(sigchld_event_);
+    }
     for (auto& [fd, ev] : events_) {
         event_free(ev);
     }
     event_base_free(base_);
+    close(wakeup_fd_);
 }
 
 void EventLoop::add(int fd, uint32_t events, std::function<void(int, uint32_t)> handler) {
@@ -45,6 +70,146 @@ void EventLoop::remove(int fd) {
     }
 }
 
+void EventLoop::modify(int fd, uint32_t events) {
+    auto it = events_.find(fd);
+    if (it == events_.end()) {
+        return;
+    }
+    short libevent_flags = EV_PERSIST;
+    if (events & EPOLLIN) libevent_flags |= EV_READ;
+    if (events & EPOLLOUT) libevent_flags |= EV_WRITE;
+
+    struct event* ev = event_new(base_, fd, libevent_flags, event_callback, this);
+    if (!ev || event_add(ev, nullptr) == -1) {
+        if (ev) event_free(ev);
+        throw std::runtime_error("Не удалось изменить событие");
+    }
+    event_free(it->second);
+    it->second = ev;
+}
+
+void EventLoop::watchChild(pid_t pid, std::function<void(pid_t, int)> on_exit) {
+    int pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+    if (pidfd >= 0) {
+        add(pidfd, EPOLLIN, [this, pid, on_exit](int fd, uint32_t) {
+            int status = 0;
+            pid_t reaped = waitpid(pid, &status, WNOHANG);
+            if (reaped == 0) {
+                return;
+            }
+            if (reaped < 0) {
+                status = -1; // Статус уже забран кем-то другим
+            }
+            // remove() уничтожает этот обработчик вместе с захваченными значениями,
+            // поэтому всё нужное после него копируем заранее
+            pid_t exited = pid;
+            auto callback = on_exit;
+            remove(fd);
+            close(fd);
+            callback(exited, status);
+        });
+        return;
+    }
+
+    // Ядро без pidfd_open (< 5.3): ждём SIGCHLD и проверяем отслеживаемые процессы
+    logWarning("EventLoop: pidfd_open недоступен (", strerror(errno), "), используется SIGCHLD");
+    if (!sigchld_event_) {
+        sigchld_event_ = evsignal_new(base_, SIGCHLD, sigchld_callback, this);
+        if (!sigchld_event_ || event_add(sigchld_event_, nullptr) == -1) {
+            throw std::runtime_error("Не удалось подписаться на SIGCHLD");
+        }
+    }
+    child_watchers_[pid] = on_exit;
+    reapWatchedChildren(); // Процесс мог завершиться до подписки
+}
+
+EventLoop::TimerId EventLoop::addTimer(std::chrono::milliseconds delay, std::function<void()> callback) {
+    auto timer = std::make_unique<Timer>();
+    timer->loop = this;
+    timer->id = next_timer_id_++;
+    timer->callback = std::move(callback);
+    timer->ev = evtimer_new(base_, timer_callback, timer.get());
+    if (!timer->ev) {
+        throw std::runtime_error("Не удалось создать таймер");
+    }
+
+    struct timeval tv;
+    tv.tv_sec = delay.count() / 1000;
+    tv.tv_usec = (delay.count() % 1000) * 1000;
+    if (evtimer_add(timer->ev, &tv) == -1) {
+        event_free(timer->ev);
+        throw std::runtime_error("Не удалось запустить таймер");
+    }
+
+    TimerId id = timer->id;
+    timers_[id] = std::move(timer);
+    return id;
+}
+
+void EventLoop::cancelTimer(TimerId id) {
+    auto it = timers_.find(id);
+    if (it != timers_.end()) {
+        event_free(it->second->ev);
+        timers_.erase(it);
+    }
+}
+
+void EventLoop::timer_callback(evutil_socket_t, short, void* arg) {
+    Timer* timer = static_cast<Timer*>(arg);
+    EventLoop* loop = timer->loop;
+    auto callback = std::move(timer->callback);
+    loop->cancelTimer(timer->id);
+    callback();
+}
+
+void EventLoop::sigchld_callback(evutil_socket_t, short, void* arg) {
+    static_cast<EventLoop*>(arg)->reapWatchedChildren();
+}
+
+void EventLoop::reapWatchedChildren() {
+    for (auto it = child_watchers_.begin(); it != child_watchers_.end();) {
+        int status = 0;
+        pid_t pid = it->first;
+        pid_t reaped = waitpid(pid, &status, WNOHANG);
+        if (reaped != 0) {
+            if (reaped < 0) {
+                status = -1;
+            }
+            auto callback = std::move(it->second);
+            it = child_watchers_.erase(it);
+            callback(pid, status);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void EventLoop::post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(posted_mutex_);
+        posted_.push_back(std::move(task));
+    }
+    uint64_t one = 1;
+    if (write(wakeup_fd_, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        logError("EventLoop: не удалось разбудить цикл: ", strerror(errno));
+    }
+}
+
+void EventLoop::runPosted() {
+    uint64_t count;
+    while (read(wakeup_fd_, &count, sizeof(count)) > 0) {
+    }
+
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(posted_mutex_);
+        tasks.swap(posted_);
+    }
+    for (auto& task : tasks) {
+        task();
+    }
+}
+
 void EventLoop::run() {
     running_ = true;
     if (event_base_dispatch(base_) == -1) {
@@ -2,12 +2,20 @@
 #define EVENT_LOOP_H
 
 #include <event2/event.h>
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
+#include <vector>
+#include <sys/types.h>
 
 class EventLoop {
 public:
+    using TimerId = uint64_t;
+
     EventLoop();
     ~EventLoop();
 
@@ -17,6 +25,20 @@ public:
     // Удаляет дескриптор из цикла событий
     void remove(int fd);
 
+    // Меняет набор ожидаемых событий дескриптора (обработчик прежний); можно вызывать из него самого
+    void modify(int fd, uint32_t events);
+
+    // Следит за завершением дочернего процесса через pidfd (или SIGCHLD на старых ядрах),
+    // забирает его статус и вызывает on_exit(pid, status) в потоке цикла
+    void watchChild(pid_t pid, std::function<void(pid_t, int)> on_exit);
+
+    // Однократный таймер; колбэк вызывается в потоке цикла. Возвращает id для отмены
+    TimerId addTimer(std::chrono::milliseconds delay, std::function<void()> callback);
+    void cancelTimer(TimerId id);
+
+    // Потокобезопасно ставит задачу в очередь; она выполнится в потоке цикла
+    void post(std::function<void()> task);
+
     // Запускает цикл событий
     void run();
 
@@ -30,10 +52,29 @@ private:
     struct event_base* base_; // Основной объект libevent
     std::map<int, struct event*> events_; // Хранилище событий
     std::map<int, std::function<void(int, uint32_t)>> handlers_; // Хранилище обработчиков
+    std::map<pid_t, std::function<void(pid_t, int)>> child_watchers_; // Без pidfd
+    struct event* sigchld_event_ = nullptr;
+
+    struct Timer {
+        EventLoop* loop;
+        TimerId id;
+        struct event* ev;
+        std::function<void()> callback;
+    };
+    std::map<TimerId, std::unique_ptr<Timer>> timers_;
+    TimerId next_timer_id_ = 1;
     bool running_ = true;
 
+    int wakeup_fd_ = -1; // eventfd: пробуждает цикл при post() из других потоков
+    std::mutex posted_mutex_;
+    std::vector<std::function<void()>> posted_;
+
     // Колбэк для обработки событий
     static void event_callback(evutil_socket_t fd, short events, void* arg);
+    static void timer_callback(evutil_socket_t fd, short events, void* arg);
+    static void sigchld_callback(evutil_socket_t sig, short events, void* arg);
+    void reapWatchedChildren();
+    void runPosted();
 };
 
 #endif // EVENT_LOOP_H
\ No newline at end of file
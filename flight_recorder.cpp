@@ -0,0 +1,133 @@
+#include "flight_recorder.h"
+#include <algorithm>
+#include <cstdio>
+#include <utility>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+FlightRecorder& FlightRecorder::instance() {
+    static FlightRecorder recorder;
+    return recorder;
+}
+
+FlightRecorder::Ring& FlightRecorder::threadRing() {
+    thread_local Ring* ring = nullptr;
+    if (!ring) {
+        auto created = std::make_unique<Ring>();
+        created->tid = static_cast<int>(syscall(SYS_gettid));
+        for (Entry& entry : created->entries) {
+            entry.name.store(nullptr, std::memory_order_relaxed);
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        ring = created.get();
+        rings_.push_back(std::move(created));
+    }
+    return *ring;
+}
+
+void FlightRecorder::record(const char* name, TraceCategory category, uint64_t start, uint64_t end,
+                            uint32_t arg) {
+    Ring& ring = threadRing();
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    Entry& entry = ring.entries[head % RING_SIZE];
+    // Как в seqlock: читатель, увидевший claimed, знает, что запись head - RING_SIZE затирается
+    ring.claimed.store(head + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    entry.name.store(name, std::memory_order_relaxed);
+    entry.start.store(start, std::memory_order_relaxed);
+    entry.duration.store(end - start, std::memory_order_relaxed);
+    entry.arg.store(static_cast<uint64_t>(category) << 56 | arg, std::memory_order_relaxed);
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+namespace {
+
+struct DumpedSpan {
+    const char* name;
+    uint64_t start;
+    uint64_t duration;
+    uint64_t arg;
+    int tid;
+};
+
+const char* categoryName(TraceCategory category) {
+    switch (category) {
+        case TraceCategory::Command: return "command";
+        case TraceCategory::Event: return "event";
+        case TraceCategory::Netlink: return "netlink";
+    }
+    return "?";
+}
+
+const char* argName(TraceCategory category) {
+    switch (category) {
+        case TraceCategory::Command: return "fd";
+        case TraceCategory::Event: return "msg_type";
+        case TraceCategory::Netlink: return "messages";
+    }
+    return "arg";
+}
+
+} // namespace
+
+std::string FlightRecorder::dumpChromeTrace(uint32_t seconds) {
+    uint64_t now_ns = now();
+    uint64_t since = now_ns > uint64_t(seconds) * 1000000000u ? now_ns - uint64_t(seconds) * 1000000000u : 0;
+
+    std::vector<DumpedSpan> spans;
+    std::vector<Ring*> rings;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& ring : rings_) {
+            rings.push_back(ring.get());
+        }
+    }
+    for (Ring* ring : rings) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = head > RING_SIZE ? head - RING_SIZE : 0;
+        std::vector<std::pair<uint64_t, DumpedSpan>> copied;
+        for (uint64_t i = first; i < head; ++i) {
+            const Entry& entry = ring->entries[i % RING_SIZE];
+            DumpedSpan span{entry.name.load(std::memory_order_relaxed), entry.start.load(std::memory_order_relaxed),
+                            entry.duration.load(std::memory_order_relaxed), entry.arg.load(std::memory_order_relaxed),
+                            ring->tid};
+            copied.emplace_back(i, span);
+        }
+        // Записи, которые владелец мог начать затирать, пока мы читали, отбрасываем
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t claimed = ring->claimed.load(std::memory_order_relaxed);
+        uint64_t valid_from = claimed > RING_SIZE ? claimed - RING_SIZE : 0;
+        for (const auto& [index, span] : copied) {
+            if (index >= valid_from && span.name && span.start >= since) {
+                spans.push_back(span);
+            }
+        }
+    }
+    std::sort(spans.begin(), spans.end(),
+              [](const DumpedSpan& a, const DumpedSpan& b) { return a.start < b.start; });
+
+    std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    char buffer[256];
+    int pid = static_cast<int>(getpid());
+    int len = snprintf(buffer, sizeof(buffer),
+                       "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"network_daemon\"}}",
+                       pid);
+    json.append(buffer, len);
+    for (const DumpedSpan& span : spans) {
+        auto category = static_cast<TraceCategory>(span.arg >> 56);
+        auto arg = static_cast<unsigned>(span.arg & 0xffffffffu);
+        len = snprintf(buffer, sizeof(buffer),
+                       ",{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%llu.%03u,\"dur\":%llu.%03u,"
+                       "\"pid\":%d,\"tid\":%d,\"args\":{",
+                       span.name, categoryName(category), static_cast<unsigned long long>(span.start / 1000),
+                       static_cast<unsigned>(span.start % 1000), static_cast<unsigned long long>(span.duration / 1000),
+                       static_cast<unsigned>(span.duration % 1000), pid, span.tid);
+        json.append(buffer, std::min<size_t>(len, sizeof(buffer) - 1));
+        if (arg) {
+            json.append("\"").append(argName(category)).append("\":").append(std::to_string(arg));
+        }
+        json += "}}";
+    }
+    json += "]}";
+    return json;
+}
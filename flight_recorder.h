@@ -0,0 +1,81 @@
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Категория отрезка: у команд аргумент - fd клиента, у событий - тип
+// сообщения netlink, у запросов к ядру - число сообщений (0 - без аргумента)
+enum class TraceCategory : uint8_t { Command, Event, Netlink };
+
+// Постоянно включённый бортовой самописец: каждый поток пишет отрезки
+// (имя, начало, длительность) в своё кольцо фиксированного размера без
+// блокировок и выделения памяти; старые записи затираются новыми.
+// Имена отрезков - строковые литералы (хранится только указатель).
+class FlightRecorder {
+public:
+    static FlightRecorder& instance();
+
+    FlightRecorder(const FlightRecorder&) = delete;
+    FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+    // Время отрезков - steady_clock (CLOCK_MONOTONIC) в наносекундах
+    static uint64_t now() { return traceTime(std::chrono::steady_clock::now()); }
+    static uint64_t traceTime(std::chrono::steady_clock::time_point time) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    }
+
+    void record(const char* name, TraceCategory category, uint64_t start, uint64_t end, uint32_t arg);
+
+    // Отрезки всех потоков, начавшиеся не раньше seconds секунд назад,
+    // в формате Chrome trace event (JSON, открывается в chrome://tracing и Perfetto)
+    std::string dumpChromeTrace(uint32_t seconds);
+
+    static constexpr size_t RING_SIZE = 16384; // Записей на поток
+
+private:
+    // Поля атомарны: кольцо читается, пока поток-владелец пишет в него
+    struct Entry {
+        std::atomic<const char*> name;
+        std::atomic<uint64_t> start;
+        std::atomic<uint64_t> duration;
+        std::atomic<uint64_t> arg; // Категория в старших 8 битах
+    };
+    struct Ring {
+        int tid;
+        std::atomic<uint64_t> claimed{0}; // Записей, начатых владельцем
+        std::atomic<uint64_t> head{0};    // Записей, законченных владельцем
+        Entry entries[RING_SIZE];
+    };
+
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Ring>> rings_; // Кольца живут до конца процесса
+
+    FlightRecorder() = default;
+    Ring& threadRing();
+};
+
+// Отрезок от создания до разрушения объекта
+class TraceSpan {
+public:
+    TraceSpan(const char* name, TraceCategory category, uint32_t arg = 0)
+        : name_(name), category_(category), arg_(arg), start_(FlightRecorder::now()) {}
+    ~TraceSpan() { FlightRecorder::instance().record(name_, category_, start_, FlightRecorder::now(), arg_); }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name_;
+    TraceCategory category_;
+    uint32_t arg_;
+    uint64_t start_;
+};
+
+#endif // FLIGHT_RECORDER_H
@@ -0,0 +1,391 @@
+#include "handoff.h"
+#include "logger.h"
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace {
+
+constexpr char MAGIC[8] = {'N', 'D', 'H', 'O', 'F', 'F', '0', '1'};
+constexpr char ACK = 'A';
+// Ответ старого процесса на ACK: он больше не обслуживает сокеты. Без него новый
+// процесс не знает, не отказался ли старый от передачи по таймауту до прихода ACK.
+constexpr char COMMIT = 'C';
+// Ядро принимает не больше SCM_MAX_FD (253) fd в одном сообщении
+constexpr size_t MAX_FDS_PER_MESSAGE = 250;
+// Сокеты, идущие перед клиентами: команды, метрики, netlink
+constexpr size_t SERVICE_FDS = 3;
+
+// Поток передачи: заголовок, затем сообщения по одному байту с fd в SCM_RIGHTS
+// (listen, metrics, netlink, клиенты по порядку), затем состояние (payload).
+// Процессы - одна машина и обычно одна сборка, числа пишутся как есть.
+struct Header {
+    char magic[8];
+    uint32_t fd_count;
+    uint32_t payload_size;
+};
+
+template <typename T>
+void put(std::string& out, const T& value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void putString(std::string& out, std::string_view value) {
+    put<uint32_t>(out, static_cast<uint32_t>(value.size()));
+    out.append(value);
+}
+
+class PayloadReader {
+public:
+    explicit PayloadReader(std::string_view data) : data_(data) {}
+
+    template <typename T>
+    void get(T& value) {
+        need(sizeof(value));
+        memcpy(&value, data_.data() + pos_, sizeof(value));
+        pos_ += sizeof(value);
+    }
+
+    void getString(std::string& value) {
+        uint32_t size;
+        get(size);
+        need(size);
+        value.assign(data_.substr(pos_, size));
+        pos_ += size;
+    }
+
+private:
+    std::string_view data_;
+    size_t pos_ = 0;
+
+    void need(size_t size) const {
+        if (data_.size() - pos_ < size) {
+            throw std::runtime_error("Повреждённое состояние передачи");
+        }
+    }
+};
+
+std::string encodeState(const HandoffState& state) {
+    std::string out;
+    put<uint32_t>(out, static_cast<uint32_t>(state.clients.size()));
+    for (const HandoffState::Client& client : state.clients) {
+        put<int32_t>(out, client.serializer);
+        putString(out, client.output);
+    }
+    put<uint32_t>(out, static_cast<uint32_t>(state.dhcp.size()));
+    for (const DhcpClient::Snapshot& dhcp : state.dhcp) {
+        putString(out, dhcp.ifname);
+        put<int32_t>(out, dhcp.ifindex);
+        out.append(reinterpret_cast<const char*>(dhcp.mac), sizeof(dhcp.mac));
+        put<uint8_t>(out, static_cast<uint8_t>(dhcp.state));
+        put<uint8_t>(out, dhcp.lease_applied);
+        put<uint32_t>(out, dhcp.xid);
+        put(out, dhcp.lease);
+        // steady_clock - CLOCK_MONOTONIC, общий для всех процессов машины
+        put<int64_t>(out, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              dhcp.lease_start.time_since_epoch()).count());
+    }
+    return out;
+}
+
+void decodeState(std::string_view payload, HandoffState& state) {
+    PayloadReader reader(payload);
+    uint32_t count;
+    reader.get(count);
+    state.clients.resize(count);
+    for (HandoffState::Client& client : state.clients) {
+        int32_t serializer;
+        reader.get(serializer);
+        client.serializer = serializer;
+        reader.getString(client.output);
+    }
+    reader.get(count);
+    state.dhcp.resize(count);
+    for (DhcpClient::Snapshot& dhcp : state.dhcp) {
+        reader.getString(dhcp.ifname);
+        int32_t ifindex;
+        reader.get(ifindex);
+        dhcp.ifindex = ifindex;
+        reader.get(dhcp.mac);
+        uint8_t value;
+        reader.get(value);
+        dhcp.state = static_cast<DhcpClient::State>(value);
+        reader.get(value);
+        dhcp.lease_applied = value != 0;
+        reader.get(dhcp.xid);
+        reader.get(dhcp.lease);
+        int64_t lease_start;
+        reader.get(lease_start);
+        dhcp.lease_start = std::chrono::steady_clock::time_point(std::chrono::nanoseconds(lease_start));
+    }
+}
+
+int remainingMs(std::chrono::steady_clock::time_point deadline) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+    return left.count() > 0 ? static_cast<int>(left.count()) : 0;
+}
+
+// Сокет клиента в старом процессе неблокирующий: при заполненном буфере ждём готовности
+bool sendAll(int sock, const char* data, size_t size, const int* fds, size_t fd_count,
+             std::chrono::steady_clock::time_point deadline, std::string& error) {
+    char control[CMSG_SPACE(MAX_FDS_PER_MESSAGE * sizeof(int))] = {};
+    while (size > 0) {
+        struct iovec iov = {const_cast<char*>(data), size};
+        struct msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        if (fd_count > 0) {
+            msg.msg_control = control;
+            msg.msg_controllen = CMSG_SPACE(fd_count * sizeof(int));
+            struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(fd_count * sizeof(int));
+            memcpy(CMSG_DATA(cmsg), fds, fd_count * sizeof(int));
+        }
+
+        ssize_t sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                error = strerror(errno);
+                return false;
+            }
+            struct pollfd pfd = {sock, POLLOUT, 0};
+            if (poll(&pfd, 1, remainingMs(deadline)) <= 0) {
+                error = "timeout";
+                return false;
+            }
+            continue;
+        }
+        // fd уходят вместе с первым байтом
+        data += sent;
+        size -= static_cast<size_t>(sent);
+        fd_count = 0;
+    }
+    return true;
+}
+
+bool waitAck(int sock, std::chrono::steady_clock::time_point deadline, std::string& error) {
+    while (true) {
+        char ack;
+        ssize_t len = recv(sock, &ack, 1, 0);
+        if (len == 1) {
+            if (ack != ACK) {
+                error = "unexpected reply";
+                return false;
+            }
+            return true;
+        }
+        if (len == 0) {
+            error = "new process closed the connection";
+            return false;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            error = strerror(errno);
+            return false;
+        }
+        struct pollfd pfd = {sock, POLLIN, 0};
+        if (poll(&pfd, 1, remainingMs(deadline)) <= 0) {
+            error = "no confirmation from new process";
+            return false;
+        }
+    }
+}
+
+void receiveAll(int sock, char* data, size_t size) {
+    while (size > 0) {
+        ssize_t len = recv(sock, data, size, 0);
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len <= 0) {
+            throw std::runtime_error(len == 0 ? "Демон закрыл соединение передачи"
+                                              : std::string("Ошибка чтения передачи: ") + strerror(errno));
+        }
+        data += len;
+        size -= static_cast<size_t>(len);
+    }
+}
+
+// Одно выражение верхнего уровня, первая '(' уже прочитана. Читаем по байту:
+// следом за выражением может идти заголовок передачи.
+std::string readExpression(int sock) {
+    std::string expression = "(";
+    int depth = 1;
+    while (depth > 0) {
+        char c;
+        receiveAll(sock, &c, 1);
+        depth += c == '(' ? 1 : c == ')' ? -1 : 0;
+        expression += c;
+    }
+    return expression;
+}
+
+} // namespace
+
+bool sendHandoff(int sock, const HandoffState& state, std::string& error) {
+    std::vector<int> fds = {state.listen_fd, state.metrics_fd, state.netlink_fd};
+    for (const HandoffState::Client& client : state.clients) {
+        fds.push_back(client.fd);
+    }
+    std::string payload = encodeState(state);
+
+    Header header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.fd_count = static_cast<uint32_t>(fds.size());
+    header.payload_size = static_cast<uint32_t>(payload.size());
+
+    auto deadline = std::chrono::steady_clock::now() + HANDOFF_TIMEOUT;
+    if (!sendAll(sock, reinterpret_cast<const char*>(&header), sizeof(header), nullptr, 0, deadline, error)) {
+        return false;
+    }
+    for (size_t i = 0; i < fds.size(); i += MAX_FDS_PER_MESSAGE) {
+        char byte = 0;
+        size_t count = std::min(MAX_FDS_PER_MESSAGE, fds.size() - i);
+        if (!sendAll(sock, &byte, 1, fds.data() + i, count, deadline, error)) {
+            return false;
+        }
+    }
+    return sendAll(sock, payload.data(), payload.size(), nullptr, 0, deadline, error) &&
+           waitAck(sock, deadline, error) && sendAll(sock, &COMMIT, 1, nullptr, 0, deadline, error);
+}
+
+HandoffState requestHandoff(const std::string& socket_path) {
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1) {
+        throw std::system_error(errno, std::generic_category(), "Не удалось создать сокет передачи");
+    }
+    HandoffState state;
+    std::vector<int> fds;
+    try {
+        struct sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+        if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            throw std::system_error(errno, std::generic_category(), "Не удалось подключиться к работающему демону");
+        }
+        struct timeval timeout = {static_cast<time_t>(HANDOFF_TIMEOUT.count()), 0};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        std::string_view request = "(handoff)";
+        if (send(sock, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size())) {
+            throw std::system_error(errno, std::generic_category(), "Не удалось запросить передачу");
+        }
+
+        // Пока (handoff) не обработан, соединение - обычный текстовый клиент и получает
+        // события: пропускаем их до отказа (handoff(error(...))) или заголовка передачи
+        Header header;
+        char* raw = reinterpret_cast<char*>(&header);
+        while (true) {
+            receiveAll(sock, raw, 1);
+            if (raw[0] == '(') {
+                std::string expression = readExpression(sock);
+                if (expression.compare(0, 9, "(handoff(") == 0) {
+                    throw std::runtime_error("Демон отказал в передаче: " + expression);
+                }
+            } else if (!isspace(static_cast<unsigned char>(raw[0]))) {
+                break;
+            }
+        }
+        receiveAll(sock, raw + 1, sizeof(header) - 1);
+        if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.fd_count < SERVICE_FDS) {
+            throw std::runtime_error("Неизвестный формат передачи");
+        }
+
+        while (fds.size() < header.fd_count) {
+            char byte;
+            char control[CMSG_SPACE(MAX_FDS_PER_MESSAGE * sizeof(int))];
+            struct iovec iov = {&byte, 1};
+            struct msghdr msg = {};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            ssize_t len = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+            if (len < 0 && errno == EINTR) {
+                continue;
+            }
+            if (len != 1) {
+                throw std::runtime_error("Обрыв передачи сокетов");
+            }
+            size_t before = fds.size();
+            for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                    size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                    for (size_t i = 0; i < count; ++i) {
+                        int fd;
+                        memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                        fds.push_back(fd);
+                    }
+                }
+            }
+            if (fds.size() == before || (msg.msg_flags & MSG_CTRUNC)) {
+                throw std::runtime_error("Сокеты не переданы (ограничение числа открытых файлов?)");
+            }
+        }
+
+        std::string payload(header.payload_size, '\0');
+        receiveAll(sock, payload.data(), payload.size());
+        decodeState(payload, state);
+        if (fds.size() != SERVICE_FDS + state.clients.size()) {
+            throw std::runtime_error("Число сокетов не совпадает с состоянием передачи");
+        }
+    } catch (...) {
+        for (int fd : fds) {
+            close(fd);
+        }
+        close(sock);
+        throw;
+    }
+
+    state.listen_fd = fds[0];
+    state.metrics_fd = fds[1];
+    state.netlink_fd = fds[2];
+    for (size_t i = 0; i < state.clients.size(); ++i) {
+        state.clients[i].fd = fds[SERVICE_FDS + i];
+    }
+    state.connection = sock;
+    logInfo("Handoff: получено ", state.clients.size(), " клиентов и ", state.dhcp.size(), " DHCP аренд");
+    return state;
+}
+
+void confirmHandoff(HandoffState& state) {
+    // Без подтверждения старый процесс продолжит работу сам: новому работать нельзя.
+    // Опоздавший ACK старый процесс не примет - он закрывает соединение (или уже
+    // отправил в него ответ с ошибкой), и вместо COMMIT приходит EOF или '('.
+    int sock = state.connection;
+    state.connection = -1;
+    bool sent = send(sock, &ACK, 1, MSG_NOSIGNAL) == 1;
+    int err = errno;
+    char reply = 0;
+    while (sent && recv(sock, &reply, 1, 0) < 0 && errno == EINTR) {
+    }
+    close(sock);
+    if (!sent) {
+        throw std::system_error(err, std::generic_category(), "Не удалось подтвердить передачу");
+    }
+    if (reply != COMMIT) {
+        throw std::runtime_error("Работающий демон отменил передачу");
+    }
+}
+
+void abandonHandoff(HandoffState& state) {
+    if (state.connection != -1) {
+        close(state.connection);
+        state.connection = -1;
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include "dhcp_client.h"
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Обновление без перерыва: новый процесс (NETWORK_DAEMON_TAKEOVER=1) подключается
+// к сокету команд и отправляет (handoff). Старый процесс передаёт ему через
+// SCM_RIGHTS слушающие сокеты, сокет уведомлений netlink с подписками и
+// соединения клиентов, а вместе с ними - состояние, которое нельзя перечитать
+// из ядра: формат каждого клиента, неотправленные ответы, DHCP аренды.
+// Старый процесс завершается только после подтверждения от нового (ACK) и
+// отвечает на него COMMIT; без подтверждения он закрывает соединение и
+// продолжает работу, как будто передачи не было. Новый процесс начинает
+// обслуживать сокеты только после COMMIT.
+struct HandoffState {
+    struct Client {
+        int fd = -1;
+        int serializer = -1;  // Индекс формата; -1 - клиент ещё не выбрал формат
+        std::string output;   // Ответы и события, ещё не ушедшие клиенту
+    };
+
+    int listen_fd = -1;  // Сокет команд
+    int metrics_fd = -1; // Сокет метрик
+    int netlink_fd = -1; // Сокет уведомлений netlink, подписан на группы
+    std::vector<Client> clients;
+    std::vector<DhcpClient::Snapshot> dhcp;
+    int connection = -1; // Новый процесс: соединение со старым до подтверждения
+
+    bool active() const { return connection != -1; }
+};
+
+// Сколько старый процесс ждёт подтверждения (и отправки при медленном чтении)
+constexpr std::chrono::seconds HANDOFF_TIMEOUT{10};
+
+// Старый процесс: отправляет состояние в соединение sock, ждёт подтверждения и
+// отвечает COMMIT. fd из state остаются открытыми. false - передача не состоялась,
+// причина в error; соединение sock после этого нужно закрыть.
+bool sendHandoff(int sock, const HandoffState& state, std::string& error);
+
+// Новый процесс: запрашивает передачу у демона на socket_path. Полученные fd
+// переходят во владение вызывающего; бросает std::runtime_error при отказе или ошибке.
+HandoffState requestHandoff(const std::string& socket_path);
+// Сообщает старому процессу, что новый принял сокеты, и ждёт COMMIT; бросает
+// исключение, если подтверждение не ушло или старый процесс уже отказался от передачи
+void confirmHandoff(HandoffState& state);
+// Новый процесс не смог принять работу: закрывает соединение, и старый
+// продолжает работу, не дожидаясь таймаута
+void abandonHandoff(HandoffState& state);
+
+#endif // HANDOFF_H
@@ -0,0 +1,228 @@
+#include "logger.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <unistd.h>
+
+// Пачка, после которой фоновый поток пишет накопленное, не дожидаясь конца буфера
+constexpr size_t WRITE_BATCH = 64 * 1024;
+// Страховка от потерянного пробуждения: фоновый поток спит не дольше
+constexpr auto IDLE_WAIT = std::chrono::milliseconds(100);
+
+std::string_view logLevelName(LogLevel level) {
+    switch (level) {
+        case LogLevel::Debug: return "debug";
+        case LogLevel::Info: return "info";
+        case LogLevel::Warning: return "warning";
+        case LogLevel::Error: return "error";
+    }
+    return "?";
+}
+
+bool parseLogLevel(std::string_view name, LogLevel& level) {
+    for (LogLevel candidate : {LogLevel::Debug, LogLevel::Info, LogLevel::Warning, LogLevel::Error}) {
+        if (logLevelName(candidate) == name) {
+            level = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+void LogLine::append(std::string_view text) {
+    size_t room = MAX_LENGTH - length_;
+    if (text.size() <= room) {
+        memcpy(text_.data() + length_, text.data(), text.size());
+        length_ += text.size();
+        return;
+    }
+    // Обрезанная запись заканчивается многоточием
+    memcpy(text_.data() + length_, text.data(), room);
+    length_ = MAX_LENGTH;
+    memcpy(text_.data() + MAX_LENGTH - 3, "...", 3);
+}
+
+void LogLine::append(const void* pointer) {
+    char buffer[2 + 2 * sizeof(uintptr_t)] = {'0', 'x'};
+    auto result = std::to_chars(buffer + 2, std::end(buffer), reinterpret_cast<uintptr_t>(pointer), 16);
+    append(std::string_view(buffer, result.ptr - buffer));
+}
+
+void LogLine::appendSigned(long long value) {
+    char buffer[24];
+    auto result = std::to_chars(std::begin(buffer), std::end(buffer), value);
+    append(std::string_view(buffer, result.ptr - buffer));
+}
+
+void LogLine::appendUnsigned(unsigned long long value) {
+    char buffer[24];
+    auto result = std::to_chars(std::begin(buffer), std::end(buffer), value);
+    append(std::string_view(buffer, result.ptr - buffer));
+}
+
+Logger& Logger::instance() {
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger() : slots_(new Slot[SLOT_COUNT]) {
+    for (size_t i = 0; i < SLOT_COUNT; ++i) {
+        slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    thread_ = std::thread(&Logger::run, this);
+}
+
+Logger::~Logger() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wakeup_.notify_one();
+    thread_.join();
+}
+
+// Писатель занимает подряд count позиций одним CAS. Позиции освобождаются читателем
+// по порядку, поэтому если свободна последняя из них, свободны и все предыдущие.
+void Logger::push(LogLevel level, std::string_view text) {
+    size_t count = std::max<size_t>(1, (text.size() + SLOT_TEXT - 1) / SLOT_TEXT);
+    uint64_t pos = head_.load(std::memory_order_relaxed);
+    while (true) {
+        uint64_t last = pos + count - 1;
+        uint64_t sequence = slots_[last % SLOT_COUNT].sequence.load(std::memory_order_acquire);
+        int64_t diff = static_cast<int64_t>(sequence - last);
+        if (diff == 0) {
+            if (head_.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            pos = head_.load(std::memory_order_relaxed);
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        size_t offset = i * SLOT_TEXT;
+        size_t len = std::min(SLOT_TEXT, text.size() - std::min(offset, text.size()));
+        memcpy(slots_[(pos + i) % SLOT_COUNT].text, text.data() + offset, len);
+    }
+    Slot& first = slots_[pos % SLOT_COUNT];
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    first.time = now.tv_sec;
+    first.length = static_cast<uint16_t>(text.size());
+    first.slots = static_cast<uint8_t>(count);
+    first.level = level;
+    // Первый слот публикуется последним: читатель, увидевший его, видит всю запись
+    for (size_t i = count; i-- > 0;) {
+        slots_[(pos + i) % SLOT_COUNT].sequence.store(pos + i + 1, std::memory_order_release);
+    }
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping_.load(std::memory_order_relaxed)) {
+        wakeup_.notify_one();
+    }
+}
+
+void Logger::flush() {
+    uint64_t target = head_.load(std::memory_order_acquire);
+    std::unique_lock<std::mutex> lock(mutex_);
+    wakeup_.notify_one();
+    flushed_.wait(lock, [this, target] {
+        return stopping_ || written_.load(std::memory_order_acquire) >= target;
+    });
+}
+
+void Logger::run() {
+    std::string out;
+    std::string err;
+    while (true) {
+        bool drained = drain(out, err);
+        uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+        if (dropped != reported_dropped_) {
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME_COARSE, &now);
+            appendTimestamp(err, now.tv_sec);
+            err.append("Logger: буфер журнала переполнен, потеряно записей: ")
+                .append(std::to_string(dropped - reported_dropped_))
+                .push_back('\n');
+            reported_dropped_ = dropped;
+        }
+        writeAll(STDOUT_FILENO, out);
+        writeAll(STDERR_FILENO, err);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            written_.store(tail_, std::memory_order_release);
+        }
+        flushed_.notify_all();
+        if (drained) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (stopping_) {
+            break;
+        }
+        sleeping_.store(true, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t sequence = slots_[tail_ % SLOT_COUNT].sequence.load(std::memory_order_acquire);
+        if (sequence != tail_ + 1) {
+            wakeup_.wait_for(lock, IDLE_WAIT);
+        }
+        sleeping_.store(false, std::memory_order_relaxed);
+    }
+}
+
+bool Logger::drain(std::string& out, std::string& err) {
+    bool any = false;
+    while (out.size() + err.size() < WRITE_BATCH) {
+        Slot& first = slots_[tail_ % SLOT_COUNT];
+        if (first.sequence.load(std::memory_order_acquire) != tail_ + 1) {
+            break;
+        }
+        size_t count = first.slots;
+        size_t length = first.length;
+        std::string& target = first.level >= LogLevel::Warning ? err : out;
+        appendTimestamp(target, first.time);
+        for (size_t i = 0; i < count; ++i) {
+            size_t offset = i * SLOT_TEXT;
+            target.append(slots_[(tail_ + i) % SLOT_COUNT].text, std::min(SLOT_TEXT, length - std::min(offset, length)));
+        }
+        target.push_back('\n');
+        for (size_t i = 0; i < count; ++i) {
+            slots_[(tail_ + i) % SLOT_COUNT].sequence.store(tail_ + i + SLOT_COUNT, std::memory_order_release);
+        }
+        tail_ += count;
+        any = true;
+    }
+    return any;
+}
+
+void Logger::appendTimestamp(std::string& out, int64_t time) {
+    if (time != formatted_time_) {
+        time_t seconds = static_cast<time_t>(time);
+        struct tm local;
+        localtime_r(&seconds, &local);
+        strftime(timestamp_, sizeof(timestamp_), "[%Y-%m-%d %H:%M:%S] ", &local);
+        formatted_time_ = time;
+    }
+    out.append(timestamp_);
+}
+
+void Logger::writeAll(int fd, std::string& data) {
+    size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t written = ::write(fd, data.data() + offset, data.size() - offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break; // Писать некуда: журнал теряется, а не блокирует работу
+        }
+        offset += written;
+    }
+    data.clear();
+}
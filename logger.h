@@ -0,0 +1,154 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+
+enum class LogLevel : uint8_t { Debug, Info, Warning, Error };
+
+// debug, info, warning, error
+std::string_view logLevelName(LogLevel level);
+bool parseLogLevel(std::string_view name, LogLevel& level);
+
+// Текст одной записи журнала. Собирается в вызывающем потоке без потоков
+// ввода-вывода и выделения памяти; слишком длинная запись обрезается.
+class LogLine {
+public:
+    static constexpr size_t MAX_LENGTH = 4096;
+
+    void clear() { length_ = 0; }
+    std::string_view view() const { return std::string_view(text_.data(), length_); }
+
+    void append(std::string_view text);
+    void append(const char* text) { append(std::string_view(text ? text : "(null)")); }
+    void append(const std::string& text) { append(std::string_view(text)); }
+    void append(char c) { append(std::string_view(&c, 1)); }
+    void append(bool value) { append(value ? std::string_view("1") : std::string_view("0")); }
+    void append(const void* pointer);
+    template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+    void append(T value) {
+        if constexpr (std::is_signed_v<T>) {
+            appendSigned(static_cast<long long>(value));
+        } else {
+            appendUnsigned(static_cast<unsigned long long>(value));
+        }
+    }
+
+private:
+    std::array<char, MAX_LENGTH> text_;
+    size_t length_ = 0;
+
+    void appendSigned(long long value);
+    void appendUnsigned(unsigned long long value);
+};
+
+// Асинхронный журнал. Вызывающий поток только собирает текст записи и кладёт
+// его в кольцевой буфер без блокировок (несколько писателей, один читатель);
+// метку времени форматирует и пишет пачками фоновый поток: в stdout, а
+// предупреждения и ошибки - в stderr. Если буфер полон, запись отбрасывается
+// и учитывается в счётчике потерь (о потерях фоновый поток сообщает сам).
+class Logger {
+public:
+    static Logger& instance();
+
+    ~Logger();
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    bool enabled(LogLevel level) const { return level >= level_.load(std::memory_order_relaxed); }
+    void setLevel(LogLevel level) { level_.store(level, std::memory_order_relaxed); }
+    LogLevel level() const { return level_.load(std::memory_order_relaxed); }
+    // Записи, не попавшие в буфер, с начала работы
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    template <typename... Args>
+    void write(LogLevel level, const Args&... args) {
+        if (!enabled(level)) {
+            return;
+        }
+        thread_local LogLine line;
+        line.clear();
+        (line.append(args), ...);
+        push(level, line.view());
+    }
+
+    // Ждёт, пока фоновый поток запишет всё, что уже в буфере
+    void flush();
+
+private:
+    // Запись занимает один или несколько подряд идущих слотов
+    static constexpr size_t SLOT_COUNT = 8192;
+    static constexpr size_t SLOT_SIZE = 128;
+    struct Slot {
+        // Номер позиции: равен ей, когда слот свободен, и на 1 больше, когда заполнен
+        std::atomic<uint64_t> sequence;
+        int64_t time;   // Первый слот записи: секунды CLOCK_REALTIME
+        uint16_t length; // Первый слот записи: длина текста
+        uint8_t slots;   // Первый слот записи: число слотов
+        LogLevel level;
+        char text[SLOT_SIZE - sizeof(std::atomic<uint64_t>) - sizeof(int64_t) - 4];
+    };
+    static constexpr size_t SLOT_TEXT = sizeof(Slot::text);
+    static constexpr size_t MAX_RECORD_SLOTS = (LogLine::MAX_LENGTH + SLOT_TEXT - 1) / SLOT_TEXT;
+
+    std::unique_ptr<Slot[]> slots_;
+    alignas(64) std::atomic<uint64_t> head_{0}; // Следующая позиция для писателей
+    alignas(64) uint64_t tail_ = 0;             // Следующая позиция для фонового потока
+    std::atomic<uint64_t> written_{0};          // Позиция, до которой всё записано
+    std::atomic<LogLevel> level_{LogLevel::Info};
+    std::atomic<uint64_t> dropped_{0};
+    uint64_t reported_dropped_ = 0;
+
+    // Фоновый поток засыпает, только когда буфер пуст; писатель будит его,
+    // если видит sleeping_ (редкий случай - первая запись после простоя)
+    std::atomic<bool> sleeping_{false};
+    std::atomic<bool> stopping_{false};
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    std::condition_variable flushed_;
+    std::thread thread_;
+
+    // Метка времени последней секунды: форматируется не чаще раза в секунду
+    int64_t formatted_time_ = -1;
+    char timestamp_[32];
+
+    Logger();
+    void push(LogLevel level, std::string_view text);
+    void run();
+    // Переносит готовые записи в out/err; false - буфер пуст
+    bool drain(std::string& out, std::string& err);
+    void appendTimestamp(std::string& out, int64_t time);
+    static void writeAll(int fd, std::string& data);
+};
+
+template <typename... Args>
+void logDebug(const Args&... args) {
+    Logger::instance().write(LogLevel::Debug, args...);
+}
+
+template <typename... Args>
+void logInfo(const Args&... args) {
+    Logger::instance().write(LogLevel::Info, args...);
+}
+
+template <typename... Args>
+void logWarning(const Args&... args) {
+    Logger::instance().write(LogLevel::Warning, args...);
+}
+
+template <typename... Args>
+void logError(const Args&... args) {
+    Logger::instance().write(LogLevel::Error, args...);
+}
+
+#endif // LOGGER_H
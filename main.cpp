@@ -1,12 +1,12 @@
 #include "network_daemon.h"
-#include <iostream>
+#include "logger.h"
 
 int main() {
     try {
         NetworkDaemon daemon;
         daemon.run();
     } catch (const std::exception& e) {
-        std::cerr << "Ошибка: " << e.what() << std::endl;
+        logError("Ошибка: ", e.what());
         return 1;
     }
     return 0;
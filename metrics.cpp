@@ -0,0 +1,219 @@
+#include "metrics.h"
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+uint64_t Counter::value() const {
+    uint64_t sum = 0;
+    for (const Cell& cell : cells_) {
+        sum += cell.value.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+Histogram::Histogram(std::vector<uint64_t> bounds, double scale)
+    : bounds_(std::move(bounds)), scale_(scale), stride_((bounds_.size() + 2 + 7) / 8 * 8),
+      lines_(new Line[METRIC_SHARDS * stride_ / 8]) {
+    if (!std::is_sorted(bounds_.begin(), bounds_.end())) {
+        throw std::invalid_argument("Histogram: bounds must be sorted");
+    }
+    for (size_t i = 0; i < METRIC_SHARDS * stride_; ++i) {
+        lines_[i / 8].cells[i % 8].store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::observe(uint64_t value) {
+    size_t index = std::lower_bound(bounds_.begin(), bounds_.end(), value) - bounds_.begin();
+    size_t shard = metricShard();
+    cell(shard, index).fetch_add(1, std::memory_order_relaxed);
+    cell(shard, bounds_.size() + 1).fetch_add(value, std::memory_order_relaxed);
+}
+
+void Histogram::snapshot(std::vector<uint64_t>& buckets, uint64_t& sum) const {
+    buckets.assign(bounds_.size() + 1, 0);
+    sum = 0;
+    for (size_t shard = 0; shard < METRIC_SHARDS; ++shard) {
+        for (size_t i = 0; i < buckets.size(); ++i) {
+            buckets[i] += cell(shard, i).load(std::memory_order_relaxed);
+        }
+        sum += cell(shard, bounds_.size() + 1).load(std::memory_order_relaxed);
+    }
+}
+
+const std::vector<uint64_t>& latencyBuckets() {
+    static const std::vector<uint64_t> bounds = {
+        10'000, 50'000, 100'000, 250'000, 500'000,                       // 10 мкс .. 500 мкс
+        1'000'000, 2'500'000, 5'000'000, 10'000'000, 25'000'000,         // 1 мс .. 25 мс
+        50'000'000, 100'000'000, 250'000'000, 500'000'000,               // 50 мс .. 500 мс
+        1'000'000'000, 2'500'000'000, 5'000'000'000, 10'000'000'000,     // 1 с .. 10 с
+    };
+    return bounds;
+}
+
+const std::vector<uint64_t>& fanoutBuckets() {
+    static const std::vector<uint64_t> bounds = {0, 1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024};
+    return bounds;
+}
+
+std::string metricLabel(std::string_view key, std::string_view value) {
+    std::string label(key);
+    label += "=\"";
+    for (char c : value) {
+        switch (c) {
+            case '\\': label += "\\\\"; break;
+            case '"': label += "\\\""; break;
+            case '\n': label += "\\n"; break;
+            default: label += c;
+        }
+    }
+    label += '"';
+    return label;
+}
+
+MetricsRegistry& MetricsRegistry::instance() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+MetricsRegistry::Series& MetricsRegistry::series(std::string_view name, std::string_view help, Type type,
+                                                 std::string_view labels, bool& created) {
+    auto family = std::find_if(families_.begin(), families_.end(),
+                               [name](const std::unique_ptr<Family>& f) { return f->name == name; });
+    if (family == families_.end()) {
+        families_.push_back(std::make_unique<Family>(Family{std::string(name), std::string(help), type, {}}));
+        family = families_.end() - 1;
+    } else if ((*family)->type != type) {
+        throw std::invalid_argument("MetricsRegistry: " + std::string(name) + " registered with another type");
+    }
+
+    auto& list = (*family)->series;
+    auto it = std::find_if(list.begin(), list.end(),
+                           [labels](const std::unique_ptr<Series>& s) { return s->labels == labels; });
+    created = it == list.end();
+    if (created) {
+        list.push_back(std::make_unique<Series>());
+        list.back()->labels = std::string(labels);
+        return *list.back();
+    }
+    return **it;
+}
+
+Counter& MetricsRegistry::counter(std::string_view name, std::string_view help, std::string_view labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool created;
+    Series& s = series(name, help, Type::Counter, labels, created);
+    if (created) {
+        s.counter = std::make_unique<Counter>();
+    } else if (!s.counter) {
+        throw std::invalid_argument("MetricsRegistry: " + std::string(name) + " is a function counter");
+    }
+    return *s.counter;
+}
+
+void MetricsRegistry::counter(std::string_view name, std::string_view help, std::string_view labels,
+                              std::function<uint64_t()> value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool created;
+    Series& s = series(name, help, Type::Counter, labels, created);
+    if (!created && s.counter) {
+        throw std::invalid_argument("MetricsRegistry: " + std::string(name) + " is a regular counter");
+    }
+    s.function = std::move(value);
+}
+
+Gauge& MetricsRegistry::gauge(std::string_view name, std::string_view help, std::string_view labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool created;
+    Series& s = series(name, help, Type::Gauge, labels, created);
+    if (created) {
+        s.gauge = std::make_unique<Gauge>();
+    }
+    return *s.gauge;
+}
+
+Histogram& MetricsRegistry::histogram(std::string_view name, std::string_view help, std::string_view labels,
+                                      const std::vector<uint64_t>& bounds, double scale) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool created;
+    Series& s = series(name, help, Type::Histogram, labels, created);
+    if (created) {
+        s.histogram = std::make_unique<Histogram>(bounds, scale);
+    }
+    return *s.histogram;
+}
+
+namespace {
+
+void appendNumber(std::string& out, double value) {
+    char buffer[32];
+    int len = snprintf(buffer, sizeof(buffer), "%.9g", value);
+    out.append(buffer, len);
+}
+
+// name{labels,extra} или name{extra}, или просто name
+void appendSeriesName(std::string& out, std::string_view name, std::string_view suffix, std::string_view labels,
+                      std::string_view extra = {}) {
+    out.append(name).append(suffix);
+    if (labels.empty() && extra.empty()) {
+        return;
+    }
+    out += '{';
+    out.append(labels);
+    if (!labels.empty() && !extra.empty()) {
+        out += ',';
+    }
+    out.append(extra);
+    out += '}';
+}
+
+} // namespace
+
+void MetricsRegistry::render(std::string& out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<uint64_t> buckets;
+    for (const auto& family : families_) {
+        static constexpr std::string_view TYPE_NAMES[] = {"counter", "gauge", "histogram"};
+        out.append("# HELP ").append(family->name).append(" ").append(family->help).append("\n");
+        out.append("# TYPE ").append(family->name).append(" ")
+            .append(TYPE_NAMES[static_cast<int>(family->type)]).append("\n");
+
+        for (const auto& s : family->series) {
+            if (family->type != Type::Histogram) {
+                appendSeriesName(out, family->name, {}, s->labels);
+                out += ' ';
+                if (s->counter) {
+                    out.append(std::to_string(s->counter->value()));
+                } else if (s->gauge) {
+                    out.append(std::to_string(s->gauge->value()));
+                } else {
+                    out.append(std::to_string(s->function()));
+                }
+                out += '\n';
+                continue;
+            }
+
+            const Histogram& h = *s->histogram;
+            uint64_t sum;
+            h.snapshot(buckets, sum);
+            uint64_t cumulative = 0;
+            for (size_t i = 0; i < buckets.size(); ++i) {
+                cumulative += buckets[i];
+                std::string le = "le=\"";
+                if (i < h.bounds().size()) {
+                    appendNumber(le, h.bounds()[i] / h.scale());
+                } else {
+                    le += "+Inf";
+                }
+                le += '"';
+                appendSeriesName(out, family->name, "_bucket", s->labels, le);
+                out.append(" ").append(std::to_string(cumulative)).append("\n");
+            }
+            appendSeriesName(out, family->name, "_sum", s->labels);
+            out += ' ';
+            appendNumber(out, sum / h.scale());
+            out += '\n';
+            appendSeriesName(out, family->name, "_count", s->labels);
+            out.append(" ").append(std::to_string(cumulative)).append("\n");
+        }
+    }
+}
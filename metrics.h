@@ -0,0 +1,135 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Счётчики разнесены по нескольким строкам кэша: каждый поток пишет в свою
+// (номер выдаётся потоку при первом обращении), значение - сумма при снятии.
+constexpr size_t METRIC_SHARDS = 8;
+
+inline size_t metricShard() {
+    static std::atomic<size_t> next_shard{0};
+    thread_local size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed) % METRIC_SHARDS;
+    return shard;
+}
+
+class Counter {
+public:
+    void inc(uint64_t n = 1) { cells_[metricShard()].value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const;
+
+private:
+    struct alignas(64) Cell {
+        std::atomic<uint64_t> value{0};
+    };
+    std::array<Cell, METRIC_SHARDS> cells_;
+};
+
+// Текущее значение (число клиентов, глубина очереди); меняется владельцем
+class Gauge {
+public:
+    void set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+    void add(int64_t delta) { value_.fetch_add(delta, std::memory_order_relaxed); }
+    int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> value_{0};
+};
+
+// Распределение целых наблюдений по корзинам с верхними границами bounds
+// (по возрастанию, включительно). В выводе значения делятся на scale:
+// длительности наблюдаются в наносекундах, а выводятся в секундах.
+class Histogram {
+public:
+    Histogram(std::vector<uint64_t> bounds, double scale);
+
+    void observe(uint64_t value);
+    void observe(std::chrono::steady_clock::duration duration) {
+        observe(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()));
+    }
+
+    const std::vector<uint64_t>& bounds() const { return bounds_; }
+    double scale() const { return scale_; }
+    // Число наблюдений по корзинам (последняя - больше всех границ) и их сумма
+    void snapshot(std::vector<uint64_t>& buckets, uint64_t& sum) const;
+
+private:
+    struct alignas(64) Line {
+        std::atomic<uint64_t> cells[8];
+    };
+    std::vector<uint64_t> bounds_;
+    double scale_;
+    size_t stride_; // Ячеек на поток: корзины, затем сумма; кратно строке кэша
+    std::unique_ptr<Line[]> lines_;
+
+    std::atomic<uint64_t>& cell(size_t shard, size_t index) const {
+        size_t offset = shard * stride_ + index;
+        return lines_[offset / 8].cells[offset % 8];
+    }
+};
+
+// Границы для длительностей: 10 мкс .. 10 с (в наносекундах)
+const std::vector<uint64_t>& latencyBuckets();
+// Границы для числа получателей рассылки: 0, 1, 2, 4 .. 1024
+const std::vector<uint64_t>& fanoutBuckets();
+// Метка key="value" с экранированием значения
+std::string metricLabel(std::string_view key, std::string_view value);
+
+// Реестр метрик процесса. Регистрация (обычно при создании компонентов) и
+// снятие идут под мьютексом, обновление метрик - без блокировок. Метрики
+// живут до конца процесса: компоненты хранят ссылки на них.
+class MetricsRegistry {
+public:
+    static MetricsRegistry& instance();
+
+    MetricsRegistry(const MetricsRegistry&) = delete;
+    MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+    // Повторный вызов с теми же именем и метками возвращает ту же метрику
+    Counter& counter(std::string_view name, std::string_view help, std::string_view labels = {});
+    Gauge& gauge(std::string_view name, std::string_view help, std::string_view labels = {});
+    Histogram& histogram(std::string_view name, std::string_view help, std::string_view labels,
+                         const std::vector<uint64_t>& bounds = latencyBuckets(), double scale = 1e9);
+    // Счётчик, значение которого читается при снятии (функция вызывается из потока сервера метрик)
+    void counter(std::string_view name, std::string_view help, std::string_view labels,
+                 std::function<uint64_t()> value);
+
+    // Все метрики в текстовом формате Prometheus
+    void render(std::string& out) const;
+
+private:
+    enum class Type { Counter, Gauge, Histogram };
+
+    struct Series {
+        std::string labels;
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Histogram> histogram;
+        std::function<uint64_t()> function;
+    };
+    struct Family {
+        std::string name;
+        std::string help;
+        Type type;
+        std::vector<std::unique_ptr<Series>> series;
+    };
+
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Family>> families_; // В порядке регистрации
+
+    MetricsRegistry() = default;
+    // Ряд name{labels}; created - ряд новый и его нужно заполнить
+    Series& series(std::string_view name, std::string_view help, Type type, std::string_view labels, bool& created);
+};
+
+#endif // METRICS_H
@@ -0,0 +1,84 @@
+#include "metrics_server.h"
+#include "logger.h"
+#include "metrics.h"
+#include <signal.h>
+
+MetricsServer::MetricsServer(const std::string& socket_path) : server_(loop_, socket_path, "metrics") {
+    server_.setClientHandler([this](int client_fd, std::string_view data) { handleInput(client_fd, data); });
+    server_.setDisconnectHandler([this](int client_fd) { requests_.erase(client_fd); });
+}
+
+MetricsServer::~MetricsServer() {
+    stop();
+}
+
+void MetricsServer::start(int listen_fd) {
+    server_.start(listen_fd);
+    // Сигналы должен получать поток основного цикла
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &previous);
+    thread_ = std::thread([this]() {
+        try {
+            loop_.run();
+        } catch (const std::exception& e) {
+            logError("MetricsServer: ", e.what());
+        }
+    });
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+}
+
+void MetricsServer::stop() {
+    if (!thread_.joinable()) {
+        return;
+    }
+    joinThread();
+    server_.stop();
+}
+
+void MetricsServer::release() {
+    joinThread();
+    server_.release();
+}
+
+void MetricsServer::joinThread() {
+    if (thread_.joinable()) {
+        loop_.post([this]() { loop_.stop(); });
+        thread_.join();
+    }
+}
+
+void MetricsServer::handleInput(int client_fd, std::string_view data) {
+    std::string& request = requests_[client_fd];
+    request.append(data);
+    size_t end = request.find("\r\n\r\n");
+    if (end == std::string::npos) {
+        end = request.find("\n\n");
+    }
+    if (end == std::string::npos) {
+        if (request.size() > MAX_REQUEST) {
+            server_.closeWhenFlushed(client_fd);
+        }
+        return;
+    }
+    std::string headers = std::move(request);
+    requests_.erase(client_fd);
+    respond(client_fd, headers);
+}
+
+void MetricsServer::respond(int client_fd, std::string_view request) {
+    std::string status = "200 OK";
+    std::string body;
+    if (request.substr(0, 4) != "GET ") {
+        status = "405 Method Not Allowed";
+        body = "only GET is supported\n";
+    } else {
+        MetricsRegistry::instance().render(body);
+    }
+    std::string response = "HTTP/1.1 " + status +
+                           "\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: " +
+                           std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+    response += body;
+    server_.sendResponse(client_fd, response);
+    server_.closeWhenFlushed(client_fd);
+}
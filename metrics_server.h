@@ -0,0 +1,45 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include "event_loop.h"
+#include "unix_socket_server.h"
+#include <map>
+#include <string>
+#include <string_view>
+#include <thread>
+
+// Отдаёт MetricsRegistry в формате Prometheus на отдельном unix сокете.
+// Работает в своём потоке со своим циклом событий, поэтому снятие метрик
+// не делит цикл с командами. Протокол - минимальный HTTP/1.x: на GET
+// приходит ответ с метриками, после чего соединение закрывается
+// (curl --unix-socket <путь> http://localhost/metrics).
+class MetricsServer {
+public:
+    explicit MetricsServer(const std::string& socket_path);
+    ~MetricsServer();
+
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    // Создаёт сокет (бросает исключение при ошибке) или берёт уже слушающий
+    // listen_fd другого процесса и запускает поток
+    void start(int listen_fd = -1);
+    void stop();
+    // Останавливает поток, не удаляя путь сокета: сокет перешёл к другому процессу
+    void release();
+    int getListenFd() const { return server_.getListenFd(); }
+
+    static constexpr size_t MAX_REQUEST = 8 * 1024;
+
+private:
+    EventLoop loop_;
+    UnixSocketServer server_;
+    std::map<int, std::string> requests_; // Заголовки запроса, пока не пришли целиком
+    std::thread thread_;
+
+    void joinThread();
+    void handleInput(int client_fd, std::string_view data);
+    void respond(int client_fd, std::string_view request);
+};
+
+#endif // METRICS_SERVER_H
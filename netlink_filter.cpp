@@ -0,0 +1,298 @@
+#include "netlink_filter.h"
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <cerrno>
+#include <cstddef>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+namespace {
+
+// Смещения полей внутри skb: заголовок netlink + фиксированная часть сообщения.
+// BPF_LD читает данные в сетевом порядке байт, поля netlink лежат в порядке хоста,
+// поэтому константы для сравнения прогоняются через htons/htonl.
+constexpr uint32_t OFF_TYPE = offsetof(struct nlmsghdr, nlmsg_type);
+constexpr uint32_t OFF_FLAGS = offsetof(struct nlmsghdr, nlmsg_flags);
+constexpr uint32_t OFF_IFI_INDEX = NLMSG_HDRLEN + offsetof(struct ifinfomsg, ifi_index);
+constexpr uint32_t OFF_IFA_INDEX = NLMSG_HDRLEN + offsetof(struct ifaddrmsg, ifa_index);
+constexpr uint32_t OFF_RTM_TABLE = NLMSG_HDRLEN + offsetof(struct rtmsg, rtm_table);
+constexpr uint32_t OFF_RTM_PROTOCOL = NLMSG_HDRLEN + offsetof(struct rtmsg, rtm_protocol);
+constexpr uint32_t OFF_RTM_FLAGS = NLMSG_HDRLEN + offsetof(struct rtmsg, rtm_flags);
+constexpr uint32_t OFF_RTM_ATTRS = NLMSG_HDRLEN + NLMSG_ALIGN(sizeof(struct rtmsg));
+
+constexpr uint32_t ACCEPT = 0xffffffff;
+constexpr uint32_t DROP = 0;
+
+// Небольшой ассемблер с метками. Условные переходы всегда короткие
+// (jt=0, jf=1 через BPF_JA), поэтому размер множеств ограничен только BPF_MAXINSNS.
+class ProgramBuilder {
+public:
+    int newLabel() {
+        labels_.push_back(-1);
+        return static_cast<int>(labels_.size()) - 1;
+    }
+
+    void bind(int label) { labels_[label] = static_cast<int>(code_.size()); }
+
+    void stmt(uint16_t code, uint32_t k) { code_.push_back({BPF_STMT(code, k), -1}); }
+
+    void ret(uint32_t k) { stmt(BPF_RET | BPF_K, k); }
+
+    void jump(int label) { code_.push_back({BPF_STMT(BPF_JMP | BPF_JA, 0), label}); }
+
+    void jumpIf(uint16_t op, uint32_t k, int label) {
+        code_.push_back({BPF_JUMP(BPF_JMP | op | BPF_K, k, 0, 1), -1});
+        jump(label);
+    }
+
+    void dropIf(uint16_t op, uint32_t k) {
+        code_.push_back({BPF_JUMP(BPF_JMP | op | BPF_K, k, 0, 1), -1});
+        ret(DROP);
+    }
+
+    std::vector<struct sock_filter> finish() const {
+        if (code_.size() > BPF_MAXINSNS) {
+            throw std::length_error("BPF программа превышает BPF_MAXINSNS");
+        }
+        std::vector<struct sock_filter> out;
+        out.reserve(code_.size());
+        for (size_t i = 0; i < code_.size(); ++i) {
+            struct sock_filter f = code_[i].insn;
+            if (code_[i].label >= 0) {
+                f.k = static_cast<uint32_t>(labels_[code_[i].label] - static_cast<int>(i) - 1);
+            }
+            out.push_back(f);
+        }
+        return out;
+    }
+
+private:
+    struct Insn {
+        struct sock_filter insn;
+        int label;
+    };
+    std::vector<Insn> code_;
+    std::vector<int> labels_;
+};
+
+// Проверка ifindex, загруженного в аккумулятор (в сетевом порядке)
+void emitIfindexCheck(ProgramBuilder& b, const NetlinkFilterSpec& spec) {
+    int drop = b.newLabel();
+    for (uint32_t idx : spec.exclude_ifindexes) {
+        b.jumpIf(BPF_JEQ, htonl(idx), drop);
+    }
+    if (spec.ifindexes.empty()) {
+        b.ret(ACCEPT);
+    } else {
+        int accept = b.newLabel();
+        for (uint32_t idx : spec.ifindexes) {
+            b.jumpIf(BPF_JEQ, htonl(idx), accept);
+        }
+        b.ret(DROP);
+        b.bind(accept);
+        b.ret(ACCEPT);
+    }
+    b.bind(drop);
+    b.ret(DROP);
+}
+
+void emitByteSetCheck(ProgramBuilder& b, uint32_t offset, const std::set<uint8_t>& values) {
+    if (values.empty()) {
+        return;
+    }
+    int ok = b.newLabel();
+    b.stmt(BPF_LD | BPF_B | BPF_ABS, offset);
+    for (uint8_t v : values) {
+        b.jumpIf(BPF_JEQ, v, ok);
+    }
+    b.ret(DROP);
+    b.bind(ok);
+}
+
+std::vector<std::string> splitList(const std::string& value) {
+    std::vector<std::string> items;
+    std::stringstream ss(value);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+uint32_t parseNumber(const std::string& text, uint32_t max) {
+    size_t pos = 0;
+    unsigned long value;
+    try {
+        value = std::stoul(text, &pos, 0);
+    } catch (...) {
+        throw std::invalid_argument("некорректное число в спецификации фильтра: " + text);
+    }
+    if (pos != text.size() || value > max) {
+        throw std::invalid_argument("некорректное число в спецификации фильтра: " + text);
+    }
+    return static_cast<uint32_t>(value);
+}
+
+} // namespace
+
+NetlinkFilterSpec NetlinkFilterSpec::defaults() {
+    NetlinkFilterSpec spec;
+    spec.msg_types = {RTM_NEWLINK, RTM_DELLINK, RTM_NEWADDR, RTM_DELADDR, RTM_NEWROUTE, RTM_DELROUTE};
+    spec.route_tables = {RT_TABLE_MAIN};
+    return spec;
+}
+
+NetlinkFilterSpec NetlinkFilterSpec::parse(const std::string& text) {
+    NetlinkFilterSpec spec = defaults();
+    std::stringstream ss(text);
+    std::string field;
+
+    while (ss >> field) {
+        size_t eq = field.find('=');
+        if (eq == std::string::npos) {
+            throw std::invalid_argument("ожидалось key=value: " + field);
+        }
+        std::string key = field.substr(0, eq);
+        std::vector<std::string> values = splitList(field.substr(eq + 1));
+
+        if (key == "types") {
+            spec.msg_types.clear();
+            for (const auto& v : values) {
+                if (v == "link") {
+                    spec.msg_types.insert({RTM_NEWLINK, RTM_DELLINK});
+                } else if (v == "addr") {
+                    spec.msg_types.insert({RTM_NEWADDR, RTM_DELADDR});
+                } else if (v == "route") {
+                    spec.msg_types.insert({RTM_NEWROUTE, RTM_DELROUTE});
+                } else {
+                    spec.msg_types.insert(static_cast<uint16_t>(parseNumber(v, 0xffff)));
+                }
+            }
+        } else if (key == "tables") {
+            spec.route_tables.clear();
+            for (const auto& v : values) {
+                if (v == "any") continue;
+                if (v == "main") spec.route_tables.insert(RT_TABLE_MAIN);
+                else if (v == "local") spec.route_tables.insert(RT_TABLE_LOCAL);
+                else if (v == "default") spec.route_tables.insert(RT_TABLE_DEFAULT);
+                else spec.route_tables.insert(static_cast<uint8_t>(parseNumber(v, 0xff)));
+            }
+        } else if (key == "protocols") {
+            spec.route_protocols.clear();
+            for (const auto& v : values) {
+                if (v == "any") continue;
+                if (v == "kernel") spec.route_protocols.insert(RTPROT_KERNEL);
+                else if (v == "boot") spec.route_protocols.insert(RTPROT_BOOT);
+                else if (v == "static") spec.route_protocols.insert(RTPROT_STATIC);
+                else if (v == "ra") spec.route_protocols.insert(RTPROT_RA);
+                else if (v == "dhcp") spec.route_protocols.insert(RTPROT_DHCP);
+                else spec.route_protocols.insert(static_cast<uint8_t>(parseNumber(v, 0xff)));
+            }
+        } else if (key == "ifindex") {
+            spec.ifindexes.clear();
+            for (const auto& v : values) {
+                spec.ifindexes.insert(parseNumber(v, 0xffffffff));
+            }
+        } else if (key == "exclude_ifindex") {
+            spec.exclude_ifindexes.clear();
+            for (const auto& v : values) {
+                spec.exclude_ifindexes.insert(parseNumber(v, 0xffffffff));
+            }
+        } else if (key == "cloned") {
+            if (values.size() != 1 || (values[0] != "keep" && values[0] != "drop")) {
+                throw std::invalid_argument("cloned ожидает keep или drop");
+            }
+            spec.drop_cloned_routes = (values[0] == "drop");
+        } else {
+            throw std::invalid_argument("неизвестный ключ спецификации фильтра: " + key);
+        }
+    }
+    return spec;
+}
+
+NetlinkFilter::NetlinkFilter(const NetlinkFilterSpec& spec) {
+    ProgramBuilder b;
+    int accept = b.newLabel();
+    int link_block = b.newLabel();
+    int addr_block = b.newLabel();
+    int route_block = b.newLabel();
+
+    // Служебные сообщения (ACK, ошибки, конец дампа) пропускаем всегда
+    b.stmt(BPF_LD | BPF_H | BPF_ABS, OFF_TYPE);
+    for (uint16_t type : {NLMSG_NOOP, NLMSG_ERROR, NLMSG_DONE, NLMSG_OVERRUN}) {
+        b.jumpIf(BPF_JEQ, htons(type), accept);
+    }
+
+    // Ответы на дампы (заполнение кэшей) не фильтруем
+    b.stmt(BPF_LD | BPF_H | BPF_ABS, OFF_FLAGS);
+    b.jumpIf(BPF_JSET, htons(NLM_F_MULTI), accept);
+
+    // Диспетчеризация по типу сообщения
+    b.stmt(BPF_LD | BPF_H | BPF_ABS, OFF_TYPE);
+    for (uint16_t type : spec.msg_types) {
+        int target = accept;
+        if (type == RTM_NEWLINK || type == RTM_DELLINK) target = link_block;
+        else if (type == RTM_NEWADDR || type == RTM_DELADDR) target = addr_block;
+        else if (type == RTM_NEWROUTE || type == RTM_DELROUTE) target = route_block;
+        b.jumpIf(BPF_JEQ, htons(type), target);
+    }
+    if (spec.msg_types.empty()) {
+        b.jump(accept);
+    } else {
+        b.ret(DROP);
+    }
+
+    b.bind(link_block);
+    b.stmt(BPF_LD | BPF_W | BPF_ABS, OFF_IFI_INDEX);
+    emitIfindexCheck(b, spec);
+
+    b.bind(addr_block);
+    b.stmt(BPF_LD | BPF_W | BPF_ABS, OFF_IFA_INDEX);
+    emitIfindexCheck(b, spec);
+
+    b.bind(route_block);
+    emitByteSetCheck(b, OFF_RTM_TABLE, spec.route_tables);
+    emitByteSetCheck(b, OFF_RTM_PROTOCOL, spec.route_protocols);
+    if (spec.drop_cloned_routes) {
+        b.stmt(BPF_LD | BPF_W | BPF_ABS, OFF_RTM_FLAGS);
+        b.dropIf(BPF_JSET, htonl(RTM_F_CLONED));
+    }
+    if (spec.ifindexes.empty() && spec.exclude_ifindexes.empty()) {
+        b.jump(accept);
+    } else {
+        // Ищем RTA_OIF средствами ядра: A = начало атрибутов, X = тип атрибута
+        b.stmt(BPF_LD | BPF_IMM, OFF_RTM_ATTRS);
+        b.stmt(BPF_LDX | BPF_IMM, RTA_OIF);
+        b.stmt(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_NLATTR);
+        b.jumpIf(BPF_JEQ, 0, accept); // Маршрут без OIF не фильтруем
+        b.stmt(BPF_MISC | BPF_TAX, 0);
+        b.stmt(BPF_LD | BPF_W | BPF_IND, NLA_HDRLEN);
+        emitIfindexCheck(b, spec);
+    }
+
+    b.bind(accept);
+    b.ret(ACCEPT);
+
+    program_ = b.finish();
+}
+
+void NetlinkFilter::attach(int fd) const {
+    struct sock_fprog prog;
+    prog.len = static_cast<unsigned short>(program_.size());
+    prog.filter = const_cast<struct sock_filter*>(program_.data());
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == -1) {
+        throw std::system_error(errno, std::generic_category(), "Не удалось установить BPF фильтр");
+    }
+}
+
+void NetlinkFilter::detach(int fd) {
+    int dummy = 0;
+    if (setsockopt(fd, SOL_SOCKET, SO_DETACH_FILTER, &dummy, sizeof(dummy)) == -1 && errno != ENOENT) {
+        throw std::system_error(errno, std::generic_category(), "Не удалось снять BPF фильтр");
+    }
+}
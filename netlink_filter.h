@@ -0,0 +1,45 @@
+#ifndef NETLINK_FILTER_H
+#define NETLINK_FILTER_H
+
+#include <linux/filter.h>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+// Описание того, какие netlink уведомления нужны демону.
+// Пустое множество означает "без ограничений" по соответствующему полю.
+struct NetlinkFilterSpec {
+    std::set<uint16_t> msg_types;          // RTM_NEWLINK, RTM_DELADDR, ...
+    std::set<uint8_t> route_tables;        // rtm_table (RT_TABLE_MAIN и т.п.)
+    std::set<uint8_t> route_protocols;     // rtm_protocol (RTPROT_STATIC, RTPROT_DHCP, ...)
+    std::set<uint32_t> ifindexes;          // Разрешённые интерфейсы
+    std::set<uint32_t> exclude_ifindexes;  // Исключённые интерфейсы
+    bool drop_cloned_routes = true;        // Отбрасывать маршруты с RTM_F_CLONED
+
+    // Спецификация по умолчанию: link/addr/route события, только таблица main
+    static NetlinkFilterSpec defaults();
+
+    // Разбирает строку вида "types=link,addr,route tables=254 protocols=static,dhcp
+    // ifindex=2,3 exclude_ifindex=7 cloned=keep". Бросает std::invalid_argument.
+    static NetlinkFilterSpec parse(const std::string& text);
+};
+
+// Генерирует classic-BPF программу для SO_ATTACH_FILTER на netlink сокете.
+// Ответы на собственные запросы (ACK, ошибки, части дампов с NLM_F_MULTI)
+// всегда пропускаются, чтобы фильтр не ломал кэши и rtnl_*_change.
+class NetlinkFilter {
+public:
+    explicit NetlinkFilter(const NetlinkFilterSpec& spec);
+
+    const std::vector<struct sock_filter>& program() const { return program_; }
+
+    // Прикрепляет/снимает фильтр с сокета; бросает std::system_error
+    void attach(int fd) const;
+    static void detach(int fd);
+
+private:
+    std::vector<struct sock_filter> program_;
+};
+
+#endif // NETLINK_FILTER_H
@@ -1,21 +1,113 @@
 #include "netlink_manager.h"
-#include <iostream>
+#include "logger.h"
+#include "flight_recorder.h"
+#include "netns.h"
+#include <algorithm>
+#include <memory>
 #include <stdexcept>
 #include <cstring>
 #include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#ifndef SOL_NETLINK
+#define SOL_NETLINK 270
+#endif
+
+namespace {
+
+constexpr int MAX_RECV_BATCH = 64;
+// Размер одной датаграммы submitBatch: ACK на неё должны уместиться в приёмный буфер
+constexpr size_t MAX_BATCH_MESSAGES = 64;
+constexpr size_t MAX_BATCH_BYTES = 32768;
+
+// Части состояния в порядке LoadPhase
+const char* const PHASE_NAMES[] = {"link", "addr", "route"};
+const char* const PHASE_SPANS[] = {"dump link", "dump addr", "dump route"};
+
+// Разбирает RTM_NEWROUTE/RTM_DELROUTE; false - маршрут не попадает в индекс
+// (не IPv4, не основная таблица или не unicast)
+bool parseRouteMessage(struct nlmsghdr* nlh, RouteEntry* route) {
+    struct rtmsg* rtm = (struct rtmsg*)nlmsg_data(nlh);
+    struct nlattr* tb[RTA_MAX + 1];
+
+    if (rtm->rtm_family != AF_INET || rtm->rtm_type != RTN_UNICAST) {
+        return false;
+    }
+    if (nla_parse(tb, RTA_MAX, nlmsg_attrdata(nlh, sizeof(*rtm)), nlmsg_attrlen(nlh, sizeof(*rtm)), NULL) < 0) {
+        return false;
+    }
+    uint32_t table = tb[RTA_TABLE] ? nla_get_u32(tb[RTA_TABLE]) : rtm->rtm_table;
+    if (table != RT_TABLE_MAIN) {
+        return false;
+    }
+
+    route->prefix = tb[RTA_DST] ? ntohl(nla_get_u32(tb[RTA_DST])) : 0;
+    route->prefix_len = rtm->rtm_dst_len;
+    route->priority = tb[RTA_PRIORITY] ? nla_get_u32(tb[RTA_PRIORITY]) : 0;
+    route->protocol = rtm->rtm_protocol;
+    route->gateway = tb[RTA_GATEWAY] ? ntohl(nla_get_u32(tb[RTA_GATEWAY])) : 0;
+    route->ifindex = tb[RTA_OIF] ? static_cast<int>(nla_get_u32(tb[RTA_OIF])) : 0;
+
+    // Для multipath маршрута в индекс попадает первый nexthop
+    if (tb[RTA_MULTIPATH] && nla_len(tb[RTA_MULTIPATH]) >= (int)sizeof(struct rtnexthop)) {
+        struct rtnexthop* nh = (struct rtnexthop*)nla_data(tb[RTA_MULTIPATH]);
+        route->ifindex = nh->rtnh_ifindex;
+        struct nlattr* nh_tb[RTA_MAX + 1];
+        if (nh->rtnh_len > sizeof(*nh) &&
+            nla_parse(nh_tb, RTA_MAX, (struct nlattr*)RTNH_DATA(nh), nh->rtnh_len - sizeof(*nh), NULL) == 0 &&
+            nh_tb[RTA_GATEWAY]) {
+            route->gateway = ntohl(nla_get_u32(nh_tb[RTA_GATEWAY]));
+        }
+    }
+    return true;
+}
+
+} // namespace
 
 
 NetlinkManager::NetlinkManager() 
-    : nl_sock_(nullptr), link_cache_(nullptr), addr_cache_(nullptr), route_cache_(nullptr) {}
+    : nl_sock_(nullptr), query_sock_(nullptr), link_cache_(nullptr), addr_cache_(nullptr), route_cache_(nullptr),
+      messages_metric_(MetricsRegistry::instance().counter("network_daemon_netlink_messages_total",
+                                                           "Netlink messages received on the notification socket")),
+      overruns_metric_(MetricsRegistry::instance().counter(
+          "network_daemon_netlink_overruns_total", "Notification queue overflows (ENOBUFS) forcing a state reload")),
+      recv_errors_metric_(MetricsRegistry::instance().counter(
+          "network_daemon_netlink_errors_total", "Netlink failures", metricLabel("op", "recv"))),
+      request_errors_metric_(MetricsRegistry::instance().counter(
+          "network_daemon_netlink_errors_total", "Netlink failures", metricLabel("op", "request"))),
+      resync_errors_metric_(MetricsRegistry::instance().counter(
+          "network_daemon_netlink_errors_total", "Netlink failures", metricLabel("op", "resync"))) {
+    for (size_t i = 0; i < LOAD_PHASES; ++i) {
+        load_metrics_[i] = &MetricsRegistry::instance().histogram(
+            "network_daemon_state_load_seconds", "Duration of one kernel state dump (initial load and reloads)",
+            metricLabel("phase", PHASE_NAMES[i]));
+    }
+}
 
 NetlinkManager::~NetlinkManager() {
+    clearReplayLog();
     if (route_cache_) nl_cache_free(route_cache_);
     if (addr_cache_) nl_cache_free(addr_cache_);
     if (link_cache_) nl_cache_free(link_cache_);
+    if (query_sock_) nl_socket_free(query_sock_);
     if (nl_sock_) nl_socket_free(nl_sock_);
 }
 
-void NetlinkManager::init() {
+void NetlinkManager::init(int event_fd) {
+    openSockets(event_fd);
+
+    // Уведомления, пришедшие во время дампов, копятся и накладываются на загруженное состояние
+    routes_requested_ = !lazy_routes_;
+    startLoad(LOAD_LINKS | LOAD_ADDRS | (routes_requested_ ? LOAD_ROUTES : 0u));
+}
+
+void NetlinkManager::openSockets(int event_fd) {
+    // Сокет netlink видит то пространство имён, в котором создан
+    NetnsScope netns(netns_fd_);
     nl_sock_ = nl_socket_alloc();
     if (!nl_sock_) {
         throw std::runtime_error("Не удалось создать netlink сокет");
@@ -26,30 +118,248 @@ void NetlinkManager::init() {
     
     // Устанавливаем callback для обработки сообщений
     nl_socket_modify_cb(nl_sock_, NL_CB_MSG_IN, NL_CB_CUSTOM, &NetlinkManager::netlinkCallback, this);
-    nl_socket_set_nonblocking(nl_sock_);
 
-    if (nl_connect(nl_sock_, NETLINK_ROUTE) < 0) {
+    if (event_fd != -1) {
+        if (nl_socket_set_fd(nl_sock_, NETLINK_ROUTE, event_fd) < 0) {
+            nl_socket_free(nl_sock_);
+            throw std::runtime_error("Не удалось принять netlink сокет предыдущего процесса");
+        }
+    } else if (nl_connect(nl_sock_, NETLINK_ROUTE) < 0) {
         nl_socket_free(nl_sock_);
         throw std::runtime_error("Не удалось подключиться к netlink");
     }
+    // До nl_connect дескриптора ещё нет, поэтому неблокирующий режим включаем здесь
+    nl_socket_set_nonblocking(nl_sock_);
 
+    // Подписки принятого сокета сохраняются, повторная подписка ничего не меняет
     if (nl_socket_add_memberships(nl_sock_, RTNLGRP_LINK, RTNLGRP_IPV4_IFADDR, RTNLGRP_IPV4_ROUTE, 0) < 0) {
         nl_close(nl_sock_);
         nl_socket_free(nl_sock_);
         throw std::runtime_error("Не удалось подписаться на netlink группы");
     }
 
-    if (rtnl_link_alloc_cache(nl_sock_, AF_UNSPEC, &link_cache_) < 0) {
-        throw std::runtime_error("Не удалось загрузить кэш ссылок");
+    initQuerySocket();
+}
+
+bool NetlinkManager::routeToEntry(struct rtnl_route* route, RouteEntry* entry) {
+    struct nl_addr* dst = rtnl_route_get_dst(route);
+    if (!dst || rtnl_route_get_family(route) != AF_INET || rtnl_route_get_table(route) != RT_TABLE_MAIN ||
+        rtnl_route_get_type(route) != RTN_UNICAST) {
+        return false;
     }
+    if (nl_addr_get_len(dst) == 4) {
+        entry->prefix = ntohl(*(uint32_t*)nl_addr_get_binary_addr(dst));
+    }
+    entry->prefix_len = static_cast<uint8_t>(nl_addr_get_prefixlen(dst));
+    entry->priority = rtnl_route_get_priority(route);
+    entry->protocol = rtnl_route_get_protocol(route);
 
-    if (rtnl_addr_alloc_cache(nl_sock_, &addr_cache_) < 0) {
-        throw std::runtime_error("Не удалось загрузить кэш адресов");
+    struct rtnl_nexthop* nh = rtnl_route_nexthop_n(route, 0);
+    if (nh) {
+        entry->ifindex = rtnl_route_nh_get_ifindex(nh);
+        struct nl_addr* gw = rtnl_route_nh_get_gateway(nh);
+        if (gw && nl_addr_get_len(gw) == 4) {
+            entry->gateway = ntohl(*(uint32_t*)nl_addr_get_binary_addr(gw));
+        }
     }
+    return true;
+}
 
-    if (rtnl_route_alloc_cache(nl_sock_, AF_INET, 0, &route_cache_) < 0) {
-        throw std::runtime_error("Не удалось загрузить кэш маршрутов");
+void NetlinkManager::loadRouteIndex() {
+    route_index_.clear();
+    struct nl_object* obj = nl_cache_get_first(route_cache_);
+    while (obj) {
+        RouteEntry entry;
+        if (routeToEntry((struct rtnl_route*)obj, &entry)) {
+            route_index_.insert(entry);
+        }
+        obj = nl_cache_get_next(obj);
     }
+    logInfo("NetlinkManager: индекс маршрутов загружен (", route_index_.size(), " маршрутов)");
+}
+
+int NetlinkManager::resyncInterfaceRoutes(int ifindex) {
+    struct nl_cache* routes = nullptr;
+    int err = dumpInterfaceRoutes(ifindex, RT_TABLE_MAIN, &routes);
+    if (err < 0) {
+        return err;
+    }
+    route_index_.removeInterface(ifindex);
+    for (struct nl_object* obj = nl_cache_get_first(routes); obj; obj = nl_cache_get_next(obj)) {
+        RouteEntry entry;
+        // Без NETLINK_GET_STRICT_CHK дамп не отфильтрован ядром
+        if (routeToEntry((struct rtnl_route*)obj, &entry) && entry.ifindex == ifindex) {
+            route_index_.insert(entry);
+        }
+    }
+    nl_cache_free(routes);
+    touchInterface(ifindex);
+    return 0;
+}
+
+void NetlinkManager::initQuerySocket() {
+    // Отдельный блокирующий сокет: ответы на запросы не смешиваются с событиями
+    query_sock_ = nl_socket_alloc();
+    if (!query_sock_) {
+        throw std::runtime_error("Не удалось создать netlink сокет запросов");
+    }
+    if (nl_connect(query_sock_, NETLINK_ROUTE) < 0) {
+        nl_socket_free(query_sock_);
+        query_sock_ = nullptr;
+        throw std::runtime_error("Не удалось подключить netlink сокет запросов");
+    }
+
+    int one = 1;
+    if (setsockopt(nl_socket_get_fd(query_sock_), SOL_NETLINK, NETLINK_GET_STRICT_CHK, &one, sizeof(one)) < 0) {
+        // Ядро < 4.20: фильтры дампа игнорируются, результат фильтруется на нашей стороне
+        logWarning("NetlinkManager: NETLINK_GET_STRICT_CHK недоступен: ", strerror(errno));
+    }
+    // Ошибки без копии исходного запроса: подтверждения пакета всегда помещаются в буфер
+    setsockopt(nl_socket_get_fd(query_sock_), SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+}
+
+int NetlinkManager::queryLink(const std::string& ifname, struct rtnl_link** result) {
+    if (!query_sock_) {
+        return -NLE_BAD_SOCK;
+    }
+    return rtnl_link_get_kernel(query_sock_, 0, ifname.c_str(), result);
+}
+
+int NetlinkManager::pickupDump(struct nl_msg* request, const char* cache_type, struct nl_cache** result) {
+    struct nl_cache* cache = nullptr;
+    int err = nl_cache_alloc_name(cache_type, &cache);
+    if (err < 0) {
+        nlmsg_free(request);
+        return err;
+    }
+
+    err = nl_send_auto(query_sock_, request);
+    nlmsg_free(request);
+    if (err >= 0) {
+        err = nl_cache_pickup(query_sock_, cache);
+    }
+    if (err < 0) {
+        nl_cache_free(cache);
+        return err;
+    }
+
+    *result = cache;
+    return 0;
+}
+
+int NetlinkManager::dumpInterfaceAddrs(int ifindex, struct nl_cache** result) {
+    if (!query_sock_) {
+        return -NLE_BAD_SOCK;
+    }
+
+    struct nl_msg* msg = nlmsg_alloc_simple(RTM_GETADDR, NLM_F_DUMP);
+    if (!msg) {
+        return -NLE_NOMEM;
+    }
+    struct ifaddrmsg ifa = {};
+    ifa.ifa_family = AF_INET;
+    ifa.ifa_index = ifindex;
+    if (nlmsg_append(msg, &ifa, sizeof(ifa), NLMSG_ALIGNTO) < 0) {
+        nlmsg_free(msg);
+        return -NLE_MSGSIZE;
+    }
+    return pickupDump(msg, "route/addr", result);
+}
+
+int NetlinkManager::dumpInterfaceRoutes(int ifindex, uint8_t table, struct nl_cache** result) {
+    if (!query_sock_) {
+        return -NLE_BAD_SOCK;
+    }
+
+    struct nl_msg* msg = nlmsg_alloc_simple(RTM_GETROUTE, NLM_F_DUMP);
+    if (!msg) {
+        return -NLE_NOMEM;
+    }
+    struct rtmsg rtm = {};
+    rtm.rtm_family = AF_INET;
+    rtm.rtm_table = table;
+    if (nlmsg_append(msg, &rtm, sizeof(rtm), NLMSG_ALIGNTO) < 0 ||
+        nla_put_u32(msg, RTA_OIF, ifindex) < 0) {
+        nlmsg_free(msg);
+        return -NLE_MSGSIZE;
+    }
+    return pickupDump(msg, "route/route", result);
+}
+
+int NetlinkManager::submitBatch(const std::vector<struct nl_msg*>& requests, std::vector<int>& errors) {
+    TraceSpan span("netlink ack", TraceCategory::Netlink, requests.size());
+    errors.assign(requests.size(), 0);
+    if (!query_sock_) {
+        return -NLE_BAD_SOCK;
+    }
+
+    // Запросы уходят пачками по несколько в одной датаграмме: ядро обрабатывает их по очереди
+    // за один системный вызов. Следующая пачка отправляется после ACK предыдущей, иначе
+    // подтверждения большого пакета переполнили бы приёмный буфер сокета.
+    size_t next = 0;
+    while (next < requests.size()) {
+        size_t end = next;
+        size_t bytes = 0;
+        while (end < requests.size() && end - next < MAX_BATCH_MESSAGES &&
+               (end == next || bytes + NLMSG_ALIGN(nlmsg_hdr(requests[end])->nlmsg_len) <= MAX_BATCH_BYTES)) {
+            bytes += NLMSG_ALIGN(nlmsg_hdr(requests[end])->nlmsg_len);
+            ++end;
+        }
+        int err = submitChunk(requests, next, end, errors);
+        if (err < 0) {
+            request_errors_metric_.inc();
+            return err;
+        }
+        next = end;
+    }
+    request_errors_metric_.inc(std::count_if(errors.begin(), errors.end(), [](int e) { return e != 0; }));
+    return 0;
+}
+
+int NetlinkManager::submitChunk(const std::vector<struct nl_msg*>& requests, size_t begin, size_t end,
+                                std::vector<int>& errors) {
+    std::vector<char> batch;
+    std::map<uint32_t, size_t> pending; // seq -> индекс запроса
+    for (size_t i = begin; i < end; ++i) {
+        struct nlmsghdr* hdr = nlmsg_hdr(requests[i]);
+        hdr->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+        hdr->nlmsg_seq = batch_seq_++;
+        hdr->nlmsg_pid = nl_socket_get_local_port(query_sock_);
+        size_t offset = batch.size();
+        batch.resize(offset + NLMSG_ALIGN(hdr->nlmsg_len));
+        memcpy(batch.data() + offset, hdr, hdr->nlmsg_len);
+        pending[hdr->nlmsg_seq] = i;
+    }
+
+    int fd = nl_socket_get_fd(query_sock_);
+    struct sockaddr_nl kernel = {};
+    kernel.nl_family = AF_NETLINK;
+    if (sendto(fd, batch.data(), batch.size(), 0, (struct sockaddr*)&kernel, sizeof(kernel)) < 0) {
+        return -errno;
+    }
+
+    char buffer[16384];
+    while (!pending.empty()) {
+        ssize_t len = recv(fd, buffer, sizeof(buffer), 0);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        int remaining = static_cast<int>(len);
+        for (struct nlmsghdr* hdr = (struct nlmsghdr*)buffer; NLMSG_OK(hdr, remaining);
+             hdr = NLMSG_NEXT(hdr, remaining)) {
+            auto it = pending.find(hdr->nlmsg_seq);
+            if (hdr->nlmsg_type != NLMSG_ERROR || it == pending.end()) {
+                continue;
+            }
+            const struct nlmsgerr* ack = (const struct nlmsgerr*)NLMSG_DATA(hdr);
+            errors[it->second] = ack->error;
+            pending.erase(it);
+        }
+    }
+    return 0;
 }
 
 int NetlinkManager::getSocketFd() const {
@@ -60,19 +370,245 @@ struct nl_sock* NetlinkManager::getSocket() const {
     return nl_sock_;
 }
 
-void NetlinkManager::processEvents() {
-    int err = nl_recvmsgs_default(nl_sock_);
-    if (err < 0) {
-        // Игнорируем ошибки EAGAIN и временные ошибки
-        if (err != -NLE_AGAIN && err != -NLE_INTR) {
-            std::cerr << "Ошибка получения netlink сообщений: " << nl_geterror(err) << std::endl;
+void NetlinkManager::setEventFilter(const NetlinkFilterSpec& spec) {
+    NetlinkFilter filter(spec);
+    filter.attach(getSocketFd());
+
+    // Фильтр, отбрасывающий часть изменений состояния, делает номер состояния ненадёжным
+    bool all_types = true;
+    for (uint16_t type : {RTM_NEWLINK, RTM_DELLINK, RTM_NEWADDR, RTM_DELADDR, RTM_NEWROUTE, RTM_DELROUTE}) {
+        all_types = all_types && spec.msg_types.count(type);
+    }
+    filter_complete_ = all_types && spec.ifindexes.empty() && spec.exclude_ifindexes.empty() &&
+                       spec.route_protocols.empty() &&
+                       (spec.route_tables.empty() || spec.route_tables.count(RT_TABLE_MAIN));
+    logInfo("NetlinkManager: BPF фильтр установлен (", filter.program().size(), " инструкций)");
+}
+
+bool NetlinkManager::processEvents() {
+    TraceSpan span("receive", TraceCategory::Event);
+    // nl_recvmsgs читает одну датаграмму; выбираем очередь целиком (с ограничением,
+    // чтобы шторм событий не блокировал остальные дескрипторы цикла)
+    for (int i = 0; i < MAX_RECV_BATCH; ++i) {
+        int err = nl_recvmsgs_default(nl_sock_);
+        if (err < 0) {
+            if (err == -NLE_NOMEM) {
+                // ENOBUFS: ядро потеряло часть уведомлений, кэши больше не совпадают с ядром
+                logWarning("NetlinkManager: переполнение очереди уведомлений, перечитываем состояние");
+                overruns_metric_.inc();
+                resyncState();
+            } else if (err != -NLE_AGAIN && err != -NLE_INTR) {
+                // Игнорируем ошибки EAGAIN и временные ошибки
+                logError("Ошибка получения netlink сообщений: ", nl_geterror(err));
+                recv_errors_metric_.inc();
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+void NetlinkManager::resyncState() {
+    startLoad(LOAD_LINKS | LOAD_ADDRS | (routes_requested_ ? LOAD_ROUTES : 0u));
+}
+
+void NetlinkManager::startLoad(unsigned phases) {
+    if (resync_in_progress_) {
+        // Уведомления до завершения текущей загрузки копятся для повтора; эта начнётся после неё
+        pending_phases_ |= phases;
+        return;
+    }
+    resync_in_progress_ = true;
+
+    // Дампы могут быть большими: каждый идёт в пуле потоков через свой временный сокет
+    // (на сокете событий стоят свой callback и BPF фильтр), а подмена кэшей - в цикле событий
+    // после завершения всех
+    auto snapshot = std::make_shared<StateSnapshot>();
+    snapshot->phases = phases;
+    snapshot->started = std::chrono::steady_clock::now();
+    snapshot->netns_fd = netns_fd_;
+    for (size_t i = 0; i < LOAD_PHASES; ++i) {
+        if (phases & (1u << i)) {
+            ++snapshot->remaining;
+        }
+    }
+    for (size_t i = 0; i < LOAD_PHASES; ++i) {
+        if (!(phases & (1u << i))) {
+            continue;
+        }
+        auto job = [snapshot, i]() { dumpPhase(*snapshot, i); };
+        auto finish = [this, snapshot]() {
+            if (--snapshot->remaining == 0) {
+                installState(*snapshot);
+            }
+        };
+        if (!worker_pool_ || !worker_pool_->submit(job, finish)) {
+            job();
+            finish();
         }
     }
 }
 
+void NetlinkManager::dumpPhase(StateSnapshot& snapshot, size_t phase) {
+    TraceSpan span(PHASE_SPANS[phase], TraceCategory::Netlink);
+    auto started = std::chrono::steady_clock::now();
+    struct nl_cache*& cache = snapshot.caches[phase];
+    struct nl_sock* sock = nl_socket_alloc();
+    bool connected = false;
+    if (sock) {
+        try {
+            NetnsScope netns(snapshot.netns_fd);
+            connected = nl_connect(sock, NETLINK_ROUTE) == 0;
+        } catch (const std::exception& e) {
+            logError("NetlinkManager: ", e.what());
+        }
+    }
+    if (connected) {
+        int err;
+        switch (1u << phase) {
+            case LOAD_LINKS: err = rtnl_link_alloc_cache(sock, AF_UNSPEC, &cache); break;
+            case LOAD_ADDRS: err = rtnl_addr_alloc_cache(sock, &cache); break;
+            default: err = rtnl_route_alloc_cache(sock, AF_INET, 0, &cache); break;
+        }
+        if (err < 0) {
+            cache = nullptr;
+        }
+    }
+    if (sock) nl_socket_free(sock);
+    snapshot.durations[phase] = std::chrono::steady_clock::now() - started;
+}
+
+void NetlinkManager::installState(StateSnapshot& snapshot) {
+    resync_in_progress_ = false;
+    bool ok = true;
+    for (size_t i = 0; i < LOAD_PHASES; ++i) {
+        if (snapshot.phases & (1u << i)) {
+            ok = ok && snapshot.caches[i];
+            load_metrics_[i]->observe(snapshot.durations[i]);
+        }
+    }
+    if (!ok) {
+        logError("NetlinkManager: не удалось загрузить состояние ядра");
+        resync_errors_metric_.inc();
+        for (struct nl_cache* cache : snapshot.caches) {
+            if (cache) nl_cache_free(cache);
+        }
+        clearReplayLog();
+        if (!routes_ready_) {
+            routes_requested_ = (pending_phases_ & LOAD_ROUTES) != 0; // Следующий whenRoutesReady повторит
+        }
+    } else {
+        struct nl_cache** targets[LOAD_PHASES] = {&link_cache_, &addr_cache_, &route_cache_};
+        std::string timings;
+        for (size_t i = 0; i < LOAD_PHASES; ++i) {
+            if (!(snapshot.phases & (1u << i))) {
+                continue;
+            }
+            std::swap(*targets[i], snapshot.caches[i]);
+            if (snapshot.caches[i]) nl_cache_free(snapshot.caches[i]);
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(snapshot.durations[i]).count();
+            timings.append(timings.empty() ? "" : ", ").append(PHASE_NAMES[i]).append(" ")
+                .append(std::to_string(nl_cache_nitems(*targets[i]))).append(" за ")
+                .append(std::to_string(us)).append(" мкс");
+        }
+        if (snapshot.phases & LOAD_ROUTES) {
+            loadRouteIndex();
+        }
+        interface_generations_.clear();
+        touchInterface(0);
+
+        // Уведомления, пришедшие пока шли дампы, накладываем поверх нового снимка
+        size_t replayed = replay_log_.size();
+        for (struct nl_msg* msg : replay_log_) {
+            applyToState(msg);
+        }
+        clearReplayLog();
+
+        auto total = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() -
+                                                                           snapshot.started).count();
+        logInfo("NetlinkManager: состояние загружено за ", total, " мкс (", timings, "; повторено ", replayed,
+                " уведомлений)");
+        state_ready_ = state_ready_ || (snapshot.phases & LOAD_LINKS);
+        routes_ready_ = routes_ready_ || (snapshot.phases & LOAD_ROUTES);
+    }
+
+    if (pending_phases_) {
+        unsigned phases = pending_phases_;
+        pending_phases_ = 0;
+        startLoad(phases);
+    }
+    notifyWaiters(snapshot.phases, ok);
+}
+
+void NetlinkManager::notifyWaiters(unsigned phases, bool ok) {
+    auto fire = [](std::vector<ReadyCallback>& waiters, bool result) {
+        std::vector<ReadyCallback> callbacks;
+        callbacks.swap(waiters);
+        for (ReadyCallback& callback : callbacks) {
+            callback(result);
+        }
+    };
+    if (isReady() || (!ok && (phases & (LOAD_LINKS | LOAD_ADDRS)))) {
+        fire(ready_waiters_, isReady());
+    }
+    if (areRoutesReady() || !ok) {
+        fire(route_waiters_, areRoutesReady());
+    }
+}
+
+void NetlinkManager::whenReady(ReadyCallback callback) {
+    if (isReady() || !resync_in_progress_) {
+        callback(isReady()); // Загрузка уже не удалась
+        return;
+    }
+    ready_waiters_.push_back(std::move(callback));
+}
+
+void NetlinkManager::whenRoutesReady(ReadyCallback callback) {
+    if (areRoutesReady()) {
+        callback(true);
+        return;
+    }
+    route_waiters_.push_back(std::move(callback));
+    if (!routes_requested_) {
+        routes_requested_ = true;
+        logInfo("NetlinkManager: загружаем маршруты по первому запросу");
+        startLoad(LOAD_ROUTES);
+    }
+}
+
+void NetlinkManager::setLazyRoutes(bool lazy) {
+    lazy_routes_ = lazy;
+}
+
+void NetlinkManager::clearReplayLog() {
+    for (struct nl_msg* msg : replay_log_) {
+        nlmsg_free(msg);
+    }
+    replay_log_.clear();
+}
+
+void NetlinkManager::setWorkerPool(WorkerPool* pool) {
+    worker_pool_ = pool;
+}
+
+void NetlinkManager::setNetns(int netns_fd) {
+    netns_fd_ = netns_fd;
+}
+
+void NetlinkManager::includeInCache(struct nl_cache* cache, struct nl_msg* msg) {
+    if (!cache) {
+        return;
+    }
+    nl_msg_parse(msg, [](struct nl_object* obj, void* arg) {
+        nl_cache_include(static_cast<struct nl_cache*>(arg), obj, nullptr, nullptr);
+    }, cache);
+}
+
 int NetlinkManager::netlinkCallback(struct nl_msg* msg, void* arg) {
     NetlinkManager* self = static_cast<NetlinkManager*>(arg);
     struct nlmsghdr* nlh = nlmsg_hdr(msg);
+    self->messages_metric_.inc();
     
     // Игнорируем сообщения типа NLMSG_DONE (тип 3)
     if (nlh->nlmsg_type == NLMSG_DONE) {
@@ -93,26 +629,98 @@ int NetlinkManager::netlinkCallback(struct nl_msg* msg, void* arg) {
             self->processRouteMessage(msg);
             break;
         default:
-            std::cout << "Необработанное netlink сообщение, тип=" << nlh->nlmsg_type << std::endl;
+            logInfo("Необработанное netlink сообщение, тип=", nlh->nlmsg_type);
             break;
     }
     
     return NL_OK;
 }
 
+void NetlinkManager::applyToState(struct nl_msg* msg) {
+    struct nlmsghdr* nlh = nlmsg_hdr(msg);
+
+    switch (nlh->nlmsg_type) {
+        case RTM_NEWLINK:
+        case RTM_DELLINK: {
+            // При отключении интерфейса ядро удаляет его маршруты без RTM_DELROUTE
+            struct ifinfomsg* ifi = (struct ifinfomsg*)nlmsg_data(nlh);
+            if (nlh->nlmsg_type == RTM_DELLINK || !(ifi->ifi_flags & IFF_UP)) {
+                route_index_.removeInterface(ifi->ifi_index);
+            }
+            // Кэш интерфейсов держим актуальным; AF_BRIDGE уведомления о портах моста в него не входят
+            if (ifi->ifi_family == AF_UNSPEC) {
+                includeInCache(link_cache_, msg);
+            }
+            touchInterface(ifi->ifi_index);
+            if (nlh->nlmsg_type == RTM_DELLINK) {
+                interface_generations_.erase(ifi->ifi_index);
+            }
+            break;
+        }
+        case RTM_NEWADDR:
+        case RTM_DELADDR:
+            includeInCache(addr_cache_, msg);
+            touchInterface(((struct ifaddrmsg*)nlmsg_data(nlh))->ifa_index);
+            break;
+        case RTM_NEWROUTE:
+        case RTM_DELROUTE: {
+            RouteEntry route;
+            if (parseRouteMessage(nlh, &route)) {
+                if (nlh->nlmsg_type == RTM_NEWROUTE) {
+                    route_index_.insert(route);
+                } else {
+                    route_index_.remove(route.prefix, route.prefix_len, route.priority);
+                }
+                touchInterface(route.ifindex);
+            }
+            break;
+        }
+    }
+
+    if (resync_in_progress_) {
+        replay_log_.push_back(nlmsg_convert(nlh));
+    }
+}
+
+void NetlinkManager::touchInterface(int ifindex) {
+    ++generation_;
+    if (ifindex > 0) {
+        interface_generations_[ifindex] = generation_;
+    } else {
+        epoch_ = generation_;
+    }
+}
+
+uint64_t NetlinkManager::getInterfaceGeneration(int ifindex) const {
+    auto it = interface_generations_.find(ifindex);
+    return it != interface_generations_.end() && it->second > epoch_ ? it->second : epoch_;
+}
+
+bool NetlinkManager::isTrackingComplete() const {
+    return filter_complete_ && !resync_in_progress_;
+}
+
+bool NetlinkManager::hasPendingEvents() const {
+    struct pollfd pfd = {getSocketFd(), POLLIN, 0};
+    return poll(&pfd, 1, 0) > 0;
+}
+
 void NetlinkManager::processLinkMessage(struct nl_msg* msg) {
+    applyToState(msg);
     if (link_callback_) {
         link_callback_(msg);
     }
 }
 
 void NetlinkManager::processAddrMessage(struct nl_msg* msg) {
+    applyToState(msg);
     if (addr_callback_) {
         addr_callback_(msg);
     }
 }
 
 void NetlinkManager::processRouteMessage(struct nl_msg* msg) {
+    applyToState(msg);
     if (route_callback_) {
         route_callback_(msg);
     }
@@ -142,9 +750,13 @@ struct nl_cache* NetlinkManager::getRouteCache() const {
     return route_cache_;
 }
 
+const RouteTable& NetlinkManager::getRouteIndex() const {
+    return route_index_;
+}
+
 std::string NetlinkManager::getInterfaceName(int ifindex) const {
     char ifname[IF_NAMESIZE];
-    const char* name = rtnl_link_i2name(link_cache_, ifindex, ifname, sizeof(ifname));
+    const char* name = link_cache_ ? rtnl_link_i2name(link_cache_, ifindex, ifname, sizeof(ifname)) : nullptr;
     if (!name) {
         snprintf(ifname, sizeof(ifname), "unknown-%d", ifindex);
     }
@@ -152,5 +764,5 @@ std::string NetlinkManager::getInterfaceName(int ifindex) const {
 }
 
 int NetlinkManager::getInterfaceIndex(const std::string& ifname) const {
-    return rtnl_link_name2i(link_cache_, ifname.c_str());
+    return link_cache_ ? rtnl_link_name2i(link_cache_, ifname.c_str()) : 0;
 }
\ No newline at end of file
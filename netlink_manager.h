@@ -7,40 +7,115 @@
 #include <netlink/route/addr.h>
 #include <netlink/route/route.h>
 #include <netlink/cache.h>
+#include "metrics.h"
+#include "netlink_filter.h"
+#include "route_table.h"
+#include "worker_pool.h"
+#include <array>
+#include <chrono>
 #include <functional>
 #include <map>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 class NetlinkManager {
 public:
     using LinkCallback = std::function<void(struct nl_msg*)>;
     using AddrCallback = std::function<void(struct nl_msg*)>;
     using RouteCallback = std::function<void(struct nl_msg*)>;
+    using ReadyCallback = std::function<void(bool ok)>;
 
     NetlinkManager();
     ~NetlinkManager();
 
-    void init();
+    // Открывает сокеты и запускает загрузку состояния: дампы link, addr и route идут
+    // параллельно, каждый через свой сокет в пуле потоков. Кэши появляются позже,
+    // в цикле событий (см. whenReady); до этого они пусты (nullptr).
+    // event_fd - сокет уведомлений, принятый от предыдущего процесса: уведомления,
+    // пришедшие во время передачи, не теряются.
+    void init(int event_fd = -1);
+    // Пул для дампов состояния (начальная загрузка, перечитывание после переполнения
+    // очереди); без пула - синхронно. Задаётся до init.
+    void setWorkerPool(WorkerPool* pool);
+    // Маршруты загружаются не в init, а при первом whenRoutesReady. Задаётся до init.
+    void setLazyRoutes(bool lazy);
+    // Сокеты открываются в пространстве имён netns_fd (-1 - в пространстве демона);
+    // fd принадлежит вызывающему и должен жить дольше менеджера. Задаётся до init.
+    void setNetns(int netns_fd);
+
+    // Загружены интерфейсы и адреса
+    bool isReady() const { return state_ready_; }
+    // Загружены и маршруты (вместе с интерфейсами и адресами)
+    bool areRoutesReady() const { return state_ready_ && routes_ready_; }
+    // callback(true) вызывается, когда состояние загружено (сразу, если уже загружено),
+    // callback(false) - если загрузка не удалась
+    void whenReady(ReadyCallback callback);
+    void whenRoutesReady(ReadyCallback callback);
     int getSocketFd() const;
     struct nl_sock* getSocket() const; // Добавлен новый метод
-    void processEvents();
+    // Обрабатывает накопившиеся уведомления; true - достигнут предел пачки и в очереди могут остаться ещё
+    bool processEvents();
+
+    // Прикрепляет BPF фильтр к сокету событий, ядро отбрасывает лишние уведомления
+    void setEventFilter(const NetlinkFilterSpec& spec);
 
     void setLinkCallback(LinkCallback callback);
     void setAddrCallback(AddrCallback callback);
     void setRouteCallback(RouteCallback callback);
 
+    // Кэши интерфейсов и адресов обновляются по уведомлениям и отражают текущее состояние ядра
     struct nl_cache* getLinkCache() const;
     struct nl_cache* getAddrCache() const;
     struct nl_cache* getRouteCache() const;
 
+    // Точечные запросы к ядру через отдельный сокет с NETLINK_GET_STRICT_CHK:
+    // ядро само фильтрует дамп по ifindex/таблице, стоимость зависит только
+    // от объектов одного интерфейса. Возвращают код ошибки libnl (< 0) при неудаче,
+    // полученные объекты освобождает вызывающий (rtnl_link_put / nl_cache_free).
+    int queryLink(const std::string& ifname, struct rtnl_link** result);
+    int dumpInterfaceAddrs(int ifindex, struct nl_cache** result);
+    int dumpInterfaceRoutes(int ifindex, uint8_t table, struct nl_cache** result);
+
+    // Отправляет запросы изменения через сокет запросов пачками (по много запросов
+    // в одном sendmsg) и собирает ACK на каждый. errors[i] - 0 или -errno ядра для requests[i] (ядро продолжает
+    // обработку после ошибки). Возвращает -errno, если не удался сам обмен.
+    int submitBatch(const std::vector<struct nl_msg*>& requests, std::vector<int>& errors);
+
+    // LPM индекс IPv4 маршрутов основной таблицы, обновляется по RTM_NEWROUTE/RTM_DELROUTE
+    const RouteTable& getRouteIndex() const;
+    // Перечитывает маршруты интерфейса в индекс. Нужно после удаления последнего адреса:
+    // ядро снимает маршруты интерфейса без RTM_DELROUTE
+    int resyncInterfaceRoutes(int ifindex);
+
     std::string getInterfaceName(int ifindex) const;
     int getInterfaceIndex(const std::string& ifname) const;
 
+    // Номер состояния: растёт с каждым применённым изменением (уведомление, перечитывание).
+    // Результат, вычисленный при том же номере, ещё верен, если isTrackingComplete().
+    uint64_t getGeneration() const { return generation_; }
+    // Номер последнего изменения интерфейса: link, его адреса и маршруты через него
+    uint64_t getInterfaceGeneration(int ifindex) const;
+    // До кэшей доходят все изменения link/addr и маршрутов main: фильтр событий
+    // их не отбрасывает и не идёт полное перечитывание
+    bool isTrackingComplete() const;
+    // В сокете событий есть ещё не обработанные уведомления
+    bool hasPendingEvents() const;
+
 private:
     struct nl_sock* nl_sock_;
+    struct nl_sock* query_sock_;
     struct nl_cache* link_cache_;
     struct nl_cache* addr_cache_;
     struct nl_cache* route_cache_;
+    RouteTable route_index_;
+    // Свои номера для пакетных запросов: счётчик libnl сверяется с ожидаемым ответом
+    uint32_t batch_seq_ = 0x80000000u;
+
+    uint64_t generation_ = 0;
+    uint64_t epoch_ = 0; // Изменение, затронувшее все интерфейсы
+    std::unordered_map<int, uint64_t> interface_generations_;
+    bool filter_complete_ = true;
 
     LinkCallback link_callback_;
     AddrCallback addr_callback_;
@@ -50,6 +125,54 @@ private:
     void processLinkMessage(struct nl_msg* msg);
     void processAddrMessage(struct nl_msg* msg);
     void processRouteMessage(struct nl_msg* msg);
+    void openSockets(int event_fd);
+    void initQuerySocket();
+    void loadRouteIndex();
+    static bool routeToEntry(struct rtnl_route* route, RouteEntry* entry);
+    int submitChunk(const std::vector<struct nl_msg*>& requests, size_t begin, size_t end, std::vector<int>& errors);
+    void includeInCache(struct nl_cache* cache, struct nl_msg* msg);
+    void applyToState(struct nl_msg* msg);
+    // Новый номер состояния; ifindex 0 - изменение не привязано к одному интерфейсу
+    void touchInterface(int ifindex);
+
+    // Загрузка состояния: каждая часть - отдельный дамп (начальная загрузка,
+    // ленивая загрузка маршрутов, полное перечитывание после ENOBUFS)
+    enum LoadPhase : unsigned { LOAD_LINKS = 1, LOAD_ADDRS = 2, LOAD_ROUTES = 4 };
+    static constexpr size_t LOAD_PHASES = 3;
+    struct StateSnapshot {
+        unsigned phases = 0; // Загружаемые части (LoadPhase)
+        int remaining = 0;   // Незавершённые дампы; меняется только в цикле событий
+        std::chrono::steady_clock::time_point started;
+        int netns_fd = -1;   // Пространство имён, в котором открываются сокеты дампов
+        // По номеру части; каждый дамп пишет только свои ячейки
+        std::array<struct nl_cache*, LOAD_PHASES> caches{};
+        std::array<std::chrono::steady_clock::duration, LOAD_PHASES> durations{};
+    };
+    WorkerPool* worker_pool_ = nullptr;
+    int netns_fd_ = -1;
+    bool resync_in_progress_ = false;
+    std::vector<struct nl_msg*> replay_log_; // Уведомления, полученные во время перечитывания
+    unsigned pending_phases_ = 0; // Запрошены, пока шла другая загрузка
+    bool lazy_routes_ = false;
+    bool routes_requested_ = false; // Маршруты загружены или загружаются
+    bool state_ready_ = false;
+    bool routes_ready_ = false;
+    std::vector<ReadyCallback> ready_waiters_;
+    std::vector<ReadyCallback> route_waiters_;
+
+    Counter& messages_metric_;
+    Counter& overruns_metric_;
+    Counter& recv_errors_metric_;
+    Counter& request_errors_metric_;
+    Counter& resync_errors_metric_;
+    std::array<Histogram*, LOAD_PHASES> load_metrics_; // Время дампа по частям
+    void resyncState();
+    void startLoad(unsigned phases);
+    static void dumpPhase(StateSnapshot& snapshot, size_t phase);
+    void installState(StateSnapshot& snapshot);
+    void notifyWaiters(unsigned phases, bool ok);
+    void clearReplayLog();
+    int pickupDump(struct nl_msg* request, const char* cache_type, struct nl_cache** result);
 };
 
 #endif // NETLINK_MANAGER_H
\ No newline at end of file
@@ -0,0 +1,208 @@
+#include "netlink_transaction.h"
+#include "logger.h"
+#include <netlink/errno.h>
+#include <netlink/route/nexthop.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <cstring>
+
+namespace {
+
+std::string addrToString(struct nl_addr* addr) {
+    char buf[64] = {0};
+    return addr ? nl_addr2str(addr, buf, sizeof(buf)) : "none";
+}
+
+} // namespace
+
+struct rtnl_route* NetlinkTransaction::buildDefaultRoute(uint32_t gateway, int ifindex, uint32_t priority,
+                                                         uint8_t protocol) {
+    struct rtnl_route* route = rtnl_route_alloc();
+    uint32_t dst_be = 0;
+    uint32_t gw_be = htonl(gateway);
+    struct nl_addr* dst = nl_addr_build(AF_INET, &dst_be, sizeof(dst_be));
+    nl_addr_set_prefixlen(dst, 0);
+    rtnl_route_set_family(route, AF_INET);
+    rtnl_route_set_dst(route, dst);
+    rtnl_route_set_table(route, RT_TABLE_MAIN);
+    rtnl_route_set_protocol(route, protocol);
+    rtnl_route_set_scope(route, RT_SCOPE_UNIVERSE);
+    rtnl_route_set_priority(route, priority);
+    nl_addr_put(dst);
+
+    struct rtnl_nexthop* nh = rtnl_route_nh_alloc();
+    if (gateway) {
+        struct nl_addr* gw = nl_addr_build(AF_INET, &gw_be, sizeof(gw_be));
+        rtnl_route_nh_set_gateway(nh, gw);
+        nl_addr_put(gw);
+    }
+    rtnl_route_nh_set_ifindex(nh, ifindex);
+    rtnl_route_add_nexthop(route, nh);
+    return route;
+}
+
+NetlinkTransaction::NetlinkTransaction(NetlinkManager& netlink_mgr)
+    : netlink_mgr_(netlink_mgr) {}
+
+NetlinkTransaction::~NetlinkTransaction() {
+    clear();
+}
+
+void NetlinkTransaction::clear() {
+    for (auto& step : steps_) {
+        nlmsg_free(step.forward);
+        if (step.undo) nlmsg_free(step.undo);
+    }
+    steps_.clear();
+}
+
+int NetlinkTransaction::stage(std::string description, int err, struct nl_msg* forward, struct nl_msg* undo) {
+    if (err < 0) {
+        if (forward) nlmsg_free(forward);
+        if (undo) nlmsg_free(undo);
+        return err;
+    }
+    steps_.push_back({std::move(description), forward, undo});
+    return 0;
+}
+
+int NetlinkTransaction::setLinkUp(struct rtnl_link* link, bool up) {
+    struct rtnl_link* change = rtnl_link_alloc();
+    struct rtnl_link* revert = rtnl_link_alloc();
+    if (!change || !revert) {
+        if (change) rtnl_link_put(change);
+        if (revert) rtnl_link_put(revert);
+        return -NLE_NOMEM;
+    }
+    if (up) {
+        rtnl_link_set_flags(change, IFF_UP);
+        rtnl_link_unset_flags(revert, IFF_UP);
+    } else {
+        rtnl_link_unset_flags(change, IFF_UP);
+        rtnl_link_set_flags(revert, IFF_UP);
+    }
+
+    struct nl_msg* forward = nullptr;
+    struct nl_msg* undo = nullptr;
+    int err = rtnl_link_build_change_request(link, change, 0, &forward);
+    if (err >= 0) {
+        err = rtnl_link_build_change_request(link, revert, 0, &undo);
+    }
+    rtnl_link_put(change);
+    rtnl_link_put(revert);
+
+    const char* name = rtnl_link_get_name(link);
+    return stage(std::string("link ") + (name ? name : "?") + (up ? " up" : " down"), err, forward, undo);
+}
+
+int NetlinkTransaction::addAddress(struct rtnl_addr* addr) {
+    struct nl_msg* forward = nullptr;
+    struct nl_msg* undo = nullptr;
+    int err = rtnl_addr_build_add_request(addr, NLM_F_EXCL, &forward);
+    if (err >= 0) {
+        err = rtnl_addr_build_delete_request(addr, 0, &undo);
+    }
+    return stage("address " + addrToString(rtnl_addr_get_local(addr)), err, forward, undo);
+}
+
+int NetlinkTransaction::deleteAddress(struct rtnl_addr* addr) {
+    struct nl_msg* forward = nullptr;
+    struct nl_msg* undo = nullptr;
+    int err = rtnl_addr_build_delete_request(addr, 0, &forward);
+    if (err >= 0) {
+        err = rtnl_addr_build_add_request(addr, NLM_F_EXCL, &undo);
+    }
+    return stage("address removal " + addrToString(rtnl_addr_get_local(addr)), err, forward, undo);
+}
+
+int NetlinkTransaction::replaceRoute(struct rtnl_route* route, struct rtnl_route* previous) {
+    struct nl_msg* forward = nullptr;
+    struct nl_msg* undo = nullptr;
+    int err = rtnl_route_build_add_request(route, NLM_F_REPLACE, &forward);
+    if (err >= 0) {
+        err = previous ? rtnl_route_build_add_request(previous, NLM_F_REPLACE, &undo)
+                       : rtnl_route_build_del_request(route, 0, &undo);
+    }
+    return stage("route " + addrToString(rtnl_route_get_dst(route)), err, forward, undo);
+}
+
+int NetlinkTransaction::deleteRoute(struct rtnl_route* route) {
+    struct nl_msg* forward = nullptr;
+    struct nl_msg* undo = nullptr;
+    int err = rtnl_route_build_del_request(route, 0, &forward);
+    if (err >= 0) {
+        err = rtnl_route_build_add_request(route, NLM_F_EXCL, &undo);
+    }
+    return stage("route removal " + addrToString(rtnl_route_get_dst(route)), err, forward, undo);
+}
+
+int NetlinkTransaction::commit() {
+    failed_step_.clear();
+    failed_index_ = 0;
+    rollback_complete_ = true;
+    if (steps_.empty()) {
+        return 0;
+    }
+
+    std::vector<struct nl_msg*> requests;
+    for (const auto& step : steps_) {
+        requests.push_back(step.forward);
+    }
+    std::vector<int> errors;
+    int err = netlink_mgr_.submitBatch(requests, errors);
+    if (err < 0) {
+        // Обмен прервался: что именно применено, неизвестно, откатывать вслепую нельзя
+        logError("NetlinkTransaction: batch submission failed: ", strerror(-err));
+        failed_step_ = "batch";
+        failed_index_ = std::string::npos;
+        rollback_complete_ = false;
+        clear();
+        return err;
+    }
+
+    std::vector<size_t> applied;
+    int first_error = 0;
+    for (size_t i = 0; i < steps_.size(); ++i) {
+        if (errors[i] == 0) {
+            applied.push_back(i);
+        } else if (first_error == 0) {
+            first_error = errors[i];
+            failed_step_ = steps_[i].description;
+            failed_index_ = i;
+        }
+    }
+
+    if (first_error < 0) {
+        logError("NetlinkTransaction: ", failed_step_, " failed: ", strerror(-first_error), ", rolling back ",
+                 applied.size(), " step(s)");
+        rollback(applied);
+    }
+    clear();
+    return first_error;
+}
+
+void NetlinkTransaction::rollback(const std::vector<size_t>& applied) {
+    std::vector<struct nl_msg*> requests;
+    std::vector<size_t> indexes;
+    for (auto it = applied.rbegin(); it != applied.rend(); ++it) {
+        if (steps_[*it].undo) {
+            requests.push_back(steps_[*it].undo);
+            indexes.push_back(*it);
+        }
+    }
+
+    std::vector<int> errors;
+    int err = netlink_mgr_.submitBatch(requests, errors);
+    if (err < 0) {
+        logError("NetlinkTransaction: rollback submission failed: ", strerror(-err));
+        rollback_complete_ = false;
+        return;
+    }
+    for (size_t i = 0; i < errors.size(); ++i) {
+        if (errors[i] < 0) {
+            logError("NetlinkTransaction: failed to roll back ", steps_[indexes[i]].description, ": ",
+                     strerror(-errors[i]));
+            rollback_complete_ = false;
+        }
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef NETLINK_TRANSACTION_H
+#define NETLINK_TRANSACTION_H
+
+#include "netlink_manager.h"
+#include <string>
+#include <vector>
+
+// Набор изменений link/addr/route, применяемый по принципу "всё или ничего".
+// Для каждого шага заранее строится обратный запрос; commit() отправляет все
+// шаги одним пакетом через NetlinkManager::submitBatch, а при ошибке любого
+// шага откатывает уже применённые в обратном порядке (тоже одним пакетом).
+class NetlinkTransaction {
+public:
+    explicit NetlinkTransaction(NetlinkManager& netlink_mgr);
+    ~NetlinkTransaction();
+
+    NetlinkTransaction(const NetlinkTransaction&) = delete;
+    NetlinkTransaction& operator=(const NetlinkTransaction&) = delete;
+
+    // Методы подготовки шагов возвращают код ошибки libnl (< 0), если запрос не собрать.
+    // Объекты libnl не захватываются, вызывающий освобождает их сам.
+    int setLinkUp(struct rtnl_link* link, bool up);
+    // Добавляет адрес с NLM_F_EXCL: уже существующий адрес не будет удалён при откате
+    int addAddress(struct rtnl_addr* addr);
+    int deleteAddress(struct rtnl_addr* addr);
+    // previous - маршрут с тем же ключом до изменения (nullptr - его не было)
+    int replaceRoute(struct rtnl_route* route, struct rtnl_route* previous);
+    int deleteRoute(struct rtnl_route* route);
+
+    // Маршрут по умолчанию основной таблицы (адреса в порядке байт хоста, gateway == 0 - без шлюза).
+    // Освобождается через rtnl_route_put.
+    static struct rtnl_route* buildDefaultRoute(uint32_t gateway, int ifindex, uint32_t priority, uint8_t protocol);
+
+    bool empty() const { return steps_.empty(); }
+    size_t size() const { return steps_.size(); }
+
+    // Применяет шаги; 0 - применены все, иначе -errno первого неудачного шага
+    // (его описание в failedStep()). После вызова транзакция пуста.
+    int commit();
+    const std::string& failedStep() const { return failed_step_; }
+    // После ошибки commit: номер неудачного шага в порядке подготовки (npos - обмен прервался)
+    size_t failedIndex() const { return failed_index_; }
+    // false - часть шагов не удалось откатить (подробности в журнале)
+    bool rollbackComplete() const { return rollback_complete_; }
+
+private:
+    struct Step {
+        std::string description;
+        struct nl_msg* forward;
+        struct nl_msg* undo; // nullptr - откатывать нечего
+    };
+
+    NetlinkManager& netlink_mgr_;
+    std::vector<Step> steps_;
+    std::string failed_step_;
+    size_t failed_index_ = 0;
+    bool rollback_complete_ = true;
+
+    int stage(std::string description, int err, struct nl_msg* forward, struct nl_msg* undo);
+    void rollback(const std::vector<size_t>& applied);
+    void clear();
+};
+
+#endif // NETLINK_TRANSACTION_H
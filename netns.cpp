@@ -0,0 +1,90 @@
+#include "netns.h"
+#include "logger.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+
+namespace {
+
+// Каталог именованных пространств ip netns
+const char* NETNS_RUN_DIR = "/run/netns/";
+// Имя входит в путь сокета, а он ограничен sizeof(sun_path)
+constexpr size_t MAX_NETNS_NAME = 32;
+
+bool validName(const std::string& name) {
+    return !name.empty() && name.size() <= MAX_NETNS_NAME && name != "." && name != ".." &&
+           std::all_of(name.begin(), name.end(), [](unsigned char c) {
+               return std::isalnum(c) || c == '_' || c == '-' || c == '.';
+           });
+}
+
+} // namespace
+
+std::vector<NetnsSpec> parseNetnsList(const std::string& text) {
+    std::vector<NetnsSpec> specs;
+    std::istringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (item.empty()) {
+            continue;
+        }
+        NetnsSpec spec;
+        size_t eq = item.find('=');
+        spec.name = item.substr(0, eq);
+        spec.path = eq == std::string::npos ? NETNS_RUN_DIR + spec.name : item.substr(eq + 1);
+        if (!validName(spec.name)) {
+            throw std::invalid_argument("неверное имя пространства имён: " + spec.name);
+        }
+        if (spec.path.empty() || spec.path[0] != '/') {
+            throw std::invalid_argument("путь пространства имён " + spec.name + " должен быть абсолютным");
+        }
+        for (const NetnsSpec& other : specs) {
+            if (other.name == spec.name) {
+                throw std::invalid_argument("пространство имён " + spec.name + " указано дважды");
+            }
+        }
+        specs.push_back(std::move(spec));
+    }
+    return specs;
+}
+
+int openNetns(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        throw std::system_error(errno, std::generic_category(), "Не удалось открыть пространство имён " + path);
+    }
+    return fd;
+}
+
+NetnsScope::NetnsScope(int netns_fd) {
+    if (netns_fd == -1) {
+        return;
+    }
+    saved_fd_ = openNetns("/proc/thread-self/ns/net");
+    if (setns(netns_fd, CLONE_NEWNET) == -1) {
+        int err = errno;
+        close(saved_fd_);
+        saved_fd_ = -1;
+        throw std::system_error(err, std::generic_category(), "Не удалось войти в пространство имён");
+    }
+}
+
+NetnsScope::~NetnsScope() {
+    if (saved_fd_ == -1) {
+        return;
+    }
+    if (setns(saved_fd_, CLONE_NEWNET) == -1) {
+        // Поток остался бы в чужом пространстве, и следующие сокеты открылись бы не там
+        logError("NetnsScope: не удалось вернуться в исходное пространство имён: ", strerror(errno));
+        std::abort();
+    }
+    close(saved_fd_);
+}
@@ -0,0 +1,36 @@
+#ifndef NETNS_H
+#define NETNS_H
+
+#include <string>
+#include <vector>
+
+// Сетевое пространство имён, которым демон управляет помимо своего
+struct NetnsSpec {
+    std::string name; // Для путей сокетов и журнала: буквы, цифры, '_', '-', '.'
+    std::string path; // Файл пространства: /run/netns/<name> или /proc/<pid>/ns/net
+};
+
+// Список пространств "blue,red=/proc/1234/ns/net": имя без пути - пространство
+// ip netns (/run/netns/<имя>). Бросает std::invalid_argument.
+std::vector<NetnsSpec> parseNetnsList(const std::string& text);
+
+// Открывает файл пространства; бросает std::system_error
+int openNetns(const std::string& path);
+
+// Переводит текущий поток в пространство netns_fd (setns), деструктор возвращает
+// поток обратно. Сокеты остаются в пространстве, где созданы, поэтому переход
+// нужен только на время их создания. netns_fd == -1 - пространство не меняется.
+class NetnsScope {
+public:
+    // Бросает std::system_error
+    explicit NetnsScope(int netns_fd);
+    ~NetnsScope();
+
+    NetnsScope(const NetnsScope&) = delete;
+    NetnsScope& operator=(const NetnsScope&) = delete;
+
+private:
+    int saved_fd_ = -1; // Пространство потока до перехода
+};
+
+#endif // NETNS_H
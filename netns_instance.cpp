@@ -0,0 +1,266 @@
+#include "netns_instance.h"
+#include "logger.h"
+#include "flight_recorder.h"
+#include "s_expression_parser.h"
+#include "binary_serializer.h"
+#include <netlink/msg.h>
+#include <netlink/route/addr.h>
+#include <netlink/route/link.h>
+#include <netlink/route/route.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/rtnetlink.h>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+namespace {
+
+// Форматы клиентов: S-выражения по умолчанию, двоичный - по приветствию
+std::vector<std::unique_ptr<CommandSerializer>> makeSerializers() {
+    std::vector<std::unique_ptr<CommandSerializer>> serializers;
+    serializers.push_back(std::make_unique<SExpressionParser>());
+    serializers.push_back(std::make_unique<BinarySerializer>());
+    return serializers;
+}
+
+// IPv4 адрес из атрибута netlink (порядок байт сети) в порядке байт хоста
+bool addressAttr(struct nlattr* attr, uint32_t& address) {
+    if (!attr || nla_len(attr) < 4) {
+        return false;
+    }
+    uint32_t address_be;
+    memcpy(&address_be, nla_data(attr), sizeof(address_be));
+    address = ntohl(address_be);
+    return true;
+}
+
+} // namespace
+
+NetnsInstance::NetnsInstance(const std::string& name, int netns_fd, const std::string& netns_path,
+                             const std::string& socket_path, EventLoop& loop, WorkerPool& worker_pool,
+                             SpawnHelper& spawn_helper, OutputBufferPool& output_pool)
+    : name_(name),
+      netns_fd_(netns_fd),
+      socket_path_(socket_path),
+      log_prefix_(name.empty() ? "NetworkDaemon: " : "NetworkDaemon[" + name + "]: "),
+      loop_(loop),
+      output_pool_(output_pool),
+      netlink_mgr_(),
+      unix_server_(loop, socket_path, name.empty() ? "command" : "command:" + name),
+      network_mgr_(netlink_mgr_, loop, worker_pool, spawn_helper),
+      command_processor_(std::make_unique<CommandProcessor>(
+          unix_server_, loop, netlink_mgr_, network_mgr_, output_pool, makeSerializers())) {
+    netlink_mgr_.setWorkerPool(&worker_pool);
+    netlink_mgr_.setNetns(netns_fd_);
+    network_mgr_.setNetns(netns_fd_, netns_path);
+
+    MetricsRegistry& metrics = MetricsRegistry::instance();
+    const char* event_types[] = {"add_iface", "del_iface", "add_addr", "del_addr", "add_route", "del_route"};
+    for (size_t i = 0; i < event_metrics_.size(); ++i) {
+        event_metrics_[i] = &metrics.counter("network_daemon_events_total", "Netlink events broadcast to clients",
+                                             metricLabel("type", event_types[i]));
+    }
+}
+
+NetnsInstance::~NetnsInstance() {
+    // Пул потоков демона уничтожается раньше: дампов, входящих в пространство, уже нет
+    if (netns_fd_ != -1) {
+        close(netns_fd_);
+    }
+}
+
+void NetnsInstance::start(const Options& options, const HandoffState& handoff) {
+    logInfo(log_prefix_, "Initializing NetlinkManager");
+    netlink_mgr_.setLazyRoutes(options.lazy_routes);
+    netlink_mgr_.init(handoff.netlink_fd);
+    // Сервер запускается сразу; команды, которым нужно состояние ядра, ждут его загрузки
+    netlink_mgr_.whenReady([this](bool ok) {
+        if (ok) {
+            logInfo(log_prefix_, "Kernel state loaded");
+        } else {
+            load_failed_ = true;
+            loop_.stop();
+        }
+    });
+    if (load_failed_) {
+        throw std::runtime_error("Не удалось загрузить состояние ядра");
+    }
+    logInfo(log_prefix_, "NetlinkManager initialized successfully");
+
+    netlink_mgr_.setEventFilter(options.event_filter);
+    network_mgr_.setDhcpBackend(options.dhcp_backend);
+
+    // Устанавливаем колбэки как методы этого класса
+    netlink_mgr_.setAddrCallback(std::bind(&NetnsInstance::handleAddrEvent, this, std::placeholders::_1));
+    netlink_mgr_.setLinkCallback(std::bind(&NetnsInstance::handleLinkEvent, this, std::placeholders::_1));
+    netlink_mgr_.setRouteCallback(std::bind(&NetnsInstance::handleRouteEvent, this, std::placeholders::_1));
+
+    // Добавляем netlink сокет в цикл событий
+    logInfo(log_prefix_, "Adding netlink socket to event loop (fd: ", netlink_mgr_.getSocketFd(), ")");
+    loop_.add(netlink_mgr_.getSocketFd(), EPOLLIN,
+        std::bind(&NetnsInstance::handleNetlinkEvent, this, std::placeholders::_1, std::placeholders::_2));
+
+    logInfo(log_prefix_, "Starting UNIX server at ", socket_path_);
+    unix_server_.start(handoff.listen_fd);
+    command_processor_->restoreClients(handoff);
+    for (const DhcpClient::Snapshot& dhcp : handoff.dhcp) {
+        network_mgr_.restoreDhcpClient(dhcp);
+    }
+    logInfo(log_prefix_, "UNIX server started successfully");
+}
+
+void NetnsInstance::setHandoffHandler(CommandProcessor::HandoffHandler handler) {
+    command_processor_->setHandoffHandler(std::move(handler));
+}
+
+bool NetnsInstance::prepareHandoff(int requester_fd, HandoffState& state, std::string& reason) {
+    if (!command_processor_->prepareHandoff(requester_fd, state, reason)) {
+        return false;
+    }
+    state.listen_fd = unix_server_.getListenFd();
+    state.netlink_fd = netlink_mgr_.getSocketFd();
+    state.dhcp = network_mgr_.exportDhcpClients();
+    return true;
+}
+
+void NetnsInstance::abortHandoff(int requester_fd) {
+    unix_server_.closeWhenFlushed(requester_fd);
+}
+
+void NetnsInstance::release() {
+    loop_.remove(netlink_mgr_.getSocketFd());
+    unix_server_.release();
+}
+
+void NetnsInstance::handleNetlinkEvent([[maybe_unused]] int fd, [[maybe_unused]] uint32_t events) {
+    try {
+        netlink_mgr_.processEvents();
+    } catch (const std::exception& e) {
+        logError(log_prefix_, "Error processing netlink events: ", e.what());
+    }
+}
+
+// Реализация методов-колбэков. События формируются в буферах из пула:
+// в установившемся режиме рассылка события не выделяет память.
+void NetnsInstance::handleLinkEvent(struct nl_msg* msg) {
+    struct nlmsghdr* nlh = nlmsg_hdr(msg);
+    struct ifinfomsg* ifi = (struct ifinfomsg*)nlmsg_data(nlh);
+    struct nlattr* tb[IFLA_MAX + 1];
+    char ifname[IFNAMSIZ] = {0};
+
+    nla_parse(tb, IFLA_MAX, nlmsg_attrdata(nlh, sizeof(*ifi)), nlmsg_attrlen(nlh, sizeof(*ifi)), NULL);
+    
+    if (tb[IFLA_IFNAME]) {
+        strncpy(ifname, (char*)nla_data(tb[IFLA_IFNAME]), IFNAMSIZ - 1);
+    }
+
+    event_metrics_[nlh->nlmsg_type == RTM_NEWLINK ? 0 : 1]->inc();
+    TraceSpan span("event", TraceCategory::Event, nlh->nlmsg_type);
+
+    // Формируем событие в формате каждого клиента и отправляем
+    auto out = output_pool_.acquire();
+    command_processor_->broadcastEvent(*out, [&](CommandSerializer& serializer, OutputBuffer& event) {
+        formatLinkEvent(serializer, event, nlh, ifi, tb, ifname);
+    });
+
+    // Логирование
+    logInfo(log_prefix_, out->view());
+}
+
+void NetnsInstance::handleAddrEvent(struct nl_msg* msg) {
+    struct nlmsghdr* nlh = nlmsg_hdr(msg);
+    struct ifaddrmsg* ifa = (struct ifaddrmsg*)nlmsg_data(nlh);
+    struct nlattr* tb[IFA_MAX + 1];
+    char ifname[IFNAMSIZ] = {0};
+
+    nla_parse(tb, IFA_MAX, nlmsg_attrdata(nlh, sizeof(*ifa)), nlmsg_attrlen(nlh, sizeof(*ifa)), NULL);
+    // Имя - из кэша пространства: if_indextoname смотрит в пространство потока
+    if (struct nl_cache* link_cache = netlink_mgr_.getLinkCache()) {
+        rtnl_link_i2name(link_cache, ifa->ifa_index, ifname, sizeof(ifname));
+    }
+    event_metrics_[nlh->nlmsg_type == RTM_NEWADDR ? 2 : 3]->inc();
+    TraceSpan span("event", TraceCategory::Event, nlh->nlmsg_type);
+
+    // Формируем событие в формате каждого клиента и отправляем
+    auto out = output_pool_.acquire();
+    command_processor_->broadcastEvent(*out, [&](CommandSerializer& serializer, OutputBuffer& event) {
+        formatAddrEvent(serializer, event, nlh, ifa, tb, ifname);
+    });
+
+    // Логирование
+    logInfo(log_prefix_, out->view());
+}
+
+void NetnsInstance::handleRouteEvent(struct nl_msg* msg) {
+    struct nlmsghdr* nlh = nlmsg_hdr(msg);
+    struct rtmsg* rtm = (struct rtmsg*)nlmsg_data(nlh);
+    struct nlattr* tb[RTA_MAX + 1];
+
+    nla_parse(tb, RTA_MAX, nlmsg_attrdata(nlh, sizeof(*rtm)), nlmsg_attrlen(nlh, sizeof(*rtm)), NULL);
+    event_metrics_[nlh->nlmsg_type == RTM_NEWROUTE ? 4 : 5]->inc();
+    TraceSpan span("event", TraceCategory::Event, nlh->nlmsg_type);
+
+    // Формируем событие в формате каждого клиента и отправляем
+    auto out = output_pool_.acquire();
+    command_processor_->broadcastEvent(*out, [&](CommandSerializer& serializer, OutputBuffer& event) {
+        formatRouteEvent(serializer, event, nlh, tb, "route0"/*ifname*/);
+    });
+
+    // Логирование
+    logInfo(log_prefix_, out->view());
+}
+
+
+// Методы форматирования событий
+void NetnsInstance::formatLinkEvent(CommandSerializer& serializer, OutputBuffer& out, struct nlmsghdr* nlh,
+                                    struct ifinfomsg* ifi, struct nlattr* tb[], const char* ifname) {
+    size_t mark = serializer.beginResponse(out, nlh->nlmsg_type == RTM_NEWLINK ? "add_iface" : "del_iface", 0);
+    const uint8_t* mac = tb[IFLA_ADDRESS] && nla_len(tb[IFLA_ADDRESS]) >= 6
+                             ? static_cast<const uint8_t*>(nla_data(tb[IFLA_ADDRESS]))
+                             : nullptr;
+    RecordWriter(serializer, out)
+        .text(Field::Iface, ifname)
+        .ipv4(Field::Addr, false, 0)
+        .mac(Field::Mac, mac, ':')
+        .ipv4(Field::Gateway, false, 0)
+        .prefixLen(Field::Mask, false, 0)
+        .hex(Field::Flag, ifi->ifi_flags)
+        .finish();
+    serializer.endResponse(out, mark);
+}
+
+void NetnsInstance::formatAddrEvent(CommandSerializer& serializer, OutputBuffer& out, struct nlmsghdr* nlh,
+                                    struct ifaddrmsg* ifa, struct nlattr* tb[], const char* ifname) {
+    size_t mark = serializer.beginResponse(out, nlh->nlmsg_type == RTM_NEWADDR ? "add_addr" : "del_addr", 0);
+    uint32_t address = 0;
+    bool has_address = addressAttr(tb[IFA_ADDRESS], address);
+    RecordWriter(serializer, out)
+        .text(Field::Iface, ifname)
+        .ipv4(Field::Addr, has_address, address)
+        .mac(Field::Mac, nullptr, ':')
+        .ipv4(Field::Gateway, false, 0)
+        .prefixLen(Field::Mask, true, ifa->ifa_prefixlen, true)
+        .hex(Field::Flag, 0)
+        .finish();
+    serializer.endResponse(out, mark);
+}
+
+void NetnsInstance::formatRouteEvent(CommandSerializer& serializer, OutputBuffer& out, struct nlmsghdr* nlh,
+                                     struct nlattr* tb[], const char* ifname) {
+    size_t mark = serializer.beginResponse(out, nlh->nlmsg_type == RTM_NEWROUTE ? "add_route" : "del_route", 0);
+    uint32_t dst = 0;
+    uint32_t gateway = 0;
+    bool has_dst = addressAttr(tb[RTA_DST], dst);
+    bool has_gateway = addressAttr(tb[RTA_GATEWAY], gateway);
+    RecordWriter(serializer, out)
+        .text(Field::Iface, ifname[0] ? ifname : "none")
+        .ipv4(Field::Addr, has_dst, dst, "default")
+        .mac(Field::Mac, nullptr, ':')
+        .ipv4(Field::Gateway, has_gateway, gateway)
+        .prefixLen(Field::Mask, false, 0)
+        .hex(Field::Flag, 0)
+        .finish();
+    serializer.endResponse(out, mark);
+}
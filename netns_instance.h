@@ -0,0 +1,91 @@
+#ifndef NETNS_INSTANCE_H
+#define NETNS_INSTANCE_H
+
+#include "netlink_manager.h"
+#include "unix_socket_server.h"
+#include "network_manager.h"
+#include "command_processor.h"
+#include "event_loop.h"
+#include "worker_pool.h"
+#include "spawn_helper.h"
+#include "output_buffer.h"
+#include "handoff.h"
+#include <array>
+#include <memory>
+#include <string>
+
+// Обслуживание одного сетевого пространства имён: сокеты netlink и кэши его
+// состояния, интерфейсы и DHCP, свой сокет команд. Клиент выбирает пространство
+// сокетом, к которому подключается, и получает события только этого пространства.
+// Все экземпляры демона делят цикл событий, пул потоков и помощник запуска процессов.
+class NetnsInstance {
+public:
+    struct Options {
+        bool lazy_routes = false;
+        NetlinkFilterSpec event_filter = NetlinkFilterSpec::defaults();
+        NetworkManager::DhcpBackend dhcp_backend = NetworkManager::DhcpBackend::Builtin;
+    };
+
+    // name пусто - пространство самого демона (netns_fd == -1), иначе экземпляр
+    // становится владельцем netns_fd, открытого из netns_path
+    NetnsInstance(const std::string& name, int netns_fd, const std::string& netns_path,
+                  const std::string& socket_path, EventLoop& loop, WorkerPool& worker_pool,
+                  SpawnHelper& spawn_helper, OutputBufferPool& output_pool);
+    ~NetnsInstance();
+
+    NetnsInstance(const NetnsInstance&) = delete;
+    NetnsInstance& operator=(const NetnsInstance&) = delete;
+
+    // Открывает сокеты netlink в пространстве, начинает загрузку состояния и запускает
+    // сервер команд. handoff - сокеты и клиенты, принятые от предыдущего процесса.
+    // Бросает исключение.
+    void start(const Options& options, const HandoffState& handoff = {});
+    // Начальная загрузка состояния не удалась; цикл событий уже остановлен
+    bool loadFailed() const { return load_failed_; }
+
+    const std::string& name() const { return name_; }
+    const std::string& socketPath() const { return socket_path_; }
+
+    // Передача работы новому процессу (см. handoff.h)
+    void setHandoffHandler(CommandProcessor::HandoffHandler handler);
+    // Клиенты, сокеты и DHCP клиенты пространства; false - идут команды, причина в reason
+    bool prepareHandoff(int requester_fd, HandoffState& state, std::string& reason);
+    // Передача не состоялась: закрывает соединение запросившего, посреди потока
+    // передачи оно непригодно для команд, а новый процесс получает вместо COMMIT EOF
+    void abortHandoff(int requester_fd);
+    // Перестаёт читать переданные сокеты; путь сокета команд не удаляется
+    void release();
+
+private:
+    std::string name_;
+    int netns_fd_;
+    std::string socket_path_;
+    std::string log_prefix_; // "NetworkDaemon: " или "NetworkDaemon[имя]: "
+    EventLoop& loop_;
+    OutputBufferPool& output_pool_;
+    NetlinkManager netlink_mgr_;
+    UnixSocketServer unix_server_;
+    NetworkManager network_mgr_;
+    std::unique_ptr<CommandProcessor> command_processor_;
+
+    // Событий netlink по типу: add_iface, del_iface, add_addr, del_addr, add_route, del_route
+    std::array<Counter*, 6> event_metrics_;
+    bool load_failed_ = false;
+
+    void handleNetlinkEvent(int fd, uint32_t events);
+
+    // Методы-колбэки для netlink событий
+    void handleLinkEvent(struct nl_msg* msg);
+    void handleAddrEvent(struct nl_msg* msg);
+    void handleRouteEvent(struct nl_msg* msg);
+
+    // Вспомогательные методы для форматирования событий
+    void formatLinkEvent(CommandSerializer& serializer, OutputBuffer& out, struct nlmsghdr* nlh,
+                         struct ifinfomsg* ifi, struct nlattr* tb[], const char* ifname);
+    void formatAddrEvent(CommandSerializer& serializer, OutputBuffer& out, struct nlmsghdr* nlh,
+                         struct ifaddrmsg* ifa, struct nlattr* tb[], const char* ifname);
+    void formatRouteEvent(CommandSerializer& serializer, OutputBuffer& out, struct nlmsghdr* nlh,
+                          struct nlattr* tb[], const char* ifname);
+};
+
+#endif // NETNS_INSTANCE_H
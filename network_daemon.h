@@ -1,12 +1,14 @@
 #ifndef NETWORK_DAEMON_H
 #define NETWORK_DAEMON_H
 
-#include "netlink_manager.h"
-#include "unix_socket_server.h"
-#include "network_manager.h"
-#include "command_processor.h"
+#include "netns_instance.h"
 #include "event_loop.h"
+#include "worker_pool.h"
+#include "spawn_helper.h"
+#include "output_buffer.h"
+#include "metrics_server.h"
 #include <memory>
+#include <vector>
 
 class NetworkDaemon {
 public:
@@ -15,32 +17,21 @@ public:
 
     void run();
     void stop();
-    std::string getTimestamp() const;
 
 private:
-    NetlinkManager netlink_mgr_;
-    UnixSocketServer unix_server_;
-    NetworkManager network_mgr_;
-    std::unique_ptr<CommandProcessor> command_processor_;
-    EventLoop loop_;
+    SpawnHelper spawn_helper_; // Первым: fork помощника, пока в процессе нет потоков и больших кэшей
+    EventLoop loop_; // Должен создаваться раньше компонентов, которые его используют
+    OutputBufferPool output_pool_; // Буферы ответов и событий потока цикла
+    // Первое - пространство имён самого демона, за ним - из NETWORK_DAEMON_NETNS
+    std::vector<std::unique_ptr<NetnsInstance>> namespaces_;
+    WorkerPool worker_pool_; // Блокирующие задания; уничтожается (с ожиданием потоков) раньше пространств
+    // Последним: поток сервера метрик останавливается раньше, чем уничтожаются компоненты
+    MetricsServer metrics_server_;
 
     void setupSignalHandlers();
-    void handleNetlinkEvent(int fd, uint32_t events);
-    
-    // Методы-колбэки для netlink событий
-    void handleLinkEvent(struct nl_msg* msg);
-    void handleAddrEvent(struct nl_msg* msg);
-    void handleRouteEvent(struct nl_msg* msg);
-    
-    // Вспомогательные методы для форматирования событий
-    std::string formatLinkEvent(struct nlmsghdr* nlh, struct ifinfomsg* ifi, 
-                               struct nlattr* tb[], const char* ifname, const char* mac_str);
-    std::string formatAddrEvent(struct nlmsghdr* nlh, struct ifaddrmsg* ifa,
-                               struct nlattr* tb[], const char* ifname, 
-                               const char* ip_str, const char* mask_str, int mask_len);
-    std::string formatRouteEvent(struct nlmsghdr* nlh, struct rtmsg* rtm,
-                                struct nlattr* tb[], const char* ifname,
-                                const char* dst_str, const char* gw_str);
+    bool loadFailed() const;
+    // Команда handoff: отдаёт сокеты и состояние новому процессу и завершает цикл
+    std::string handOff(int client_fd);
 };
 
 #endif // NETWORK_DAEMON_H
\ No newline at end of file
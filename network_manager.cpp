@@ -1,4 +1,9 @@
 #include "network_manager.h"
+#include "logger.h"
+#include "metrics.h"
+#include "flight_recorder.h"
+#include "netlink_transaction.h"
+#include "output_buffer.h"
 #include <netlink/netlink.h>
 #include <netlink/cache.h>
 #include <netlink/utils.h>
@@ -11,216 +16,630 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <memory>
 #include <sstream>
-#include <iostream>
 
-NetworkManager::NetworkManager(NetlinkManager& netlink_mgr) : netlink_mgr_(netlink_mgr) {}
+namespace {
 
-std::string NetworkManager::setDynamicIP(const std::string& ifname) {
-    if (ifname.empty()) {
-        return "error(no interface specified)";
+constexpr size_t MAX_CHILD_OUTPUT = 4096;
+// Метрика маршрута по умолчанию из DHCP, как у dhcpcd: у каждого интерфейса своя
+constexpr uint32_t DHCP_ROUTE_METRIC_BASE = 1000;
+
+// Читает всё доступное из неблокирующего pipe; false - достигнут EOF
+bool drainPipe(int fd, std::string& output) {
+    char buffer[512];
+    while (true) {
+        ssize_t len = read(fd, buffer, sizeof(buffer));
+        if (len > 0) {
+            size_t room = MAX_CHILD_OUTPUT - std::min(output.size(), MAX_CHILD_OUTPUT);
+            output.append(buffer, std::min(static_cast<size_t>(len), room));
+        } else if (len == 0) {
+            return false;
+        } else {
+            return errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK;
+        }
     }
+}
 
-    stopDhcpcd(ifname);
+// Запускает процесс с stderr, перенаправленным в pipe. Вызывается из рабочего потока,
+// поэтому в дочернем процессе до exec допустимы только async-signal-safe вызовы.
+NetworkManager::SpawnedChild spawnChild(const std::vector<std::string>& args) {
+    NetworkManager::SpawnedChild result;
     int pipefd[2];
-    if (pipe(pipefd) == -1) {
-        std::cerr << "ERROR: pipe() failed: " << strerror(errno) << std::endl;
-        return "error(pipe failed)";
+    if (pipe2(pipefd, O_CLOEXEC) == -1) {
+        logError("ERROR: pipe() failed: ", strerror(errno));
+        result.error = "pipe failed";
+        return result;
+    }
+
+    std::vector<char*> argv;
+    for (const auto& arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
     }
+    argv.push_back(nullptr);
 
     pid_t pid = fork();
     if (pid == -1) {
-        std::cerr << "ERROR: fork() failed: " << strerror(errno) << std::endl;
+        logError("ERROR: fork() failed: ", strerror(errno));
         close(pipefd[0]);
         close(pipefd[1]);
-        return "error(fork failed)";
+        result.error = "fork failed";
+        return result;
     } else if (pid == 0) {
-        close(pipefd[0]);  // Закрываем конец для чтения
-        dup2(pipefd[1], STDERR_FILENO);  // Перенаправляем stderr в pipe
-        close(pipefd[1]);  // Закрываем оригинальный конец записи
-        execlp("dhcpcd", "dhcpcd", "-n", ifname.c_str(), nullptr);
-        // Если execlp fails, ошибка уже в pipe через stderr
+        dup2(pipefd[1], STDERR_FILENO);  // Перенаправляем stderr в pipe (dup2 снимает O_CLOEXEC)
+        execvp(argv[0], argv.data());
+        // Если execvp fails, ошибка уходит в pipe через stderr
+        const char* parts[] = {argv[0], ": ", strerror(errno), "\n"};
+        for (const char* part : parts) {
+            if (write(STDERR_FILENO, part, strlen(part)) < 0) {
+                break;
+            }
+        }
         _exit(EXIT_FAILURE);
     }
 
     close(pipefd[1]);  // Закрываем конец для записи в родителе
-    int status;
-    waitpid(pid, &status, 0);
+    result.pid = pid;
+    result.stderr_fd = pipefd[0];
+    return result;
+}
+
+} // namespace
+
+NetworkManager::NetworkManager(NetlinkManager& netlink_mgr, EventLoop& loop, WorkerPool& worker_pool,
+                               SpawnHelper& spawn_helper)
+    : netlink_mgr_(netlink_mgr), loop_(loop), worker_pool_(worker_pool), spawn_helper_(spawn_helper) {}
 
-    char buffer[256];
-    ssize_t len = read(pipefd[0], buffer, sizeof(buffer) - 1);
-    close(pipefd[0]);
-    std::string error_msg;
-    if (len > 0) {
-        buffer[len] = '\0';
-        error_msg = buffer;
-        std::cerr << "ERROR from dhcpcd child: " << error_msg << std::endl;
+NetworkManager::~NetworkManager() = default;
+
+void NetworkManager::setDhcpBackend(DhcpBackend backend) {
+    dhcp_backend_ = backend;
+}
+
+void NetworkManager::setNetns(int netns_fd, const std::string& netns_path) {
+    netns_fd_ = netns_fd;
+    netns_path_ = netns_path;
+}
+
+void NetworkManager::runProcess(const std::vector<std::string>& program, ProcessCallback on_exit) {
+    // Помощник и fork наследуют пространство демона: в чужое процесс входит через nsenter
+    std::vector<std::string> args = program;
+    if (!netns_path_.empty()) {
+        args.insert(args.begin(), {"nsenter", "--net=" + netns_path_, "--"});
     }
+    // Время от запуска до выхода процесса (dhcpcd -n ждёт получения адреса)
+    Histogram& duration = MetricsRegistry::instance().histogram(
+        "network_daemon_process_duration_seconds", "Time from spawning a helper program to its exit",
+        metricLabel("program", program[0]));
+    auto started = std::chrono::steady_clock::now();
+    ProcessCallback done = [&duration, started, on_exit](int status, const std::string& output) {
+        duration.observe(std::chrono::steady_clock::now() - started);
+        on_exit(status, output);
+    };
 
-    if (WIFEXITED(status) && WEXITSTATUS(status) == 0 && error_msg.empty()) {
-        return getInterfaceInfo(ifname);
-    } else {
-        return "error(dhcpcd failed: " + error_msg + ")";
+    // Обычно запуск делает помощник, созданный при старте: ему не нужно копировать
+    // адресное пространство демона, а статус выхода он присылает сам
+    if (spawn_helper_.available()) {
+        int pipefd[2];
+        if (pipe2(pipefd, O_CLOEXEC) == -1) {
+            logError("ERROR: pipe() failed: ", strerror(errno));
+            done(-1, "pipe failed");
+            return;
+        }
+        auto output = std::make_shared<std::shared_ptr<ChildOutput>>();
+        bool sent = spawn_helper_.spawn(args, {{STDERR_FILENO, pipefd[1]}},
+            [this, args, output, done](pid_t pid, int status) {
+                finishOutput(**output);
+                if (pid == -1) {
+                    logError("ERROR: failed to spawn ", args[0], ": ", strerror(status));
+                    done(-1, args[0] + ": " + strerror(status));
+                    return;
+                }
+                done(status, (*output)->output);
+            });
+        close(pipefd[1]);
+        if (sent) {
+            *output = collectOutput(pipefd[0]);
+            return;
+        }
+        close(pipefd[0]);
     }
+
+    // Помощник недоступен: fork большого процесса занимает заметное время, поэтому
+    // запуск идёт в пуле потоков, а наблюдение за процессом - в цикле событий
+    auto spawned = std::make_shared<SpawnedChild>();
+    auto job = [args, spawned]() { *spawned = spawnChild(args); };
+    auto finish = [this, spawned, done]() {
+        if (spawned->pid == -1) {
+            done(-1, spawned->error);
+            return;
+        }
+        watchProcess(spawned->pid, spawned->stderr_fd, done);
+    };
+    if (!worker_pool_.submit(job, finish)) {
+        // Пул перегружен: запускаем прямо в цикле, как раньше
+        job();
+        finish();
+    }
+}
+
+void NetworkManager::watchProcess(pid_t pid, int stderr_fd, ProcessCallback done) {
+    auto state = collectOutput(stderr_fd);
+    loop_.watchChild(pid, [this, state, done](pid_t, int status) {
+        finishOutput(*state);
+        done(status, state->output);
+    });
+}
+
+std::shared_ptr<NetworkManager::ChildOutput> NetworkManager::collectOutput(int stderr_fd) {
+    fcntl(stderr_fd, F_SETFL, fcntl(stderr_fd, F_GETFL) | O_NONBLOCK);
+
+    // stderr читаем по мере поступления. Демонизированный dhcpcd может держать pipe
+    // открытым и после выхода родителя, поэтому операция завершается по выходу процесса.
+    auto state = std::make_shared<ChildOutput>(ChildOutput{stderr_fd, true, {}});
+    loop_.add(state->fd, EPOLLIN, [this, state](int fd, uint32_t) {
+        if (!drainPipe(fd, state->output)) {
+            state->watching = false;
+            loop_.remove(fd);
+        }
+    });
+    return state;
+}
+
+void NetworkManager::finishOutput(ChildOutput& state) {
+    if (state.fd == -1) {
+        return;
+    }
+    if (state.watching) {
+        loop_.remove(state.fd);
+        state.watching = false;
+    }
+    drainPipe(state.fd, state.output);
+    close(state.fd);
+    state.fd = -1;
 }
 
-void NetworkManager::stopDhcpcd(const std::string& ifname) {
+void NetworkManager::setDynamicIP(const std::string& ifname, ResultCallback done) {
     if (ifname.empty()) {
-        std::cerr << "ERROR: Empty interface name provided" << std::endl;
+        done("error(no interface specified)");
         return;
     }
 
-    // Проверка существования интерфейса
-    struct nl_cache* link_cache = netlink_mgr_.getLinkCache();
-    if (!link_cache || !rtnl_link_get_by_name(link_cache, ifname.c_str())) {
-        std::cerr << "ERROR: Interface " << ifname << " not found" << std::endl;
+    if (dhcp_backend_ == DhcpBackend::Builtin) {
+        startBuiltinDhcp(ifname, done);
         return;
     }
 
-    pid_t pid = fork();
-    if (pid == -1) {
-        std::cerr << "ERROR: fork() failed: " << strerror(errno) << std::endl;
+    stopDhcpcd(ifname, [this, ifname, done](const std::string&) {
+        runProcess({"dhcpcd", "-n", ifname}, [this, ifname, done](int status, const std::string& error_msg) {
+            if (!error_msg.empty()) {
+                logError("ERROR from dhcpcd child: ", error_msg);
+            }
+            if (WIFEXITED(status) && WEXITSTATUS(status) == 0 && error_msg.empty()) {
+                done(getInterfaceInfo(ifname));
+            } else {
+                done("error(dhcpcd failed: " + error_msg + ")");
+            }
+        });
+    });
+}
+
+void NetworkManager::startBuiltinDhcp(const std::string& ifname, ResultCallback done) {
+    auto existing = dhcp_clients_.find(ifname);
+    if (existing != dhcp_clients_.end()) {
+        std::unique_ptr<DhcpClient> old = std::move(existing->second);
+        dhcp_clients_.erase(existing);
+        old->stop();
+    }
+
+    struct rtnl_link* link = nullptr;
+    if (netlink_mgr_.queryLink(ifname, &link) < 0 || !link) {
+        done("error(interface not found)");
         return;
-    } else if (pid == 0) {
-        execlp("dhcpcd", "dhcpcd", "-k", ifname.c_str(), nullptr);
-        std::cerr << "ERROR: execlp failed: " << strerror(errno) << std::endl;
-        _exit(EXIT_FAILURE);
     }
+    int ifindex = rtnl_link_get_ifindex(link);
+    unsigned int flags = rtnl_link_get_flags(link);
+    struct nl_addr* hwaddr = rtnl_link_get_addr(link);
+    uint8_t mac[6] = {0};
+    bool has_mac = hwaddr && nl_addr_get_len(hwaddr) == sizeof(mac);
+    if (has_mac) {
+        memcpy(mac, nl_addr_get_binary_addr(hwaddr), sizeof(mac));
+    }
+    rtnl_link_put(link);
 
-    int status;
-    waitpid(pid, &status, 0);
-    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
-        std::cerr << "ERROR: dhcpcd -k failed for interface: " << ifname << std::endl;
-    } else {
-        std::cout << "INFO: dhcpcd stopped for interface: " << ifname << std::endl;
+    if (!has_mac) {
+        done("error(interface has no ethernet address)");
+        return;
+    }
+    // DHCP невозможен на выключенном интерфейсе, dhcpcd тоже поднимает его сам
+    if (!(flags & IFF_UP) && !bringInterfaceUp(ifname)) {
+        done("error(failed to enable interface)");
+        return;
+    }
+
+    auto client = std::make_unique<DhcpClient>(loop_, *this, ifname, ifindex, mac);
+    try {
+        client->start(done);
+    } catch (const std::exception& e) {
+        logError("ERROR: DHCP client start failed on ", ifname, ": ", e.what());
+        done("error(dhcp client failed: " + std::string(e.what()) + ")");
+        return;
     }
+    dhcp_clients_[ifname] = std::move(client);
 }
 
-void NetworkManager::setStaticIP(const std::string& ifname, const std::string& ip_mask, const std::string& gateway) {
-    struct nl_sock* sock = netlink_mgr_.getSocket();
-    struct nl_cache* link_cache = netlink_mgr_.getLinkCache();
+std::vector<DhcpClient::Snapshot> NetworkManager::exportDhcpClients() const {
+    std::vector<DhcpClient::Snapshot> snapshots;
+    for (const auto& [ifname, client] : dhcp_clients_) {
+        if (client->state() != DhcpClient::State::Stopped) {
+            snapshots.push_back(client->snapshot());
+        }
+    }
+    return snapshots;
+}
 
-    struct rtnl_link* link = rtnl_link_get_by_name(link_cache, ifname.c_str());
-    if (!link) {
-        std::cerr << "Interface " << ifname << " not found" << std::endl;
+void NetworkManager::restoreDhcpClient(const DhcpClient::Snapshot& snapshot) {
+    auto client = std::make_unique<DhcpClient>(loop_, *this, snapshot.ifname, snapshot.ifindex, snapshot.mac);
+    try {
+        client->resume(snapshot);
+    } catch (const std::exception& e) {
+        logError("ERROR: DHCP client resume failed on ", snapshot.ifname, ": ", e.what());
         return;
     }
+    dhcp_clients_[snapshot.ifname] = std::move(client);
+}
 
-    int ifindex = rtnl_link_get_ifindex(link);
-    struct nl_addr* addr;
-    nl_addr_parse(ip_mask.c_str(), AF_INET, &addr);
+// Запросы аренды идут через сокет запросов (submitBatch), как и остальные изменения:
+// сокет событий неблокирующий, и его ACK смешались бы с уведомлениями
+bool NetworkManager::applyDhcpLease(int ifindex, uint32_t address, uint8_t prefix_len, uint32_t router,
+                                    uint32_t lease_time) {
+    uint32_t addr_be = htonl(address);
+
+    struct nl_addr* local = nl_addr_build(AF_INET, &addr_be, sizeof(addr_be));
+    nl_addr_set_prefixlen(local, prefix_len);
     struct rtnl_addr* rt_addr = rtnl_addr_alloc();
     rtnl_addr_set_ifindex(rt_addr, ifindex);
-    rtnl_addr_set_local(rt_addr, addr);
     rtnl_addr_set_family(rt_addr, AF_INET);
+    rtnl_addr_set_local(rt_addr, local);
+    if (prefix_len < 31) {
+        uint32_t bcast_be = htonl(address | ~(prefix_len ? ~0u << (32 - prefix_len) : 0u));
+        struct nl_addr* bcast = nl_addr_build(AF_INET, &bcast_be, sizeof(bcast_be));
+        rtnl_addr_set_broadcast(rt_addr, bcast);
+        nl_addr_put(bcast);
+    }
+    if (lease_time != 0xffffffff) {
+        // Адрес исчезнет сам, если аренду не удастся продлить (и даже если демон упадёт)
+        rtnl_addr_set_valid_lifetime(rt_addr, lease_time);
+        rtnl_addr_set_preferred_lifetime(rt_addr, lease_time);
+    }
 
-    int err = rtnl_addr_add(sock, rt_addr, 0);
+    std::vector<struct nl_msg*> requests;
+    struct nl_msg* msg = nullptr;
+    int err = rtnl_addr_build_add_request(rt_addr, NLM_F_REPLACE, &msg);
+    nl_addr_put(local);
+    rtnl_addr_put(rt_addr);
     if (err < 0) {
-        std::cerr << "Failed to set IP " << ip_mask << " on " << ifname << ": " << nl_geterror(err) << std::endl;
-    } else {
-        std::cout << "Статический IP установлен: " << ip_mask << " на интерфейсе " << ifname << std::endl;
+        logError("Failed to build DHCP address request on ifindex ", ifindex, ": ", nl_geterror(err));
+        return false;
+    }
+    requests.push_back(msg);
+    if (router) {
+        struct rtnl_route* route =
+            NetlinkTransaction::buildDefaultRoute(router, ifindex, DHCP_ROUTE_METRIC_BASE + ifindex, RTPROT_DHCP);
+        msg = nullptr;
+        err = rtnl_route_build_add_request(route, NLM_F_REPLACE, &msg);
+        rtnl_route_put(route);
+        if (err < 0) {
+            logError("Failed to build DHCP gateway request on ifindex ", ifindex, ": ", nl_geterror(err));
+        } else {
+            requests.push_back(msg);
+        }
     }
 
-    nl_addr_put(addr);
-    rtnl_addr_put(rt_addr);
-    rtnl_link_put(link);
+    std::vector<int> errors;
+    err = netlink_mgr_.submitBatch(requests, errors);
+    for (struct nl_msg* request : requests) {
+        nlmsg_free(request);
+    }
+    if (err == 0 && errors[0] < 0) {
+        err = errors[0];
+    }
+    if (err < 0) {
+        logError("Failed to apply DHCP address on ifindex ", ifindex, ": ", strerror(-err));
+        return false;
+    }
+    if (requests.size() > 1 && errors[1] < 0) {
+        logError("Failed to set DHCP gateway on ifindex ", ifindex, ": ", strerror(-errors[1]));
+    }
+
+    // Уведомления о новых адресе и маршруте могут прийти после ACK; забираем их сразу,
+    // чтобы индекс маршрутов и ответ dhcpOn уже видели аренду
+    netlink_mgr_.processEvents();
+    return true;
+}
 
-    if (!gateway.empty() && gateway != "none") {
-        struct nl_addr* gw_addr;
-        nl_addr_parse(gateway.c_str(), AF_INET, &gw_addr);
+void NetworkManager::removeDhcpLease(int ifindex, uint32_t address, uint8_t prefix_len, uint32_t router) {
+    std::vector<struct nl_msg*> requests;
+    struct nl_msg* msg = nullptr;
+    if (router) {
         struct rtnl_route* route = rtnl_route_alloc();
-        struct nl_addr* dst_addr;
-        nl_addr_parse("0.0.0.0/0", AF_INET, &dst_addr);
-        rtnl_route_set_dst(route, dst_addr);
-        rtnl_route_set_scope(route, RT_SCOPE_UNIVERSE);
-        rtnl_route_set_protocol(route, RTPROT_STATIC);
+        uint32_t dst_be = 0;
+        struct nl_addr* dst = nl_addr_build(AF_INET, &dst_be, sizeof(dst_be));
+        nl_addr_set_prefixlen(dst, 0);
         rtnl_route_set_family(route, AF_INET);
+        rtnl_route_set_dst(route, dst);
         rtnl_route_set_table(route, RT_TABLE_MAIN);
+        rtnl_route_set_priority(route, DHCP_ROUTE_METRIC_BASE + ifindex);
+        if (rtnl_route_build_del_request(route, 0, &msg) >= 0) {
+            requests.push_back(msg);
+        }
+        nl_addr_put(dst);
+        rtnl_route_put(route);
+    }
+
+    uint32_t addr_be = htonl(address);
+    struct nl_addr* local = nl_addr_build(AF_INET, &addr_be, sizeof(addr_be));
+    nl_addr_set_prefixlen(local, prefix_len);
+    struct rtnl_addr* rt_addr = rtnl_addr_alloc();
+    rtnl_addr_set_ifindex(rt_addr, ifindex);
+    rtnl_addr_set_family(rt_addr, AF_INET);
+    rtnl_addr_set_local(rt_addr, local);
+    msg = nullptr;
+    if (rtnl_addr_build_delete_request(rt_addr, 0, &msg) >= 0) {
+        requests.push_back(msg);
+    }
+    nl_addr_put(local);
+    rtnl_addr_put(rt_addr);
 
-        struct rtnl_nexthop* nh = rtnl_route_nh_alloc();
-        rtnl_route_nh_set_gateway(nh, gw_addr);
-        rtnl_route_nh_set_ifindex(nh, ifindex);
-        rtnl_route_add_nexthop(route, nh);
+    std::vector<int> errors;
+    int err = netlink_mgr_.submitBatch(requests, errors);
+    for (struct nl_msg* request : requests) {
+        nlmsg_free(request);
+    }
+    if (err < 0) {
+        logError("Failed to remove DHCP lease on ifindex ", ifindex, ": ", strerror(-err));
+        return;
+    }
+    // Маршрут или адрес могли уже исчезнуть (истёк срок адреса, интерфейс опущен)
+    for (int e : errors) {
+        if (e < 0 && e != -ESRCH && e != -EADDRNOTAVAIL) {
+            logError("Failed to remove DHCP lease on ifindex ", ifindex, ": ", strerror(-e));
+        }
+    }
+}
 
-        err = rtnl_route_add(sock, route, 0);
-        if (err < 0) {
-            std::cerr << "Failed to set gateway " << gateway << ": " << nl_geterror(err) << std::endl;
-        } else {
-            std::cout << "Шлюз установлен: " << gateway << " через интерфейс " << ifindex << std::endl;
+void NetworkManager::stopDhcpcd(const std::string& ifname, ResultCallback done) {
+    if (ifname.empty()) {
+        logError("ERROR: Empty interface name provided");
+        done("error(no interface specified)");
+        return;
+    }
+
+    if (dhcp_backend_ == DhcpBackend::Builtin) {
+        auto it = dhcp_clients_.find(ifname);
+        if (it == dhcp_clients_.end()) {
+            done("error(DHCP not running)");
+            return;
         }
+        // Клиент удаляем вне его собственных колбэков: stop() может ответить ожидающему dhcpOn
+        std::unique_ptr<DhcpClient> client = std::move(it->second);
+        dhcp_clients_.erase(it);
+        client->stop();
+        logInfo("INFO: DHCP client stopped for interface: ", ifname);
+        done("success(DHCP disabled)");
+        return;
+    }
 
-        nl_addr_put(dst_addr);
-        nl_addr_put(gw_addr);
-        rtnl_route_put(route);
+    // Проверка существования интерфейса
+    struct nl_cache* link_cache = netlink_mgr_.getLinkCache();
+    struct rtnl_link* link = link_cache ? rtnl_link_get_by_name(link_cache, ifname.c_str()) : nullptr;
+    if (!link) {
+        logError("ERROR: Interface ", ifname, " not found");
+        done("error(interface not found)");
+        return;
     }
+    rtnl_link_put(link);
+
+    runProcess({"dhcpcd", "-k", ifname}, [ifname, done](int status, const std::string&) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            logError("ERROR: dhcpcd -k failed for interface: ", ifname);
+            done("error(dhcpcd -k failed)");
+            return;
+        }
+        logInfo("INFO: dhcpcd stopped for interface: ", ifname);
+        done("success(DHCP disabled)");
+    });
 }
 
-std::string NetworkManager::getInterfaceInfo(const std::string& ifname) {
-    struct nl_cache* link_cache = netlink_mgr_.getLinkCache();
-    struct nl_cache* addr_cache = netlink_mgr_.getAddrCache();
-    struct nl_cache* route_cache = netlink_mgr_.getRouteCache();
-    if (!link_cache || !addr_cache || !route_cache) {
-        return "error(no cache available)";
+bool NetworkManager::setStaticIP(const std::string& ifname, const std::string& ip_mask, const std::string& gateway,
+                                 std::string& error) {
+    NetlinkTransaction txn(netlink_mgr_);
+    if (!stageStaticIP(txn, ifname, ip_mask, gateway, error)) {
+        return false;
     }
 
-    struct rtnl_link* link = rtnl_link_get_by_name(link_cache, ifname.c_str());
-    if (!link) {
-        return "error(interface not found)";
+    int err = txn.commit();
+    // Уведомления об изменениях забираем сразу, чтобы индекс маршрутов и кэши их видели
+    netlink_mgr_.processEvents();
+    if (err < 0) {
+        error = "failed to set " + txn.failedStep() + ": " + strerror(-err) +
+                (txn.rollbackComplete() ? ", changes rolled back" : ", rollback incomplete");
+        return false;
     }
 
+    logInfo("Статический IP установлен: ", ip_mask, " на интерфейсе ", ifname,
+            (gateway.empty() || gateway == "none" ? "" : ", шлюз " + gateway));
+    return true;
+}
+
+bool NetworkManager::stageStaticIP(NetlinkTransaction& txn, const std::string& ifname, const std::string& ip_mask,
+                                   const std::string& gateway, std::string& error) {
+    struct rtnl_link* link = nullptr;
+    if (netlink_mgr_.queryLink(ifname, &link) < 0 || !link) {
+        error = "interface not found";
+        return false;
+    }
     int ifindex = rtnl_link_get_ifindex(link);
-    unsigned int flags = rtnl_link_get_flags(link);
-    std::string flag_str = (flags & IFF_UP) ? "UP" : "DOWN";
+    bool link_up = rtnl_link_get_flags(link) & IFF_UP;
 
-    std::string ip_str = "none";
-    std::string mask_str = "none";
-    struct nl_object* obj = nl_cache_get_first(addr_cache);
-    while (obj) {
-        struct rtnl_addr* addr = (struct rtnl_addr*)obj;
-        if (rtnl_addr_get_ifindex(addr) == ifindex && rtnl_addr_get_family(addr) == AF_INET) {
-            struct nl_addr* local = rtnl_addr_get_local(addr);
-            if (local) {
-                char ip_buf[INET_ADDRSTRLEN] = {0};
-                nl_addr2str(local, ip_buf, sizeof(ip_buf));
-                ip_str = ip_buf;
-                size_t slash_pos = ip_str.find('/');
-                if (slash_pos != std::string::npos) {
-                    mask_str = ip_str.substr(slash_pos + 1);
-                    ip_str = ip_str.substr(0, slash_pos);
-                }
+    struct nl_addr* local = nullptr;
+    if (nl_addr_parse(ip_mask.c_str(), AF_INET, &local) < 0) {
+        rtnl_link_put(link);
+        error = "invalid IP address";
+        return false;
+    }
+    struct nl_addr* gw_addr = nullptr;
+    bool has_gateway = !gateway.empty() && gateway != "none";
+    if (has_gateway && nl_addr_parse(gateway.c_str(), AF_INET, &gw_addr) < 0) {
+        nl_addr_put(local);
+        rtnl_link_put(link);
+        error = "invalid gateway address";
+        return false;
+    }
+
+    // Шаги, которые уже выполнены в ядре, пропускаем: повторный setStatic ничего не меняет
+    int err = 0;
+    if (!link_up) {
+        err = txn.setLinkUp(link, true);
+    }
+
+    bool has_address = false;
+    struct nl_cache* if_addr_cache = nullptr;
+    if (netlink_mgr_.dumpInterfaceAddrs(ifindex, &if_addr_cache) == 0) {
+        for (struct nl_object* obj = nl_cache_get_first(if_addr_cache); obj; obj = nl_cache_get_next(obj)) {
+            struct rtnl_addr* existing = (struct rtnl_addr*)obj;
+            struct nl_addr* existing_local = rtnl_addr_get_local(existing);
+            if (rtnl_addr_get_ifindex(existing) == ifindex && existing_local && nl_addr_cmp(existing_local, local) == 0) {
+                has_address = true;
                 break;
             }
         }
-        obj = nl_cache_get_next(obj);
-    }
-
-    std::string gateway_str = "none";
-    obj = nl_cache_get_first(route_cache);
-    while (obj) {
-        struct rtnl_route* route = (struct rtnl_route*)obj;
-        if (rtnl_route_get_family(route) == AF_INET) {
-            struct nl_addr* dst = rtnl_route_get_dst(route);
-            if (dst && nl_addr_get_prefixlen(dst) == 0) { // Проверяем маршрут по умолчанию (0.0.0.0/0)
-                struct rtnl_nexthop* nh = rtnl_route_nexthop_n(route, 0);
-                if (nh && rtnl_route_nh_get_ifindex(nh) == ifindex) {
-                    struct nl_addr* gw = rtnl_route_nh_get_gateway(nh);
-                    if (gw) {
-                        char gw_buf[INET_ADDRSTRLEN] = {0};
-                        inet_ntop(AF_INET, nl_addr_get_binary_addr(gw), gw_buf, sizeof(gw_buf));
-                        gateway_str = gw_buf;
-                        break;
-                    }
-                }
-            }
+        nl_cache_free(if_addr_cache);
+    }
+    if (err == 0 && !has_address) {
+        struct rtnl_addr* rt_addr = rtnl_addr_alloc();
+        rtnl_addr_set_ifindex(rt_addr, ifindex);
+        rtnl_addr_set_local(rt_addr, local);
+        rtnl_addr_set_family(rt_addr, AF_INET);
+        err = txn.addAddress(rt_addr);
+        rtnl_addr_put(rt_addr);
+    }
+
+    if (err == 0 && has_gateway) {
+        uint32_t gateway_host = ntohl(*(uint32_t*)nl_addr_get_binary_addr(gw_addr));
+        // Маршрут по умолчанию с метрикой 0 один на таблицу: при замене запоминаем прежний для отката
+        const RouteEntry* previous = netlink_mgr_.getRouteIndex().findPriority(0, 0, 0);
+        if (!previous || previous->gateway != gateway_host || previous->ifindex != ifindex) {
+            struct rtnl_route* route = NetlinkTransaction::buildDefaultRoute(gateway_host, ifindex, 0, RTPROT_STATIC);
+            struct rtnl_route* old_route = previous
+                ? NetlinkTransaction::buildDefaultRoute(previous->gateway, previous->ifindex, previous->priority,
+                                                        previous->protocol)
+                : nullptr;
+            err = txn.replaceRoute(route, old_route);
+            rtnl_route_put(route);
+            if (old_route) rtnl_route_put(old_route);
         }
-        obj = nl_cache_get_next(obj);
     }
 
+    nl_addr_put(local);
+    if (gw_addr) nl_addr_put(gw_addr);
+    rtnl_link_put(link);
+
+    if (err < 0) {
+        error = "failed to prepare configuration: " + std::string(nl_geterror(err));
+        return false;
+    }
+    return true;
+}
+
+bool NetworkManager::getInterfaceState(const std::string& ifname, InterfaceState& state, std::string& error) {
+    struct nl_cache* link_cache = netlink_mgr_.getLinkCache();
+    struct nl_cache* addr_cache = netlink_mgr_.getAddrCache();
+    if (!link_cache || !addr_cache) {
+        error = "no cache available";
+        return false;
+    }
+
+    // Актуальное состояние интерфейса запрашиваем у ядра; общий кэш - запасной вариант
+    struct rtnl_link* link = nullptr;
+    if (netlink_mgr_.queryLink(ifname, &link) < 0) {
+        link = rtnl_link_get_by_name(link_cache, ifname.c_str());
+    }
+    if (!link) {
+        error = "interface not found";
+        return false;
+    }
+
+    state = InterfaceState();
+    state.ifindex = rtnl_link_get_ifindex(link);
+    state.flags = rtnl_link_get_flags(link);
     rtnl_link_put(link);
 
-    std::stringstream ss;
-    ss << ifname << ":" << ip_str << ":" << mask_str << ":" << flag_str << ":" << gateway_str;
-    return ss.str();
+    // Дамп адресов, отфильтрованный ядром по ifindex
+    struct nl_cache* if_addr_cache = nullptr;
+    if (netlink_mgr_.dumpInterfaceAddrs(state.ifindex, &if_addr_cache) == 0) {
+        addr_cache = if_addr_cache;
+    }
+
+    for (struct nl_object* obj = nl_cache_get_first(addr_cache); obj; obj = nl_cache_get_next(obj)) {
+        struct rtnl_addr* addr = (struct rtnl_addr*)obj;
+        if (rtnl_addr_get_ifindex(addr) != state.ifindex || rtnl_addr_get_family(addr) != AF_INET) {
+            continue;
+        }
+        struct nl_addr* local = rtnl_addr_get_local(addr);
+        if (local && nl_addr_get_len(local) == sizeof(uint32_t)) {
+            uint32_t address_be;
+            memcpy(&address_be, nl_addr_get_binary_addr(local), sizeof(address_be));
+            state.has_address = true;
+            state.address = ntohl(address_be);
+            state.prefix_len = static_cast<uint8_t>(nl_addr_get_prefixlen(local));
+            break;
+        }
+    }
+    if (if_addr_cache) nl_cache_free(if_addr_cache);
+
+    // Шлюз берём из LPM индекса: маршрут по умолчанию через этот интерфейс
+    const RouteEntry* default_route = netlink_mgr_.getRouteIndex().find(0, 0, state.ifindex);
+    if (default_route) {
+        state.gateway = default_route->gateway;
+    }
+    return true;
+}
+
+std::string NetworkManager::getInterfaceInfo(const std::string& ifname) {
+    InterfaceState state;
+    std::string error;
+    if (!getInterfaceState(ifname, state, error)) {
+        return "error(" + error + ")";
+    }
+
+    OutputBuffer out;
+    out.append(ifname).append(':');
+    if (state.has_address) {
+        out.appendIPv4(state.address);
+    } else {
+        out.append("none");
+    }
+    // Длина префикса /32 в текстовой записи адреса не указывается
+    out.append(':');
+    if (state.has_address && state.prefix_len != 32) {
+        out.appendDecimal(state.prefix_len);
+    } else {
+        out.append("none");
+    }
+    out.append((state.flags & IFF_UP) ? ":UP:" : ":DOWN:");
+    if (state.gateway) {
+        out.appendIPv4(state.gateway);
+    } else {
+        out.append("none");
+    }
+    return out.str();
 }
 
 bool NetworkManager::bringInterfaceUp(const std::string& ifname) {
@@ -229,14 +648,14 @@ bool NetworkManager::bringInterfaceUp(const std::string& ifname) {
     
     struct rtnl_link* link = rtnl_link_get_by_name(link_cache, ifname.c_str());
     if (!link) {
-        std::cerr << "Interface " << ifname << " not found" << std::endl;
+        logError("Interface ", ifname, " not found");
         return false;
     }
     
     // Создаем новый объект link для изменения
     struct rtnl_link* new_link = rtnl_link_alloc();
     if (!new_link) {
-        std::cerr << "Failed to allocate link object" << std::endl;
+        logError("Failed to allocate link object");
         rtnl_link_put(link);
         return false;
     }
@@ -244,15 +663,19 @@ bool NetworkManager::bringInterfaceUp(const std::string& ifname) {
     // Устанавливаем флаг UP
     rtnl_link_set_flags(new_link, IFF_UP);
     
-    int err = rtnl_link_change(sock, link, new_link, 0);
+    int err;
+    {
+        TraceSpan span("netlink ack", TraceCategory::Netlink, 1);
+        err = rtnl_link_change(sock, link, new_link, 0);
+    }
     if (err < 0) {
-        std::cerr << "Failed to bring interface " << ifname << " up: " << nl_geterror(err) << std::endl;
+        logError("Failed to bring interface ", ifname, " up: ", nl_geterror(err));
         rtnl_link_put(link);
         rtnl_link_put(new_link);
         return false;
     }
     
-    std::cout << "Interface " << ifname << " brought up successfully" << std::endl;
+    logInfo("Interface ", ifname, " brought up successfully");
     
     rtnl_link_put(link);
     rtnl_link_put(new_link);
@@ -265,14 +688,14 @@ bool NetworkManager::bringInterfaceDown(const std::string& ifname) {
     
     struct rtnl_link* link = rtnl_link_get_by_name(link_cache, ifname.c_str());
     if (!link) {
-        std::cerr << "Interface " << ifname << " not found" << std::endl;
+        logError("Interface ", ifname, " not found");
         return false;
     }
     
     // Создаем новый объект link для изменения
     struct rtnl_link* new_link = rtnl_link_alloc();
     if (!new_link) {
-        std::cerr << "Failed to allocate link object" << std::endl;
+        logError("Failed to allocate link object");
         rtnl_link_put(link);
         return false;
     }
@@ -280,15 +703,19 @@ bool NetworkManager::bringInterfaceDown(const std::string& ifname) {
     // Снимаем флаг UP
     rtnl_link_unset_flags(new_link, IFF_UP);
     
-    int err = rtnl_link_change(sock, link, new_link, 0);
+    int err;
+    {
+        TraceSpan span("netlink ack", TraceCategory::Netlink, 1);
+        err = rtnl_link_change(sock, link, new_link, 0);
+    }
     if (err < 0) {
-        std::cerr << "Failed to bring interface " << ifname << " down: " << nl_geterror(err) << std::endl;
+        logError("Failed to bring interface ", ifname, " down: ", nl_geterror(err));
         rtnl_link_put(link);
         rtnl_link_put(new_link);
         return false;
     }
     
-    std::cout << "Interface " << ifname << " brought down successfully" << std::endl;
+    logInfo("Interface ", ifname, " brought down successfully");
     
     rtnl_link_put(link);
     rtnl_link_put(new_link);
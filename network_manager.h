@@ -2,21 +2,103 @@
 #define NETWORK_MANAGER_H
 
 #include "netlink_manager.h"
+#include "netlink_transaction.h"
+#include "event_loop.h"
+#include "worker_pool.h"
+#include "spawn_helper.h"
+#include "dhcp_client.h"
+#include <functional>
+#include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
 class NetworkManager {
 public:
-    NetworkManager(NetlinkManager& netlink_mgr);
+    // Результат асинхронной операции в формате ответа команды
+    using ResultCallback = std::function<void(const std::string&)>;
+    // Завершение дочернего процесса: статус waitpid и вывод stderr
+    using ProcessCallback = std::function<void(int status, const std::string& stderr_output)>;
+
+    // Кто обслуживает dhcpOn/dhcpOff: встроенный клиент или внешний dhcpcd
+    enum class DhcpBackend { Builtin, Dhcpcd };
+
+    // Текущее состояние интерфейса (адреса в порядке байт хоста, 0 - нет шлюза)
+    struct InterfaceState {
+        int ifindex = 0;
+        unsigned int flags = 0;
+        bool has_address = false; // Первый IPv4 адрес интерфейса
+        uint32_t address = 0;
+        uint8_t prefix_len = 0;
+        uint32_t gateway = 0; // Шлюз маршрута по умолчанию через интерфейс
+    };
+
+    // Результат запуска дочернего процесса в рабочем потоке
+    struct SpawnedChild {
+        pid_t pid = -1;
+        int stderr_fd = -1;
+        std::string error;
+    };
+
+    NetworkManager(NetlinkManager& netlink_mgr, EventLoop& loop, WorkerPool& worker_pool,
+                   SpawnHelper& spawn_helper);
+    ~NetworkManager();
+
+    void setDhcpBackend(DhcpBackend backend);
+    // Пространство имён интерфейсов (см. NetlinkManager::setNetns): в нём открываются
+    // сокеты DHCP, а программы запускаются через nsenter --net=netns_path
+    void setNetns(int netns_fd, const std::string& netns_path);
+    int getNetns() const { return netns_fd_; }
     
-    std::string setDynamicIP(const std::string& ifname);
-    void stopDhcpcd(const std::string& ifname);
-    void setStaticIP(const std::string& ifname, const std::string& ip_mask, const std::string& gateway);
+    // dhcpcd запускается без блокировки цикла событий, done вызывается после выхода процесса
+    void setDynamicIP(const std::string& ifname, ResultCallback done);
+    // done получает success(DHCP disabled) или ошибку: клиент не запущен, dhcpcd -k не удался
+    void stopDhcpcd(const std::string& ifname, ResultCallback done);
+    // Адрес, маршрут по умолчанию и включение интерфейса применяются одной транзакцией:
+    // при ошибке любого шага уже сделанные изменения откатываются, причина - в error
+    bool setStaticIP(const std::string& ifname, const std::string& ip_mask, const std::string& gateway,
+                     std::string& error);
+    // Только подготовка шагов setStaticIP в чужой транзакции (для пакета команд)
+    bool stageStaticIP(NetlinkTransaction& txn, const std::string& ifname, const std::string& ip_mask,
+                       const std::string& gateway, std::string& error);
+    bool getInterfaceState(const std::string& ifname, InterfaceState& state, std::string& error);
+    // Состояние интерфейса текстом: ifname:ip:mask:UP|DOWN:gateway
     std::string getInterfaceInfo(const std::string& ifname);
     bool bringInterfaceUp(const std::string& ifname); 
     bool bringInterfaceDown(const std::string& ifname);
 
+    // Применение аренды встроенного DHCP клиента (адреса в порядке байт хоста)
+    bool applyDhcpLease(int ifindex, uint32_t address, uint8_t prefix_len, uint32_t router, uint32_t lease_time);
+    void removeDhcpLease(int ifindex, uint32_t address, uint8_t prefix_len, uint32_t router);
+
+    // Передача работы новому процессу: работающие встроенные DHCP клиенты.
+    // Аренды остаются на интерфейсах, их продлевает принявший процесс.
+    std::vector<DhcpClient::Snapshot> exportDhcpClients() const;
+    void restoreDhcpClient(const DhcpClient::Snapshot& snapshot);
+
 private:
     NetlinkManager& netlink_mgr_;
+    EventLoop& loop_;
+    WorkerPool& worker_pool_;
+    SpawnHelper& spawn_helper_;
+    DhcpBackend dhcp_backend_ = DhcpBackend::Builtin;
+    int netns_fd_ = -1;
+    std::string netns_path_;
+    std::map<std::string, std::unique_ptr<DhcpClient>> dhcp_clients_;
+
+    void startBuiltinDhcp(const std::string& ifname, ResultCallback done);
+    void runProcess(const std::vector<std::string>& program, ProcessCallback done);
+    void watchProcess(pid_t pid, int stderr_fd, ProcessCallback done);
+
+    // stderr дочернего процесса, собираемый в цикле событий
+    struct ChildOutput {
+        int fd;
+        bool watching;
+        std::string output;
+    };
+    std::shared_ptr<ChildOutput> collectOutput(int stderr_fd);
+    // Снимает наблюдение, дочитывает и закрывает pipe
+    void finishOutput(ChildOutput& state);
 };
 
 #endif // NETWORK_MANAGER_H
\ No newline at end of file
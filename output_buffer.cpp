@@ -0,0 +1,122 @@
+#include "output_buffer.h"
+#include <array>
+
+namespace {
+
+// Десятичная запись чисел 0..255: октеты адресов и длины префиксов
+struct OctetText {
+    char text[3];
+    uint8_t len;
+};
+
+constexpr std::array<OctetText, 256> makeOctetTable() {
+    std::array<OctetText, 256> table{};
+    for (int i = 0; i < 256; ++i) {
+        OctetText& entry = table[i];
+        if (i >= 100) {
+            entry.text[0] = static_cast<char>('0' + i / 100);
+            entry.text[1] = static_cast<char>('0' + i / 10 % 10);
+            entry.text[2] = static_cast<char>('0' + i % 10);
+            entry.len = 3;
+        } else if (i >= 10) {
+            entry.text[0] = static_cast<char>('0' + i / 10);
+            entry.text[1] = static_cast<char>('0' + i % 10);
+            entry.len = 2;
+        } else {
+            entry.text[0] = static_cast<char>('0' + i);
+            entry.len = 1;
+        }
+    }
+    return table;
+}
+
+// Две шестнадцатеричные цифры каждого байта
+constexpr std::array<char, 512> makeHexTable() {
+    constexpr char digits[] = "0123456789abcdef";
+    std::array<char, 512> table{};
+    for (int i = 0; i < 256; ++i) {
+        table[i * 2] = digits[i >> 4];
+        table[i * 2 + 1] = digits[i & 0xf];
+    }
+    return table;
+}
+
+constexpr std::array<OctetText, 256> OCTETS = makeOctetTable();
+constexpr std::array<char, 512> HEX = makeHexTable();
+
+} // namespace
+
+OutputBuffer& OutputBuffer::appendDecimal(uint32_t value) {
+    if (value < 256) {
+        data_.append(OCTETS[value].text, OCTETS[value].len);
+        return *this;
+    }
+    char buffer[10];
+    size_t pos = sizeof(buffer);
+    do {
+        buffer[--pos] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value);
+    data_.append(buffer + pos, sizeof(buffer) - pos);
+    return *this;
+}
+
+OutputBuffer& OutputBuffer::appendIPv4(uint32_t address) {
+    char buffer[15];
+    size_t len = 0;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        const OctetText& octet = OCTETS[(address >> shift) & 0xff];
+        for (uint8_t i = 0; i < octet.len; ++i) {
+            buffer[len++] = octet.text[i];
+        }
+        if (shift) {
+            buffer[len++] = '.';
+        }
+    }
+    data_.append(buffer, len);
+    return *this;
+}
+
+OutputBuffer& OutputBuffer::appendNetmask(uint8_t prefix_len) {
+    return appendIPv4(prefix_len == 0 ? 0 : ~0u << (32 - (prefix_len > 32 ? 32 : prefix_len)));
+}
+
+OutputBuffer& OutputBuffer::appendMac(const uint8_t* mac, char separator) {
+    char buffer[17];
+    for (int i = 0; i < 6; ++i) {
+        buffer[i * 3] = HEX[mac[i] * 2];
+        buffer[i * 3 + 1] = HEX[mac[i] * 2 + 1];
+        if (i < 5) {
+            buffer[i * 3 + 2] = separator;
+        }
+    }
+    data_.append(buffer, sizeof(buffer));
+    return *this;
+}
+
+OutputBuffer& OutputBuffer::appendHex32(uint32_t value) {
+    char buffer[8];
+    for (int i = 0; i < 4; ++i) {
+        uint8_t byte = static_cast<uint8_t>(value >> (24 - i * 8));
+        buffer[i * 2] = HEX[byte * 2];
+        buffer[i * 2 + 1] = HEX[byte * 2 + 1];
+    }
+    data_.append(buffer, sizeof(buffer));
+    return *this;
+}
+
+OutputBufferPool::Lease OutputBufferPool::acquire() {
+    if (free_.empty()) {
+        return Lease(*this, std::make_unique<OutputBuffer>());
+    }
+    std::unique_ptr<OutputBuffer> buffer = std::move(free_.back());
+    free_.pop_back();
+    buffer->clear();
+    return Lease(*this, std::move(buffer));
+}
+
+void OutputBufferPool::release(std::unique_ptr<OutputBuffer> buffer) {
+    if (free_.size() < MAX_POOLED && buffer->capacity() <= MAX_RETAINED_CAPACITY) {
+        free_.push_back(std::move(buffer));
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Буфер для формирования ответов и событий. clear() сохраняет выделенную
+// память, поэтому повторно используемый буфер не выделяет её заново.
+// Числа, адреса и флаги кодируются по таблицам, без snprintf и потоков.
+class OutputBuffer {
+public:
+    void clear() { data_.clear(); }
+    bool empty() const { return data_.empty(); }
+    size_t size() const { return data_.size(); }
+    size_t capacity() const { return data_.capacity(); }
+    std::string_view view() const { return data_; }
+    std::string str() const { return data_; }
+
+    OutputBuffer& append(std::string_view text) {
+        data_.append(text.data(), text.size());
+        return *this;
+    }
+    OutputBuffer& append(char c) {
+        data_.push_back(c);
+        return *this;
+    }
+    // Двоичные данные; overwrite - дописать заголовок, размер которого стал известен позже
+    OutputBuffer& appendBytes(const void* data, size_t len) {
+        data_.append(static_cast<const char*>(data), len);
+        return *this;
+    }
+    void overwrite(size_t pos, const void* data, size_t len) {
+        data_.replace(pos, len, static_cast<const char*>(data), len);
+    }
+    OutputBuffer& appendDecimal(uint32_t value);
+    // Адрес в порядке байт хоста, точечная запись
+    OutputBuffer& appendIPv4(uint32_t address);
+    // Маска по длине префикса: 24 -> 255.255.255.0
+    OutputBuffer& appendNetmask(uint8_t prefix_len);
+    OutputBuffer& appendMac(const uint8_t* mac, char separator);
+    // Ровно 8 шестнадцатеричных цифр в нижнем регистре
+    OutputBuffer& appendHex32(uint32_t value);
+
+private:
+    std::string data_;
+};
+
+// Пул буферов потока цикла событий: acquire() в установившемся режиме
+// берёт буфер с уже выделенной памятью, Lease возвращает его в деструкторе.
+class OutputBufferPool {
+public:
+    class Lease {
+    public:
+        Lease(OutputBufferPool& pool, std::unique_ptr<OutputBuffer> buffer)
+            : pool_(&pool), buffer_(std::move(buffer)) {}
+        Lease(Lease&& other) noexcept = default;
+        Lease& operator=(Lease&&) = delete;
+        ~Lease() {
+            if (buffer_) {
+                pool_->release(std::move(buffer_));
+            }
+        }
+
+        OutputBuffer& operator*() const { return *buffer_; }
+        OutputBuffer* operator->() const { return buffer_.get(); }
+
+    private:
+        OutputBufferPool* pool_;
+        std::unique_ptr<OutputBuffer> buffer_;
+    };
+
+    Lease acquire();
+
+private:
+    // Буферы больше этого (например, после enumerate на тысячах интерфейсов)
+    // не возвращаются в пул, чтобы не удерживать память
+    static constexpr size_t MAX_RETAINED_CAPACITY = 256 * 1024;
+    static constexpr size_t MAX_POOLED = 16;
+
+    std::vector<std::unique_ptr<OutputBuffer>> free_;
+
+    void release(std::unique_ptr<OutputBuffer> buffer);
+};
+
+#endif // OUTPUT_BUFFER_H
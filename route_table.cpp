@@ -0,0 +1,291 @@
+#include "route_table.h"
+#include <algorithm>
+
+namespace {
+
+inline uint32_t prefixMask(uint8_t len) {
+    return len == 0 ? 0 : ~0u << (32 - len);
+}
+
+inline int bitAt(uint32_t value, uint8_t pos) {
+    return (value >> (31 - pos)) & 1;
+}
+
+inline uint8_t commonLength(uint32_t a, uint32_t b, uint8_t max) {
+    uint32_t diff = a ^ b;
+    uint8_t len = diff ? static_cast<uint8_t>(__builtin_clz(diff)) : 32;
+    return std::min(len, max);
+}
+
+} // namespace
+
+RouteTable::RouteTable() = default;
+
+uint32_t RouteTable::allocNode(uint32_t key, uint8_t len) {
+    Node node = {key & prefixMask(len), len, {NIL, NIL}, NIL};
+    if (!free_nodes_.empty()) {
+        uint32_t idx = free_nodes_.back();
+        free_nodes_.pop_back();
+        nodes_[idx] = node;
+        return idx;
+    }
+    nodes_.push_back(node);
+    return static_cast<uint32_t>(nodes_.size() - 1);
+}
+
+uint32_t RouteTable::allocSlot(const RouteEntry& route) {
+    RouteSlot slot = {route, NIL};
+    if (!free_slots_.empty()) {
+        uint32_t idx = free_slots_.back();
+        free_slots_.pop_back();
+        slots_[idx] = slot;
+        return idx;
+    }
+    slots_.push_back(slot);
+    return static_cast<uint32_t>(slots_.size() - 1);
+}
+
+void RouteTable::setLink(uint32_t parent, int bit, uint32_t node) {
+    if (parent == NIL) {
+        root_ = node;
+    } else {
+        nodes_[parent].child[bit] = node;
+    }
+}
+
+uint32_t RouteTable::findOrCreate(uint32_t prefix, uint8_t len) {
+    uint32_t parent = NIL;
+    int bit = 0;
+    uint32_t cur = root_;
+
+    while (cur != NIL) {
+        const Node& node = nodes_[cur];
+        uint8_t common = commonLength(node.key, prefix, std::min(node.len, len));
+        if (common == node.len) {
+            if (node.len == len) {
+                return cur;
+            }
+            parent = cur;
+            bit = bitAt(prefix, node.len);
+            cur = node.child[bit];
+            continue;
+        }
+
+        // Префикс расходится с узлом: вставляем новый узел или развилку над ним.
+        // allocNode может перераспределить nodes_, ссылку node после него не используем.
+        uint32_t existing_key = node.key;
+        uint32_t created = allocNode(prefix, len);
+        if (common == len) {
+            nodes_[created].child[bitAt(existing_key, len)] = cur;
+            setLink(parent, bit, created);
+        } else {
+            uint32_t branch = allocNode(prefix, common);
+            nodes_[branch].child[bitAt(existing_key, common)] = cur;
+            nodes_[branch].child[bitAt(prefix, common)] = created;
+            setLink(parent, bit, branch);
+        }
+        return created;
+    }
+
+    uint32_t created = allocNode(prefix, len);
+    setLink(parent, bit, created);
+    return created;
+}
+
+void RouteTable::insert(const RouteEntry& route) {
+    RouteEntry entry = route;
+    entry.prefix &= prefixMask(entry.prefix_len);
+    uint32_t node = findOrCreate(entry.prefix, entry.prefix_len);
+
+    // Список отсортирован по priority: первый элемент - активный маршрут
+    uint32_t prev = NIL;
+    uint32_t cur = nodes_[node].routes;
+    while (cur != NIL && slots_[cur].entry.priority < entry.priority) {
+        prev = cur;
+        cur = slots_[cur].next;
+    }
+    if (cur != NIL && slots_[cur].entry.priority == entry.priority) {
+        forgetRoute(slots_[cur].entry);
+        slots_[cur].entry = entry;
+    } else {
+        uint32_t slot = allocSlot(entry);
+        slots_[slot].next = cur;
+        if (prev == NIL) {
+            nodes_[node].routes = slot;
+        } else {
+            slots_[prev].next = slot;
+        }
+        ++route_count_;
+    }
+    ++routes_per_ifindex_[entry.ifindex];
+}
+
+void RouteTable::forgetRoute(const RouteEntry& route) {
+    auto it = routes_per_ifindex_.find(route.ifindex);
+    if (it != routes_per_ifindex_.end() && --it->second == 0) {
+        routes_per_ifindex_.erase(it);
+    }
+}
+
+bool RouteTable::remove(uint32_t prefix, uint8_t prefix_len, uint32_t priority) {
+    prefix &= prefixMask(prefix_len);
+    std::vector<uint32_t> path;
+    uint32_t cur = root_;
+
+    while (cur != NIL) {
+        const Node& node = nodes_[cur];
+        if (node.len > prefix_len || commonLength(node.key, prefix, node.len) != node.len) {
+            return false;
+        }
+        path.push_back(cur);
+        if (node.len == prefix_len) {
+            break;
+        }
+        cur = node.child[bitAt(prefix, node.len)];
+    }
+    if (cur == NIL) {
+        return false;
+    }
+
+    uint32_t* link = &nodes_[cur].routes;
+    while (*link != NIL && slots_[*link].entry.priority != priority) {
+        link = &slots_[*link].next;
+    }
+    if (*link == NIL) {
+        return false;
+    }
+
+    uint32_t slot = *link;
+    forgetRoute(slots_[slot].entry);
+    *link = slots_[slot].next;
+    free_slots_.push_back(slot);
+    --route_count_;
+
+    collapse(path);
+    return true;
+}
+
+void RouteTable::collapse(const std::vector<uint32_t>& path) {
+    // Убираем опустевшие узлы без маршрутов, у которых осталось меньше двух потомков
+    for (size_t i = path.size(); i-- > 0;) {
+        uint32_t cur = path[i];
+        const Node& node = nodes_[cur];
+        if (node.routes != NIL || (node.child[0] != NIL && node.child[1] != NIL)) {
+            break;
+        }
+
+        uint32_t replacement = (node.child[0] != NIL) ? node.child[0] : node.child[1];
+        uint32_t parent = (i > 0) ? path[i - 1] : NIL;
+        int bit = (parent != NIL) ? bitAt(node.key, nodes_[parent].len) : 0;
+        setLink(parent, bit, replacement);
+        free_nodes_.push_back(cur);
+
+        if (replacement != NIL) {
+            break; // У родителя число потомков не изменилось
+        }
+    }
+}
+
+size_t RouteTable::removeInterface(int ifindex) {
+    if (routes_per_ifindex_.find(ifindex) == routes_per_ifindex_.end()) {
+        return 0;
+    }
+
+    std::vector<RouteEntry> doomed;
+    std::vector<uint32_t> stack;
+    if (root_ != NIL) {
+        stack.push_back(root_);
+    }
+    while (!stack.empty()) {
+        uint32_t cur = stack.back();
+        stack.pop_back();
+        for (uint32_t s = nodes_[cur].routes; s != NIL; s = slots_[s].next) {
+            if (slots_[s].entry.ifindex == ifindex) {
+                doomed.push_back(slots_[s].entry);
+            }
+        }
+        for (uint32_t child : nodes_[cur].child) {
+            if (child != NIL) {
+                stack.push_back(child);
+            }
+        }
+    }
+
+    for (const auto& route : doomed) {
+        remove(route.prefix, route.prefix_len, route.priority);
+    }
+    return doomed.size();
+}
+
+void RouteTable::clear() {
+    nodes_.clear();
+    free_nodes_.clear();
+    slots_.clear();
+    free_slots_.clear();
+    routes_per_ifindex_.clear();
+    root_ = NIL;
+    route_count_ = 0;
+}
+
+const RouteEntry* RouteTable::lookup(uint32_t addr) const {
+    const RouteEntry* best = nullptr;
+    uint32_t cur = root_;
+
+    while (cur != NIL) {
+        const Node& node = nodes_[cur];
+        if ((addr ^ node.key) & prefixMask(node.len)) {
+            break;
+        }
+        if (node.routes != NIL) {
+            best = &slots_[node.routes].entry;
+        }
+        if (node.len == 32) {
+            break;
+        }
+        cur = node.child[bitAt(addr, node.len)];
+    }
+    return best;
+}
+
+uint32_t RouteTable::findNode(uint32_t prefix, uint8_t prefix_len) const {
+    prefix &= prefixMask(prefix_len);
+    uint32_t cur = root_;
+
+    while (cur != NIL) {
+        const Node& node = nodes_[cur];
+        if (node.len > prefix_len || commonLength(node.key, prefix, node.len) != node.len) {
+            return NIL;
+        }
+        if (node.len == prefix_len) {
+            return cur;
+        }
+        cur = node.child[bitAt(prefix, node.len)];
+    }
+    return NIL;
+}
+
+const RouteEntry* RouteTable::find(uint32_t prefix, uint8_t prefix_len, int ifindex) const {
+    uint32_t node = findNode(prefix, prefix_len);
+    if (node == NIL) {
+        return nullptr;
+    }
+    for (uint32_t s = nodes_[node].routes; s != NIL; s = slots_[s].next) {
+        if (ifindex == 0 || slots_[s].entry.ifindex == ifindex) {
+            return &slots_[s].entry;
+        }
+    }
+    return nullptr;
+}
+
+const RouteEntry* RouteTable::findPriority(uint32_t prefix, uint8_t prefix_len, uint32_t priority) const {
+    uint32_t node = findNode(prefix, prefix_len);
+    if (node == NIL) {
+        return nullptr;
+    }
+    for (uint32_t s = nodes_[node].routes; s != NIL && slots_[s].entry.priority <= priority; s = slots_[s].next) {
+        if (slots_[s].entry.priority == priority) {
+            return &slots_[s].entry;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,75 @@
+#ifndef ROUTE_TABLE_H
+#define ROUTE_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Маршрут IPv4. Адреса хранятся в порядке байт хоста, gateway == 0 - без шлюза.
+struct RouteEntry {
+    uint32_t prefix = 0;
+    uint8_t prefix_len = 0;
+    uint32_t gateway = 0;
+    int ifindex = 0;
+    uint32_t priority = 0;
+    uint8_t protocol = 0;
+};
+
+// Индекс longest-prefix-match на сжатом двоичном дереве (path-compressed trie).
+// Узлы и маршруты лежат в плоских векторах со ссылками по индексу, чтобы
+// полная таблица Интернета (~1M префиксов) занимала десятки мегабайт,
+// а поиск делал не более 33 переходов по узлам.
+class RouteTable {
+public:
+    RouteTable();
+
+    // Добавляет маршрут; маршрут с тем же префиксом и priority заменяется
+    void insert(const RouteEntry& route);
+    bool remove(uint32_t prefix, uint8_t prefix_len, uint32_t priority);
+    // Удаляет все маршруты через интерфейс (ядро убирает их без RTM_DELROUTE)
+    size_t removeInterface(int ifindex);
+    void clear();
+
+    // Лучший (с минимальной priority) маршрут для адреса, nullptr если не найден
+    const RouteEntry* lookup(uint32_t addr) const;
+    // Точное совпадение префикса; ifindex == 0 - любой интерфейс
+    const RouteEntry* find(uint32_t prefix, uint8_t prefix_len, int ifindex = 0) const;
+    // Точное совпадение префикса и priority - ключ маршрута в ядре
+    const RouteEntry* findPriority(uint32_t prefix, uint8_t prefix_len, uint32_t priority) const;
+
+    size_t size() const { return route_count_; }
+
+private:
+    static constexpr uint32_t NIL = UINT32_MAX;
+
+    struct Node {
+        uint32_t key;
+        uint8_t len;
+        uint32_t child[2];
+        uint32_t routes; // Голова списка маршрутов, отсортированного по priority
+    };
+
+    struct RouteSlot {
+        RouteEntry entry;
+        uint32_t next;
+    };
+
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> free_nodes_;
+    std::vector<RouteSlot> slots_;
+    std::vector<uint32_t> free_slots_;
+    std::unordered_map<int, size_t> routes_per_ifindex_;
+    uint32_t root_ = NIL;
+    size_t route_count_ = 0;
+
+    uint32_t allocNode(uint32_t key, uint8_t len);
+    uint32_t allocSlot(const RouteEntry& route);
+    void setLink(uint32_t parent, int bit, uint32_t node);
+    uint32_t findOrCreate(uint32_t prefix, uint8_t len);
+    void collapse(const std::vector<uint32_t>& path);
+    void forgetRoute(const RouteEntry& route);
+    uint32_t findNode(uint32_t prefix, uint8_t prefix_len) const;
+};
+
+#endif // ROUTE_TABLE_H
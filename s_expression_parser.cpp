@@ -1,56 +1,268 @@
 #include "s_expression_parser.h"
-#include <sstream>
+#include <algorithm>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-std::vector<std::string> SExpressionParser::parseCommand(const std::string& command) {
-    std::vector<std::string> result;
-    std::string current;
-    int depth = 0;
-    bool in_token = false;
+namespace {
 
-    // Проверяем, что команда начинается с '(' и заканчивается ')'
-    if (command.length() < 2 || command.front() != '(' || command.back() != ')') {
-        return result; // Пустой результат при неверном формате
+inline bool isDelimiter(char c) {
+    return c == '(' || c == ')' || c == ',' || c == ' ' || c == '\t' || c == '\n';
+}
+
+// Длина начального блока обычных символов (до первого разделителя или конца)
+size_t ordinaryRun(const char* data, size_t len) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i open = _mm_set1_epi8('(');
+    const __m128i close = _mm_set1_epi8(')');
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i hits = _mm_or_si128(
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, open), _mm_cmpeq_epi8(chunk, close)),
+                         _mm_or_si128(_mm_cmpeq_epi8(chunk, comma), _mm_cmpeq_epi8(chunk, space))),
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, tab), _mm_cmpeq_epi8(chunk, newline)));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    while (i < len && !isDelimiter(data[i])) {
+        ++i;
+    }
+    return i;
+}
+
+// Номер запроса: 1..4294967295
+bool parseRequestId(std::string_view text, uint32_t& id) {
+    if (text.empty() || text.size() > 10) {
+        return false;
+    }
+    uint64_t value = 0;
+    for (char c : text) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        value = value * 10 + (c - '0');
+    }
+    if (value == 0 || value > UINT32_MAX) {
+        return false;
+    }
+    id = static_cast<uint32_t>(value);
+    return true;
+}
+
+} // namespace
+
+std::unique_ptr<CommandStream> SExpressionParser::createStream() {
+    return std::make_unique<SExpressionStream>();
+}
+
+// (cmd(тело)); с номером запроса - (cmd(id=7)(тело))
+size_t SExpressionParser::beginResponse(OutputBuffer& out, std::string_view command, uint32_t request_id) {
+    size_t mark = out.size();
+    out.append('(').append(command).append('(');
+    if (request_id) {
+        out.append("id=").appendDecimal(request_id).append(")(");
+    }
+    return mark;
+}
+
+void SExpressionParser::endResponse(OutputBuffer& out, size_t) {
+    out.append("))");
+}
+
+void SExpressionParser::parseError(OutputBuffer& out) {
+    out.append("(error(invalid S-expression format))");
+}
+
+void SExpressionParser::status(OutputBuffer& out, std::string_view text) {
+    out.append(text);
+}
+
+// Список: name(запись запись ...), записи - поля key=value через пробел
+void SExpressionParser::beginList(OutputBuffer& out, std::string_view name) {
+    out.append(name).append('(');
+}
+
+void SExpressionParser::endList(OutputBuffer& out) {
+    out.append(')');
+}
+
+void SExpressionParser::recordSeparator(OutputBuffer& out) {
+    out.append(' ');
+}
+
+size_t SExpressionParser::beginRecord(OutputBuffer& out) {
+    return out.size();
+}
+
+void SExpressionParser::endRecord(OutputBuffer&, size_t) {}
+
+void SExpressionParser::textField(OutputBuffer& out, bool first, Field field, std::string_view value) {
+    key(out, first, field).append(value);
+}
+
+void SExpressionParser::ipv4Field(OutputBuffer& out, bool first, Field field, bool present, uint32_t address,
+                                  std::string_view absent) {
+    if (present) {
+        key(out, first, field).appendIPv4(address);
+    } else {
+        key(out, first, field).append(absent);
     }
+}
+
+void SExpressionParser::prefixField(OutputBuffer& out, bool first, Field field, uint32_t address,
+                                    uint8_t prefix_len) {
+    key(out, first, field).appendIPv4(address).append('/').appendDecimal(prefix_len);
+}
+
+void SExpressionParser::prefixLenField(OutputBuffer& out, bool first, Field field, bool present,
+                                       uint8_t prefix_len, bool netmask) {
+    if (!present) {
+        key(out, first, field).append("none");
+    } else if (netmask) {
+        key(out, first, field).appendNetmask(prefix_len);
+    } else {
+        key(out, first, field).appendDecimal(prefix_len);
+    }
+}
 
-    // Парсим содержимое между скобками
-    for (size_t i = 1; i < command.length() - 1; ++i) {
-        char c = command[i];
+void SExpressionParser::macField(OutputBuffer& out, bool first, Field field, const uint8_t* mac, char separator) {
+    if (mac) {
+        key(out, first, field).appendMac(mac, separator);
+    } else {
+        key(out, first, field).append("none");
+    }
+}
+
+void SExpressionParser::hexField(OutputBuffer& out, bool first, Field field, uint32_t value) {
+    key(out, first, field).appendHex32(value);
+}
+
+void SExpressionParser::decimalField(OutputBuffer& out, bool first, Field field, uint32_t value) {
+    key(out, first, field).appendDecimal(value);
+}
+
+OutputBuffer& SExpressionParser::key(OutputBuffer& out, bool first, Field field) {
+    if (!first) {
+        out.append(' ');
+    }
+    return out.append(fieldName(field)).append('=');
+}
+
+// Токены - как и раньше: на верхнем уровне команду делят скобки и запятая вне
+// токена; внутри вложенных скобок всё, кроме пробелов и скобок, склеивается.
+CommandStream::Status SExpressionStream::parse(std::string& buffer, CommandTokens& tokens, size_t& end) {
+    char* data = &buffer[0];
+    size_t size = buffer.size();
+
+    while (pos_ < size) {
+        if (depth_ == 0) {
+            // Между командами допускаются только пробельные символы
+            char c = data[pos_];
+            if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+                ++pos_;
+                continue;
+            }
+            if (c != '(') {
+                return Status::Error;
+            }
+            ++pos_;
+            depth_ = 1;
+            in_token_ = false;
+            token_open_ = false;
+            spans_.clear();
+            continue;
+        }
+
+        size_t run = ordinaryRun(data + pos_, size - pos_);
+        if (run == 0 && data[pos_] == ',' && (depth_ != 1 || in_token_)) {
+            run = 1; // Запятая внутри токена или вложенных скобок - обычный символ
+        }
+        if (run > 0) {
+            if (!token_open_) {
+                token_open_ = true;
+                token_begin_ = write_ = pos_;
+            }
+            if (write_ != pos_) {
+                memmove(data + write_, data + pos_, run);
+            }
+            write_ += run;
+            pos_ += run;
+            in_token_ = true;
+            continue;
+        }
+
+        char c = data[pos_++];
         if (c == '(') {
-            if (depth == 0 && !current.empty()) {
-                result.push_back(current);
-                current.clear();
+            if (depth_ == 1) {
+                finishToken();
             }
-            depth++;
-            in_token = false;
+            ++depth_;
+            in_token_ = false;
         } else if (c == ')') {
-            depth--;
-            if (depth == 0 && !current.empty()) {
-                result.push_back(current);
-                current.clear();
+            --depth_;
+            if (depth_ <= 1) {
+                finishToken();
             }
-            in_token = false;
-        } else if (c == ',' && depth == 0 && !in_token) {
-            if (!current.empty()) {
-                result.push_back(current);
-                current.clear();
+            in_token_ = false;
+            if (depth_ == 0) {
+                tokens.clear();
+                for (size_t i = 0; i < spans_.size(); ++i) {
+                    std::string_view token(data + spans_[i].first, spans_[i].second - spans_[i].first);
+                    // Первый аргумент (id=N) - номер запроса, а не аргумент команды
+                    if (i == 1 && token.compare(0, 3, "id=") == 0) {
+                        uint32_t id = 0;
+                        if (!parseRequestId(token.substr(3), id)) {
+                            tokens.clear();
+                            break;
+                        }
+                        tokens.setRequestId(id);
+                        continue;
+                    }
+                    tokens.push(token);
+                }
+                end = pos_;
+                return Status::Complete;
             }
-        } else if (c != ' ' && c != '\t' && c != '\n') {
-            current += c;
-            in_token = true;
-        } else if (in_token && (c == ' ' || c == '\t' || c == '\n')) {
-            in_token = false;
+        } else if (c == ',') {
+            finishToken(); // Запятая на верхнем уровне вне токена
+        } else {
+            in_token_ = false; // Пробел: следующий символ продолжит тот же токен
         }
     }
+    return Status::NeedMore;
+}
 
-    if (!current.empty() && depth == 0) {
-        result.push_back(current);
+void SExpressionStream::finishToken() {
+    if (!token_open_) {
+        return;
     }
+    token_open_ = false;
+    spans_.emplace_back(token_begin_, write_);
+}
 
-    return result;
+void SExpressionStream::discard(size_t bytes) {
+    pos_ -= bytes;
+    token_begin_ -= std::min(token_begin_, bytes);
+    write_ -= std::min(write_, bytes);
+    for (auto& span : spans_) {
+        span.first -= bytes;
+        span.second -= bytes;
+    }
 }
 
-std::string SExpressionParser::serializeResponse(const std::string& command, const std::string& response) {
-    std::stringstream ss;
-    ss << "(" << command << "(" << response << "))";
-    return ss.str();
-}
\ No newline at end of file
+void SExpressionStream::reset() {
+    pos_ = 0;
+    depth_ = 0;
+    in_token_ = false;
+    token_open_ = false;
+    spans_.clear();
+}
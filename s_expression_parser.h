@@ -3,12 +3,58 @@
 
 #include "command_serializer.h"
 #include <string>
+#include <utility>
 #include <vector>
 
 class SExpressionParser : public CommandSerializer {
 public:
-    std::vector<std::string> parseCommand(const std::string& command) override;
-    std::string serializeResponse(const std::string& command, const std::string& response) override;
+    std::unique_ptr<CommandStream> createStream() override;
+    size_t beginResponse(OutputBuffer& out, std::string_view command, uint32_t request_id) override;
+    void endResponse(OutputBuffer& out, size_t mark) override;
+    void parseError(OutputBuffer& out) override;
+
+    void status(OutputBuffer& out, std::string_view text) override;
+    void beginList(OutputBuffer& out, std::string_view name) override;
+    void endList(OutputBuffer& out) override;
+    void recordSeparator(OutputBuffer& out) override;
+    size_t beginRecord(OutputBuffer& out) override;
+    void endRecord(OutputBuffer& out, size_t mark) override;
+
+    void textField(OutputBuffer& out, bool first, Field field, std::string_view value) override;
+    void ipv4Field(OutputBuffer& out, bool first, Field field, bool present, uint32_t address,
+                   std::string_view absent) override;
+    void prefixField(OutputBuffer& out, bool first, Field field, uint32_t address, uint8_t prefix_len) override;
+    void prefixLenField(OutputBuffer& out, bool first, Field field, bool present, uint8_t prefix_len,
+                        bool netmask) override;
+    void macField(OutputBuffer& out, bool first, Field field, const uint8_t* mac, char separator) override;
+    void hexField(OutputBuffer& out, bool first, Field field, uint32_t value) override;
+    void decimalField(OutputBuffer& out, bool first, Field field, uint32_t value) override;
+
+private:
+    // " key=" (без пробела для первого поля)
+    static OutputBuffer& key(OutputBuffer& out, bool first, Field field);
+};
+
+// Потоковый разбор S-выражений. Обычные символы пропускаются блоками (поиск
+// разделителей векторизован), токен без внутренних пробелов и скобок остаётся
+// на месте без копирования, остальные сдвигаются внутри буфера.
+class SExpressionStream : public CommandStream {
+public:
+    Status parse(std::string& buffer, CommandTokens& tokens, size_t& end) override;
+    void discard(size_t bytes) override;
+    void reset() override;
+
+private:
+    // Смещения в буфере; depth_ == 0 - между командами
+    size_t pos_ = 0;
+    int depth_ = 0;
+    bool in_token_ = false;
+    bool token_open_ = false;
+    size_t token_begin_ = 0;
+    size_t write_ = 0;
+    std::vector<std::pair<size_t, size_t>> spans_;
+
+    void finishToken();
 };
 
-#endif // S_EXPRESSION_PARSER_H
\ No newline at end of file
+#endif // S_EXPRESSION_PARSER_H
@@ -0,0 +1,332 @@
+#include "spawn_helper.h"
+#include "logger.h"
+#include <stdexcept>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+namespace {
+
+constexpr uint32_t REPLY_SPAWNED = 1; // value - 0 или errno запуска
+constexpr uint32_t REPLY_EXITED = 2;  // value - статус waitpid
+constexpr size_t MAX_REQUEST_SIZE = 8192;
+
+// Запрос: заголовок, затем argc строк argv, каждая с завершающим '\0'.
+// fd перенаправлений идут в SCM_RIGHTS в том же порядке, что и targets.
+struct RequestHeader {
+    uint32_t id;
+    uint32_t argc;
+    uint32_t redirect_count;
+    int32_t targets[SpawnHelper::MAX_REDIRECTS];
+};
+
+struct Reply {
+    uint32_t type;
+    uint32_t id;
+    int32_t pid;
+    int32_t value;
+};
+
+void sendReply(int sock, uint32_t type, uint32_t id, pid_t pid, int value) {
+    Reply reply = {type, id, pid, value};
+    while (send(sock, &reply, sizeof(reply), MSG_NOSIGNAL) == -1 && errno == EINTR) {
+    }
+}
+
+// Запускает процесс по запросу; возвращает pid или -errno
+pid_t spawnRequest(const RequestHeader& header, const char* strings, size_t strings_len, const int* fds) {
+    std::vector<char*> argv;
+    size_t offset = 0;
+    for (uint32_t i = 0; i < header.argc; ++i) {
+        const char* end = static_cast<const char*>(memchr(strings + offset, '\0', strings_len - offset));
+        if (!end) {
+            return -EINVAL;
+        }
+        argv.push_back(const_cast<char*>(strings + offset));
+        offset = end - strings + 1;
+    }
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    for (uint32_t i = 0; i < header.redirect_count; ++i) {
+        posix_spawn_file_actions_adddup2(&actions, fds[i], header.targets[i]);
+    }
+
+    // Дочерний процесс получает обычную маску сигналов и их обработку по умолчанию
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t empty, defaults;
+    sigemptyset(&empty);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGCHLD);
+    sigaddset(&defaults, SIGPIPE);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGTERM);
+    posix_spawnattr_setsigmask(&attr, &empty);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    pid_t pid = -1;
+    int err = posix_spawnp(&pid, argv[0], &actions, &attr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    return err ? -err : pid;
+}
+
+} // namespace
+
+SpawnHelper::SpawnHelper() {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+        throw std::runtime_error("Не удалось создать socketpair для помощника запуска");
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        close(sv[0]);
+        close(sv[1]);
+        throw std::runtime_error("Не удалось запустить помощник запуска процессов");
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        helperMain(sv[1]);
+    }
+
+    close(sv[1]);
+    sock_ = sv[0];
+    helper_pid_ = pid;
+    fcntl(sock_, F_SETFL, fcntl(sock_, F_GETFL) | O_NONBLOCK);
+}
+
+SpawnHelper::~SpawnHelper() {
+    // Цикл событий к этому моменту уже уничтожен, поэтому только закрываем сокет:
+    // помощник увидит EOF и завершится
+    if (sock_ != -1) {
+        close(sock_);
+    }
+    if (helper_pid_ > 0) {
+        waitpid(helper_pid_, nullptr, 0);
+    }
+}
+
+void SpawnHelper::attach(EventLoop& loop) {
+    loop_ = &loop;
+    if (sock_ != -1) {
+        loop.add(sock_, EPOLLIN, [this](int fd, uint32_t events) { handleReplies(fd, events); });
+    }
+}
+
+bool SpawnHelper::spawn(const std::vector<std::string>& args, const std::vector<Redirect>& redirects,
+                        ExitCallback on_exit) {
+    if (sock_ == -1 || args.empty() || redirects.size() > MAX_REDIRECTS) {
+        return false;
+    }
+
+    RequestHeader header = {};
+    header.id = next_request_id_++;
+    header.argc = static_cast<uint32_t>(args.size());
+    header.redirect_count = static_cast<uint32_t>(redirects.size());
+    int fds[MAX_REDIRECTS];
+    for (size_t i = 0; i < redirects.size(); ++i) {
+        header.targets[i] = redirects[i].first;
+        fds[i] = redirects[i].second;
+    }
+
+    std::string payload(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const auto& arg : args) {
+        payload.append(arg.c_str(), arg.size() + 1);
+    }
+    if (payload.size() > MAX_REQUEST_SIZE) {
+        return false;
+    }
+
+    struct iovec iov = {&payload[0], payload.size()};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    char control[CMSG_SPACE(sizeof(fds))] = {};
+    if (!redirects.empty()) {
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(redirects.size() * sizeof(int));
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(redirects.size() * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, redirects.size() * sizeof(int));
+    }
+
+    if (sendmsg(sock_, &msg, MSG_NOSIGNAL) == -1) {
+        logError("SpawnHelper: не удалось отправить запрос: ", strerror(errno));
+        if (errno == EPIPE || errno == ECONNRESET) {
+            shutdown(EPIPE);
+        }
+        return false;
+    }
+    pending_[header.id] = std::move(on_exit);
+    return true;
+}
+
+void SpawnHelper::handleReplies(int fd, uint32_t) {
+    while (true) {
+        Reply reply;
+        ssize_t len = recv(fd, &reply, sizeof(reply), 0);
+        if (len == 0) {
+            logError("SpawnHelper: помощник запуска завершился");
+            shutdown(EPIPE);
+            return;
+        }
+        if (len < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                shutdown(errno);
+            }
+            return;
+        }
+        if (len != sizeof(reply)) {
+            continue;
+        }
+
+        auto it = pending_.find(reply.id);
+        if (it == pending_.end()) {
+            continue;
+        }
+        if (reply.type == REPLY_SPAWNED && reply.pid > 0) {
+            continue; // Процесс запущен, ждём REPLY_EXITED
+        }
+        ExitCallback callback = std::move(it->second);
+        pending_.erase(it);
+        if (reply.type == REPLY_SPAWNED) {
+            callback(-1, reply.value);
+        } else {
+            callback(reply.pid, reply.value);
+        }
+    }
+}
+
+void SpawnHelper::shutdown(int error) {
+    if (sock_ == -1) {
+        return;
+    }
+    if (loop_) {
+        loop_->remove(sock_);
+    }
+    close(sock_);
+    sock_ = -1;
+    if (helper_pid_ > 0 && waitpid(helper_pid_, nullptr, WNOHANG) == helper_pid_) {
+        helper_pid_ = -1;
+    }
+
+    // Статус уже запущенных процессов больше не узнать
+    auto pending = std::move(pending_);
+    pending_.clear();
+    for (auto& [id, callback] : pending) {
+        callback(-1, error);
+    }
+}
+
+void SpawnHelper::helperMain(int sock) {
+    prctl(PR_SET_NAME, "nd-spawn", 0, 0, 0);
+    // Ctrl+C приходит всей группе: помощник завершается по EOF, после остановки демона
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTERM, SIG_IGN);
+    sigset_t chld;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, nullptr);
+    int sfd = signalfd(-1, &chld, SFD_CLOEXEC);
+    if (sfd == -1) {
+        _exit(EXIT_FAILURE);
+    }
+
+    std::map<pid_t, uint32_t> children; // pid -> id запроса
+    std::vector<char> buffer(MAX_REQUEST_SIZE);
+
+    while (true) {
+        struct pollfd fds[2] = {{sock, POLLIN, 0}, {sfd, POLLIN, 0}};
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            _exit(EXIT_FAILURE);
+        }
+
+        if (fds[1].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            while (read(sfd, &info, sizeof(info)) == -1 && errno == EINTR) {
+            }
+            int status = 0;
+            pid_t pid;
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+                auto it = children.find(pid);
+                if (it != children.end()) {
+                    sendReply(sock, REPLY_EXITED, it->second, pid, status);
+                    children.erase(it);
+                }
+            }
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            char control[CMSG_SPACE(MAX_REDIRECTS * sizeof(int))];
+            struct iovec iov = {buffer.data(), buffer.size()};
+            struct msghdr msg = {};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            ssize_t len = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+            if (len == 0) {
+                _exit(EXIT_SUCCESS); // Демон закрыл сокет
+            }
+            if (len < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                _exit(EXIT_FAILURE);
+            }
+
+            int passed[MAX_REDIRECTS];
+            size_t passed_count = 0;
+            for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                    size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                    for (size_t i = 0; i < count && passed_count < MAX_REDIRECTS; ++i) {
+                        memcpy(&passed[passed_count++], CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                    }
+                }
+            }
+
+            RequestHeader header;
+            pid_t result = -EINVAL;
+            if (static_cast<size_t>(len) >= sizeof(header) && !(msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+                memcpy(&header, buffer.data(), sizeof(header));
+                if (header.argc > 0 && header.redirect_count == passed_count) {
+                    result = spawnRequest(header, buffer.data() + sizeof(header), len - sizeof(header), passed);
+                }
+            } else {
+                header.id = 0;
+            }
+            for (size_t i = 0; i < passed_count; ++i) {
+                close(passed[i]);
+            }
+
+            if (result > 0) {
+                children[result] = header.id;
+                sendReply(sock, REPLY_SPAWNED, header.id, result, 0);
+            } else {
+                sendReply(sock, REPLY_SPAWNED, header.id, -1, -result);
+            }
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef SPAWN_HELPER_H
+#define SPAWN_HELPER_H
+
+#include "event_loop.h"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+
+// Маленький вспомогательный процесс для запуска дочерних процессов.
+// Создаётся fork() при старте демона, пока тот ещё мал, и дальше запускает
+// процессы через posix_spawn по запросам из socketpair. Стоимость запуска
+// не зависит от размера демона, а статус завершения приходит асинхронно.
+class SpawnHelper {
+public:
+    // pid == -1: запуск не удался, status - errno; иначе status из waitpid
+    using ExitCallback = std::function<void(pid_t pid, int status)>;
+    // Перенаправление: {номер fd в дочернем процессе, fd демона}
+    using Redirect = std::pair<int, int>;
+
+    static constexpr size_t MAX_REDIRECTS = 3;
+
+    // Запускает вспомогательный процесс; бросает std::runtime_error
+    SpawnHelper();
+    ~SpawnHelper();
+
+    SpawnHelper(const SpawnHelper&) = delete;
+    SpawnHelper& operator=(const SpawnHelper&) = delete;
+
+    // Подключает сокет ответов к циклу событий (цикл создаётся позже помощника)
+    void attach(EventLoop& loop);
+    bool available() const { return sock_ != -1; }
+
+    // Отправляет запрос на запуск; fd перенаправлений передаются через SCM_RIGHTS,
+    // свои копии вызывающий закрывает сам. false - помощник недоступен, on_exit не вызывается.
+    bool spawn(const std::vector<std::string>& args, const std::vector<Redirect>& redirects,
+               ExitCallback on_exit);
+
+private:
+    int sock_ = -1;
+    pid_t helper_pid_ = -1;
+    EventLoop* loop_ = nullptr;
+    uint32_t next_request_id_ = 1;
+    std::map<uint32_t, ExitCallback> pending_;
+
+    void handleReplies(int fd, uint32_t events);
+    void shutdown(int error);
+
+    [[noreturn]] static void helperMain(int sock);
+};
+
+#endif // SPAWN_HELPER_H
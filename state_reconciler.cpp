@@ -0,0 +1,240 @@
+#include "state_reconciler.h"
+#include "logger.h"
+#include "netlink_transaction.h"
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+uint32_t parseIPv4(const std::string& text) {
+    struct in_addr addr;
+    if (inet_pton(AF_INET, text.c_str(), &addr) != 1) {
+        throw std::invalid_argument("invalid IP address " + text);
+    }
+    return ntohl(addr.s_addr);
+}
+
+struct nl_addr* buildAddr(uint32_t address, uint8_t prefix_len) {
+    uint32_t addr_be = htonl(address);
+    struct nl_addr* addr = nl_addr_build(AF_INET, &addr_be, sizeof(addr_be));
+    nl_addr_set_prefixlen(addr, prefix_len);
+    return addr;
+}
+
+} // namespace
+
+InterfaceSpec InterfaceSpec::parse(const std::string& text) {
+    InterfaceSpec spec;
+    std::istringstream iss(text);
+    std::string item;
+
+    while (std::getline(iss, item, ',')) {
+        if (item.empty()) {
+            continue;
+        }
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            throw std::invalid_argument("expected key=value: " + item);
+        }
+        std::string key = item.substr(0, eq);
+        std::string value = item.substr(eq + 1);
+
+        if (key == "iface") {
+            if (value.empty() || value.size() >= IFNAMSIZ) {
+                throw std::invalid_argument("invalid interface name " + value);
+            }
+            spec.ifname = value;
+        } else if (key == "state") {
+            if (value == "up") {
+                spec.state = LinkState::Up;
+            } else if (value == "down") {
+                spec.state = LinkState::Down;
+            } else {
+                throw std::invalid_argument("state must be up or down");
+            }
+        } else if (key == "addr") {
+            spec.manage_addresses = true;
+            if (value == "none") {
+                continue;
+            }
+            size_t slash = value.find('/');
+            if (slash == std::string::npos) {
+                throw std::invalid_argument("address needs a prefix length: " + value);
+            }
+            int prefix_len = -1;
+            try {
+                prefix_len = std::stoi(value.substr(slash + 1));
+            } catch (...) {
+            }
+            if (prefix_len < 0 || prefix_len > 32) {
+                throw std::invalid_argument("invalid prefix length in " + value);
+            }
+            spec.addresses.emplace_back(parseIPv4(value.substr(0, slash)), static_cast<uint8_t>(prefix_len));
+        } else if (key == "gateway") {
+            spec.manage_gateway = true;
+            spec.gateway = (value == "none") ? 0 : parseIPv4(value);
+        } else {
+            throw std::invalid_argument("unknown key " + key);
+        }
+    }
+
+    if (spec.ifname.empty()) {
+        throw std::invalid_argument("iface is required");
+    }
+    if (spec.gateway && spec.state == LinkState::Down) {
+        throw std::invalid_argument("gateway requires the interface to be up");
+    }
+    return spec;
+}
+
+StateReconciler::StateReconciler(NetlinkManager& netlink_mgr)
+    : netlink_mgr_(netlink_mgr) {}
+
+bool StateReconciler::apply(const std::vector<InterfaceSpec>& desired, size_t& operations, std::string& error) {
+    operations = 0;
+    struct nl_cache* link_cache = netlink_mgr_.getLinkCache();
+    struct nl_cache* addr_cache = netlink_mgr_.getAddrCache();
+    if (!link_cache || !addr_cache) {
+        error = "no cache available";
+        return false;
+    }
+
+    // Маршрут по умолчанию с метрикой 0 в таблице один, поэтому шлюз может быть только у одного интерфейса
+    std::set<std::string> seen;
+    const InterfaceSpec* gateway_owner = nullptr;
+    for (const auto& spec : desired) {
+        if (!seen.insert(spec.ifname).second) {
+            error = "interface " + spec.ifname + " specified twice";
+            return false;
+        }
+        if (spec.gateway) {
+            if (gateway_owner) {
+                error = "gateway specified for both " + gateway_owner->ifname + " and " + spec.ifname;
+                return false;
+            }
+            gateway_owner = &spec;
+        }
+    }
+
+    NetlinkTransaction txn(netlink_mgr_);
+    std::vector<int> addresses_removed; // ifindex интерфейсов, где удаляются адреса
+    const RouteEntry* current_default = netlink_mgr_.getRouteIndex().findPriority(0, 0, 0);
+    int err = 0;
+
+    for (const auto& spec : desired) {
+        struct rtnl_link* link = rtnl_link_get_by_name(link_cache, spec.ifname.c_str());
+        if (!link) {
+            error = "interface " + spec.ifname + " not found";
+            return false;
+        }
+        int ifindex = rtnl_link_get_ifindex(link);
+        bool is_up = rtnl_link_get_flags(link) & IFF_UP;
+
+        // Включение - первым шагом интерфейса, выключение - последним
+        if (spec.state == InterfaceSpec::LinkState::Up && !is_up) {
+            err = txn.setLinkUp(link, true);
+        }
+
+        bool addresses_changed = false;
+        if (err == 0 && spec.manage_addresses) {
+            std::vector<std::pair<uint32_t, uint8_t>> present;
+            // Сначала удаляем лишние: при удалении основного адреса ядро может снять и вторичные
+            for (struct nl_object* obj = nl_cache_get_first(addr_cache); obj && err == 0;
+                 obj = nl_cache_get_next(obj)) {
+                struct rtnl_addr* addr = (struct rtnl_addr*)obj;
+                struct nl_addr* local = rtnl_addr_get_local(addr);
+                if (rtnl_addr_get_ifindex(addr) != ifindex || rtnl_addr_get_family(addr) != AF_INET || !local ||
+                    nl_addr_get_len(local) != 4) {
+                    continue;
+                }
+                std::pair<uint32_t, uint8_t> key(ntohl(*(uint32_t*)nl_addr_get_binary_addr(local)),
+                                                 static_cast<uint8_t>(rtnl_addr_get_prefixlen(addr)));
+                if (std::find(spec.addresses.begin(), spec.addresses.end(), key) != spec.addresses.end()) {
+                    present.push_back(key);
+                } else {
+                    err = txn.deleteAddress(addr);
+                    addresses_changed = true;
+                    if (addresses_removed.empty() || addresses_removed.back() != ifindex) {
+                        addresses_removed.push_back(ifindex);
+                    }
+                }
+            }
+            for (const auto& wanted : spec.addresses) {
+                if (err != 0 || std::find(present.begin(), present.end(), wanted) != present.end()) {
+                    continue;
+                }
+                struct nl_addr* local = buildAddr(wanted.first, wanted.second);
+                struct rtnl_addr* addr = rtnl_addr_alloc();
+                rtnl_addr_set_ifindex(addr, ifindex);
+                rtnl_addr_set_family(addr, AF_INET);
+                rtnl_addr_set_local(addr, local);
+                err = txn.addAddress(addr);
+                rtnl_addr_put(addr);
+                nl_addr_put(local);
+                addresses_changed = true;
+            }
+        }
+
+        if (err == 0 && spec.manage_gateway) {
+            bool routed_here = current_default && current_default->ifindex == ifindex;
+            if (spec.gateway) {
+                // После смены адресов ядро могло снять маршрут через старую подсеть: REPLACE безопасен в любом случае
+                if (!routed_here || current_default->gateway != spec.gateway || addresses_changed ||
+                    (spec.state == InterfaceSpec::LinkState::Up && !is_up)) {
+                    struct rtnl_route* route =
+                        NetlinkTransaction::buildDefaultRoute(spec.gateway, ifindex, 0, RTPROT_STATIC);
+                    struct rtnl_route* previous = current_default
+                        ? NetlinkTransaction::buildDefaultRoute(current_default->gateway, current_default->ifindex,
+                                                                current_default->priority, current_default->protocol)
+                        : nullptr;
+                    err = txn.replaceRoute(route, previous);
+                    rtnl_route_put(route);
+                    if (previous) rtnl_route_put(previous);
+                }
+            } else if (routed_here && !gateway_owner) {
+                // Если шлюз переезжает на другой интерфейс, старый маршрут заменит его REPLACE
+                struct rtnl_route* route = NetlinkTransaction::buildDefaultRoute(
+                    current_default->gateway, ifindex, current_default->priority, current_default->protocol);
+                err = txn.deleteRoute(route);
+                rtnl_route_put(route);
+            }
+        }
+
+        if (err == 0 && spec.state == InterfaceSpec::LinkState::Down && is_up) {
+            err = txn.setLinkUp(link, false);
+        }
+        rtnl_link_put(link);
+
+        if (err < 0) {
+            error = "failed to prepare changes for " + spec.ifname + ": " + nl_geterror(err);
+            return false;
+        }
+    }
+
+    operations = txn.size();
+    if (txn.empty()) {
+        return true;
+    }
+
+    err = txn.commit();
+    // Забираем уведомления сразу: следующий apply должен сравнивать уже с новым состоянием
+    while (netlink_mgr_.processEvents()) {
+    }
+    for (int ifindex : addresses_removed) {
+        netlink_mgr_.resyncInterfaceRoutes(ifindex);
+    }
+    if (err < 0) {
+        operations = 0;
+        error = "failed to apply " + txn.failedStep() + ": " + strerror(-err) +
+                (txn.rollbackComplete() ? ", changes rolled back" : ", rollback incomplete");
+        return false;
+    }
+
+    logInfo("StateReconciler: применено изменений: ", operations);
+    return true;
+}
@@ -0,0 +1,41 @@
+#ifndef STATE_RECONCILER_H
+#define STATE_RECONCILER_H
+
+#include "netlink_manager.h"
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Желаемое состояние одного интерфейса. Неуказанные аспекты не трогаются.
+struct InterfaceSpec {
+    enum class LinkState { Keep, Up, Down };
+
+    std::string ifname;
+    LinkState state = LinkState::Keep;
+    bool manage_addresses = false;
+    std::vector<std::pair<uint32_t, uint8_t>> addresses; // IPv4 адрес (порядок байт хоста) и префикс
+    bool manage_gateway = false;
+    uint32_t gateway = 0;                                // 0 - маршрута по умолчанию через интерфейс нет
+
+    // Разбирает "iface=eth0,state=up,addr=10.0.0.5/24,addr=10.0.0.6/24,gateway=10.0.0.1".
+    // addr=none - адресов быть не должно, gateway=none - маршрута по умолчанию.
+    // Бросает std::invalid_argument.
+    static InterfaceSpec parse(const std::string& text);
+};
+
+// Сводит текущее состояние (живые кэши NetlinkManager и индекс маршрутов) к желаемому:
+// строит минимальный набор изменений и применяет его одной транзакцией.
+// Если состояние уже совпадает, к ядру не уходит ни одного запроса.
+class StateReconciler {
+public:
+    explicit StateReconciler(NetlinkManager& netlink_mgr);
+
+    // operations - число изменений, отправленных в ядро; при ошибке ничего не меняется
+    bool apply(const std::vector<InterfaceSpec>& desired, size_t& operations, std::string& error);
+
+private:
+    NetlinkManager& netlink_mgr_;
+};
+
+#endif // STATE_RECONCILER_H
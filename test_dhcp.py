@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+# Встроенный DHCP клиент против упрощённого DHCP сервера на другом конце veth:
+# DISCOVER -> OFFER -> REQUEST -> ACK, применение аренды, RELEASE по dhcpOff.
+# Запуск: sudo NETWORK_DAEMON_BIN=build/network_daemon ./test_dhcp.py
+
+import os
+import socket
+import struct
+import subprocess
+import sys
+import time
+
+from test_helpers import Client, Daemon, Netns, check, require_root
+
+SERVER_ADDR = "10.50.0.1"
+LEASED_ADDR = "10.50.0.77"
+DISCOVER, OFFER, REQUEST, ACK, RELEASE = 1, 2, 3, 5, 7
+
+
+def serve(ifname):
+    # Сервер: отвечает на DISCOVER и REQUEST, о каждом сообщении пишет строку в stdout
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    s.setsockopt(socket.SOL_SOCKET, socket.SO_BROADCAST, 1)
+    s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    s.setsockopt(socket.SOL_SOCKET, socket.SO_BINDTODEVICE, ifname.encode() + b"\0")
+    s.bind(("0.0.0.0", 67))
+    server = socket.inet_aton(SERVER_ADDR)
+    while True:
+        packet, _ = s.recvfrom(2048)
+        xid, ciaddr, chaddr, options = packet[4:8], packet[12:16], packet[28:44], packet[240:]
+        msg_type, i = None, 0
+        while i < len(options) and options[i] != 255:
+            if options[i] == 0:
+                i += 1
+                continue
+            if options[i] == 53:
+                msg_type = options[i + 2]
+            i += 2 + options[i + 1]
+        print(msg_type, flush=True)
+        reply = {DISCOVER: OFFER, REQUEST: ACK}.get(msg_type)
+        if not reply:
+            continue
+        out = bytes([2, 1, 6, 0]) + xid + b"\0" * 4 + ciaddr + socket.inet_aton(LEASED_ADDR) + server
+        out += b"\0" * 4 + chaddr + b"\0" * 192 + struct.pack("!I", 0x63825363)
+        out += bytes([53, 1, reply, 54, 4]) + server + bytes([51, 4]) + struct.pack("!I", 600)
+        out += bytes([1, 4]) + socket.inet_aton("255.255.255.0") + bytes([3, 4]) + server + bytes([255])
+        s.sendto(out, ("255.255.255.255", 68))
+
+
+def main():
+    require_root()
+    with Netns("ndtest_dhcp_cli") as cli, Netns("ndtest_dhcp_srv") as srv:
+        cli.ip(f"link add dh0 type veth peer name dh1 netns {srv.name}")
+        srv.ip(f"addr add {SERVER_ADDR}/24 dev dh1")
+        srv.ip("link set dh1 up")
+        server = subprocess.Popen(["ip", "netns", "exec", srv.name, sys.executable, os.path.abspath(__file__),
+                                   "--serve", "dh1"], stdout=subprocess.PIPE, text=True)
+        try:
+            with Daemon(cli.name) as daemon:
+                client = Client()
+                reply = client.command("(dhcpOn (dh0))", timeout=15)
+                check(LEASED_ADDR in reply and "error" not in reply, f"dhcpOn: {reply}")
+                check(f"inet {LEASED_ADDR}/24" in cli.ip("-4 addr show dev dh0"), "адрес аренды не назначен")
+                routes = cli.ip("route show default")
+                check(f"via {SERVER_ADDR}" in routes and "proto dhcp" in routes, f"маршрут аренды: {routes}")
+
+                reply = client.command("(dhcpOff (dh0))")
+                check(reply == "(dhcpOff(success(DHCP disabled)))", f"dhcpOff: {reply}")
+                time.sleep(0.3)
+                check(LEASED_ADDR not in cli.ip("-4 addr show dev dh0"), "адрес не снят после dhcpOff")
+                check(f"via {SERVER_ADDR}" not in cli.ip("route show default"), "маршрут не снят после dhcpOff")
+
+                reply = client.command("(dhcpOff (dh0))")
+                check(reply == "(dhcpOff(error(DHCP not running)))", f"повторный dhcpOff: {reply}")
+        finally:
+            server.terminate()
+            messages = [int(line) for line in server.communicate()[0].split() if line.isdigit()]
+        check(messages[:2] == [DISCOVER, REQUEST], f"сообщения клиента: {messages}")
+        check(RELEASE in messages, f"нет DHCPRELEASE: {messages}")
+    print("OK")
+
+
+if __name__ == "__main__":
+    if len(sys.argv) == 3 and sys.argv[1] == "--serve":
+        serve(sys.argv[2])
+    else:
+        main()
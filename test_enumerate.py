@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+# Поля адреса в записях enumerate; enumerate по страницам (from/limit/next) и потоком
+# (stream=1) при медленном чтении, ответы на команды, отправленные пачкой без чтения.
+# Запуск: sudo NETWORK_DAEMON_BIN=build/network_daemon ./test_enumerate.py
+
+import re
+import time
+
+from test_helpers import Client, Daemon, Netns, check, require_root, sh
+
+PAIRS = 60  # veth пар: вместе с lo 121 интерфейс
+PAGE = 25
+
+
+def names(response):
+    return re.findall(r"iface=(\S+)", response)
+
+
+def main():
+    require_root()
+    with Netns("ndtest_enum") as ns:
+        commands = "".join(f"link add ve{i}a type veth peer name ve{i}b\\n" for i in range(PAIRS))
+        sh(f"printf '{commands}' | ip -n {ns.name} -batch -")
+        with Daemon(ns.name):
+            client = Client()
+            everything = names(client.command("(enumerate)"))
+            check(len(everything) == 2 * PAIRS + 1, f"enumerate: {len(everything)} интерфейсов")
+
+            # Адрес, маска и шлюз - из кэшей, изменения видны следующей же команде
+            ns.ip("link set ve0a up")
+            ns.ip("addr add 10.53.0.5/24 dev ve0a")
+            ns.ip("route add default via 10.53.0.1 dev ve0a")
+            reply = client.command("(enumerate (name=ve0a) (fields=iface,addr,mask,gateway))")
+            check(reply == "(enumerate(enumerate(iface=ve0a addr=10.53.0.5 gateway=10.53.0.1 mask=24)))",
+                  f"адрес в записи: {reply}")
+
+            # Страницы: курсор next до последней, без повторов и пропусков
+            paged, cursor, pages = [], 0, 0
+            while True:
+                reply = client.command(f"(enumerate (from={cursor}) (limit={PAGE}))")
+                page = names(reply)
+                check(0 < len(page) <= PAGE, f"страница {pages}: {reply[:200]}")
+                paged += page
+                pages += 1
+                match = re.search(r"next=(\d+)\)\)$", reply)
+                if not match:
+                    break
+                check(int(match.group(1)) > cursor, f"курсор не растёт: {reply[-60:]}")
+                cursor = int(match.group(1))
+            check(pages == -(-len(everything) // PAGE), f"страниц {pages}")
+            check(sorted(paged) == sorted(everything) and len(set(paged)) == len(paged),
+                  "страницы не совпадают с полным списком")
+
+            for bad in ("(enumerate (limit=x))", "(enumerate (from=-1))", "(enumerate (bogus=1))"):
+                reply = client.command(bad)
+                check("error(" in reply, f"{bad}: {reply}")
+
+            # Поток при медленном чтении: записи приходят все и по одной, клиента не отключают
+            reader = Client(rcvbuf=4096)
+            reader.send("(enumerate (stream=1))")
+            time.sleep(1)
+            records = []
+            while True:
+                expression = reader.read()
+                check(expression is not None, f"поток оборвался после {len(records)} записей")
+                if "success(" in expression:
+                    break
+                check(len(names(expression)) == 1, f"запись потока: {expression[:200]}")
+                records += names(expression)
+            check(expression == f"(enumerate(success({len(everything)} interfaces)))", f"конец потока: {expression}")
+            check(sorted(records) == sorted(everything), "поток не совпадает с полным списком")
+            check("success" in reader.command("(logLevel)"), "клиент потока не отвечает после потока")
+
+            # Команды пачкой без чтения: ответы (около 1 МиБ, больше буфера сокета)
+            # ждут в очереди демона и приходят все по порядку
+            count = 20000
+            client.send("(logLevel)" * count + "(route_lookup (127.0.0.1))")
+            time.sleep(1)
+            for i in range(count):
+                expression = client.read()
+                check(expression is not None and expression.startswith("(logLevel(success"),
+                      f"ответ {i}: {expression}")
+            check(client.read().startswith("(route_lookup("), "последний ответ пачки")
+    print("OK")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+# Общие части тестов демона: сетевые пространства имён, запуск демона и клиент
+# текстового протокола. Тестам нужны root, ip и nsenter; без них тест пропускается.
+
+import os
+import re
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+SOCKET_PATH = "/tmp/network_daemon.sock"
+# Код выхода пропущенного теста (SKIP_RETURN_CODE в CMakeLists.txt)
+SKIP = 77
+
+
+def daemon_binary():
+    default = os.path.join(os.path.dirname(os.path.abspath(__file__)), "build", "network_daemon")
+    return os.environ.get("NETWORK_DAEMON_BIN", default)
+
+
+def require_root():
+    if os.geteuid() != 0:
+        print("SKIP: нужны права root")
+        sys.exit(SKIP)
+    if not os.path.exists(daemon_binary()):
+        print(f"SKIP: нет {daemon_binary()} (путь задаётся NETWORK_DAEMON_BIN)")
+        sys.exit(SKIP)
+
+
+def sh(command, check=True):
+    return subprocess.run(command, shell=True, check=check, capture_output=True, text=True).stdout
+
+
+class Netns:
+    # Именованное пространство ip netns, удаляется при выходе из with
+    def __init__(self, name):
+        self.name = name
+
+    def __enter__(self):
+        sh(f"ip netns del {self.name}", check=False)
+        sh(f"ip netns add {self.name}")
+        self.ip("link set lo up")
+        return self
+
+    def __exit__(self, *exc):
+        sh(f"ip netns del {self.name}", check=False)
+
+    def ip(self, args, check=True):
+        return sh(f"ip -n {self.name} {args}", check)
+
+
+class Daemon:
+    # Демон в пространстве netns (None - в текущем); журнал выводится, если тест упал
+    def __init__(self, netns=None, env=None, socket_path=SOCKET_PATH):
+        self.log = tempfile.NamedTemporaryFile(prefix="network_daemon_", suffix=".log", delete=False)
+        command = [daemon_binary()]
+        if netns:
+            command = ["ip", "netns", "exec", netns] + command
+        if os.path.exists(socket_path):
+            os.unlink(socket_path)
+        self.process = subprocess.Popen(command, stdout=self.log, stderr=subprocess.STDOUT,
+                                        env=dict(os.environ, **(env or {})))
+        deadline = time.time() + 5
+        while time.time() < deadline:
+            if self.process.poll() is not None:
+                raise AssertionError(f"демон завершился при запуске:\n{self.output()}")
+            try:
+                Client(socket_path).close()
+                return
+            except OSError:
+                time.sleep(0.05)
+        raise AssertionError(f"демон не открыл {socket_path}:\n{self.output()}")
+
+    def output(self):
+        with open(self.log.name, errors="replace") as f:
+            return f.read()
+
+    def stop(self):
+        if self.process.poll() is None:
+            self.process.terminate()
+            try:
+                self.process.wait(5)
+            except subprocess.TimeoutExpired:
+                self.process.kill()
+                self.process.wait()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, *exc):
+        self.stop()
+        if exc_type:
+            print(self.output()[-8000:])
+        os.unlink(self.log.name)
+
+
+class Client:
+    # Клиент S-выражений: разбирает поток на выражения верхнего уровня,
+    # ответы отделяет от событий по имени команды
+    # rcvbuf - размер приёмного буфера сокета, чтобы ответы копились у демона
+    def __init__(self, path=SOCKET_PATH, rcvbuf=None):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        if rcvbuf:
+            self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, rcvbuf)
+        self.sock.connect(path)
+        self.buffer = ""
+        self.events = []
+
+    def close(self):
+        self.sock.close()
+
+    def send(self, text):
+        self.sock.sendall(text.encode() if isinstance(text, str) else text)
+
+    def read(self, timeout=10):
+        # Следующее полное выражение; None - не пришло за timeout
+        deadline = time.time() + timeout
+        while True:
+            expression = self._split()
+            if expression is not None:
+                return expression
+            left = deadline - time.time()
+            if left <= 0:
+                return None
+            self.sock.settimeout(left)
+            try:
+                data = self.sock.recv(65536)
+            except socket.timeout:
+                return None
+            if not data:
+                raise AssertionError(f"демон закрыл соединение, непрочитано: {self.buffer!r}")
+            self.buffer += data.decode()
+
+    def _split(self):
+        depth = 0
+        for i, c in enumerate(self.buffer):
+            if c == "(":
+                depth += 1
+            elif c == ")":
+                depth -= 1
+                if depth == 0:
+                    expression, self.buffer = self.buffer[:i + 1], self.buffer[i + 1:]
+                    return expression
+        return None
+
+    def reply(self, name, timeout=10):
+        # Ответ команды name; события, пришедшие раньше, копятся в events
+        deadline = time.time() + timeout
+        while True:
+            expression = self.read(max(0, deadline - time.time()))
+            if expression is None:
+                raise AssertionError(f"нет ответа {name}, события: {self.events}")
+            if expression.startswith(f"({name}("):
+                return expression
+            self.events.append(expression)
+
+    def command(self, text, timeout=10):
+        self.send(text)
+        return self.reply(re.match(r"\(\s*(\w+)", text).group(1), timeout)
+
+    def drain(self, timeout=0.5):
+        # События, пришедшие за timeout, вместе с накопленными
+        while True:
+            expression = self.read(timeout)
+            if expression is None:
+                events, self.events = self.events, []
+                return events
+            self.events.append(expression)
+
+
+def check(condition, message):
+    if not condition:
+        raise AssertionError(message)
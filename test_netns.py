@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+# Дополнительное пространство имён (NETWORK_DAEMON_NETNS=x=/proc/<pid>/ns/net):
+# команды через /tmp/network_daemon.x.sock меняют интерфейсы только в нём,
+# события пространства приходят только клиентам его сокета.
+# Запуск: sudo NETWORK_DAEMON_BIN=build/network_daemon ./test_netns.py
+
+import os
+import shutil
+import subprocess
+import sys
+import time
+
+from test_helpers import SKIP, Client, Daemon, Netns, check, require_root, sh
+
+NETNS_SOCKET = "/tmp/network_daemon.x.sock"
+ADDRESS = "10.51.0.2"
+
+
+def connect(path, timeout=5):
+    # Сокеты пространств открываются после основного
+    deadline = time.time() + timeout
+    while True:
+        try:
+            return Client(path)
+        except OSError:
+            if time.time() > deadline:
+                raise
+            time.sleep(0.05)
+
+
+def main():
+    require_root()
+    if not shutil.which("unshare") or not shutil.which("nsenter"):
+        print("SKIP: нужны unshare и nsenter")
+        sys.exit(SKIP)
+    # Пространство без имени ip netns: доступно только через /proc/<pid>/ns/net
+    holder = subprocess.Popen(["unshare", "-n", "sleep", "600"])
+    try:
+        time.sleep(0.2)
+        x = f"nsenter -t {holder.pid} -n ip"
+        sh(f"{x} link add nd0 type veth peer name nd1")
+        sh(f"{x} link set nd1 up")
+        if os.path.exists(NETNS_SOCKET):
+            os.unlink(NETNS_SOCKET)
+        with Netns("ndtest_netns_own") as own_ns, \
+                Daemon(own_ns.name, env={"NETWORK_DAEMON_NETNS": f"x=/proc/{holder.pid}/ns/net"}):
+            own = Client()
+            client = connect(NETNS_SOCKET)
+            # Оба клиента выбирают текстовый формат первой командой
+            check("success" in own.command("(logLevel)"), "основной сокет не отвечает")
+            check("success" in client.command("(logLevel)"), "сокет пространства не отвечает")
+
+            reply = own.command("(on (nd0))")
+            check(reply == "(on(error(interface not found)))", f"nd0 виден в основном пространстве: {reply}")
+
+            reply = client.command("(on (nd0))")
+            check("success" in reply, f"on: {reply}")
+            check("UP" in sh(f"{x} link show nd0").split(">")[0], "nd0 не поднят")
+
+            reply = client.command(f"(setStatic (nd0) ({ADDRESS}) (24) (10.51.0.1))")
+            check("success" in reply, f"setStatic: {reply}")
+            check(f"inet {ADDRESS}/24" in sh(f"{x} -4 addr show dev nd0"), "адрес не назначен в пространстве x")
+            check(ADDRESS not in own_ns.ip("-4 addr show"), "адрес назначен в основном пространстве")
+
+            reply = client.command("(off (nd0))")
+            check("success" in reply, f"off: {reply}")
+            check("UP" not in sh(f"{x} link show nd0").split(">")[0], "nd0 не опущен")
+
+            events = client.drain()
+            check(any(e.startswith("(add_addr(") and ADDRESS in e for e in events),
+                  f"нет события add_addr на сокете пространства: {events}")
+            check(any(e.startswith("(add_iface(") and "iface=nd0" in e for e in events),
+                  f"нет события add_iface на сокете пространства: {events}")
+            leaked = [e for e in own.drain() if "nd0" in e or ADDRESS in e]
+            check(not leaked, f"события пространства x на основном сокете: {leaked}")
+    finally:
+        holder.kill()
+        holder.wait()
+    print("OK")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,216 @@
+#!/usr/bin/env python3
+# Разбор входного потока команд в текстовом и двоичном протоколах: команды,
+# разрезанные между отправками и склеенные в одну, неверный ввод и продолжение
+# работы после него; номера запросов (id) в ответах.
+# Запуск: sudo NETWORK_DAEMON_BIN=build/network_daemon ./test_protocol.py
+
+import socket
+import struct
+import time
+
+from test_helpers import SOCKET_PATH, Client, Daemon, Netns, check, require_root
+
+PARSE_ERROR = "(error(invalid S-expression format))"
+ON_LO = "(on(success(interface enabled)))"
+# Незавершённая команда ограничена MAX_PENDING_INPUT (command_processor.cpp)
+MAX_PENDING_INPUT = 1024 * 1024
+
+# Двоичный протокол (binary_serializer.h)
+HELLO = b"\0NDB" + struct.pack("=HH", 1, 0)
+CODE_ON, CODE_LOGLEVEL, CODE_ADD_ADDR, CODE_ERROR = 2, 11, 0x102, 0xffff
+ATTR_STRING, ATTR_REQUEST_ID, ATTR_STATUS, ATTR_MESSAGE = 1, 4, 16, 17
+MAX_FRAME = 1024 * 1024
+
+
+def attr(kind, data):
+    length = 4 + len(data)
+    return struct.pack("=HH", length, kind) + data + b"\0" * (-length % 4)
+
+
+def frame(code, attrs=b""):
+    return struct.pack("=IHH", 8 + len(attrs), code, 0) + attrs
+
+
+class BinaryClient:
+    # Кадры {u32 длина, u16 код, u16 флаги} + атрибуты {u16 длина, u16 тип}
+    def __init__(self, hello=True):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(SOCKET_PATH)
+        self.buffer = b""
+        if hello:
+            self.hello()
+
+    def hello(self):
+        self.sock.sendall(HELLO)
+        check(self.receive(len(HELLO)) == HELLO, "нет ответного приветствия")
+
+    def send(self, data):
+        self.sock.sendall(data)
+
+    def receive(self, size, timeout=5):
+        # None - соединение закрыто
+        self.sock.settimeout(timeout)
+        while len(self.buffer) < size:
+            data = self.sock.recv(65536)
+            if not data:
+                return None
+            self.buffer += data
+        data, self.buffer = self.buffer[:size], self.buffer[size:]
+        return data
+
+    def frame(self, timeout=5):
+        # (код, [(тип, данные)]); None - соединение закрыто
+        header = self.receive(8, timeout)
+        if header is None:
+            return None
+        length, code, _ = struct.unpack("=IHH", header)
+        body = self.receive(length - 8, timeout)
+        attrs, offset = [], 0
+        while offset + 4 <= len(body):
+            size, kind = struct.unpack_from("=HH", body, offset)
+            attrs.append((kind, body[offset + 4:offset + size]))
+            offset += (size + 3) & ~3
+        return code, attrs
+
+    def status(self, timeout=5):
+        # (код, статус, текст) следующего ответа
+        code, attrs = self.frame(timeout)
+        values = dict(attrs)
+        return code, values[ATTR_STATUS][0], values[ATTR_MESSAGE].decode()
+
+
+def test_text():
+    client = Client()
+    # Команда по одному байту
+    for c in "(on (lo))":
+        client.send(c)
+        time.sleep(0.01)
+    check(client.read() == ON_LO, "команда, отправленная по байту")
+
+    # Разрез внутри токенов
+    for part in ("(o", "n (l", "o))"):
+        client.send(part)
+        time.sleep(0.05)
+    check(client.read() == ON_LO, "команда, разрезанная внутри токенов")
+
+    # Несколько команд в одной отправке, между ними пробельные символы
+    client.send("(logLevel)(on (lo))\n (on ( l o ))\r\n")
+    replies = [client.read() for _ in range(3)]
+    check(replies[0].startswith("(logLevel(success(") and replies[1:] == [ON_LO, ON_LO],
+          f"склеенные команды: {replies}")
+
+    # Мусор вне скобок и лишняя ')': ошибка разбора, соединение продолжает работать
+    for garbage in ("x", ")"):
+        client.send(garbage)
+        check(client.read() == PARSE_ERROR, f"ответ на {garbage!r}")
+        check(client.command("(on (lo))") == ON_LO, f"команда после {garbage!r}")
+
+    # Число аргументов не ограничено; следующая команда той же отправки выполняется
+    client.send("(batch " + "(on,lo) " * 100 + ")(on " + "(lo) " * 100 + ")(on (lo))")
+    reply = client.read()
+    check(reply.startswith("(batch(success(") and reply.count("on lo") == 100, f"batch из 100 команд: {reply[:200]}")
+    check(client.read() == "(on(error(unknown command or invalid arguments)))", "on со 100 аргументами")
+    check(client.read() == ON_LO, "команда после длинных")
+
+    # Незавершённая команда больше предела отбрасывается, соединение остаётся
+    client.send("(on (" + "a" * (MAX_PENDING_INPUT + 4096))
+    errors = client.drain(1)
+    check(errors and all(e == PARSE_ERROR for e in errors), f"ответ на длинную команду: {errors[:3]}")
+    check(client.command("(on (lo))") == ON_LO, "команда после длинной")
+    client.close()
+
+
+def test_binary(ns):
+    on_lo = frame(CODE_ON, attr(ATTR_STRING, b"lo"))
+    ok = (CODE_ON, 0, "interface enabled")
+
+    # Текст события до приветствия не попадает в двоичный поток: первыми клиент
+    # получает ответное приветствие, следующие события - кадрами
+    client = BinaryClient(hello=False)
+    ns.ip("addr add 10.52.0.1/32 dev lo")
+    time.sleep(0.2)
+    client.send(HELLO[:3])
+    time.sleep(0.05)
+    client.send(HELLO[3:])
+    check(client.receive(len(HELLO)) == HELLO, "приветствие, разрезанное на части")
+    ns.ip("addr add 10.52.0.2/32 dev lo")
+    code, _ = client.frame()
+    check(code == CODE_ADD_ADDR, f"событие после приветствия: код {code:#x}")
+
+    # Кадр по одному байту и два кадра в одной отправке
+    for i in range(len(on_lo)):
+        client.send(on_lo[i:i + 1])
+        time.sleep(0.005)
+    check(client.status() == ok, "кадр, отправленный по байту")
+    client.send(on_lo + frame(CODE_LOGLEVEL))
+    check(client.status() == ok and client.status()[:2] == (CODE_LOGLEVEL, 0), "два кадра в одной отправке")
+
+    # Неверные атрибуты и неизвестный код: граница кадра известна, ответ - ошибка,
+    # следующий кадр выполняется
+    for bad in (frame(CODE_ON, struct.pack("=HH", 40, ATTR_STRING)), frame(CODE_ON, struct.pack("=HH", 2, ATTR_STRING)),
+                frame(77)):
+        client.send(bad + on_lo)
+        code, status, _ = client.status()
+        check(code == CODE_ERROR and status == 1, f"ответ на неверный кадр {bad!r}")
+        check(client.status() == ok, f"кадр после неверного {bad!r}")
+
+    # Неверная длина в заголовке: граница следующего кадра потеряна, после
+    # ошибки соединение закрывается
+    for length in (MAX_FRAME + 1, 4):
+        client = BinaryClient()
+        client.send(struct.pack("=IHH", length, CODE_ON, 0) + on_lo)
+        code, status, message = client.status()
+        check(code == CODE_ERROR and status == 1, f"ответ на заголовок длины {length}: {message}")
+        check(client.frame() is None, f"соединение не закрыто после заголовка длины {length}")
+
+    # Неизвестная версия приветствия - это не двоичный клиент
+    client = BinaryClient(hello=False)
+    client.send(b"\0NDB" + struct.pack("=HH", 2, 0))
+    check(client.receive(len(PARSE_ERROR)) == PARSE_ERROR.encode(), "приветствие неизвестной версии")
+
+
+def test_request_ids(ns):
+    client = Client()
+    check(client.command("(on (id=7) (lo))") == "(on(id=7)(success(interface enabled)))", "id в ответе")
+    check(client.command("(nosuch (id=9))") == "(nosuch(id=9)(error(unknown command or invalid arguments)))",
+          "id в ответе на неизвестную команду")
+    reply = client.command("(logLevel (id=4294967295))")
+    check(reply.startswith("(logLevel(id=4294967295)(success("), f"наибольший id: {reply}")
+    # id только первым аргументом и только 1..2^32-1
+    check(client.command("(on (lo) (id=3))") == "(on(error(unknown command or invalid arguments)))",
+          "id не первым аргументом")
+    for bad in ("0", "4294967296", "x", ""):
+        client.send(f"(on (id={bad}) (lo))")
+        check(client.read() == PARSE_ERROR, f"ответ на id={bad}")
+    # События не несут id, хотя клиент ими пользуется
+    ns.ip("addr add 10.52.0.3/32 dev lo")
+    events = [e for e in client.drain() if "10.52.0.3" in e]
+    check(events and all("id=" not in e for e in events), f"события: {events}")
+    client.close()
+
+    client = BinaryClient()
+    request_id = attr(ATTR_REQUEST_ID, struct.pack("=I", 7))
+    client.send(frame(CODE_ON, request_id + attr(ATTR_STRING, b"lo")))
+    code, attrs = client.frame()
+    check(code == CODE_ON and attrs[0] == (ATTR_REQUEST_ID, struct.pack("=I", 7)),
+          f"REQUEST_ID первым атрибутом ответа: {attrs}")
+    client.send(frame(CODE_ON, attr(ATTR_STRING, b"lo")))
+    code, attrs = client.frame()
+    check(code == CODE_ON and all(kind != ATTR_REQUEST_ID for kind, _ in attrs), f"ответ без id: {attrs}")
+    for bad in (struct.pack("=I", 0), b"12"):
+        client.send(frame(CODE_ON, attr(ATTR_REQUEST_ID, bad) + attr(ATTR_STRING, b"lo")))
+        code, status, _ = client.status()
+        check(code == CODE_ERROR and status == 1, f"ответ на REQUEST_ID {bad!r}")
+
+
+def main():
+    require_root()
+    with Netns("ndtest_proto") as ns, Daemon(ns.name):
+        test_text()
+        test_binary(ns)
+        test_request_ids(ns)
+    print("OK")
+
+
+if __name__ == "__main__":
+    main()
@@ -1,5 +1,6 @@
 #include "unix_socket_server.h"
-#include <iostream>
+#include "logger.h"
+#include "flight_recorder.h"
 #include <system_error>
 #include <cstring>
 #include <unistd.h>
@@ -9,21 +10,43 @@
 #include <sys/socket.h>
 #include <sys/epoll.h>
 
-UnixSocketServer::UnixSocketServer(EventLoop& loop, const std::string& socket_path)
-    : loop_(loop), socket_path_(socket_path) {
+// Крупные чтения: пакеты команд разбираются блоками, а не по 4 КБ
+constexpr size_t READ_BUFFER_SIZE = 64 * 1024;
+
+UnixSocketServer::UnixSocketServer(EventLoop& loop, const std::string& socket_path, std::string_view name)
+    : loop_(loop), socket_path_(socket_path), read_buffer_(READ_BUFFER_SIZE),
+      clients_metric_(MetricsRegistry::instance().gauge(
+          "network_daemon_clients", "Connected clients", metricLabel("server", name))),
+      connections_metric_(MetricsRegistry::instance().counter(
+          "network_daemon_connections_total", "Accepted client connections", metricLabel("server", name))),
+      received_metric_(MetricsRegistry::instance().counter(
+          "network_daemon_received_bytes_total", "Bytes read from clients", metricLabel("server", name))),
+      sent_metric_(MetricsRegistry::instance().counter(
+          "network_daemon_sent_bytes_total", "Bytes written to clients", metricLabel("server", name))),
+      queued_metric_(MetricsRegistry::instance().gauge(
+          "network_daemon_output_queued_bytes", "Bytes waiting in client output queues",
+          metricLabel("server", name))),
+      slow_clients_metric_(MetricsRegistry::instance().counter(
+          "network_daemon_slow_client_disconnects_total", "Clients disconnected for not reading responses",
+          metricLabel("server", name))) {
     struct event_base* base = loop_.get_event_base();
     if (!base) {
         throw std::runtime_error("EventLoop::get_event_base() returned nullptr");
     }
-    std::cout << "UnixSocketServer: event_base is valid: " << base << std::endl;
+    logInfo("UnixSocketServer: event_base is valid: ", base);
 }
 
 UnixSocketServer::~UnixSocketServer() {
     stop();
 }
 
-void UnixSocketServer::start() {
-    createSocket();
+void UnixSocketServer::start(int listen_fd) {
+    if (listen_fd != -1) {
+        server_fd_ = listen_fd;
+        logInfo("Unix сокет ", socket_path_, " принят от предыдущего процесса");
+    } else {
+        createSocket();
+    }
     loop_.add(server_fd_, EPOLLIN, 
         [this](int fd, uint32_t events) { handleServerEvent(fd, events); });
 }
@@ -32,7 +55,9 @@ void UnixSocketServer::stop() {
     if (server_fd_ != -1) {
         loop_.remove(server_fd_);
         close(server_fd_);
-        unlink(socket_path_.c_str());
+        if (unlink_on_stop_) {
+            unlink(socket_path_.c_str());
+        }
         server_fd_ = -1;
     }
 
@@ -42,6 +67,33 @@ void UnixSocketServer::stop() {
     }
     client_handlers_.clear();
     client_last_activity_.clear();
+    client_ids_.clear();
+    for (const auto& [fd, queue] : outputs_) {
+        queued_metric_.add(-static_cast<int64_t>(queue.size()));
+    }
+    outputs_.clear();
+    clients_metric_.set(0);
+}
+
+void UnixSocketServer::release() {
+    unlink_on_stop_ = false;
+    stop();
+}
+
+std::vector<int> UnixSocketServer::getClients() const {
+    std::vector<int> clients;
+    for (const auto& [fd, _] : client_handlers_) {
+        clients.push_back(fd);
+    }
+    return clients;
+}
+
+std::string_view UnixSocketServer::getPendingOutput(int client_fd) const {
+    auto it = outputs_.find(client_fd);
+    if (it == outputs_.end()) {
+        return {};
+    }
+    return std::string_view(it->second.data).substr(it->second.offset);
 }
 
 void UnixSocketServer::createSocket() {
@@ -67,7 +119,7 @@ void UnixSocketServer::createSocket() {
     }
     
     chmod(socket_path_.c_str(), 0666);
-    std::cout << "Unix сокет создан и прослушивается по пути " << socket_path_ << std::endl;
+    logInfo("Unix сокет создан и прослушивается по пути ", socket_path_);
 }
 
 void UnixSocketServer::handleServerEvent(int fd, [[maybe_unused]] uint32_t events) {
@@ -75,46 +127,61 @@ void UnixSocketServer::handleServerEvent(int fd, [[maybe_unused]] uint32_t event
     socklen_t addrlen = sizeof(addr);
     int client_fd = accept(fd, (struct sockaddr*)&addr, &addrlen);
     if (client_fd == -1) {
-        std::cerr << "Ошибка принятия соединения: " << strerror(errno) << std::endl;
+        logError("Ошибка принятия соединения: ", strerror(errno));
         return;
     }
     
-    std::cout << "Новое клиентское соединение, fd=" << client_fd << std::endl;
+    logInfo("Новое клиентское соединение, fd=", client_fd);
+    adoptClient(client_fd);
+}
 
+void UnixSocketServer::adoptClient(int client_fd) {
     int flags = fcntl(client_fd, F_GETFL, 0);
     if (flags == -1 || fcntl(client_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
-        std::cerr << "Ошибка установки неблокирующего режима: " << strerror(errno) << std::endl;
+        logError("Ошибка установки неблокирующего режима: ", strerror(errno));
         close(client_fd);
         return;
     }
 
     client_last_activity_[client_fd] = std::chrono::steady_clock::now();
+    client_ids_[client_fd] = next_client_id_++;
     auto handler = [this](int client_fd, uint32_t events) {
         handleClientEvent(client_fd, events);
     };
     loop_.add(client_fd, EPOLLIN, handler);
     client_handlers_[client_fd] = handler;
+    connections_metric_.inc();
+    clients_metric_.set(client_ids_.size());
 }
 
-void UnixSocketServer::handleClientEvent(int client_fd, [[maybe_unused]] uint32_t events) {
-    char buffer[4096];
-    ssize_t len = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
+void UnixSocketServer::handleClientEvent(int client_fd, uint32_t events) {
+    if (events & EPOLLOUT) {
+        uint64_t client_id = getClientId(client_fd);
+        flushOutput(client_fd);
+        if (!isClientConnected(client_fd, client_id) || !(events & EPOLLIN)) {
+            return;
+        }
+    }
+
+    ssize_t len;
+    {
+        TraceSpan span("recv", TraceCategory::Command, client_fd);
+        len = recv(client_fd, read_buffer_.data(), read_buffer_.size(), 0);
+    }
     if (len <= 0) {
         if (len == 0) {
-            std::cout << "Клиент (fd=" << client_fd << ") закрыл соединение" << std::endl;
+            logInfo("Клиент (fd=", client_fd, ") закрыл соединение");
         } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
-            std::cerr << "Ошибка чтения из клиентского сокета: " << strerror(errno) << std::endl;
+            logError("Ошибка чтения из клиентского сокета: ", strerror(errno));
         }
         cleanupClient(client_fd);
         return;
     }
     
     client_last_activity_[client_fd] = std::chrono::steady_clock::now();
-    buffer[len] = '\0';
-    std::string command(buffer);
-    
+    received_metric_.inc(len);
     if (client_handler_) {
-        client_handler_(client_fd, command);
+        client_handler_(client_fd, std::string_view(read_buffer_.data(), len));
     }
 }
 
@@ -122,22 +189,171 @@ void UnixSocketServer::cleanupClient(int client_fd) {
     loop_.remove(client_fd);
     client_handlers_.erase(client_fd);
     client_last_activity_.erase(client_fd);
+    client_ids_.erase(client_fd);
+    auto queued = outputs_.find(client_fd);
+    if (queued != outputs_.end()) {
+        queued_metric_.add(-static_cast<int64_t>(queued->second.size()));
+        outputs_.erase(queued);
+    }
+    clients_metric_.set(client_ids_.size());
     close(client_fd);
+    if (disconnect_handler_) {
+        disconnect_handler_(client_fd);
+    }
+}
+
+uint64_t UnixSocketServer::getClientId(int client_fd) const {
+    auto it = client_ids_.find(client_fd);
+    return it != client_ids_.end() ? it->second : 0;
+}
+
+bool UnixSocketServer::isClientConnected(int client_fd, uint64_t client_id) const {
+    auto it = client_ids_.find(client_fd);
+    return it != client_ids_.end() && it->second == client_id;
 }
 
 void UnixSocketServer::setClientHandler(ClientHandler handler) {
     client_handler_ = handler;
 }
 
-void UnixSocketServer::sendResponse(int client_fd, const std::string& response) {
-    if (send(client_fd, response.c_str(), response.length(), 0) < 0) {
-        std::cerr << "Ошибка отправки ответа клиенту: " << strerror(errno) << std::endl;
+void UnixSocketServer::setDisconnectHandler(DisconnectHandler handler) {
+    disconnect_handler_ = handler;
+}
+
+void UnixSocketServer::sendResponse(int client_fd, std::string_view response) {
+    if (!client_ids_.count(client_fd)) {
+        return; // Клиент уже отключён (например, при рассылке из его же обработчика)
+    }
+
+    auto queued = outputs_.find(client_fd);
+    if (queued != outputs_.end() && queued->second.size() > 0) {
+        // Порядок ответов сохраняется: новые данные только за уже ждущими
+        if (queued->second.size() + response.size() > MAX_OUTPUT_QUEUE) {
+            logWarning("Клиент (fd=", client_fd, ") не читает ответы, очередь превысила ", MAX_OUTPUT_QUEUE,
+                     " байт, отключаем");
+            slow_clients_metric_.inc();
+            cleanupClient(client_fd);
+            return;
+        }
+        queued->second.data.append(response.data(), response.size());
+        queued_metric_.add(response.size());
+        return;
+    }
+
+    ssize_t sent = send(client_fd, response.data(), response.size(), MSG_NOSIGNAL);
+    if (sent < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            logError("Ошибка отправки ответа клиенту: ", strerror(errno));
+            cleanupClient(client_fd);
+            return;
+        }
+        sent = 0;
+    }
+    sent_metric_.inc(sent);
+    if (static_cast<size_t>(sent) < response.size()) {
+        OutputQueue& queue = outputs_[client_fd];
+        queue.data.assign(response.data() + sent, response.size() - sent);
+        queue.offset = 0;
+        queued_metric_.add(queue.size());
+        loop_.modify(client_fd, EPOLLIN | EPOLLOUT);
+    }
+}
+
+void UnixSocketServer::flushOutput(int client_fd) {
+    auto it = outputs_.find(client_fd);
+    if (it == outputs_.end()) {
+        loop_.modify(client_fd, EPOLLIN);
+        return;
+    }
+    OutputQueue& queue = it->second;
+    while (queue.size() > 0) {
+        ssize_t sent = send(client_fd, queue.data.data() + queue.offset, queue.size(), MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            logError("Ошибка отправки ответа клиенту: ", strerror(errno));
+            cleanupClient(client_fd);
+            return;
+        }
+        queue.offset += sent;
+        sent_metric_.inc(sent);
+        queued_metric_.add(-sent);
+    }
+
+    if (queue.size() == 0) {
+        if (queue.close_when_flushed) {
+            cleanupClient(client_fd);
+            return;
+        }
+        queue.data.clear();
+        queue.offset = 0;
+        loop_.modify(client_fd, EPOLLIN);
+    } else if (queue.offset > queue.data.size() / 2) {
+        queue.data.erase(0, queue.offset);
+        queue.offset = 0;
+    }
+
+    if (queue.on_writable && queue.size() <= OUTPUT_LOW_WATERMARK) {
+        std::function<void()> callback = std::move(queue.on_writable);
+        queue.on_writable = nullptr;
+        if (queue.size() == 0) {
+            outputs_.erase(it);
+        }
+        callback();
+    } else if (queue.size() == 0 && !queue.on_writable) {
+        outputs_.erase(it);
+    }
+}
+
+void UnixSocketServer::onWritable(int client_fd, std::function<void()> callback) {
+    uint64_t client_id = getClientId(client_fd);
+    if (!client_id) {
+        return;
+    }
+    if (getQueuedOutput(client_fd) > OUTPUT_LOW_WATERMARK) {
+        outputs_[client_fd].on_writable = std::move(callback);
+        return;
+    }
+    // Очередь уже мала: продолжаем на следующей итерации цикла, давая поработать другим клиентам
+    loop_.post([this, client_fd, client_id, callback = std::move(callback)]() {
+        if (isClientConnected(client_fd, client_id)) {
+            callback();
+        }
+    });
+}
+
+void UnixSocketServer::closeWhenFlushed(int client_fd) {
+    if (!client_ids_.count(client_fd)) {
+        return;
+    }
+    auto it = outputs_.find(client_fd);
+    if (it == outputs_.end() || it->second.size() == 0) {
         cleanupClient(client_fd);
+        return;
     }
+    it->second.close_when_flushed = true;
 }
 
-void UnixSocketServer::broadcastToAllClients(const std::string& message) {
-    for (const auto& [fd, _] : client_handlers_) {
+size_t UnixSocketServer::getQueuedOutput(int client_fd) const {
+    auto it = outputs_.find(client_fd);
+    return it != outputs_.end() ? it->second.size() : 0;
+}
+
+void UnixSocketServer::broadcastToAllClients(std::string_view message) {
+    // Ошибка отправки удаляет клиента из client_handlers_, поэтому итератор сдвигаем заранее
+    for (auto it = client_handlers_.begin(); it != client_handlers_.end();) {
+        int fd = (it++)->first;
         sendResponse(fd, message);
     }
+}
+
+void UnixSocketServer::broadcastToAllClients(const std::function<std::string_view(int client_fd)>& message) {
+    for (auto it = client_handlers_.begin(); it != client_handlers_.end();) {
+        int fd = (it++)->first;
+        std::string_view text = message(fd);
+        if (!text.empty()) {
+            sendResponse(fd, text);
+        }
+    }
 }
\ No newline at end of file
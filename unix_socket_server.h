@@ -2,37 +2,97 @@
 #define UNIX_SOCKET_SERVER_H
 
 #include "event_loop.h"
+#include "metrics.h"
 #include <functional>
 #include <map>
 #include <string>
+#include <string_view>
+#include <vector>
 #include <chrono>
 
 class UnixSocketServer {
 public:
-    using ClientHandler = std::function<void(int, const std::string&)>;
+    // Данные передаются кусками в порядке поступления; границы команд определяет обработчик
+    using ClientHandler = std::function<void(int, std::string_view)>;
+    using DisconnectHandler = std::function<void(int)>;
 
-    UnixSocketServer(EventLoop& loop, const std::string& socket_path);
+    // name - метка server="..." в метриках сервера
+    UnixSocketServer(EventLoop& loop, const std::string& socket_path, std::string_view name);
     ~UnixSocketServer();
 
-    void start();
+    // listen_fd - уже слушающий сокет, принятый от другого процесса (путь не пересоздаётся)
+    void start(int listen_fd = -1);
     void stop();
+    // Как stop(), но путь сокета не удаляется: сокеты перешли к другому процессу
+    void release();
+    int getListenFd() const { return server_fd_; }
+    // Регистрирует уже установленное соединение как принятого клиента
+    void adoptClient(int client_fd);
+    std::vector<int> getClients() const;
+    // Ещё не отправленная клиенту часть ответов
+    std::string_view getPendingOutput(int client_fd) const;
     void setClientHandler(ClientHandler handler);
-    void sendResponse(int client_fd, const std::string& response);
-    void broadcastToAllClients(const std::string& message);
+    void setDisconnectHandler(DisconnectHandler handler);
+    // Что не ушло в сокет сразу, ждёт в очереди клиента и дописывается по готовности
+    // сокета к записи. Клиент, не читающий ответы (очередь больше MAX_OUTPUT_QUEUE), отключается.
+    void sendResponse(int client_fd, std::string_view response);
+    // Закрывает соединение, как только клиенту уйдёт всё, что для него в очереди
+    void closeWhenFlushed(int client_fd);
+    void broadcastToAllClients(std::string_view message);
+    // Сообщение для каждого клиента своё (например, в выбранном им формате); пустое не отправляется
+    void broadcastToAllClients(const std::function<std::string_view(int client_fd)>& message);
+
+    // Идентификатор соединения: номер fd может быть переиспользован после закрытия клиента,
+    // поэтому отложенные ответы проверяют, что соединение то же самое
+    uint64_t getClientId(int client_fd) const;
+    bool isClientConnected(int client_fd, uint64_t client_id) const;
+
+    // Управление потоком для длинных ответов: callback вызывается из цикла событий
+    // (не из onWritable), когда в очереди клиента не больше OUTPUT_LOW_WATERMARK байт.
+    // Один ожидающий callback на клиента; при отключении клиента не вызывается.
+    void onWritable(int client_fd, std::function<void()> callback);
+    size_t getQueuedOutput(int client_fd) const;
+
+    static constexpr size_t OUTPUT_LOW_WATERMARK = 64 * 1024;
+    static constexpr size_t MAX_OUTPUT_QUEUE = 8 * 1024 * 1024;
 
 private:
     EventLoop& loop_;
     std::string socket_path_;
     int server_fd_ = -1;
+    bool unlink_on_stop_ = true;
     std::map<int, std::function<void(int, uint32_t)>> client_handlers_; // Изменён тип
     ClientHandler client_handler_;
+    DisconnectHandler disconnect_handler_;
+    std::vector<char> read_buffer_;
     std::map<int, std::chrono::steady_clock::time_point> client_last_activity_;
+    std::map<int, uint64_t> client_ids_;
+
+    // Неотправленный хвост ответов клиента
+    struct OutputQueue {
+        std::string data;
+        size_t offset = 0;
+        std::function<void()> on_writable;
+        bool close_when_flushed = false;
+
+        size_t size() const { return data.size() - offset; }
+    };
+    std::map<int, OutputQueue> outputs_;
+    uint64_t next_client_id_ = 1;
     struct event* timer_event_ = nullptr;
 
+    Gauge& clients_metric_;
+    Counter& connections_metric_;
+    Counter& received_metric_;
+    Counter& sent_metric_;
+    Gauge& queued_metric_; // Байт в очередях вывода всех клиентов
+    Counter& slow_clients_metric_;
+
     void createSocket();
     void handleServerEvent(int fd, uint32_t events);
     void handleClientEvent(int client_fd, uint32_t events);
     void cleanupClient(int client_fd);
+    void flushOutput(int client_fd);
     void checkTimeouts();
     static void timer_callback(evutil_socket_t fd, short events, void* arg);
 };
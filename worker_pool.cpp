@@ -0,0 +1,76 @@
+#include "worker_pool.h"
+#include "logger.h"
+#include <signal.h>
+
+WorkerPool::WorkerPool(EventLoop& loop, size_t threads, size_t max_pending)
+    : loop_(loop), max_pending_(max_pending),
+      queue_metric_(MetricsRegistry::instance().gauge("network_daemon_worker_queue_depth",
+                                                      "Jobs waiting for a worker thread")),
+      rejected_metric_(MetricsRegistry::instance().counter("network_daemon_worker_rejected_total",
+                                                           "Jobs not queued because the worker queue was full")) {
+    // Сигналы должен получать поток цикла: рабочие потоки создаются с заблокированными сигналами
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &previous);
+    for (size_t i = 0; i < threads; ++i) {
+        threads_.emplace_back(&WorkerPool::workerMain, this);
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        queue_.clear(); // Не начатые задания отменяются, выполняемые дорабатывают
+        queue_metric_.set(0);
+    }
+    cv_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+bool WorkerPool::submit(Job job, Completion done) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_ || queue_.size() >= max_pending_) {
+            rejected_metric_.inc();
+            return false;
+        }
+        queue_.push_back({std::move(job), std::move(done)});
+        queue_metric_.set(queue_.size());
+    }
+    cv_.notify_one();
+    return true;
+}
+
+size_t WorkerPool::pending() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size();
+}
+
+void WorkerPool::workerMain() {
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return;
+            }
+            task = std::move(queue_.front());
+            queue_.pop_front();
+            queue_metric_.set(queue_.size());
+        }
+
+        try {
+            task.job();
+        } catch (const std::exception& e) {
+            logError("WorkerPool: job failed: ", e.what());
+        }
+        if (task.done) {
+            loop_.post(std::move(task.done));
+        }
+    }
+}
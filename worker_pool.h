@@ -0,0 +1,53 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include "event_loop.h"
+#include "metrics.h"
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Пул потоков для блокирующих операций (fork/exec, полные дампы netlink).
+// Задание выполняется в рабочем потоке, его завершение - в потоке EventLoop,
+// поэтому завершения могут свободно трогать состояние демона.
+// Очередь ограничена: при переполнении submit() возвращает false.
+class WorkerPool {
+public:
+    using Job = std::function<void()>;
+    using Completion = std::function<void()>;
+
+    WorkerPool(EventLoop& loop, size_t threads, size_t max_pending);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    bool submit(Job job, Completion done);
+
+    size_t threadCount() const { return threads_.size(); }
+    size_t pending() const;
+
+private:
+    struct Task {
+        Job job;
+        Completion done;
+    };
+
+    EventLoop& loop_;
+    size_t max_pending_;
+    std::vector<std::thread> threads_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Task> queue_;
+    bool stopping_ = false;
+    Gauge& queue_metric_;
+    Counter& rejected_metric_;
+
+    void workerMain();
+};
+
+#endif // WORKER_POOL_H